@@ -37,13 +37,35 @@
 #include "interaction.h"
 #include "paramset.h"
 #include "stats.h"
+#include "hash.h"
+#include "mappedfile.h"
+#include "shapes/triangle.h"
 #include <algorithm>
+#include <chrono>
+#include <stdio.h>
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && \
+    (defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1)
+#define PBRT_WIDE_BVH_SSE
+#include <xmmintrin.h>
+#endif
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && defined(__AVX__)
+#define PBRT_WIDE_BVH_AVX
+#include <immintrin.h>
+#endif
 
 STAT_TIMER("Time/BVH construction", constructionTime);
 STAT_MEMORY_COUNTER("Memory/BVH tree", treeBytes);
 STAT_RATIO("BVH/Primitives per leaf node", totalPrimitives, totalLeafNodes);
 STAT_COUNTER("BVH/Interior nodes", interiorNodes);
 STAT_COUNTER("BVH/Leaf nodes", leafNodes);
+STAT_RATIO("BVH/Children per wide node", wideChildren, wideNodeCount);
+STAT_COUNTER("BVH/Spatial splits", spatialSplits);
+STAT_RATIO("BVH/References per primitive", sbvhReferences, sbvhPrimitives);
+STAT_COUNTER("BVH/Trees loaded from cache", cacheHits);
+STAT_COUNTER("BVH/Refits", refits);
+STAT_COUNTER("BVH/Motion blur trees", motionTrees);
+STAT_PERCENT("BVH/Primitives in triangle packets", packedPrimitives,
+             packablePrimitives);
 
 // BVHAccel Local Declarations
 struct BVHPrimitiveInfo {
@@ -64,6 +86,7 @@ struct BVHBuildNode {
         nPrimitives = n;
         bounds = b;
         children[0] = children[1] = nullptr;
+        nNodes = 1;
         ++leafNodes;
         ++totalLeafNodes;
         totalPrimitives += n;
@@ -74,11 +97,13 @@ struct BVHBuildNode {
         bounds = Union(c0->bounds, c1->bounds);
         splitAxis = axis;
         nPrimitives = 0;
+        nNodes = 1 + c0->nNodes + c1->nNodes;
         ++interiorNodes;
     }
     Bounds3f bounds;
     BVHBuildNode *children[2];
     int splitAxis, firstPrimOffset, nPrimitives;
+    int nNodes;  // size of the subtree rooted at this node
 };
 
 struct MortonPrimitive {
@@ -102,7 +127,91 @@ struct LinearBVHNode {
     uint8_t pad[1];        // ensure 32 byte total size
 };
 
+// Interior node whose children's bounds are quantized to 8 bits within the
+// node's own (decoded) bounds; leaf children are stored in place
+struct QuantizedBVHNode {
+    // Child bounds: [lower/upper][child][axis]
+    uint8_t bounds[2][2][3];
+    int32_t offset[2];       // interior: node index, leaf: first primitive
+    uint8_t nPrimitives[2];  // 0 -> interior child
+    uint8_t axis;            // xyz
+    uint8_t pad[1];          // ensure 24 byte total size
+};
+
+template <int N>
+struct WideBVHNode {
+    // Child bounds laid out for SIMD slab tests: [lower/upper][axis][child]
+    Float bounds[2][3][N];
+    int32_t offset[N];        // interior: node index, leaf: first primitive,
+                              // empty: -1
+    uint16_t nPrimitives[N];  // 0 -> interior child
+};
+
+// BVH cache files hold this header, the ordered primitive numbers, and the
+// nodes, starting at the next cache line boundary
+struct BVHCacheHeader {
+    char magic[8];
+    uint32_t version;
+    int32_t layout;  // 1 -> quantized, otherwise the node width
+    uint64_t key;
+    uint64_t nPrimitives;
+    uint64_t nPrimNums;
+    uint64_t nodeBytes;
+    Bounds3f bounds;
+};
+
+static const char bvhCacheMagic[8] = "pbrtBVH";
+static PBRT_CONSTEXPR uint32_t bvhCacheVersion = 1;
+
+inline size_t CacheNodeOffset(const BVHCacheHeader &header) {
+    size_t end = sizeof(BVHCacheHeader) + header.nPrimNums * sizeof(int32_t);
+    return (end + PBRT_L1_CACHE_LINE_SIZE - 1) &
+           ~(size_t)(PBRT_L1_CACHE_LINE_SIZE - 1);
+}
+
+// Ranges of primitives at least this large are processed in parallel while
+// building the BVH
+static PBRT_CONSTEXPR int parallelBuildThreshold = 64 * 1024;
+static PBRT_CONSTEXPR int buildChunkSize = 16 * 1024;
+
 // BVHAccel Utility Functions
+// Interpolation weights for quantized coordinates, computed by division so
+// that 0 and 255 map exactly to the ends of the range
+static const struct QuantizationWeights {
+    QuantizationWeights() {
+        for (int q = 0; q < 256; ++q) {
+            t[q] = q / (Float)255;
+            oneMinusT[q] = (255 - q) / (Float)255;
+        }
+    }
+    Float t[256], oneMinusT[256];
+} quantizationWeights;
+
+inline Float Dequantize(uint8_t q, Float lo, Float hi) {
+    return quantizationWeights.oneMinusT[q] * lo +
+           quantizationWeights.t[q] * hi;
+}
+
+inline Bounds3f ChildBounds(const QuantizedBVHNode &node, int child,
+                            const Bounds3f &nodeBounds) {
+    Bounds3f b;
+    for (int a = 0; a < 3; ++a) {
+        b.pMin[a] = Dequantize(node.bounds[0][child][a], nodeBounds.pMin[a],
+                               nodeBounds.pMax[a]);
+        b.pMax[a] = Dequantize(node.bounds[1][child][a], nodeBounds.pMin[a],
+                               nodeBounds.pMax[a]);
+    }
+    return b;
+}
+
+// Bounds of a node of a motion blur BVH at _t_ between its start and end
+inline Bounds3f LerpBounds(Float t, const Bounds3f &b0, const Bounds3f &b1) {
+    Bounds3f b;
+    b.pMin = Lerp(t, b0.pMin, b1.pMin);
+    b.pMax = Lerp(t, b0.pMax, b1.pMax);
+    return b;
+}
+
 inline uint32_t LeftShift3(uint32_t x) {
     Assert(x <= (1 << 10));
     if (x == (1 << 10)) --x;
@@ -175,48 +284,692 @@ static void RadixSort(std::vector<MortonPrimitive> *v) {
     if (nPasses & 1) std::swap(*v, tempVector);
 }
 
+// Tests a ray against the children of a wide node, storing each child's
+// entry distance in _tNear_ and returning a bit mask of the children hit
+template <int N>
+inline int IntersectChildren(const WideBVHNode<N> &node, const Ray &ray,
+                             const Vector3f &invDir, const int dirIsNeg[3],
+                             Float tNear[N]) {
+    // Scale far distances as _Bounds3::IntersectP()_ does, for robustness
+    const Float farScale = 1 + 2 * gamma(3);
+#ifdef PBRT_WIDE_BVH_SSE
+    int hitMask = 0;
+    for (int c = 0; c < N; c += 4) {
+        __m128 t0 = _mm_setzero_ps(), t1 = _mm_set1_ps(ray.tMax);
+        for (int a = 0; a < 3; ++a) {
+            __m128 o = _mm_set1_ps(ray.o[a]), inv = _mm_set1_ps(invDir[a]);
+            __m128 tSlabNear = _mm_mul_ps(
+                _mm_sub_ps(_mm_loadu_ps(&node.bounds[dirIsNeg[a]][a][c]), o),
+                inv);
+            __m128 tSlabFar = _mm_mul_ps(
+                _mm_sub_ps(_mm_loadu_ps(&node.bounds[1 - dirIsNeg[a]][a][c]),
+                           o),
+                inv);
+            tSlabFar = _mm_mul_ps(tSlabFar, _mm_set1_ps(farScale));
+            // Operand order makes NaN slab distances leave the interval as is
+            t0 = _mm_max_ps(tSlabNear, t0);
+            t1 = _mm_min_ps(tSlabFar, t1);
+        }
+        _mm_storeu_ps(&tNear[c], t0);
+        hitMask |= _mm_movemask_ps(_mm_cmple_ps(t0, t1)) << c;
+    }
+    return hitMask;
+#else
+    int hitMask = 0;
+    for (int c = 0; c < N; ++c) {
+        Float t0 = 0, t1 = ray.tMax;
+        for (int a = 0; a < 3; ++a) {
+            Float tSlabNear =
+                (node.bounds[dirIsNeg[a]][a][c] - ray.o[a]) * invDir[a];
+            Float tSlabFar =
+                (node.bounds[1 - dirIsNeg[a]][a][c] - ray.o[a]) * invDir[a];
+            tSlabFar *= farScale;
+            t0 = tSlabNear > t0 ? tSlabNear : t0;
+            t1 = tSlabFar < t1 ? tSlabFar : t1;
+        }
+        tNear[c] = t0;
+        if (t0 <= t1) hitMask |= 1 << c;
+    }
+    return hitMask;
+#endif  // PBRT_WIDE_BVH_SSE
+}
+
+// Rays of a packet laid out for testing them against a box together. When
+// the rays' directions share signs, interval bounds on their origins and
+// inverse directions also let whole nodes be culled with a single test.
+class RayPacket {
+  public:
+    RayPacket(int n, const Ray *rays) : n(n), frustumValid(true) {
+        for (int a = 0; a < 3; ++a) {
+            oMin[a] = invDirMin[a] = Infinity;
+            oMax[a] = invDirMax[a] = -Infinity;
+            dirIsNeg[a] = rays[0].d[a] < 0;
+        }
+        tMaxBound = 0;
+        for (int i = 0; i < MaxRayPacketSize; ++i) {
+            const Ray &ray = rays[std::min(i, n - 1)];
+            for (int a = 0; a < 3; ++a) {
+                o[a][i] = ray.o[a];
+                invDir[a][i] = 1 / ray.d[a];
+            }
+            tMax[i] = ray.tMax;
+        }
+        for (int i = 0; i < n; ++i) {
+            tMaxBound = std::max(tMaxBound, tMax[i]);
+            for (int a = 0; a < 3; ++a) {
+                // Don't cull with the frustum if the packet straddles an
+                // axis or contains rays parallel to one
+                if ((rays[i].d[a] < 0) != dirIsNeg[a] ||
+                    std::isinf(invDir[a][i]))
+                    frustumValid = false;
+                oMin[a] = std::min(oMin[a], o[a][i]);
+                oMax[a] = std::max(oMax[a], o[a][i]);
+                invDirMin[a] = std::min(invDirMin[a], invDir[a][i]);
+                invDirMax[a] = std::max(invDirMax[a], invDir[a][i]);
+            }
+        }
+    }
+    int DirIsNeg(int i, int axis) const { return invDir[axis][i] < 0; }
+    void SetTMax(int i, Float t) { tMax[i] = t; }
+    uint32_t Intersect(const Bounds3f &b, uint32_t activeMask) const {
+        if (FrustumMisses(b)) return 0;
+        // Scale far distances as _Bounds3::IntersectP()_ does
+        const Float farScale = 1 + 2 * gamma(3);
+        uint32_t hitMask = 0;
+#ifdef PBRT_WIDE_BVH_SSE
+        for (int g = 0; g < n; g += 4) {
+            if (!((activeMask >> g) & 0xf)) continue;
+            __m128 t0 = _mm_setzero_ps(), t1 = _mm_loadu_ps(&tMax[g]);
+            for (int a = 0; a < 3; ++a) {
+                __m128 oA = _mm_loadu_ps(&o[a][g]);
+                __m128 invA = _mm_loadu_ps(&invDir[a][g]);
+                __m128 tA = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.pMin[a]), oA),
+                                       invA);
+                __m128 tB = _mm_mul_ps(_mm_sub_ps(_mm_set1_ps(b.pMax[a]), oA),
+                                       invA);
+                t0 = _mm_max_ps(_mm_min_ps(tA, tB), t0);
+                t1 = _mm_min_ps(
+                    _mm_mul_ps(_mm_max_ps(tA, tB), _mm_set1_ps(farScale)), t1);
+            }
+            hitMask |= (uint32_t)_mm_movemask_ps(_mm_cmple_ps(t0, t1)) << g;
+        }
+#else
+        for (uint32_t m = activeMask; m; m &= m - 1) {
+            int i = CountTrailingZeros(m);
+            Float t0 = 0, t1 = tMax[i];
+            for (int a = 0; a < 3; ++a) {
+                Float tA = (b.pMin[a] - o[a][i]) * invDir[a][i];
+                Float tB = (b.pMax[a] - o[a][i]) * invDir[a][i];
+                Float tNear = std::min(tA, tB), tFar = std::max(tA, tB);
+                tFar *= farScale;
+                t0 = tNear > t0 ? tNear : t0;
+                t1 = tFar < t1 ? tFar : t1;
+            }
+            if (t0 <= t1) hitMask |= 1u << i;
+        }
+#endif  // PBRT_WIDE_BVH_SSE
+        return hitMask & activeMask;
+    }
+
+  private:
+    bool FrustumMisses(const Bounds3f &b) const {
+        if (!frustumValid) return false;
+        // Bound every ray's entry and exit distances using interval
+        // arithmetic over the packet's origins and inverse directions
+        Float tEnter = 0, tExit = tMaxBound;
+        for (int a = 0; a < 3; ++a) {
+            Float pNear = b[dirIsNeg[a]][a], pFar = b[1 - dirIsNeg[a]][a];
+            Float t0 = std::min(std::min((pNear - oMax[a]) * invDirMin[a],
+                                         (pNear - oMax[a]) * invDirMax[a]),
+                                std::min((pNear - oMin[a]) * invDirMin[a],
+                                         (pNear - oMin[a]) * invDirMax[a]));
+            Float t1 = std::max(std::max((pFar - oMax[a]) * invDirMin[a],
+                                         (pFar - oMax[a]) * invDirMax[a]),
+                                std::max((pFar - oMin[a]) * invDirMin[a],
+                                         (pFar - oMin[a]) * invDirMax[a]));
+            tEnter = std::max(tEnter, t0);
+            tExit = std::min(tExit, t1 * (1 + 2 * gamma(3)));
+        }
+        return tEnter > tExit;
+    }
+
+    // RayPacket Private Data
+    const int n;
+    Float o[3][MaxRayPacketSize], invDir[3][MaxRayPacketSize];
+    Float tMax[MaxRayPacketSize];
+    bool frustumValid;
+    int dirIsNeg[3];
+    Float oMin[3], oMax[3], invDirMin[3], invDirMax[3], tMaxBound;
+};
+
+#ifdef PBRT_WIDE_BVH_AVX
+template <>
+inline int IntersectChildren<8>(const WideBVHNode<8> &node, const Ray &ray,
+                                const Vector3f &invDir, const int dirIsNeg[3],
+                                Float tNear[8]) {
+    const Float farScale = 1 + 2 * gamma(3);
+    __m256 t0 = _mm256_setzero_ps(), t1 = _mm256_set1_ps(ray.tMax);
+    for (int a = 0; a < 3; ++a) {
+        __m256 o = _mm256_set1_ps(ray.o[a]), inv = _mm256_set1_ps(invDir[a]);
+        __m256 tSlabNear = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_loadu_ps(node.bounds[dirIsNeg[a]][a]), o),
+            inv);
+        __m256 tSlabFar = _mm256_mul_ps(
+            _mm256_sub_ps(_mm256_loadu_ps(node.bounds[1 - dirIsNeg[a]][a]),
+                          o),
+            inv);
+        tSlabFar = _mm256_mul_ps(tSlabFar, _mm256_set1_ps(farScale));
+        t0 = _mm256_max_ps(tSlabNear, t0);
+        t1 = _mm256_min_ps(tSlabFar, t1);
+    }
+    _mm256_storeu_ps(tNear, t0);
+    return _mm256_movemask_ps(_mm256_cmp_ps(t0, t1, _CMP_LE_OQ));
+}
+#endif  // PBRT_WIDE_BVH_AVX
+
+// Moves the references of the leaves under _node_, which each subtree of a
+// spatial split build stored at the start of its own share of
+// _orderedPrimNums_, to consecutive entries from _offset_ in depth-first
+// order, and returns the offset after them
+static int CompactLeafReferences(BVHBuildNode *node,
+                                 std::vector<int> &orderedPrimNums,
+                                 int offset) {
+    if (node->nPrimitives == 0) {
+        offset = CompactLeafReferences(node->children[0], orderedPrimNums,
+                                       offset);
+        return CompactLeafReferences(node->children[1], orderedPrimNums,
+                                     offset);
+    }
+    // Shares follow each other in depth-first order, so references only
+    // move towards the front
+    std::copy(orderedPrimNums.begin() + node->firstPrimOffset,
+              orderedPrimNums.begin() + node->firstPrimOffset +
+                  node->nPrimitives,
+              orderedPrimNums.begin() + offset);
+    node->firstPrimOffset = offset;
+    return offset + node->nPrimitives;
+}
+
 // BVHAccel Method Definitions
 BVHAccel::BVHAccel(const std::vector<std::shared_ptr<Primitive>> &p,
-                   int maxPrimsInNode, SplitMethod splitMethod)
+                   int maxPrimsInNode, SplitMethod splitMethod, int width,
+                   Float duplicationBudget, bool quantized,
+                   const std::string &cacheDir, bool packTriangles)
     : maxPrimsInNode(std::min(255, maxPrimsInNode)),
       splitMethod(splitMethod),
-      primitives(p) {
+      width(width),
+      duplicationBudget(std::max((Float)0, duplicationBudget)),
+      owners(p) {
     StatTimer buildTime(&constructionTime);
+    for (const std::shared_ptr<Primitive> &prim : owners)
+        prim->Flatten(&primitives);
     if (primitives.size() == 0) return;
     // Build BVH from _primitives_
 
-    // Initialize _primitiveInfo_ array for primitives
+    // If any primitives move, the tree is built for where they are halfway
+    // through their motion and its nodes are given bounds at the start and
+    // end of it, which only the binary layout stores
+    bool moving = FindMotionInterval();
+
+    // Initialize _primitiveInfo_ array for primitives, hashing their bounds
+    // in fixed-size chunks if the BVH may come from the cache
     std::vector<BVHPrimitiveInfo> primitiveInfo(primitives.size());
-    for (size_t i = 0; i < primitives.size(); ++i)
-        primitiveInfo[i] = {i, primitives[i]->WorldBound()};
+    bool useCache =
+        !cacheDir.empty() && splitMethod != SplitMethod::SBVH && !moving;
+    int nChunks = (primitives.size() + buildChunkSize - 1) / buildChunkSize;
+    std::vector<uint64_t> chunkHashes(nChunks);
+    ParallelFor([&](int64_t c) {
+        size_t start = c * buildChunkSize;
+        size_t end = std::min(primitives.size(), start + buildChunkSize);
+        uint64_t hash = 0;
+        for (size_t i = start; i < end; ++i) {
+            if (moving) {
+                Bounds3f b0, b1;
+                primitives[i]->LinearBounds(motionStart, motionEnd, &b0, &b1);
+                primitiveInfo[i] = {i, LerpBounds(.5f, b0, b1)};
+            } else
+                primitiveInfo[i] = {i, primitives[i]->WorldBound()};
+            if (useCache) hash = HashValue(primitiveInfo[i].bounds, hash);
+        }
+        chunkHashes[c] = hash;
+    }, nChunks);
+
+    // Load the BVH from the cache if this build has been done before. The
+    // tree depends only on the primitives' bounds and the build parameters,
+    // except for spatial splits, which also depend on the geometry
+    std::string cacheFilename;
+    uint64_t cacheKey = 0;
+    if (useCache) {
+        int64_t parameters[] = {
+            bvhCacheVersion, sizeof(Float), sizeof(LinearBVHNode),
+            sizeof(QuantizedBVHNode), sizeof(WideBVHNode<4>),
+            sizeof(WideBVHNode<8>), maxPrimsInNode, (int)splitMethod, width,
+            quantized, (int64_t)primitives.size()};
+        cacheKey = HashBuffer(chunkHashes.data(),
+                              chunkHashes.size() * sizeof(uint64_t),
+                              HashBuffer(parameters, sizeof(parameters)));
+        char name[32];
+        snprintf(name, sizeof(name), "bvh-%016llx.cache",
+                 (unsigned long long)cacheKey);
+        cacheFilename = cacheDir + "/" + name;
+        if (LoadCache(cacheFilename, cacheKey, quantized)) {
+            if (packTriangles) BuildTrianglePackets();
+            return;
+        }
+    }
 
     // Build BVH tree for primitives using _primitiveInfo_
     MemoryArena arena(1024 * 1024);
+    std::vector<MemoryArena> threadArenas(MaxThreadIndex());
     int totalNodes = 0;
-    std::vector<std::shared_ptr<Primitive>> orderedPrims;
-    orderedPrims.reserve(primitives.size());
+    std::vector<int> orderedPrimNums(primitives.size());
     BVHBuildNode *root;
     if (splitMethod == SplitMethod::HLBVH)
-        root = HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrims);
-    else
-        root = recursiveBuild(arena, primitiveInfo, 0, primitives.size(),
-                              &totalNodes, orderedPrims);
+        root =
+            HLBVHBuild(arena, primitiveInfo, &totalNodes, orderedPrimNums);
+    else if (splitMethod == SplitMethod::SBVH && !moving) {
+        // Spatial splits may reference a primitive from several leaves
+        Bounds3f rootBounds;
+        for (const BVHPrimitiveInfo &info : primitiveInfo)
+            rootBounds = Union(rootBounds, info.bounds);
+        int maxRefs = (int)std::min(
+            (double)std::numeric_limits<int>::max(),
+            primitives.size() * (1 + (double)duplicationBudget));
+        orderedPrimNums.resize(maxRefs);
+        root = spatialSplitBuild(threadArenas.data(), primitiveInfo, maxRefs,
+                                 rootBounds.SurfaceArea(), 0, orderedPrimNums,
+                                 0);
+        orderedPrimNums.resize(
+            CompactLeafReferences(root, orderedPrimNums, 0));
+        totalNodes = root->nNodes;
+        sbvhPrimitives += primitives.size();
+        sbvhReferences += orderedPrimNums.size();
+    } else {
+        root = recursiveBuild(threadArenas.data(), primitiveInfo, 0,
+                              primitives.size(), orderedPrimNums);
+        totalNodes = root->nNodes;
+    }
+    bounds = root->bounds;
+
+    // Quantize the tree's bounds if requested; a tree that is a single leaf
+    // is already as small as it gets
+    if (quantized && width == 2 && root->nPrimitives == 0 && !moving) {
+        OrderPrimitives(orderedPrimNums.data(), orderedPrimNums.size(), true);
+        BuildQuantizedBVH(root);
+    } else {
+        // Order _primitives_ as the leaves reference them
+        OrderPrimitives(orderedPrimNums.data(), orderedPrimNums.size(),
+                        false);
+
+        // Collapse the binary tree into a wide BVH if one was requested
+        if (width == 4 && !moving)
+            BuildWideBVH<4>(root);
+        else if (width == 8 && !moving)
+            BuildWideBVH<8>(root);
+        else {
+            Info("BVH created with %d nodes for %d primitives (%.2f MB)",
+                 totalNodes, (int)primitives.size(),
+                 float(totalNodes * sizeof(LinearBVHNode)) /
+                     (1024.f * 1024.f));
+
+            // Compute representation of depth-first traversal of BVH tree
+            nodeBytes = totalNodes * sizeof(LinearBVHNode);
+            treeBytes += nodeBytes;
+            nodes = AllocAligned<LinearBVHNode>(totalNodes);
+            Assert(root->nNodes == totalNodes);
+            flattenBVHTree(root, 0);
+            if (moving) {
+                FitMotionBounds();
+                treeBytes += endBounds.size() * sizeof(Bounds3f);
+                ++motionTrees;
+            }
+            ReplicateNodes(nodes, nodeBytes);
+        }
+    }
+    if (useCache) WriteCache(cacheFilename, cacheKey, orderedPrimNums);
+    if (packTriangles) BuildTrianglePackets();
+}
+
+void BVHAccel::OrderPrimitives(const int *orderedPrimNums, size_t count,
+                               bool indexed) {
+    std::vector<const Primitive *> orderedPrims;
+    if (!indexed) {
+        orderedPrims.resize(count);
+        for (size_t i = 0; i < count; ++i)
+            orderedPrims[i] = primitives[orderedPrimNums[i]];
+    } else {
+        // Store each primitive once, in the order the leaves first
+        // reference it, and refer to it from the leaves by index
+        std::vector<int> newIndex(primitives.size(), -1);
+        orderedPrims.reserve(primitives.size());
+        primIndices.resize(count);
+        for (size_t i = 0; i < count; ++i) {
+            int primNum = orderedPrimNums[i];
+            if (newIndex[primNum] == -1) {
+                newIndex[primNum] = (int)orderedPrims.size();
+                orderedPrims.push_back(primitives[primNum]);
+            }
+            primIndices[i] = newIndex[primNum];
+        }
+    }
     primitives.swap(orderedPrims);
-    Info("BVH created with %d nodes for %d primitives (%.2f MB)", totalNodes,
-         (int)primitives.size(),
-         float(totalNodes * sizeof(LinearBVHNode)) / (1024.f * 1024.f));
+    treeBytes += sizeof(*this) + owners.size() * sizeof(owners[0]) +
+                 primitives.size() * sizeof(primitives[0]) +
+                 primIndices.size() * sizeof(primIndices[0]);
+}
+
+// Checks the tree structure of BVH nodes read from a cache file, so that
+// traversal can't be sent outside the nodes or primitives or around a cycle:
+// every interior child must follow its parent and have no other parent, the
+// tree must be shallow enough for the traversal stacks, and leaves must
+// refer to the file's primitive numbers
+class CacheTreeValidator {
+  public:
+    CacheTreeValidator(size_t nNodes, uint64_t nPrimNums)
+        : depth(nNodes, 0), nPrimNums(nPrimNums) {
+        depth[0] = 1;
+    }
+    bool Reached(size_t node) const { return depth[node] != 0; }
+    bool Interior(size_t parent, int64_t child) {
+        if (child <= (int64_t)parent || child >= (int64_t)depth.size() ||
+            depth[child] != 0 || depth[parent] >= 64)
+            return false;
+        depth[child] = depth[parent] + 1;
+        return true;
+    }
+    bool Leaf(int64_t offset, int64_t nPrimitives) const {
+        return offset >= 0 && offset + nPrimitives <= (int64_t)nPrimNums;
+    }
+
+  private:
+    std::vector<int> depth;
+    uint64_t nPrimNums;
+};
+
+template <int N>
+static bool ValidCacheNode(const WideBVHNode<N> &node, size_t i,
+                           CacheTreeValidator &tree) {
+    for (int c = 0; c < N; ++c) {
+        if (node.nPrimitives[c] > 0) {
+            if (!tree.Leaf(node.offset[c], node.nPrimitives[c])) return false;
+        } else if (node.offset[c] == -1) {
+            // Empty slots must never be hit
+            for (int a = 0; a < 3; ++a)
+                if (node.bounds[0][a][c] != Infinity ||
+                    node.bounds[1][a][c] != -Infinity)
+                    return false;
+        } else if (!tree.Interior(i, node.offset[c]))
+            return false;
+    }
+    return true;
+}
+
+static bool ValidCacheNodes(const void *nodes, int layout, size_t nNodes,
+                            uint64_t nPrimNums) {
+    CacheTreeValidator tree(nNodes, nPrimNums);
+    for (size_t i = 0; i < nNodes; ++i) {
+        // Nodes are stored after their parents, starting with the root
+        if (!tree.Reached(i)) return false;
+        bool valid = true;
+        if (layout == 1) {
+            const QuantizedBVHNode &node =
+                static_cast<const QuantizedBVHNode *>(nodes)[i];
+            valid = node.axis < 3;
+            for (int c = 0; c < 2 && valid; ++c)
+                valid = node.nPrimitives[c] > 0
+                            ? tree.Leaf(node.offset[c], node.nPrimitives[c])
+                            : tree.Interior(i, node.offset[c]);
+        } else if (layout == 2) {
+            const LinearBVHNode &node =
+                static_cast<const LinearBVHNode *>(nodes)[i];
+            if (node.nPrimitives > 0)
+                valid = tree.Leaf(node.primitivesOffset, node.nPrimitives);
+            else
+                valid = node.axis < 3 && tree.Interior(i, i + 1) &&
+                        tree.Interior(i, node.secondChildOffset);
+        } else if (layout == 4)
+            valid = ValidCacheNode(
+                static_cast<const WideBVHNode<4> *>(nodes)[i], i, tree);
+        else
+            valid = ValidCacheNode(
+                static_cast<const WideBVHNode<8> *>(nodes)[i], i, tree);
+        if (!valid) return false;
+    }
+    return true;
+}
+
+bool BVHAccel::LoadCache(const std::string &filename, uint64_t key,
+                         bool quantized) {
+    std::unique_ptr<MappedFile> file(new MappedFile(filename));
+    if (!file->IsValid()) return false;
+
+    // Check that the file holds a complete BVH of the expected layout for
+    // these primitives
+    BVHCacheHeader header;
+    bool valid = file->Size() >= sizeof(header);
+    // The header is plain data, apart from the constructor of its bounds
+    if (valid) memcpy((void *)&header, file->Data(), sizeof(header));
+    size_t nodeSize = 0;
+    if (valid) {
+        if (header.layout == 1 && quantized && width == 2)
+            nodeSize = sizeof(QuantizedBVHNode);
+        else if (header.layout == 2 && width == 2)
+            nodeSize = sizeof(LinearBVHNode);
+        else if (header.layout == 4 && width == 4)
+            nodeSize = sizeof(WideBVHNode<4>);
+        else if (header.layout == 8 && width == 8)
+            nodeSize = sizeof(WideBVHNode<8>);
+        valid = nodeSize > 0 &&
+                !memcmp(header.magic, bvhCacheMagic, sizeof(bvhCacheMagic)) &&
+                header.version == bvhCacheVersion && header.key == key &&
+                header.nPrimitives == primitives.size() &&
+                header.nodeBytes > 0 && header.nodeBytes % nodeSize == 0 &&
+                header.nPrimNums <= file->Size() / sizeof(int32_t) &&
+                CacheNodeOffset(header) + header.nodeBytes == file->Size();
+    }
+    const int *primNums =
+        reinterpret_cast<const int *>(file->Data() + sizeof(header));
+    for (uint64_t i = 0; valid && i < header.nPrimNums; ++i)
+        valid = primNums[i] >= 0 && primNums[i] < (int)primitives.size();
+    void *fileNodes = nullptr;
+    if (valid) {
+        fileNodes = const_cast<char *>(file->Data()) + CacheNodeOffset(header);
+        valid = ValidCacheNodes(fileNodes, header.layout,
+                                header.nodeBytes / nodeSize, header.nPrimNums);
+    }
+    if (!valid) {
+        Warning("Ignoring invalid BVH cache file \"%s\".", filename.c_str());
+        return false;
+    }
+
+    // Use the file's nodes in place; they are paged in as they are visited
+    OrderPrimitives(primNums, header.nPrimNums, header.layout == 1);
+    bounds = header.bounds;
+    nodeBytes = header.nodeBytes;
+    if (header.layout == 1)
+        quantizedNodes = static_cast<QuantizedBVHNode *>(fileNodes);
+    else if (header.layout == 2)
+        nodes = static_cast<LinearBVHNode *>(fileNodes);
+    else
+        wideNodes = fileNodes;
+    cacheFile = std::move(file);
+    Info("BVH loaded from \"%s\" (%.2f MB)", filename.c_str(),
+         float(nodeBytes) / (1024.f * 1024.f));
+    ++cacheHits;
+    treeBytes += nodeBytes;
+    ReplicateNodes(fileNodes, nodeBytes);
+    return true;
+}
+
+void BVHAccel::WriteCache(const std::string &filename, uint64_t key,
+                          const std::vector<int> &orderedPrimNums) const {
+    BVHCacheHeader header;
+    memcpy(header.magic, bvhCacheMagic, sizeof(header.magic));
+    header.version = bvhCacheVersion;
+    header.layout = quantizedNodes ? 1 : width;
+    header.key = key;
+    header.nPrimitives = primitives.size();
+    header.nPrimNums = orderedPrimNums.size();
+    header.nodeBytes = nodeBytes;
+    header.bounds = bounds;
+    const void *nodeData = quantizedNodes
+                               ? (const void *)quantizedNodes
+                               : wideNodes ? wideNodes : (const void *)nodes;
+    size_t padding = CacheNodeOffset(header) - sizeof(header) -
+                     orderedPrimNums.size() * sizeof(int32_t);
+    static const char zeros[PBRT_L1_CACHE_LINE_SIZE] = {};
+
+    // Write to a uniquely named file and then rename it, so that concurrent
+    // runs never see a partially written cache
+    std::string tempFilename =
+        filename + "." +
+        std::to_string(
+            std::chrono::steady_clock::now().time_since_epoch().count()) +
+        ".tmp";
+    FILE *f = fopen(tempFilename.c_str(), "wb");
+    bool written = f && fwrite(&header, sizeof(header), 1, f) == 1 &&
+                   fwrite(orderedPrimNums.data(), sizeof(int32_t),
+                          orderedPrimNums.size(),
+                          f) == orderedPrimNums.size() &&
+                   fwrite(zeros, 1, padding, f) == padding &&
+                   fwrite(nodeData, 1, nodeBytes, f) == nodeBytes;
+    if (f && fclose(f) != 0) written = false;
+    if (written)
+        written = rename(tempFilename.c_str(), filename.c_str()) == 0;
+    if (!written) {
+        if (f) remove(tempFilename.c_str());
+        Warning("Unable to write BVH cache file \"%s\".", filename.c_str());
+    }
+}
+
+void BVHAccel::ReplicateNodes(const void *nodes, size_t bytes) {
+    // Give each NUMA node its own copy of the read-only nodes, first
+    // touched by a thread running on that node
+    int nNodes = NumaNodeCount();
+    if (nNodes == 1) return;
+    nodeReplicas.resize(nNodes);
+    for (int node = 0; node < nNodes; ++node)
+        RunOnNumaNode(node, [&]() {
+            nodeReplicas[node] = AllocAligned(bytes);
+            memcpy(nodeReplicas[node], nodes, bytes);
+        });
+    treeBytes += nNodes * bytes;
+}
+
+void BVHAccel::BuildTrianglePackets() {
+    // Find the leaves, as ranges of the references to _primitives_
+    std::vector<std::pair<int, int>> leaves;
+    if (nodes) {
+        for (size_t i = 0; i < nodeBytes / sizeof(LinearBVHNode); ++i)
+            if (nodes[i].nPrimitives > 0)
+                leaves.push_back(
+                    {nodes[i].primitivesOffset, nodes[i].nPrimitives});
+    } else if (quantizedNodes) {
+        for (size_t i = 0; i < nodeBytes / sizeof(QuantizedBVHNode); ++i)
+            for (int c = 0; c < 2; ++c)
+                if (quantizedNodes[i].nPrimitives[c] > 0)
+                    leaves.push_back({quantizedNodes[i].offset[c],
+                                      quantizedNodes[i].nPrimitives[c]});
+    } else if (width == 4) {
+        auto wide = static_cast<const WideBVHNode<4> *>(wideNodes);
+        for (size_t i = 0; i < nodeBytes / sizeof(WideBVHNode<4>); ++i)
+            for (int c = 0; c < 4; ++c)
+                if (wide[i].nPrimitives[c] > 0)
+                    leaves.push_back(
+                        {wide[i].offset[c], wide[i].nPrimitives[c]});
+    } else {
+        auto wide = static_cast<const WideBVHNode<8> *>(wideNodes);
+        for (size_t i = 0; i < nodeBytes / sizeof(WideBVHNode<8>); ++i)
+            for (int c = 0; c < 8; ++c)
+                if (wide[i].nPrimitives[c] > 0)
+                    leaves.push_back(
+                        {wide[i].offset[c], wide[i].nPrimitives[c]});
+    }
+
+    // Count the packets of the leaves that hold only triangles the packet
+    // test can handle
+    PBRT_CONSTEXPR int packetWidth = TrianglePacket::Width;
+    std::vector<int> leafPacketCounts(leaves.size());
+    ParallelFor([&](int64_t i) {
+        int end = std::min((int)leaves.size(), (int)(i + 1) * buildChunkSize);
+        for (int l = (int)i * buildChunkSize; l < end; ++l) {
+            bool packable = true;
+            for (int j = 0; j < leaves[l].second && packable; ++j) {
+                auto tri = dynamic_cast<const TriangleMeshPrimitive *>(
+                    &LeafPrimitive(leaves[l].first + j));
+                packable = tri && !tri->HasAlphaTexture();
+            }
+            leafPacketCounts[l] =
+                packable ? (leaves[l].second + packetWidth - 1) / packetWidth
+                         : 0;
+        }
+    }, (leaves.size() + buildChunkSize - 1) / buildChunkSize);
+    int nPackets = 0;
+    leafPackets.assign(primIndices.empty() ? primitives.size()
+                                           : primIndices.size(),
+                       -1);
+    for (size_t l = 0; l < leaves.size(); ++l) {
+        packablePrimitives += leaves[l].second;
+        if (leafPacketCounts[l] == 0) continue;
+        leafPackets[leaves[l].first] = nPackets;
+        nPackets += leafPacketCounts[l];
+        packedPrimitives += leaves[l].second;
+    }
+    if (nPackets == 0) {
+        leafPackets.clear();
+        return;
+    }
 
-    // Compute representation of depth-first traversal of BVH tree
-    treeBytes += totalNodes * sizeof(LinearBVHNode) + sizeof(*this) +
-                 primitives.size() * sizeof(primitives[0]);
-    nodes = AllocAligned<LinearBVHNode>(totalNodes);
-    int offset = 0;
-    flattenBVHTree(root, &offset);
-    Assert(offset == totalNodes);
+    // Gather the leaves' triangle vertices into packets
+    trianglePackets = AllocAligned<TrianglePacket>(nPackets);
+    treeBytes += nPackets * sizeof(TrianglePacket) +
+                 leafPackets.size() * sizeof(leafPackets[0]);
+    ParallelFor([&](int64_t i) {
+        int end = std::min((int)leaves.size(), (int)(i + 1) * buildChunkSize);
+        for (int l = (int)i * buildChunkSize; l < end; ++l)
+            if (leafPacketCounts[l] > 0)
+                PackLeafTriangles(leaves[l].first, leaves[l].second);
+    }, (leaves.size() + buildChunkSize - 1) / buildChunkSize);
 }
 
-Bounds3f BVHAccel::WorldBound() const {
-    return nodes ? nodes[0].bounds : Bounds3f();
+void BVHAccel::PackLeafTriangles(int offset, int nPrimitives) {
+    // Gather the leaf's triangle vertices into its packets
+    PBRT_CONSTEXPR int packetWidth = TrianglePacket::Width;
+    TrianglePacket *packet = &trianglePackets[leafPackets[offset]];
+    for (int j = 0; j < nPrimitives; j += packetWidth, ++packet) {
+        *packet = TrianglePacket();
+        for (int k = 0; k < packetWidth; ++k) {
+            packet->index[k] = -1;
+            if (j + k >= nPrimitives) continue;
+            int ref = offset + j + k;
+            Point3f p[3];
+            static_cast<const TriangleMeshPrimitive &>(LeafPrimitive(ref))
+                .GetVertices(p);
+            for (int v = 0; v < 3; ++v)
+                for (int a = 0; a < 3; ++a) packet->p[v][a][k] = p[v][a];
+            packet->index[k] = primIndices.empty() ? ref : primIndices[ref];
+        }
+    }
+}
+
+Bounds3f BVHAccel::WorldBound() const { return bounds; }
+
+bool BVHAccel::MotionInterval(Float *startTime, Float *endTime) const {
+    if (endBounds.empty()) return false;
+    *startTime = motionStart;
+    *endTime = motionEnd;
+    return true;
+}
+
+void BVHAccel::LinearBounds(Float time0, Float time1, Bounds3f *b0,
+                            Bounds3f *b1) const {
+    // The root's bounds only interpolate over the tree's own interval
+    if (endBounds.empty() || time0 != motionStart || time1 != motionEnd) {
+        Aggregate::LinearBounds(time0, time1, b0, b1);
+        return;
+    }
+    *b0 = nodes[0].bounds;
+    *b1 = endBounds[0];
 }
 
 struct BucketInfo {
@@ -224,44 +977,144 @@ struct BucketInfo {
     Bounds3f bounds;
 };
 
+// Computes the bounds of the primitives in [_start_, _end_) and of their
+// centroids
+static void ComputeBounds(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                          int start, int end, Bounds3f *bounds,
+                          Bounds3f *centroidBounds) {
+    int nChunks = (end - start + buildChunkSize - 1) / buildChunkSize;
+    std::vector<Bounds3f> chunkBounds(nChunks), chunkCentroidBounds(nChunks);
+    auto boundChunk = [&](int64_t c) {
+        int chunkEnd = std::min(end, start + (int)(c + 1) * buildChunkSize);
+        for (int i = start + (int)c * buildChunkSize; i < chunkEnd; ++i) {
+            chunkBounds[c] = Union(chunkBounds[c], primitiveInfo[i].bounds);
+            chunkCentroidBounds[c] =
+                Union(chunkCentroidBounds[c], primitiveInfo[i].centroid);
+        }
+    };
+    if (end - start >= parallelBuildThreshold)
+        ParallelFor(boundChunk, nChunks);
+    else
+        for (int c = 0; c < nChunks; ++c) boundChunk(c);
+    // Unions are exact, so the result doesn't depend on the chunking
+    for (int c = 0; c < nChunks; ++c) {
+        *bounds = Union(*bounds, chunkBounds[c]);
+        *centroidBounds = Union(*centroidBounds, chunkCentroidBounds[c]);
+    }
+}
+
+// Accumulates the primitives in [_start_, _end_) into SAH buckets, given a
+// function that returns a primitive's bucket
+template <typename BucketFunc>
+static void ComputeBuckets(const std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                           int start, int end, int nBuckets,
+                           BucketInfo *buckets, const BucketFunc &bucketFunc) {
+    auto bucketRange = [&](int rangeStart, int rangeEnd,
+                           BucketInfo *rangeBuckets) {
+        for (int i = rangeStart; i < rangeEnd; ++i) {
+            int b = bucketFunc(primitiveInfo[i]);
+            rangeBuckets[b].count++;
+            rangeBuckets[b].bounds =
+                Union(rangeBuckets[b].bounds, primitiveInfo[i].bounds);
+        }
+    };
+    if (end - start < parallelBuildThreshold) {
+        bucketRange(start, end, buckets);
+        return;
+    }
+    int nChunks = (end - start + buildChunkSize - 1) / buildChunkSize;
+    std::vector<BucketInfo> chunkBuckets(nChunks * nBuckets);
+    ParallelFor([&](int64_t c) {
+        bucketRange(start + (int)c * buildChunkSize,
+                    std::min(end, start + (int)(c + 1) * buildChunkSize),
+                    &chunkBuckets[c * nBuckets]);
+    }, nChunks);
+    for (int c = 0; c < nChunks; ++c)
+        for (int b = 0; b < nBuckets; ++b) {
+            buckets[b].count += chunkBuckets[c * nBuckets + b].count;
+            buckets[b].bounds = Union(buckets[b].bounds,
+                                      chunkBuckets[c * nBuckets + b].bounds);
+        }
+}
+
+// Partitions [_start_, _end_) so that primitives satisfying _pred_ come
+// first, returning the index of the first one that doesn't. Large ranges
+// are partitioned in parallel, stably, through a temporary buffer.
+template <typename Predicate>
+static int PartitionPrimitives(std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                               int start, int end, const Predicate &pred) {
+    if (end - start < parallelBuildThreshold)
+        return std::partition(&primitiveInfo[start],
+                              &primitiveInfo[end - 1] + 1, pred) -
+               &primitiveInfo[0];
+
+    // Count the primitives that go first in each chunk
+    int nChunks = (end - start + buildChunkSize - 1) / buildChunkSize;
+    auto chunkStart = [&](int c) { return start + c * buildChunkSize; };
+    auto chunkEnd = [&](int c) {
+        return std::min(end, start + (c + 1) * buildChunkSize);
+    };
+    std::vector<int> firstCount(nChunks, 0);
+    ParallelFor([&](int64_t c) {
+        for (int i = chunkStart(c); i < chunkEnd(c); ++i)
+            if (pred(primitiveInfo[i])) ++firstCount[c];
+    }, nChunks);
+
+    // Compute each chunk's output offsets and scatter the primitives
+    std::vector<int> firstOffset(nChunks), secondOffset(nChunks);
+    int nFirst = 0, nSecond = 0;
+    for (int c = 0; c < nChunks; ++c) {
+        firstOffset[c] = nFirst;
+        secondOffset[c] = nSecond;
+        nFirst += firstCount[c];
+        nSecond += chunkEnd(c) - chunkStart(c) - firstCount[c];
+    }
+    std::vector<BVHPrimitiveInfo> partitioned(end - start);
+    ParallelFor([&](int64_t c) {
+        int first = firstOffset[c], second = nFirst + secondOffset[c];
+        for (int i = chunkStart(c); i < chunkEnd(c); ++i)
+            partitioned[pred(primitiveInfo[i]) ? first++ : second++] =
+                primitiveInfo[i];
+    }, nChunks);
+    ParallelFor([&](int64_t c) {
+        std::copy(&partitioned[chunkStart(c) - start],
+                  &partitioned[chunkEnd(c) - 1 - start] + 1,
+                  &primitiveInfo[chunkStart(c)]);
+    }, nChunks);
+    return start + nFirst;
+}
+
 BVHBuildNode *BVHAccel::recursiveBuild(
-    MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo, int start,
-    int end, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) {
+    MemoryArena *threadArenas, std::vector<BVHPrimitiveInfo> &primitiveInfo,
+    int start, int end, std::vector<int> &orderedPrimNums) {
     Assert(start != end);
-    BVHBuildNode *node = arena.Alloc<BVHBuildNode>();
-    (*totalNodes)++;
-    // Compute bounds of all primitives in BVH node
-    Bounds3f bounds;
-    for (int i = start; i < end; ++i)
-        bounds = Union(bounds, primitiveInfo[i].bounds);
+    BVHBuildNode *node = threadArenas[ThreadIndex].Alloc<BVHBuildNode>();
+    // Compute bounds of all primitives and of their centroids in BVH node
+    Bounds3f bounds, centroidBounds;
+    ComputeBounds(primitiveInfo, start, end, &bounds, &centroidBounds);
     int nPrimitives = end - start;
-    if (nPrimitives == 1) {
-        // Create leaf _BVHBuildNode_
-        int firstPrimOffset = orderedPrims.size();
+    // Leaves hold the primitives of their range, which the partitioning has
+    // already put in final order
+    auto initLeaf = [&]() {
         for (int i = start; i < end; ++i) {
             int primNum = primitiveInfo[i].primitiveNumber;
-            orderedPrims.push_back(primitives[primNum]);
+            orderedPrimNums[i] = primNum;
         }
-        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+        node->InitLeaf(start, nPrimitives, bounds);
+    };
+    if (nPrimitives == 1) {
+        // Create leaf _BVHBuildNode_
+        initLeaf();
         return node;
     } else {
-        // Compute bound of primitive centroids, choose split dimension _dim_
-        Bounds3f centroidBounds;
-        for (int i = start; i < end; ++i)
-            centroidBounds = Union(centroidBounds, primitiveInfo[i].centroid);
+        // Choose split dimension _dim_
         int dim = centroidBounds.MaximumExtent();
 
         // Partition primitives into two sets and build children
         int mid = (start + end) / 2;
         if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) {
             // Create leaf _BVHBuildNode_
-            int firstPrimOffset = orderedPrims.size();
-            for (int i = start; i < end; ++i) {
-                int primNum = primitiveInfo[i].primitiveNumber;
-                orderedPrims.push_back(primitives[primNum]);
-            }
-            node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+            initLeaf();
             return node;
         } else {
             // Partition primitives based on _splitMethod_
@@ -270,12 +1123,11 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                 // Partition primitives through node's midpoint
                 Float pmid =
                     (centroidBounds.pMin[dim] + centroidBounds.pMax[dim]) / 2;
-                BVHPrimitiveInfo *midPtr = std::partition(
-                    &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                mid = PartitionPrimitives(
+                    primitiveInfo, start, end,
                     [dim, pmid](const BVHPrimitiveInfo &pi) {
                         return pi.centroid[dim] < pmid;
                     });
-                mid = midPtr - &primitiveInfo[0];
                 // For lots of prims with large overlapping bounding boxes, this
                 // may fail to partition; in that case don't break and fall
                 // through
@@ -310,18 +1162,17 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     // Allocate _BucketInfo_ for SAH partition buckets
                     PBRT_CONSTEXPR int nBuckets = 12;
                     BucketInfo buckets[nBuckets];
-
-                    // Initialize _BucketInfo_ for SAH partition buckets
-                    for (int i = start; i < end; ++i) {
+                    auto bucketIndex = [=](const BVHPrimitiveInfo &pi) {
                         int b = nBuckets *
-                                centroidBounds.Offset(
-                                    primitiveInfo[i].centroid)[dim];
+                                centroidBounds.Offset(pi.centroid)[dim];
                         if (b == nBuckets) b = nBuckets - 1;
                         Assert(b >= 0 && b < nBuckets);
-                        buckets[b].count++;
-                        buckets[b].bounds =
-                            Union(buckets[b].bounds, primitiveInfo[i].bounds);
-                    }
+                        return b;
+                    };
+
+                    // Initialize _BucketInfo_ for SAH partition buckets
+                    ComputeBuckets(primitiveInfo, start, end, nBuckets,
+                                   buckets, bucketIndex);
 
                     // Compute costs for splitting after each bucket
                     Float cost[nBuckets - 1];
@@ -356,44 +1207,323 @@ BVHBuildNode *BVHAccel::recursiveBuild(
                     // bucket
                     Float leafCost = nPrimitives;
                     if (nPrimitives > maxPrimsInNode || minCost < leafCost) {
-                        BVHPrimitiveInfo *pmid = std::partition(
-                            &primitiveInfo[start], &primitiveInfo[end - 1] + 1,
+                        mid = PartitionPrimitives(
+                            primitiveInfo, start, end,
                             [=](const BVHPrimitiveInfo &pi) {
-                                int b = nBuckets *
-                                        centroidBounds.Offset(pi.centroid)[dim];
-                                if (b == nBuckets) b = nBuckets - 1;
-                                Assert(b >= 0 && b < nBuckets);
-                                return b <= minCostSplitBucket;
+                                return bucketIndex(pi) <= minCostSplitBucket;
                             });
-                        mid = pmid - &primitiveInfo[0];
                     } else {
                         // Create leaf _BVHBuildNode_
-                        int firstPrimOffset = orderedPrims.size();
-                        for (int i = start; i < end; ++i) {
-                            int primNum = primitiveInfo[i].primitiveNumber;
-                            orderedPrims.push_back(primitives[primNum]);
-                        }
-                        node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
+                        initLeaf();
                         return node;
                     }
                 }
                 break;
             }
             }
-            node->InitInterior(dim,
-                               recursiveBuild(arena, primitiveInfo, start, mid,
-                                              totalNodes, orderedPrims),
-                               recursiveBuild(arena, primitiveInfo, mid, end,
-                                              totalNodes, orderedPrims));
+
+            // Build large subtrees in parallel, each on its own task
+            if (nPrimitives >= parallelBuildThreshold) {
+                Future<BVHBuildNode *> c0 = Async([&]() {
+                    return recursiveBuild(threadArenas, primitiveInfo, start,
+                                          mid, orderedPrimNums);
+                });
+                BVHBuildNode *c1 = recursiveBuild(threadArenas, primitiveInfo,
+                                                  mid, end, orderedPrimNums);
+                node->InitInterior(dim, c0.Get(), c1);
+            } else
+                node->InitInterior(
+                    dim,
+                    recursiveBuild(threadArenas, primitiveInfo, start, mid,
+                                   orderedPrimNums),
+                    recursiveBuild(threadArenas, primitiveInfo, mid, end,
+                                   orderedPrimNums));
         }
     }
     return node;
 }
 
+// Surface area of the overlap of two bounds, or zero if they are disjoint
+static Float OverlapArea(const Bounds3f &b0, const Bounds3f &b1) {
+    Bounds3f overlap = Intersect(b0, b1);
+    for (int axis = 0; axis < 3; ++axis)
+        if (overlap.pMin[axis] > overlap.pMax[axis]) return 0;
+    return overlap.SurfaceArea();
+}
+
+static bool IsEmpty(const Bounds3f &b) {
+    return b.pMin.x > b.pMax.x || b.pMin.y > b.pMax.y || b.pMin.z > b.pMax.z;
+}
+
+// Nodes with at least this many references are built with parallel tasks
+static PBRT_CONSTEXPR int parallelSpatialSplitThreshold = 4096;
+
+// The lowest-cost split found along one axis
+struct SplitCandidate {
+    Float cost = Infinity;
+    int bin = 0;
+    Bounds3f bounds[2];
+};
+
+// Builds the subtree for _refs_, whose leaves may hold up to _maxRefs_
+// references in total; they are stored in _orderedPrimNums_ from _firstRef_,
+// wherever the parallel build ends, until _CompactLeafReferences()_ packs
+// them in tree order
+BVHBuildNode *BVHAccel::spatialSplitBuild(
+    MemoryArena *threadArenas, std::vector<BVHPrimitiveInfo> &refs,
+    int maxRefs, Float rootArea, int depth, std::vector<int> &orderedPrimNums,
+    int firstRef) {
+    Assert(!refs.empty());
+    BVHBuildNode *node = threadArenas[ThreadIndex].Alloc<BVHBuildNode>();
+    Bounds3f bounds, centroidBounds;
+    for (const BVHPrimitiveInfo &ref : refs) {
+        bounds = Union(bounds, ref.bounds);
+        centroidBounds = Union(centroidBounds, ref.centroid);
+    }
+    int nRefs = refs.size();
+    auto initLeaf = [&]() {
+        for (int i = 0; i < nRefs; ++i)
+            orderedPrimNums[firstRef + i] = refs[i].primitiveNumber;
+        node->InitLeaf(firstRef, nRefs, bounds);
+    };
+    if (nRefs == 1) {
+        initLeaf();
+        return node;
+    }
+    Float invArea = 1 / bounds.SurfaceArea();
+    // Evaluates _func_ for each axis, in parallel for large nodes
+    auto forEachAxis = [&](const std::function<void(int64_t)> &func) {
+        if (nRefs >= parallelSpatialSplitThreshold)
+            ParallelFor(func, 3);
+        else
+            for (int dim = 0; dim < 3; ++dim) func(dim);
+    };
+
+    // Find the best object split along each axis
+    PBRT_CONSTEXPR int nBuckets = 12;
+    auto bucketIndex = [&](const BVHPrimitiveInfo &ref, int dim) -> int {
+        int b = nBuckets * centroidBounds.Offset(ref.centroid)[dim];
+        return std::min(b, nBuckets - 1);
+    };
+    SplitCandidate objectSplits[3];
+    forEachAxis([&](int64_t dim) {
+        if (centroidBounds.pMax[dim] == centroidBounds.pMin[dim]) return;
+        BucketInfo buckets[nBuckets];
+        for (const BVHPrimitiveInfo &ref : refs) {
+            int b = bucketIndex(ref, dim);
+            buckets[b].count++;
+            buckets[b].bounds = Union(buckets[b].bounds, ref.bounds);
+        }
+        // Sweep from the right, then evaluate each split from the left
+        Bounds3f rightBounds[nBuckets - 1];
+        int rightCount[nBuckets - 1];
+        Bounds3f b1;
+        int count1 = 0;
+        for (int i = nBuckets - 1; i > 0; --i) {
+            b1 = Union(b1, buckets[i].bounds);
+            count1 += buckets[i].count;
+            rightBounds[i - 1] = b1;
+            rightCount[i - 1] = count1;
+        }
+        Bounds3f b0;
+        int count0 = 0;
+        for (int i = 0; i < nBuckets - 1; ++i) {
+            b0 = Union(b0, buckets[i].bounds);
+            count0 += buckets[i].count;
+            if (count0 == 0 || rightCount[i] == 0) continue;
+            Float cost = 1 + (count0 * b0.SurfaceArea() +
+                              rightCount[i] * rightBounds[i].SurfaceArea()) *
+                                 invArea;
+            if (cost < objectSplits[dim].cost) {
+                objectSplits[dim].cost = cost;
+                objectSplits[dim].bin = i;
+                objectSplits[dim].bounds[0] = b0;
+                objectSplits[dim].bounds[1] = rightBounds[i];
+            }
+        }
+    });
+    int objectDim = -1;
+    for (int dim = 0; dim < 3; ++dim)
+        if (objectSplits[dim].cost < Infinity &&
+            (objectDim == -1 ||
+             objectSplits[dim].cost < objectSplits[objectDim].cost))
+            objectDim = dim;
+    Float objectCost =
+        objectDim == -1 ? Infinity : objectSplits[objectDim].cost;
+
+    // Look for a spatial split if the object split's children overlap
+    // significantly and the duplication budget allows it
+    PBRT_CONSTEXPR int nSpatialBins = 32;
+    PBRT_CONSTEXPR Float spatialSplitAlpha = 1e-5f;
+    PBRT_CONSTEXPR int maxSpatialSplitDepth = 48;
+    auto binIndex = [&](int dim, Float x) -> int {
+        int b = nSpatialBins * (x - bounds.pMin[dim]) /
+                (bounds.pMax[dim] - bounds.pMin[dim]);
+        return Clamp(b, 0, nSpatialBins - 1);
+    };
+    auto binPlane = [&](int dim, int b) -> Float {
+        return Lerp((Float)b / nSpatialBins, bounds.pMin[dim],
+                    bounds.pMax[dim]);
+    };
+    int spatialDim = -1;
+    SplitCandidate spatialCandidates[3];
+    if (nRefs < maxRefs && depth < maxSpatialSplitDepth &&
+        (objectDim == -1 ||
+         OverlapArea(objectSplits[objectDim].bounds[0],
+                     objectSplits[objectDim].bounds[1]) >
+             spatialSplitAlpha * rootArea)) {
+        forEachAxis([&](int64_t dim) {
+            if (bounds.pMax[dim] == bounds.pMin[dim]) return;
+            // Split each reference among the bins it overlaps
+            Bounds3f binBounds[nSpatialBins];
+            int entries[nSpatialBins] = {0}, exits[nSpatialBins] = {0};
+            for (const BVHPrimitiveInfo &ref : refs) {
+                int first = binIndex(dim, ref.bounds.pMin[dim]);
+                int last = binIndex(dim, ref.bounds.pMax[dim]);
+                ++entries[first];
+                ++exits[last];
+                Bounds3f rest = ref.bounds;
+                for (int b = first; b < last; ++b) {
+                    Bounds3f l;
+                    primitives[ref.primitiveNumber]->SplitWorldBound(
+                        rest, dim, binPlane(dim, b + 1), &l, &rest);
+                    binBounds[b] = Union(binBounds[b], l);
+                }
+                binBounds[last] = Union(binBounds[last], rest);
+            }
+            // Evaluate the SAH for a split at each bin boundary
+            Bounds3f rightBounds[nSpatialBins - 1];
+            Bounds3f b1;
+            for (int i = nSpatialBins - 1; i > 0; --i)
+                rightBounds[i - 1] = b1 = Union(b1, binBounds[i]);
+            Bounds3f b0;
+            int count0 = 0, count1 = nRefs;
+            for (int i = 0; i < nSpatialBins - 1; ++i) {
+                b0 = Union(b0, binBounds[i]);
+                count0 += entries[i];
+                count1 -= exits[i];
+                if (count0 == 0 || count1 == 0 || count0 + count1 > maxRefs)
+                    continue;
+                Float cost = 1 + (count0 * b0.SurfaceArea() +
+                                  count1 * rightBounds[i].SurfaceArea()) *
+                                     invArea;
+                if (cost < spatialCandidates[dim].cost) {
+                    spatialCandidates[dim].cost = cost;
+                    spatialCandidates[dim].bin = i;
+                }
+            }
+        });
+        for (int dim = 0; dim < 3; ++dim)
+            if (spatialCandidates[dim].cost < Infinity &&
+                (spatialDim == -1 ||
+                 spatialCandidates[dim].cost <
+                     spatialCandidates[spatialDim].cost))
+                spatialDim = dim;
+    }
+    Float spatialCost =
+        spatialDim == -1 ? Infinity : spatialCandidates[spatialDim].cost;
+
+    // Create a leaf if no split is possible or none beats the leaf's cost
+    if ((objectDim == -1 && spatialDim == -1) ||
+        (nRefs <= maxPrimsInNode &&
+         std::min(objectCost, spatialCost) >= nRefs)) {
+        initLeaf();
+        return node;
+    }
+
+    // Distribute the references between the two children
+    std::vector<BVHPrimitiveInfo> left, right;
+    int dim = spatialDim;
+    if (spatialCost < objectCost) {
+        int splitBin = spatialCandidates[dim].bin;
+        Float plane = binPlane(dim, splitBin + 1);
+        Bounds3f lb, rb;
+        std::vector<BVHPrimitiveInfo> straddling;
+        for (const BVHPrimitiveInfo &ref : refs) {
+            if (binIndex(dim, ref.bounds.pMax[dim]) <= splitBin) {
+                left.push_back(ref);
+                lb = Union(lb, ref.bounds);
+            } else if (binIndex(dim, ref.bounds.pMin[dim]) > splitBin) {
+                right.push_back(ref);
+                rb = Union(rb, ref.bounds);
+            } else
+                straddling.push_back(ref);
+        }
+        // Split the straddling references, unless moving one entirely to
+        // one side is cheaper
+        for (const BVHPrimitiveInfo &ref : straddling) {
+            Bounds3f l, r;
+            primitives[ref.primitiveNumber]->SplitWorldBound(ref.bounds, dim,
+                                                             plane, &l, &r);
+            int nl = left.size(), nr = right.size();
+            Float splitCost = Union(lb, l).SurfaceArea() * (nl + 1) +
+                              Union(rb, r).SurfaceArea() * (nr + 1);
+            Float leftCost = Union(lb, ref.bounds).SurfaceArea() * (nl + 1) +
+                             rb.SurfaceArea() * nr;
+            Float rightCost = lb.SurfaceArea() * nl +
+                              Union(rb, ref.bounds).SurfaceArea() * (nr + 1);
+            if (IsEmpty(l))
+                leftCost = splitCost = Infinity;
+            else if (IsEmpty(r))
+                rightCost = splitCost = Infinity;
+            if (leftCost <= splitCost && leftCost <= rightCost) {
+                left.push_back(ref);
+                lb = Union(lb, ref.bounds);
+            } else if (rightCost <= splitCost) {
+                right.push_back(ref);
+                rb = Union(rb, ref.bounds);
+            } else {
+                left.push_back(BVHPrimitiveInfo(ref.primitiveNumber, l));
+                right.push_back(BVHPrimitiveInfo(ref.primitiveNumber, r));
+                lb = Union(lb, l);
+                rb = Union(rb, r);
+            }
+        }
+    }
+    if (!left.empty() && !right.empty())
+        ++spatialSplits;
+    else {
+        // Partition the references at the object split's bucket
+        if (objectDim == -1) {
+            initLeaf();
+            return node;
+        }
+        dim = objectDim;
+        left.clear();
+        right.clear();
+        for (const BVHPrimitiveInfo &ref : refs)
+            (bucketIndex(ref, dim) <= objectSplits[dim].bin ? left : right)
+                .push_back(ref);
+    }
+    int nChildRefs = left.size() + right.size();
+    std::vector<BVHPrimitiveInfo>().swap(refs);
+
+    // Share the remaining duplication budget in proportion to child size
+    int extraRefs = std::max(0, maxRefs - nChildRefs);
+    int leftMaxRefs =
+        left.size() + (int)((int64_t)extraRefs * left.size() / nChildRefs);
+    int rightMaxRefs = right.size() + extraRefs - (leftMaxRefs - left.size());
+    auto buildLeft = [&]() {
+        return spatialSplitBuild(threadArenas, left, leftMaxRefs, rootArea,
+                                 depth + 1, orderedPrimNums, firstRef);
+    };
+    auto buildRight = [&]() {
+        return spatialSplitBuild(threadArenas, right, rightMaxRefs, rootArea,
+                                 depth + 1, orderedPrimNums,
+                                 firstRef + leftMaxRefs);
+    };
+    if (nChildRefs >= parallelSpatialSplitThreshold) {
+        Future<BVHBuildNode *> c0 = Async(buildLeft);
+        BVHBuildNode *c1 = buildRight();
+        node->InitInterior(dim, c0.Get(), c1);
+    } else
+        node->InitInterior(dim, buildLeft(), buildRight());
+    return node;
+}
+
 BVHBuildNode *BVHAccel::HLBVHBuild(
     MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
-    int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims) const {
+    int *totalNodes, std::vector<int> &orderedPrimNums) const {
     // Compute bounding box of all primitive centroids
     Bounds3f bounds;
     for (const BVHPrimitiveInfo &pi : primitiveInfo)
@@ -436,8 +1566,8 @@ BVHBuildNode *BVHAccel::HLBVHBuild(
     }
 
     // Create LBVHs for treelets in parallel
-    std::atomic<int> atomicTotal(0), orderedPrimsOffset(0);
-    orderedPrims.resize(primitives.size());
+    std::atomic<int> atomicTotal(0);
+    orderedPrimNums.resize(primitives.size());
     ParallelFor([&](int i) {
         // Generate _i_th LBVH treelet
         int nodesCreated = 0;
@@ -445,8 +1575,8 @@ BVHBuildNode *BVHAccel::HLBVHBuild(
         LBVHTreelet &tr = treeletsToBuild[i];
         tr.buildNodes =
             emitLBVH(tr.buildNodes, primitiveInfo, &mortonPrims[tr.startIndex],
-                     tr.nPrimitives, &nodesCreated, orderedPrims,
-                     &orderedPrimsOffset, firstBitIndex);
+                     tr.nPrimitives, &nodesCreated, orderedPrimNums,
+                     tr.startIndex, firstBitIndex);
         atomicTotal += nodesCreated;
     }, treeletsToBuild.size());
     *totalNodes = atomicTotal;
@@ -464,18 +1594,17 @@ BVHBuildNode *BVHAccel::emitLBVH(
     BVHBuildNode *&buildNodes,
     const std::vector<BVHPrimitiveInfo> &primitiveInfo,
     MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-    std::vector<std::shared_ptr<Primitive>> &orderedPrims,
-    std::atomic<int> *orderedPrimsOffset, int bitIndex) const {
+    std::vector<int> &orderedPrimNums, int firstPrimOffset,
+    int bitIndex) const {
     Assert(nPrimitives > 0);
     if (bitIndex == -1 || nPrimitives < maxPrimsInNode) {
         // Create and return leaf node of LBVH treelet
         (*totalNodes)++;
         BVHBuildNode *node = buildNodes++;
         Bounds3f bounds;
-        int firstPrimOffset = orderedPrimsOffset->fetch_add(nPrimitives);
         for (int i = 0; i < nPrimitives; ++i) {
             int primitiveIndex = mortonPrims[i].primitiveIndex;
-            orderedPrims[firstPrimOffset + i] = primitives[primitiveIndex];
+            orderedPrimNums[firstPrimOffset + i] = primitiveIndex;
             bounds = Union(bounds, primitiveInfo[primitiveIndex].bounds);
         }
         node->InitLeaf(firstPrimOffset, nPrimitives, bounds);
@@ -486,7 +1615,7 @@ BVHBuildNode *BVHAccel::emitLBVH(
         if ((mortonPrims[0].mortonCode & mask) ==
             (mortonPrims[nPrimitives - 1].mortonCode & mask))
             return emitLBVH(buildNodes, primitiveInfo, mortonPrims, nPrimitives,
-                            totalNodes, orderedPrims, orderedPrimsOffset,
+                            totalNodes, orderedPrimNums, firstPrimOffset,
                             bitIndex - 1);
 
         // Find LBVH split point for this dimension
@@ -513,11 +1642,11 @@ BVHBuildNode *BVHAccel::emitLBVH(
         BVHBuildNode *node = buildNodes++;
         BVHBuildNode *lbvh[2] = {
             emitLBVH(buildNodes, primitiveInfo, mortonPrims, splitOffset,
-                     totalNodes, orderedPrims, orderedPrimsOffset,
+                     totalNodes, orderedPrimNums, firstPrimOffset,
                      bitIndex - 1),
             emitLBVH(buildNodes, primitiveInfo, &mortonPrims[splitOffset],
-                     nPrimitives - splitOffset, totalNodes, orderedPrims,
-                     orderedPrimsOffset, bitIndex - 1)};
+                     nPrimitives - splitOffset, totalNodes, orderedPrimNums,
+                     firstPrimOffset + splitOffset, bitIndex - 1)};
         int axis = bitIndex % 3;
         node->InitInterior(axis, lbvh[0], lbvh[1]);
         return node;
@@ -623,34 +1752,354 @@ BVHBuildNode *BVHAccel::buildUpperSAH(MemoryArena &arena,
     return node;
 }
 
-int BVHAccel::flattenBVHTree(BVHBuildNode *node, int *offset) {
-    LinearBVHNode *linearNode = &nodes[*offset];
+void BVHAccel::flattenBVHTree(const BVHBuildNode *node, int offset) {
+    LinearBVHNode *linearNode = &nodes[offset];
     linearNode->bounds = node->bounds;
-    int myOffset = (*offset)++;
     if (node->nPrimitives > 0) {
         Assert(!node->children[0] && !node->children[1]);
         Assert(node->nPrimitives < 65536);
         linearNode->primitivesOffset = node->firstPrimOffset;
         linearNode->nPrimitives = node->nPrimitives;
     } else {
-        // Create interior flattened BVH node
+        // Create interior flattened BVH node; subtree sizes give the
+        // children's offsets, so large subtrees can be flattened in parallel
         linearNode->axis = node->splitAxis;
         linearNode->nPrimitives = 0;
-        flattenBVHTree(node->children[0], offset);
-        linearNode->secondChildOffset =
-            flattenBVHTree(node->children[1], offset);
+        int secondChildOffset = offset + 1 + node->children[0]->nNodes;
+        linearNode->secondChildOffset = secondChildOffset;
+        if (node->nNodes >= parallelBuildThreshold) {
+            Future<void> first = Async(
+                [&]() { flattenBVHTree(node->children[0], offset + 1); });
+            flattenBVHTree(node->children[1], secondChildOffset);
+            first.Get();
+        } else {
+            flattenBVHTree(node->children[0], offset + 1);
+            flattenBVHTree(node->children[1], secondChildOffset);
+        }
+    }
+}
+
+template <int N>
+int BVHAccel::collapseBVHTree(const BVHBuildNode *node,
+                              std::vector<WideBVHNode<N>> &wideNodes) const {
+    // Gather up to _N_ descendants of _node_, repeatedly opening the interior
+    // child with the largest surface area
+    const BVHBuildNode *children[N];
+    int nChildren = 0;
+    if (node->nPrimitives > 0)
+        children[nChildren++] = node;
+    else {
+        children[nChildren++] = node->children[0];
+        children[nChildren++] = node->children[1];
+    }
+    while (nChildren < N) {
+        int open = -1;
+        Float maxArea = -1;
+        for (int i = 0; i < nChildren; ++i)
+            if (children[i]->nPrimitives == 0 &&
+                children[i]->bounds.SurfaceArea() > maxArea) {
+                open = i;
+                maxArea = children[i]->bounds.SurfaceArea();
+            }
+        if (open == -1) break;
+        const BVHBuildNode *opened = children[open];
+        children[open] = opened->children[0];
+        children[nChildren++] = opened->children[1];
+    }
+    wideChildren += nChildren;
+    ++wideNodeCount;
+
+    // Initialize the wide node; empty slots get inverted bounds so they are
+    // never hit
+    int myOffset = (int)wideNodes.size();
+    wideNodes.push_back(WideBVHNode<N>());
+    for (int c = 0; c < N; ++c) {
+        for (int a = 0; a < 3; ++a) {
+            wideNodes[myOffset].bounds[0][a][c] =
+                c < nChildren ? children[c]->bounds.pMin[a] : Infinity;
+            wideNodes[myOffset].bounds[1][a][c] =
+                c < nChildren ? children[c]->bounds.pMax[a] : -Infinity;
+        }
+        wideNodes[myOffset].offset[c] = -1;
+        wideNodes[myOffset].nPrimitives[c] = 0;
+    }
+
+    // Store leaf children in place and recursively collapse interior ones
+    for (int c = 0; c < nChildren; ++c) {
+        if (children[c]->nPrimitives > 0) {
+            Assert(children[c]->nPrimitives < 65536);
+            wideNodes[myOffset].offset[c] = children[c]->firstPrimOffset;
+            wideNodes[myOffset].nPrimitives[c] = children[c]->nPrimitives;
+        } else {
+            int childOffset = collapseBVHTree<N>(children[c], wideNodes);
+            wideNodes[myOffset].offset[c] = childOffset;
+        }
     }
     return myOffset;
 }
 
-BVHAccel::~BVHAccel() { FreeAligned(nodes); }
+template <int N>
+void BVHAccel::BuildWideBVH(const BVHBuildNode *root) {
+    std::vector<WideBVHNode<N>> collapsed;
+    collapseBVHTree<N>(root, collapsed);
+    nodeBytes = collapsed.size() * sizeof(WideBVHNode<N>);
+    Info("BVH%d created with %d nodes for %d primitives (%.2f MB)", N,
+         (int)collapsed.size(), (int)primitives.size(),
+         float(nodeBytes) / (1024.f * 1024.f));
+    treeBytes += nodeBytes;
+    wideNodes = AllocAligned(nodeBytes);
+    memcpy(wideNodes, collapsed.data(), nodeBytes);
+    ReplicateNodes(wideNodes, nodeBytes);
+}
+
+int BVHAccel::quantizeBVHTree(
+    const BVHBuildNode *node, const Bounds3f &nodeBounds,
+    std::vector<QuantizedBVHNode> &quantizedNodes) const {
+    // Leaves too large for a quantized node's counts are split in half
+    BVHBuildNode halves[2];
+    const BVHBuildNode *const *children = node->children;
+    const BVHBuildNode *leafChildren[2] = {&halves[0], &halves[1]};
+    int axis = node->splitAxis;
+    if (node->nPrimitives > 0) {
+        int nFirst = node->nPrimitives / 2;
+        for (int c = 0; c < 2; ++c) {
+            halves[c].bounds = node->bounds;
+            halves[c].children[0] = halves[c].children[1] = nullptr;
+            halves[c].nNodes = 1;
+        }
+        halves[0].firstPrimOffset = node->firstPrimOffset;
+        halves[0].nPrimitives = nFirst;
+        halves[1].firstPrimOffset = node->firstPrimOffset + nFirst;
+        halves[1].nPrimitives = node->nPrimitives - nFirst;
+        children = leafChildren;
+        axis = 0;
+    }
+
+    // Quantize each child's bounds conservatively: the lower bound rounds
+    // down and the upper bound up
+    int myOffset = (int)quantizedNodes.size();
+    quantizedNodes.push_back(QuantizedBVHNode());
+    QuantizedBVHNode qNode;
+    qNode.axis = axis;
+    for (int c = 0; c < 2; ++c)
+        for (int a = 0; a < 3; ++a) {
+            Float lo = nodeBounds.pMin[a], hi = nodeBounds.pMax[a];
+            Float vMin = children[c]->bounds.pMin[a];
+            Float vMax = children[c]->bounds.pMax[a];
+            int qMin = 0, qMax = 255;
+            if (hi > lo) {
+                qMin = Clamp((int)(255 * (vMin - lo) / (hi - lo)), 0, 255);
+                qMax = Clamp((int)std::ceil(255 * (vMax - lo) / (hi - lo)), 0,
+                             255);
+            }
+            while (qMin > 0 && Dequantize(qMin, lo, hi) > vMin) --qMin;
+            while (qMin < 255 && Dequantize(qMin + 1, lo, hi) <= vMin) ++qMin;
+            while (qMax < 255 && Dequantize(qMax, lo, hi) < vMax) ++qMax;
+            while (qMax > 0 && Dequantize(qMax - 1, lo, hi) >= vMax) --qMax;
+            qNode.bounds[0][c][a] = qMin;
+            qNode.bounds[1][c][a] = qMax;
+        }
+
+    // Store leaf children in place and recursively quantize interior ones
+    for (int c = 0; c < 2; ++c) {
+        if (children[c]->nPrimitives > 0 && children[c]->nPrimitives < 256) {
+            qNode.offset[c] = children[c]->firstPrimOffset;
+            qNode.nPrimitives[c] = children[c]->nPrimitives;
+        } else {
+            qNode.offset[c] = quantizeBVHTree(
+                children[c], ChildBounds(qNode, c, nodeBounds), quantizedNodes);
+            qNode.nPrimitives[c] = 0;
+        }
+    }
+    quantizedNodes[myOffset] = qNode;
+    return myOffset;
+}
+
+void BVHAccel::BuildQuantizedBVH(const BVHBuildNode *root) {
+    std::vector<QuantizedBVHNode> quantized;
+    quantizeBVHTree(root, bounds, quantized);
+    nodeBytes = quantized.size() * sizeof(QuantizedBVHNode);
+    Info("Quantized BVH created with %d nodes for %d primitives (%.2f MB)",
+         (int)quantized.size(), (int)primitives.size(),
+         float(nodeBytes) / (1024.f * 1024.f));
+    treeBytes += nodeBytes;
+    quantizedNodes = AllocAligned<QuantizedBVHNode>(quantized.size());
+    memcpy(quantizedNodes, quantized.data(), nodeBytes);
+    ReplicateNodes(quantizedNodes, nodeBytes);
+}
+
+BVHAccel::~BVHAccel() {
+    for (void *replica : nodeReplicas) FreeAligned(replica);
+    FreeAligned(trianglePackets);
+    // Nodes loaded from the cache belong to its mapping
+    if (cacheFile) return;
+    FreeAligned(nodes);
+    FreeAligned(wideNodes);
+    FreeAligned(quantizedNodes);
+}
+
+bool BVHAccel::FindMotionInterval() {
+    // Find the interval spanned by the motion of the primitives that move
+    bool moving = false;
+    for (const Primitive *prim : primitives) {
+        Float start, end;
+        if (!prim->MotionInterval(&start, &end)) continue;
+        motionStart = moving ? std::min(motionStart, start) : start;
+        motionEnd = moving ? std::max(motionEnd, end) : end;
+        moving = true;
+    }
+    return moving && motionEnd > motionStart;
+}
+
+void BVHAccel::FitMotionBounds() {
+    // Bound the leaves' primitives at the start and end of the motion
+    int nNodes = nodeBytes / sizeof(LinearBVHNode);
+    endBounds.resize(nNodes);
+    ParallelFor([&](int64_t c) {
+        int end = std::min(nNodes, (int)(c + 1) * buildChunkSize);
+        for (int i = c * buildChunkSize; i < end; ++i) {
+            LinearBVHNode &node = nodes[i];
+            if (node.nPrimitives == 0) continue;
+            node.bounds = endBounds[i] = Bounds3f();
+            for (int j = 0; j < node.nPrimitives; ++j) {
+                Bounds3f b0, b1;
+                primitives[node.primitivesOffset + j]->LinearBounds(
+                    motionStart, motionEnd, &b0, &b1);
+                node.bounds = Union(node.bounds, b0);
+                endBounds[i] = Union(endBounds[i], b1);
+            }
+        }
+    }, (nNodes + buildChunkSize - 1) / buildChunkSize);
+
+    // Interpolating the union of the children's bounds bounds both of them
+    for (int i = nNodes - 1; i >= 0; --i)
+        if (nodes[i].nPrimitives == 0) {
+            int second = nodes[i].secondChildOffset;
+            nodes[i].bounds = Union(nodes[i + 1].bounds, nodes[second].bounds);
+            endBounds[i] = Union(endBounds[i + 1], endBounds[second]);
+        }
+    bounds = Union(nodes[0].bounds, endBounds[0]);
+}
+
+bool BVHAccel::Refit() {
+    // Only binary trees built in memory can be refit, and trees with spatial
+    // splits hold references clipped to the old bounds
+    if (!nodes || cacheFile || splitMethod == SplitMethod::SBVH) return false;
+    ++refits;
+    if (FindMotionInterval()) {
+        FitMotionBounds();
+        for (void *replica : nodeReplicas) memcpy(replica, nodes, nodeBytes);
+        return true;
+    }
+    endBounds.clear();
+    int nNodes = nodeBytes / sizeof(LinearBVHNode);
+    ParallelFor([&](int64_t c) {
+        // Bound the primitives' new positions in the leaves, and copy the
+        // new vertices of packed triangles
+        int end = std::min(nNodes, (int)(c + 1) * buildChunkSize);
+        for (int i = c * buildChunkSize; i < end; ++i) {
+            LinearBVHNode &node = nodes[i];
+            if (node.nPrimitives == 0) continue;
+            node.bounds = Bounds3f();
+            for (int j = 0; j < node.nPrimitives; ++j)
+                node.bounds = Union(
+                    node.bounds,
+                    primitives[node.primitivesOffset + j]->WorldBound());
+            if (!leafPackets.empty() &&
+                leafPackets[node.primitivesOffset] >= 0)
+                PackLeafTriangles(node.primitivesOffset, node.nPrimitives);
+        }
+    }, (nNodes + buildChunkSize - 1) / buildChunkSize);
+
+    // Children follow their parent in depth-first order, so a reverse pass
+    // reaches every interior node after both of its children
+    for (int i = nNodes - 1; i >= 0; --i)
+        if (nodes[i].nPrimitives == 0)
+            nodes[i].bounds = Union(nodes[i + 1].bounds,
+                                    nodes[nodes[i].secondChildOffset].bounds);
+    bounds = nodes[0].bounds;
+    for (void *replica : nodeReplicas) memcpy(replica, nodes, nodeBytes);
+    return true;
+}
+
+Float BVHAccel::SAHCost() const {
+    // Expected cost of a ray that hits the root, with a node visit costing
+    // the same as a primitive intersection; motion blur trees are costed
+    // halfway through their motion
+    auto nodeBounds = [&](int i) {
+        return endBounds.empty() ? nodes[i].bounds
+                                 : LerpBounds(.5f, nodes[i].bounds,
+                                              endBounds[i]);
+    };
+    if (!nodes || nodeBounds(0).SurfaceArea() == 0) return 0;
+    int nNodes = nodeBytes / sizeof(LinearBVHNode);
+    double cost = 0;
+    for (int i = 0; i < nNodes; ++i)
+        cost += nodeBounds(i).SurfaceArea() *
+                (nodes[i].nPrimitives > 0 ? nodes[i].nPrimitives : 1);
+    return (Float)(cost / nodeBounds(0).SurfaceArea());
+}
+
+bool BVHAccel::IntersectLeaf(const Ray &ray, const TriangleRay &triRay,
+                             int offset, int nPrimitives,
+                             SurfaceInteraction *isect,
+                             TriangleHit *triHit) const {
+    bool hit = false;
+    if (!leafPackets.empty() && leafPackets[offset] >= 0) {
+        // Test the leaf's triangles a packet at a time, leaving _isect_ to
+        // be filled in for the closest hit once traversal is done
+        const TrianglePacket *packet = &trianglePackets[leafPackets[offset]];
+        for (int i = 0; i < nPrimitives; i += TrianglePacket::Width, ++packet)
+            if (IntersectTrianglePacket(*packet, triRay, ray.tMax, triHit)) {
+                ray.tMax = triHit->t;
+                hit = true;
+            }
+        return hit;
+    }
+    for (int i = 0; i < nPrimitives; ++i)
+        if (LeafPrimitive(offset + i).Intersect(ray, isect)) {
+            // This hit is closer than any triangle hit found so far
+            triHit->index = -1;
+            hit = true;
+        }
+    return hit;
+}
+
+bool BVHAccel::IntersectPLeaf(const Ray &ray, const TriangleRay &triRay,
+                              int offset, int nPrimitives) const {
+    if (!leafPackets.empty() && leafPackets[offset] >= 0) {
+        const TrianglePacket *packet = &trianglePackets[leafPackets[offset]];
+        for (int i = 0; i < nPrimitives; i += TrianglePacket::Width, ++packet)
+            if (IntersectPTrianglePacket(*packet, triRay, ray.tMax))
+                return true;
+        return false;
+    }
+    for (int i = 0; i < nPrimitives; ++i)
+        if (LeafPrimitive(offset + i).IntersectP(ray)) return true;
+    return false;
+}
+
+void BVHAccel::InteractionFromTriangleHit(const Ray &ray,
+                                          const TriangleHit &triHit,
+                                          SurfaceInteraction *isect) const {
+    if (triHit.index < 0) return;
+    static_cast<const TriangleMeshPrimitive &>(*primitives[triHit.index])
+        .InteractionFromHit(ray, triHit, isect);
+}
 
 bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    if (width == 4 && wideNodes) return IntersectWide<4>(ray, isect);
+    if (width == 8 && wideNodes) return IntersectWide<8>(ray, isect);
+    if (quantizedNodes) return IntersectQuantized(ray, isect);
+    if (!endBounds.empty()) return IntersectMotion(ray, isect);
     if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersect);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
     bool hit = false;
     Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
+    TriangleHit triHit;
     // Follow ray through BVH nodes to find primitive intersections
     int toVisitOffset = 0, currentNodeIndex = 0;
     int nodesToVisit[64];
@@ -660,10 +2109,9 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             if (node->nPrimitives > 0) {
                 // Intersect ray with primitives in leaf BVH node
-                for (int i = 0; i < node->nPrimitives; ++i)
-                    if (primitives[node->primitivesOffset + i]->Intersect(
-                            ray, isect))
-                        hit = true;
+                if (IntersectLeaf(ray, triRay, node->primitivesOffset,
+                                  node->nPrimitives, isect, &triHit))
+                    hit = true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
@@ -682,14 +2130,21 @@ bool BVHAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             currentNodeIndex = nodesToVisit[--toVisitOffset];
         }
     }
+    InteractionFromTriangleHit(ray, triHit, isect);
     return hit;
 }
 
 bool BVHAccel::IntersectP(const Ray &ray) const {
+    if (width == 4 && wideNodes) return IntersectPWide<4>(ray);
+    if (width == 8 && wideNodes) return IntersectPWide<8>(ray);
+    if (quantizedNodes) return IntersectPQuantized(ray);
+    if (!endBounds.empty()) return IntersectPMotion(ray);
     if (!nodes) return false;
     ProfilePhase p(Prof::AccelIntersectP);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
     Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
     int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
     int nodesToVisit[64];
     int toVisitOffset = 0, currentNodeIndex = 0;
     while (true) {
@@ -697,17 +2152,401 @@ bool BVHAccel::IntersectP(const Ray &ray) const {
         if (node->bounds.IntersectP(ray, invDir, dirIsNeg)) {
             // Process BVH node _node_ for traversal
             if (node->nPrimitives > 0) {
-                for (int i = 0; i < node->nPrimitives; ++i) {
-                    if (primitives[node->primitivesOffset + i]->IntersectP(
-                            ray)) {
-                        return true;
+                if (IntersectPLeaf(ray, triRay, node->primitivesOffset,
+                                   node->nPrimitives))
+                    return true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    /// second child first
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    return false;
+}
+
+void BVHAccel::IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                               bool *hits) const {
+    // Wide BVHs already test several boxes at once for each ray, and the
+    // rays of a packet may see a motion blur BVH at different times
+    if (!nodes || !endBounds.empty()) {
+        Aggregate::IntersectPacket(n, rays, isects, hits);
+        return;
+    }
+    Assert(n > 0 && n <= MaxRayPacketSize);
+    ProfilePhase p(Prof::AccelIntersect);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
+    RayPacket packet(n, rays);
+    TriangleRay triRays[MaxRayPacketSize];
+    TriangleHit triHits[MaxRayPacketSize];
+    for (int i = 0; i < n; ++i) {
+        hits[i] = false;
+        triRays[i] = TriangleRay(rays[i]);
+    }
+
+    // Follow the packet through BVH nodes, keeping a mask of the rays that
+    // reached each node
+    struct ToVisit {
+        int nodeIndex;
+        uint32_t activeMask;
+    };
+    ToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint32_t activeMask = (1u << n) - 1;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        // Check the packet's active rays against BVH node
+        uint32_t hitMask = packet.Intersect(node->bounds, activeMask);
+        if (hitMask) {
+            if (node->nPrimitives > 0) {
+                // Intersect the rays that hit the leaf with its primitives
+                for (uint32_t m = hitMask; m; m &= m - 1) {
+                    int i = CountTrailingZeros(m);
+                    if (IntersectLeaf(rays[i], triRays[i],
+                                      node->primitivesOffset,
+                                      node->nPrimitives, &isects[i],
+                                      &triHits[i])) {
+                        hits[i] = true;
+                        packet.SetTMax(i, rays[i].tMax);
                     }
                 }
+            } else {
+                // Visit the near child first for the first ray that reached
+                // the node
+                int first = CountTrailingZeros(hitMask);
+                if (packet.DirIsNeg(first, node->axis)) {
+                    nodesToVisit[toVisitOffset++] = {currentNodeIndex + 1,
+                                                     hitMask};
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = {node->secondChildOffset,
+                                                     hitMask};
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                activeMask = hitMask;
+                continue;
+            }
+        }
+        if (toVisitOffset == 0) break;
+        --toVisitOffset;
+        currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+        activeMask = nodesToVisit[toVisitOffset].activeMask;
+    }
+    for (int i = 0; i < n; ++i)
+        InteractionFromTriangleHit(rays[i], triHits[i], &isects[i]);
+}
+
+void BVHAccel::IntersectPPacket(int n, const Ray *rays, bool *occluded) const {
+    if (!nodes || !endBounds.empty()) {
+        Aggregate::IntersectPPacket(n, rays, occluded);
+        return;
+    }
+    Assert(n > 0 && n <= MaxRayPacketSize);
+    ProfilePhase p(Prof::AccelIntersectP);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
+    RayPacket packet(n, rays);
+    TriangleRay triRays[MaxRayPacketSize];
+    for (int i = 0; i < n; ++i) {
+        occluded[i] = false;
+        triRays[i] = TriangleRay(rays[i]);
+    }
+
+    // Traverse until every ray of the packet is known to be occluded
+    struct ToVisit {
+        int nodeIndex;
+        uint32_t activeMask;
+    };
+    ToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    uint32_t unoccludedMask = (1u << n) - 1, activeMask = unoccludedMask;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        uint32_t hitMask =
+            packet.Intersect(node->bounds, activeMask & unoccludedMask);
+        if (hitMask) {
+            if (node->nPrimitives > 0) {
+                for (uint32_t m = hitMask & unoccludedMask; m; m &= m - 1) {
+                    int i = CountTrailingZeros(m);
+                    if (IntersectPLeaf(rays[i], triRays[i],
+                                       node->primitivesOffset,
+                                       node->nPrimitives)) {
+                        occluded[i] = true;
+                        unoccludedMask &= ~(1u << i);
+                    }
+                }
+                if (!unoccludedMask) break;
+            } else {
+                int first = CountTrailingZeros(hitMask);
+                if (packet.DirIsNeg(first, node->axis)) {
+                    nodesToVisit[toVisitOffset++] = {currentNodeIndex + 1,
+                                                     hitMask};
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = {node->secondChildOffset,
+                                                     hitMask};
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+                activeMask = hitMask;
+                continue;
+            }
+        }
+        if (toVisitOffset == 0) break;
+        --toVisitOffset;
+        currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+        activeMask = nodesToVisit[toVisitOffset].activeMask;
+    }
+}
+
+template <int N>
+bool BVHAccel::IntersectWide(const Ray &ray, SurfaceInteraction *isect) const {
+    ProfilePhase p(Prof::AccelIntersect);
+    const WideBVHNode<N> *nodes =
+        LocalNodes(static_cast<const WideBVHNode<N> *>(wideNodes));
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
+    TriangleHit triHit;
+    // Follow ray through wide BVH nodes, visiting hit children front to back
+    struct ToVisit {
+        int offset, nPrimitives;
+        Float tNear;
+    };
+    ToVisit toVisit[64 * (N - 1) + 1];
+    int toVisitOffset = 0;
+    toVisit[toVisitOffset++] = {0, 0, 0};
+    while (toVisitOffset > 0) {
+        const ToVisit current = toVisit[--toVisitOffset];
+        // Skip children that start beyond the closest hit found so far
+        if (current.tNear > ray.tMax) continue;
+        if (current.nPrimitives > 0) {
+            // Intersect ray with primitives in leaf child
+            if (IntersectLeaf(ray, triRay, current.offset, current.nPrimitives,
+                              isect, &triHit))
+                hit = true;
+            continue;
+        }
+
+        // Push the hit children of _node_, nearest on top of the stack
+        const WideBVHNode<N> &node = nodes[current.offset];
+        Float tNear[N];
+        int hitMask = IntersectChildren<N>(node, ray, invDir, dirIsNeg, tNear);
+        int first = toVisitOffset;
+        for (int c = 0; c < N; ++c) {
+            if (!(hitMask & (1 << c))) continue;
+            ToVisit child = {node.offset[c], node.nPrimitives[c], tNear[c]};
+            int i = toVisitOffset++;
+            for (; i > first && toVisit[i - 1].tNear < child.tNear; --i)
+                toVisit[i] = toVisit[i - 1];
+            toVisit[i] = child;
+        }
+    }
+    InteractionFromTriangleHit(ray, triHit, isect);
+    return hit;
+}
+
+template <int N>
+bool BVHAccel::IntersectPWide(const Ray &ray) const {
+    ProfilePhase p(Prof::AccelIntersectP);
+    const WideBVHNode<N> *nodes =
+        LocalNodes(static_cast<const WideBVHNode<N> *>(wideNodes));
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
+    int nodesToVisit[64 * (N - 1) + 1];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        // Any hit ends the search, so children are visited in any order
+        const WideBVHNode<N> &node = nodes[currentNodeIndex];
+        Float tNear[N];
+        int hitMask = IntersectChildren<N>(node, ray, invDir, dirIsNeg, tNear);
+        for (int c = 0; c < N; ++c) {
+            if (!(hitMask & (1 << c))) continue;
+            if (node.nPrimitives[c] > 0) {
+                if (IntersectPLeaf(ray, triRay, node.offset[c],
+                                   node.nPrimitives[c]))
+                    return true;
+            } else
+                nodesToVisit[toVisitOffset++] = node.offset[c];
+        }
+        if (toVisitOffset == 0) break;
+        currentNodeIndex = nodesToVisit[--toVisitOffset];
+    }
+    return false;
+}
+
+// A node still to be visited by quantized BVH traversal, with the decoded
+// bounds its children are quantized within
+struct QuantizedNodeToVisit {
+    int nodeIndex;
+    Bounds3f bounds;
+};
+
+bool BVHAccel::IntersectQuantized(const Ray &ray,
+                                  SurfaceInteraction *isect) const {
+    ProfilePhase p(Prof::AccelIntersect);
+    const QuantizedBVHNode *nodes = LocalNodes(quantizedNodes);
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!bounds.IntersectP(ray, invDir, dirIsNeg)) return false;
+    TriangleRay triRay(ray);
+    TriangleHit triHit;
+    QuantizedNodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    Bounds3f nodeBounds = bounds;
+    while (true) {
+        const QuantizedBVHNode &node = nodes[currentNodeIndex];
+        // Decode and test both children before visiting them near to far
+        Bounds3f childBounds[2];
+        bool childHit[2];
+        for (int c = 0; c < 2; ++c) {
+            childBounds[c] = ChildBounds(node, c, nodeBounds);
+            childHit[c] = childBounds[c].IntersectP(ray, invDir, dirIsNeg);
+        }
+        int first = dirIsNeg[node.axis], next = -1;
+        for (int i = 0; i < 2; ++i) {
+            int c = first ^ i;
+            if (!childHit[c]) continue;
+            if (node.nPrimitives[c] > 0) {
+                // Intersect ray with primitives in leaf child
+                if (IntersectLeaf(ray, triRay, node.offset[c],
+                                  node.nPrimitives[c], isect, &triHit))
+                    hit = true;
+            } else if (next == -1)
+                next = c;
+            else
+                nodesToVisit[toVisitOffset++] = {node.offset[c],
+                                                 childBounds[c]};
+        }
+        if (next != -1) {
+            currentNodeIndex = node.offset[next];
+            nodeBounds = childBounds[next];
+        } else {
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+            nodeBounds = nodesToVisit[toVisitOffset].bounds;
+        }
+    }
+    InteractionFromTriangleHit(ray, triHit, isect);
+    return hit;
+}
+
+bool BVHAccel::IntersectPQuantized(const Ray &ray) const {
+    ProfilePhase p(Prof::AccelIntersectP);
+    const QuantizedBVHNode *nodes = LocalNodes(quantizedNodes);
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    if (!bounds.IntersectP(ray, invDir, dirIsNeg)) return false;
+    TriangleRay triRay(ray);
+    QuantizedNodeToVisit nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    Bounds3f nodeBounds = bounds;
+    while (true) {
+        const QuantizedBVHNode &node = nodes[currentNodeIndex];
+        int next = -1;
+        Bounds3f nextBounds;
+        for (int c = 0; c < 2; ++c) {
+            Bounds3f childBounds = ChildBounds(node, c, nodeBounds);
+            if (!childBounds.IntersectP(ray, invDir, dirIsNeg)) continue;
+            if (node.nPrimitives[c] > 0) {
+                if (IntersectPLeaf(ray, triRay, node.offset[c],
+                                   node.nPrimitives[c]))
+                    return true;
+            } else if (next == -1) {
+                next = node.offset[c];
+                nextBounds = childBounds;
+            } else
+                nodesToVisit[toVisitOffset++] = {node.offset[c], childBounds};
+        }
+        if (next != -1) {
+            currentNodeIndex = next;
+            nodeBounds = nextBounds;
+        } else {
+            if (toVisitOffset == 0) break;
+            --toVisitOffset;
+            currentNodeIndex = nodesToVisit[toVisitOffset].nodeIndex;
+            nodeBounds = nodesToVisit[toVisitOffset].bounds;
+        }
+    }
+    return false;
+}
+
+bool BVHAccel::IntersectMotion(const Ray &ray,
+                               SurfaceInteraction *isect) const {
+    ProfilePhase p(Prof::AccelIntersect);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
+    bool hit = false;
+    Vector3f invDir(1 / ray.d.x, 1 / ray.d.y, 1 / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
+    TriangleHit triHit;
+    // Test the ray against each node's bounds at the ray's time
+    Float t = Clamp((ray.time - motionStart) / (motionEnd - motionStart), 0, 1);
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    int nodesToVisit[64];
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        Bounds3f b =
+            LerpBounds(t, node->bounds, endBounds[currentNodeIndex]);
+        if (b.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                if (IntersectLeaf(ray, triRay, node->primitivesOffset,
+                                  node->nPrimitives, isect, &triHit))
+                    hit = true;
+                if (toVisitOffset == 0) break;
+                currentNodeIndex = nodesToVisit[--toVisitOffset];
+            } else {
+                if (dirIsNeg[node->axis]) {
+                    nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
+                    currentNodeIndex = node->secondChildOffset;
+                } else {
+                    nodesToVisit[toVisitOffset++] = node->secondChildOffset;
+                    currentNodeIndex = currentNodeIndex + 1;
+                }
+            }
+        } else {
+            if (toVisitOffset == 0) break;
+            currentNodeIndex = nodesToVisit[--toVisitOffset];
+        }
+    }
+    InteractionFromTriangleHit(ray, triHit, isect);
+    return hit;
+}
+
+bool BVHAccel::IntersectPMotion(const Ray &ray) const {
+    ProfilePhase p(Prof::AccelIntersectP);
+    const LinearBVHNode *nodes = LocalNodes(this->nodes);
+    Vector3f invDir(1.f / ray.d.x, 1.f / ray.d.y, 1.f / ray.d.z);
+    int dirIsNeg[3] = {invDir.x < 0, invDir.y < 0, invDir.z < 0};
+    TriangleRay triRay(ray);
+    Float t = Clamp((ray.time - motionStart) / (motionEnd - motionStart), 0, 1);
+    int nodesToVisit[64];
+    int toVisitOffset = 0, currentNodeIndex = 0;
+    while (true) {
+        const LinearBVHNode *node = &nodes[currentNodeIndex];
+        Bounds3f b =
+            LerpBounds(t, node->bounds, endBounds[currentNodeIndex]);
+        if (b.IntersectP(ray, invDir, dirIsNeg)) {
+            if (node->nPrimitives > 0) {
+                if (IntersectPLeaf(ray, triRay, node->primitivesOffset,
+                                   node->nPrimitives))
+                    return true;
                 if (toVisitOffset == 0) break;
                 currentNodeIndex = nodesToVisit[--toVisitOffset];
             } else {
                 if (dirIsNeg[node->axis]) {
-                    /// second child first
                     nodesToVisit[toVisitOffset++] = currentNodeIndex + 1;
                     currentNodeIndex = node->secondChildOffset;
                 } else {
@@ -735,6 +2574,8 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
         splitMethod = BVHAccel::SplitMethod::Middle;
     else if (splitMethodName == "equal")
         splitMethod = BVHAccel::SplitMethod::EqualCounts;
+    else if (splitMethodName == "sbvh")
+        splitMethod = BVHAccel::SplitMethod::SBVH;
     else {
         Warning("BVH split method \"%s\" unknown.  Using \"sah\".",
                 splitMethodName.c_str());
@@ -742,5 +2583,19 @@ std::shared_ptr<BVHAccel> CreateBVHAccelerator(
     }
 
     int maxPrimsInNode = ps.FindOneInt("maxnodeprims", 4);
-    return std::make_shared<BVHAccel>(prims, maxPrimsInNode, splitMethod);
+    int width = ps.FindOneInt("width", 2);
+    if (width != 2 && width != 4 && width != 8) {
+        Warning("BVH width %d unsupported. Using 2.", width);
+        width = 2;
+    }
+    Float duplicationBudget = ps.FindOneFloat("duplicationbudget", .3f);
+    bool quantized = ps.FindOneBool("quantized", false);
+    if (quantized && width != 2) {
+        Warning("Quantized BVH nodes require a width of 2. Not quantizing.");
+        quantized = false;
+    }
+    bool packTriangles = ps.FindOneBool("trianglepackets", false);
+    return std::make_shared<BVHAccel>(prims, maxPrimsInNode, splitMethod,
+                                      width, duplicationBudget, quantized,
+                                      PbrtOptions.bvhCacheDir, packTriangles);
 }
@@ -42,55 +42,135 @@
 // accelerators/bvh.h*
 #include "pbrt.h"
 #include "primitive.h"
+#include "parallel.h"
 #include <atomic>
 struct BVHBuildNode;
+class MappedFile;
 
 // BVHAccel Forward Declarations
 struct BVHPrimitiveInfo;
 struct MortonPrimitive;
 struct LinearBVHNode;
+struct QuantizedBVHNode;
+template <int N>
+struct WideBVHNode;
+struct TriangleRay;
+struct TriangleHit;
+struct TrianglePacket;
 
 // BVHAccel Declarations
 class BVHAccel : public Aggregate {
   public:
     // BVHAccel Public Types
-    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts };
+    enum class SplitMethod { SAH, HLBVH, Middle, EqualCounts, SBVH };
 
     // BVHAccel Public Methods
     BVHAccel(const std::vector<std::shared_ptr<Primitive>> &p,
              int maxPrimsInNode = 1,
-             SplitMethod splitMethod = SplitMethod::SAH);
+             SplitMethod splitMethod = SplitMethod::SAH, int width = 2,
+             Float duplicationBudget = 0.3f, bool quantized = false,
+             const std::string &cacheDir = "", bool packTriangles = false);
     Bounds3f WorldBound() const;
     ~BVHAccel();
     bool Intersect(const Ray &ray, SurfaceInteraction *isect) const;
     bool IntersectP(const Ray &ray) const;
+    void IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                         bool *hits) const;
+    void IntersectPPacket(int n, const Ray *rays, bool *occluded) const;
+    bool MotionInterval(Float *startTime, Float *endTime) const;
+    void LinearBounds(Float time0, Float time1, Bounds3f *b0,
+                      Bounds3f *b1) const;
+    bool Refit();
+    Float SAHCost() const;
 
   private:
     // BVHAccel Private Methods
-    BVHBuildNode *recursiveBuild(
-        MemoryArena &arena, std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int start, int end, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims);
+    BVHBuildNode *recursiveBuild(MemoryArena *threadArenas,
+                                 std::vector<BVHPrimitiveInfo> &primitiveInfo,
+                                 int start, int end,
+                                 std::vector<int> &orderedPrimNums);
+    BVHBuildNode *spatialSplitBuild(MemoryArena *threadArenas,
+                                    std::vector<BVHPrimitiveInfo> &refs,
+                                    int maxRefs, Float rootArea, int depth,
+                                    std::vector<int> &orderedPrimNums,
+                                    int firstRef);
     BVHBuildNode *HLBVHBuild(
         MemoryArena &arena, const std::vector<BVHPrimitiveInfo> &primitiveInfo,
-        int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims) const;
+        int *totalNodes, std::vector<int> &orderedPrimNums) const;
     BVHBuildNode *emitLBVH(
         BVHBuildNode *&buildNodes,
         const std::vector<BVHPrimitiveInfo> &primitiveInfo,
         MortonPrimitive *mortonPrims, int nPrimitives, int *totalNodes,
-        std::vector<std::shared_ptr<Primitive>> &orderedPrims,
-        std::atomic<int> *orderedPrimsOffset, int bitIndex) const;
+        std::vector<int> &orderedPrimNums, int firstPrimOffset,
+        int bitIndex) const;
     BVHBuildNode *buildUpperSAH(MemoryArena &arena,
                                 std::vector<BVHBuildNode *> &treeletRoots,
                                 int start, int end, int *totalNodes) const;
-    int flattenBVHTree(BVHBuildNode *node, int *offset);
+    void flattenBVHTree(const BVHBuildNode *node, int offset);
+    template <int N>
+    int collapseBVHTree(const BVHBuildNode *node,
+                        std::vector<WideBVHNode<N>> &wideNodes) const;
+    template <int N>
+    void BuildWideBVH(const BVHBuildNode *root);
+    template <int N>
+    bool IntersectWide(const Ray &ray, SurfaceInteraction *isect) const;
+    template <int N>
+    bool IntersectPWide(const Ray &ray) const;
+    int quantizeBVHTree(const BVHBuildNode *node, const Bounds3f &nodeBounds,
+                        std::vector<QuantizedBVHNode> &quantizedNodes) const;
+    void BuildQuantizedBVH(const BVHBuildNode *root);
+    void OrderPrimitives(const int *orderedPrimNums, size_t count,
+                         bool indexed);
+    bool LoadCache(const std::string &filename, uint64_t key, bool quantized);
+    void WriteCache(const std::string &filename, uint64_t key,
+                    const std::vector<int> &orderedPrimNums) const;
+    bool IntersectQuantized(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectPQuantized(const Ray &ray) const;
+    bool FindMotionInterval();
+    void FitMotionBounds();
+    bool IntersectMotion(const Ray &ray, SurfaceInteraction *isect) const;
+    bool IntersectPMotion(const Ray &ray) const;
+    void ReplicateNodes(const void *nodes, size_t bytes);
+    void BuildTrianglePackets();
+    void PackLeafTriangles(int offset, int nPrimitives);
+    const Primitive &LeafPrimitive(int i) const {
+        return primIndices.empty() ? *primitives[i]
+                                   : *primitives[primIndices[i]];
+    }
+    bool IntersectLeaf(const Ray &ray, const TriangleRay &triRay, int offset,
+                       int nPrimitives, SurfaceInteraction *isect,
+                       TriangleHit *triHit) const;
+    bool IntersectPLeaf(const Ray &ray, const TriangleRay &triRay, int offset,
+                        int nPrimitives) const;
+    void InteractionFromTriangleHit(const Ray &ray, const TriangleHit &triHit,
+                                    SurfaceInteraction *isect) const;
+    template <typename Node>
+    const Node *LocalNodes(const Node *nodes) const {
+        return nodeReplicas.empty()
+                   ? nodes
+                   : static_cast<const Node *>(nodeReplicas[ThreadNumaNode]);
+    }
 
     // BVHAccel Private Data
     const int maxPrimsInNode;
     const SplitMethod splitMethod;
-    std::vector<std::shared_ptr<Primitive>> primitives;
+    const int width;
+    const Float duplicationBudget;
+    // The primitives the BVH was created from own the ones it is built over
+    std::vector<std::shared_ptr<Primitive>> owners;
+    std::vector<const Primitive *> primitives;
+    Bounds3f bounds;
     LinearBVHNode *nodes = nullptr;
+    void *wideNodes = nullptr;
+    QuantizedBVHNode *quantizedNodes = nullptr;
+    size_t nodeBytes = 0;
+    std::vector<uint32_t> primIndices;
+    std::vector<void *> nodeReplicas;
+    TrianglePacket *trianglePackets = nullptr;
+    std::vector<int32_t> leafPackets;
+    std::unique_ptr<MappedFile> cacheFile;
+    Float motionStart = 0, motionEnd = 0;
+    std::vector<Bounds3f> endBounds;
 };
 
 std::shared_ptr<BVHAccel> CreateBVHAccelerator(
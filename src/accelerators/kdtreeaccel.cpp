@@ -87,7 +87,9 @@ KdTreeAccel::KdTreeAccel(const std::vector<std::shared_ptr<Primitive>> &p,
       traversalCost(traversalCost),
       maxPrims(maxPrims),
       emptyBonus(emptyBonus),
-      primitives(p) {
+      owners(p) {
+    for (const std::shared_ptr<Primitive> &prim : owners)
+        prim->Flatten(&primitives);
     // Build kd-tree for accelerator
     nextFreeNode = nAllocedNodes = 0;
     if (maxDepth <= 0)
@@ -96,7 +98,7 @@ KdTreeAccel::KdTreeAccel(const std::vector<std::shared_ptr<Primitive>> &p,
     // Compute bounds for kd-tree construction
     std::vector<Bounds3f> primBounds;
     primBounds.reserve(primitives.size());
-    for (const std::shared_ptr<Primitive> &prim : primitives) {
+    for (const Primitive *prim : primitives) {
         Bounds3f b = prim->WorldBound();
         bounds = Union(bounds, b);
         primBounds.push_back(b);
@@ -318,15 +320,14 @@ bool KdTreeAccel::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
             // Check for intersections inside leaf node
             int nPrimitives = node->nPrimitives();
             if (nPrimitives == 1) {
-                const std::shared_ptr<Primitive> &p =
-                    primitives[node->onePrimitive];
+                const Primitive *p = primitives[node->onePrimitive];
                 // Check one primitive inside leaf node
                 if (p->Intersect(ray, isect)) hit = true;
             } else {
                 for (int i = 0; i < nPrimitives; ++i) {
                     int index =
                         primitiveIndices[node->primitiveIndicesOffset + i];
-                    const std::shared_ptr<Primitive> &p = primitives[index];
+                    const Primitive *p = primitives[index];
                     // Check one primitive inside leaf node
                     if (p->Intersect(ray, isect)) hit = true;
                 }
@@ -364,8 +365,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
             // Check for shadow ray intersections inside leaf node
             int nPrimitives = node->nPrimitives();
             if (nPrimitives == 1) {
-                const std::shared_ptr<Primitive> &p =
-                    primitives[node->onePrimitive];
+                const Primitive *p = primitives[node->onePrimitive];
                 if (p->IntersectP(ray)) {
                     return true;
                 }
@@ -373,8 +373,7 @@ bool KdTreeAccel::IntersectP(const Ray &ray) const {
                 for (int i = 0; i < nPrimitives; ++i) {
                     int primitiveIndex =
                         primitiveIndices[node->primitiveIndicesOffset + i];
-                    const std::shared_ptr<Primitive> &prim =
-                        primitives[primitiveIndex];
+                    const Primitive *prim = primitives[primitiveIndex];
                     if (prim->IntersectP(ray)) {
                         return true;
                     }
@@ -68,7 +68,9 @@ class KdTreeAccel : public Aggregate {
     // KdTreeAccel Private Data
     const int isectCost, traversalCost, maxPrims;
     const Float emptyBonus;
-    std::vector<std::shared_ptr<Primitive>> primitives;
+    // The primitives the tree was created from own the ones it was built over
+    std::vector<std::shared_ptr<Primitive>> owners;
+    std::vector<const Primitive *> primitives;
     std::vector<int> primitiveIndices;
     KdAccelNode *nodes;
     int nAllocedNodes, nextFreeNode;
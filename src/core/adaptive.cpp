@@ -0,0 +1,171 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// core/adaptive.cpp*
+#include "adaptive.h"
+#include "film.h"
+#include "sampler.h"
+#include "paramset.h"
+#include "parallel.h"
+#include "progressreporter.h"
+#include "imageio.h"
+#include "memory.h"
+#include "stats.h"
+#include "tilescheduler.h"
+
+STAT_COUNTER("Integrator/Adaptive sampling passes", adaptivePasses);
+STAT_INT_DISTRIBUTION("Integrator/Adaptive samples per pixel",
+	adaptiveSamplesPerPixel);
+
+// AdaptiveSamplingOptions Method Definitions
+AdaptiveSamplingOptions::AdaptiveSamplingOptions(const ParamSet &params,
+	const Film *film) {
+	enabled = params.FindOneBool("adaptive", false);
+	if (!enabled) return;
+	samplesPerPass = params.FindOneInt("adaptivepasssamples", samplesPerPass);
+	targetError = params.FindOneFloat("adaptivetargeterror", targetError);
+	timeBudget = params.FindOneFloat("adaptivetimebudget", timeBudget);
+	if (samplesPerPass < 1) {
+		Warning("\"adaptivepasssamples\" must be positive. Using 1.");
+		samplesPerPass = 1;
+	}
+
+	// Write the sample-count map next to the film output by default
+	std::string base = film->filename;
+	size_t dot = base.find_last_of('.');
+	if (dot != std::string::npos &&
+		base.find_first_of("/\\", dot) == std::string::npos)
+		base = base.substr(0, dot);
+	sampleCountFile =
+		params.FindOneString("samplecountmap", base + "_spp.exr");
+}
+
+// PixelVariance Method Definitions
+void PixelVariance::AddSample(const IntegrationResult &result) {
+	Update(result.L.y(), ++nSamples, &meanL, &m2L);
+
+	// Reduce the sample's histogram to its energy-weighted mean path length
+	double energy = 0, weightedPathLength = 0;
+	for (const HistogramSample &sample : result.histogramSamples) {
+		Float y = sample.L.y();
+		energy += y;
+		weightedPathLength += y * sample.pathLength;
+	}
+	if (energy > 0)
+		Update(weightedPathLength / energy, ++nPathSamples, &meanPathLength,
+			&m2PathLength);
+}
+
+Float PixelVariance::RelativeError(int64_t n, double mean, double m2) {
+	// Relative standard error of the mean estimated from _n_ samples
+	if (n < 2) return Infinity;
+	double variance = m2 / (n - 1);
+	if (variance == 0) return 0;
+	if (mean == 0) return Infinity;
+	return (Float)(std::sqrt(variance / n) / std::abs(mean));
+}
+
+Float PixelVariance::RelativeError() const {
+	Float error = RelativeError(nSamples, meanL, m2L);
+	// Pixels that never received energy have no path length to converge
+	if (nPathSamples > 0)
+		error = std::max(error,
+			RelativeError(nPathSamples, meanPathLength, m2PathLength));
+	return error;
+}
+
+// Adaptive Sampling Function Definitions
+int64_t RenderAdaptive(const AdaptiveSamplingOptions &options, Film *film,
+	Sampler &sampler, const PixelSampleFunction &sampleFunc) {
+	// Partition the image into tiles
+	const Bounds2i sampleBounds = film->GetSampleBounds();
+	const Vector2i sampleExtent = sampleBounds.Diagonal();
+	TileScheduler tiles(sampleBounds);
+
+	// Split the sampler's budget into passes of _samplesPerPass_
+	const int64_t maxSamples = sampler.samplesPerPixel;
+	const int64_t samplesPerPass =
+		std::min((int64_t)options.samplesPerPass, maxSamples);
+	const int64_t nPasses = (maxSamples + samplesPerPass - 1) / samplesPerPass;
+	std::vector<PixelVariance> pixels(sampleBounds.Area());
+	auto needsSamples = [&](const PixelVariance &pixel) -> bool {
+		return pixel.SampleCount() < maxSamples &&
+			(pixel.SampleCount() < samplesPerPass ||
+				pixel.RelativeError() > options.targetError);
+	};
+
+	ProgressReporter reporter(nPasses * sampleBounds.Area(), "Rendering");
+	std::atomic<int64_t> totalSamples(0);
+	for (int64_t pass = 0; pass < nPasses; ++pass) {
+		// Stop refining once the time budget has been spent
+		if (pass > 0 && options.timeBudget > 0 &&
+			reporter.ElapsedMS() > 1000 * options.timeBudget)
+			break;
+
+		std::atomic<int64_t> activePixels(0);
+		tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
+			// Refine the unconverged pixels of _tileBounds_
+			MemoryArena arena;
+			std::unique_ptr<FilmTile> filmTile = film->GetFilmTile(tileBounds);
+			int64_t tileSamples = 0;
+			for (Point2i pPixel : tileBounds) {
+				Vector2i pOffset = pPixel - sampleBounds.pMin;
+				int pixelIndex = pOffset.y * sampleExtent.x + pOffset.x;
+				PixelVariance &pixel = pixels[pixelIndex];
+				if (!needsSamples(pixel)) continue;
+
+				// Resume the pixel's sample sequence where the last pass
+				// ended. Samplers that shuffle their strata in _StartPixel()_
+				// draw the shuffle from their seed, so seeding by pixel gives
+				// every pass the same sequence whatever the tiling.
+				int64_t start = pixel.SampleCount();
+				int64_t end = std::min(start + samplesPerPass, maxSamples);
+				std::unique_ptr<Sampler> pixelSampler =
+					sampler.Clone(pixelIndex);
+				pixelSampler->StartPixel(pPixel);
+				for (int64_t i = start; i < end; ++i) {
+					pixelSampler->SetSampleNumber(i);
+					pixel.AddSample(
+						sampleFunc(pPixel, *pixelSampler, *filmTile, arena));
+					arena.Reset();
+				}
+				tileSamples += end - start;
+				++activePixels;
+			}
+			if (tileSamples > 0) film->MergeFilmTile(std::move(filmTile));
+			totalSamples += tileSamples;
+			reporter.Update(tileBounds.Area());
+		});
+		++adaptivePasses;
+		if (activePixels == 0) break;
+
+		// Subdivide the tiles that held up this pass before the next one
+		tiles.Refine();
+	}
+	reporter.Done();
+
+	// Write the sample-count map for the cropped image
+	Bounds2i cropBounds = film->croppedPixelBounds;
+	std::unique_ptr<Float[]> counts(new Float[3 * cropBounds.Area()]);
+	int offset = 0;
+	for (Point2i pPixel : cropBounds) {
+		Vector2i pOffset = pPixel - sampleBounds.pMin;
+		Float count =
+			(Float)pixels[pOffset.y * sampleExtent.x + pOffset.x].SampleCount();
+		for (int c = 0; c < 3; ++c) counts[offset++] = count;
+		ReportValue(adaptiveSamplesPerPixel, (int64_t)count);
+	}
+	if (!options.sampleCountFile.empty())
+		WriteImage(options.sampleCountFile, counts.get(), cropBounds,
+			film->fullResolution);
+	return totalSamples;
+}
@@ -0,0 +1,77 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_ADAPTIVE_H
+#define PBRT_CORE_ADAPTIVE_H
+#include "stdafx.h"
+
+// core/adaptive.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include "integrationresult.h"
+#include <functional>
+
+// Adaptive Sampling Declarations
+struct AdaptiveSamplingOptions {
+	// AdaptiveSamplingOptions Public Methods
+	AdaptiveSamplingOptions() {}
+	AdaptiveSamplingOptions(const ParamSet &params, const Film *film);
+
+	// AdaptiveSamplingOptions Public Data
+	bool enabled = false;
+	int samplesPerPass = 16;
+	Float targetError = 0.01f;
+	Float timeBudget = 0;
+	std::string sampleCountFile;
+};
+
+// Running estimate of a pixel's convergence. Tracks the variance of the
+// sample luminance and of each sample's energy-weighted mean path length
+// using Welford's online algorithm.
+class PixelVariance {
+public:
+	// PixelVariance Public Methods
+	void AddSample(const IntegrationResult &result);
+	Float RelativeError() const;
+	int64_t SampleCount() const { return nSamples; }
+
+private:
+	// PixelVariance Private Methods
+	static void Update(double x, int64_t n, double *mean, double *m2) {
+		double delta = x - *mean;
+		*mean += delta / n;
+		*m2 += delta * (x - *mean);
+	}
+	static Float RelativeError(int64_t n, double mean, double m2);
+
+	// PixelVariance Private Data
+	int64_t nSamples = 0, nPathSamples = 0;
+	double meanL = 0, m2L = 0;
+	double meanPathLength = 0, m2PathLength = 0;
+};
+
+// Takes one sample for _pixel_ from _sampler_, adds it to _filmTile_, and
+// returns the result so its convergence can be tracked.
+typedef std::function<IntegrationResult(const Point2i &pixel,
+	Sampler &sampler, FilmTile &filmTile, MemoryArena &arena)>
+	PixelSampleFunction;
+
+// Renders the film's sample bounds in passes, each pass taking
+// _samplesPerPass_ further samples in every pixel that has not yet reached
+// the target relative error. Returns the total number of samples taken.
+int64_t RenderAdaptive(const AdaptiveSamplingOptions &options, Film *film,
+	Sampler &sampler, const PixelSampleFunction &sampleFunc);
+
+#endif  // PBRT_CORE_ADAPTIVE_H
@@ -34,6 +34,7 @@
 
 // core/api.cpp*
 #include "api.h"
+#include "binaryscene.h"
 #include "parallel.h"
 #include "paramset.h"
 #include "spectrum.h"
@@ -41,6 +42,7 @@
 #include "film.h"
 #include "medium.h"
 #include "stats.h"
+#include "hash.h"
 
 // API Additional Headers
 #include "accelerators/bvh.h"
@@ -69,6 +71,8 @@
 #include "integrators/directtof.h"
 #include "integrators/bdpttof.h"
 #include "integrators/mlttof.h"
+#include "integrators/sppmtof.h"
+#include "integrators/volpathtof.h"
 #include "lights/diffuse.h"
 #include "lights/distant.h"
 #include "lights/goniometric.h"
@@ -121,8 +125,11 @@
 #include "textures/wrinkled.h"
 #include "media/grid.h"
 #include "media/homogeneous.h"
+#include <atomic>
 #include <map>
+#include <mutex>
 #include <stdio.h>
+#include <unordered_map>
 
 // API Global Variables
 Options PbrtOptions;
@@ -157,10 +164,47 @@ struct TransformSet {
     Transform t[MaxTransforms];
 };
 
+// A named object placed in the world by _ObjectInstance_
+struct InstanceUse {
+    InstanceUse(const std::shared_ptr<Primitive> &object,
+                const AnimatedTransform *instanceToWorld)
+        : object(object), instanceToWorld(instanceToWorld) {}
+    std::shared_ptr<Primitive> object;
+    // Owned by _transformCache_, which instances with the same placement
+    // share
+    const AnimatedTransform *instanceToWorld;
+};
+
+// A _Shape_ directive whose shapes are being created by a task, so that
+// shapes load in parallel with parsing and with each other. Its primitives
+// are added to the scene in the order the directives were given.
+struct PendingShape {
+    // The task's shapes, and their primitives unless they are area lights,
+    // whose parameters can't be shared between tasks
+    struct Entities {
+        std::vector<std::shared_ptr<Shape>> shapes;
+        std::vector<std::shared_ptr<Primitive>> prims;
+    };
+    Future<Entities> entities;
+    std::shared_ptr<ParamSet> params;
+    ErrorLocation location;
+    // The named object the shape belongs to, or _nullptr_ for the world
+    std::vector<std::shared_ptr<Primitive>> *instance;
+    std::string areaLight;
+    ParamSet areaLightParams;
+    Transform lightToWorld;
+    // For animated shapes, which are placed by a single primitive over all
+    // of their primitives once they are added
+    const AnimatedTransform *animatedObjectToWorld = nullptr;
+    std::shared_ptr<Material> material;
+    MediumInterface mediumInterface;
+};
+
 struct RenderOptions {
     // RenderOptions Public Methods
     Integrator *MakeIntegrator() const;
     Scene *MakeScene();
+    std::shared_ptr<Primitive> MakeInstanceAccelerator();
     Camera *MakeCamera() const;
 
     // RenderOptions Public Data
@@ -183,11 +227,25 @@ struct RenderOptions {
     std::vector<std::shared_ptr<Primitive>> primitives;
     std::map<std::string, std::vector<std::shared_ptr<Primitive>>> instances;
     std::vector<std::shared_ptr<Primitive>> *currentInstance = nullptr;
+    // The cached transforms that each named object's shapes refer to, which
+    // stay pinned in _transformCache_ while the object exists
+    std::map<std::string, std::vector<const Transform *>> instanceTransforms;
+    std::vector<const Transform *> *currentInstanceTransforms = nullptr;
+    std::vector<InstanceUse> instanceUses;
+    std::vector<PendingShape> pendingShapes;
+
+    // The BVH over the last world block's instances, kept so that it can be
+    // refit when a later block places the same objects
+    std::shared_ptr<BVHAccel> instanceAccel;
+    std::vector<std::shared_ptr<TransformedPrimitive>> instancePrimitives;
+    std::vector<std::shared_ptr<Primitive>> instancedObjects;
+    Float instanceAccelBuildCost = 0;
 };
 
 struct GraphicsState {
     // Graphics State Methods
-    std::shared_ptr<Material> CreateMaterial(const ParamSet &params);
+    std::shared_ptr<Material> CreateMaterial(const ParamSet &params,
+                                             bool reportGeomParams = true);
     MediumInterface CreateMediumInterface();
 
     // Graphics State
@@ -203,34 +261,260 @@ struct GraphicsState {
     bool reverseOrientation = false;
 };
 
+// Interns the transforms that shapes, cameras and instances point to, so
+// that each distinct matrix is stored once. Transforms are found by a hash
+// of their matrix; inverses and animated transforms are created the first
+// time they are asked for. Lookups of entries that are already cached take
+// no lock, so the cache can be shared by threads that load the scene;
+// _Clear()_ must not run concurrently with lookups.
+//
+// Named objects outlive the world block, so the transforms their shapes
+// refer to are pinned: lookups given a _pins_ list pin the transforms they
+// return and record them there, and _Unpin()_ releases them once the object
+// is gone. _Clear(true)_ keeps pinned transforms at the same addresses.
 class TransformCache {
   public:
     // TransformCache Public Methods
     void Lookup(const Transform &t, Transform **tCached,
-                Transform **tCachedInverse) {
-        auto iter = cache.find(t);
-        if (iter == cache.end()) {
-            Transform *tr = arena.Alloc<Transform>();
-            *tr = t;
-            Transform *tinv = arena.Alloc<Transform>();
-            *tinv = Transform(Inverse(t));
-            cache[t] = std::make_pair(tr, tinv);
-            iter = cache.find(t);
-        }
-        if (tCached) *tCached = iter->second.first;
-        if (tCachedInverse) *tCachedInverse = iter->second.second;
-    }
-    void Clear() {
-        arena.Reset();
-        cache.erase(cache.begin(), cache.end());
-    }
+                Transform **tCachedInverse,
+                std::vector<const Transform *> *pins = nullptr);
+    const AnimatedTransform *Lookup(
+        const TransformSet &ts, Float startTime, Float endTime,
+        std::vector<const Transform *> *pins = nullptr);
+    void Unpin(const std::vector<const Transform *> &pins);
+    void Clear(bool keepPinned = false);
 
   private:
+    // TransformCache Private Declarations
+    struct TransformEntry {
+        uint64_t hash;
+        Transform *transform;
+        std::atomic<Transform *> inverse;
+        // Number of named objects' pins on the entry, and whether it lives
+        // in a _PinnedTransform_ rather than the arena, as pinned ones must
+        int pinCount;
+        bool pinnable;
+    };
+    struct PinnedTransform {
+        TransformEntry entry;
+        Transform transform, inverse;
+    };
+    struct AnimatedEntry {
+        uint64_t hash;
+        const Transform *start, *end;
+        Float startTime, endTime;
+        AnimatedTransform *animated;
+    };
+    // Open-addressed table of entry pointers, kept at most half full.
+    // Readers search it without the lock while a writer that holds it
+    // inserts; growing publishes a new slot array, and the old ones stay
+    // valid for readers until the table is cleared.
+    template <typename Entry>
+    class Table {
+      public:
+        template <typename Match>
+        Entry *Find(uint64_t hash, Match match) const {
+            const Slots *s = current.load(std::memory_order_acquire);
+            if (!s) return nullptr;
+            for (size_t i = hash & s->mask;; i = (i + 1) & s->mask) {
+                Entry *e = s->entries[i].load(std::memory_order_acquire);
+                if (!e) return nullptr;
+                if (e->hash == hash && match(*e)) return e;
+            }
+        }
+        void Insert(Entry *e) {
+            Slots *s = current.load(std::memory_order_relaxed);
+            if (!s || 2 * (count + 1) > s->mask + 1) {
+                // Move the entries to a table twice the size
+                Slots *grown = new Slots(s ? 2 * (s->mask + 1) : 256);
+                for (size_t i = 0; s && i <= s->mask; ++i)
+                    if (Entry *old = s->entries[i].load(
+                            std::memory_order_relaxed))
+                        Place(grown, old);
+                slots.push_back(std::unique_ptr<Slots>(grown));
+                current.store(s = grown, std::memory_order_release);
+            }
+            Place(s, e);
+            ++count;
+        }
+        void Replace(Entry *old, Entry *e) {
+            // Readers may still see _old_, which stays valid until the table
+            // is cleared
+            Slots *s = current.load(std::memory_order_relaxed);
+            for (size_t i = old->hash & s->mask;; i = (i + 1) & s->mask)
+                if (s->entries[i].load(std::memory_order_relaxed) == old) {
+                    s->entries[i].store(e, std::memory_order_release);
+                    return;
+                }
+        }
+        void Clear() {
+            current.store(nullptr, std::memory_order_relaxed);
+            slots.clear();
+            count = 0;
+        }
+
+      private:
+        struct Slots {
+            Slots(size_t size)
+                : mask(size - 1), entries(new std::atomic<Entry *>[size]) {
+                for (size_t i = 0; i < size; ++i) entries[i] = nullptr;
+            }
+            size_t mask;
+            std::unique_ptr<std::atomic<Entry *>[]> entries;
+        };
+        static void Place(Slots *s, Entry *e) {
+            size_t i = e->hash & s->mask;
+            while (s->entries[i].load(std::memory_order_relaxed))
+                i = (i + 1) & s->mask;
+            s->entries[i].store(e, std::memory_order_release);
+        }
+        std::atomic<Slots *> current{nullptr};
+        std::vector<std::unique_ptr<Slots>> slots;
+        size_t count = 0;
+    };
+
     // TransformCache Private Data
-    std::map<Transform, std::pair<Transform *, Transform *>> cache;
+    Table<TransformEntry> transforms;
+    Table<AnimatedEntry> animatedTransforms;
+    std::vector<std::unique_ptr<PinnedTransform>> pinned;
+    std::mutex mutex;
     MemoryArena arena;
 };
 
+STAT_PERCENT("Scene/Transform cache hits", nTransformCacheHits,
+             nTransformCacheLookups);
+
+// TransformCache Method Definitions
+void TransformCache::Lookup(const Transform &t, Transform **tCached,
+                            Transform **tCachedInverse,
+                            std::vector<const Transform *> *pins) {
+    ++nTransformCacheLookups;
+    const Matrix4x4 &m = t.GetMatrix();
+    uint64_t hash = HashValue(m);
+    auto match = [&](const TransformEntry &e) {
+        return e.transform->GetMatrix() == m;
+    };
+    TransformEntry *entry = transforms.Find(hash, match);
+    if (entry && !pins)
+        ++nTransformCacheHits;
+    else {
+        std::lock_guard<std::mutex> lock(mutex);
+        // Another thread may have added _t_ since the search above
+        entry = transforms.Find(hash, match);
+        if (entry) ++nTransformCacheHits;
+        if (pins && (!entry || !entry->pinnable)) {
+            // Move the transform out of the arena so that it survives
+            // _Clear(true)_; users of the arena copy keep it until then
+            PinnedTransform *p = new PinnedTransform;
+            pinned.push_back(std::unique_ptr<PinnedTransform>(p));
+            p->transform = t;
+            p->inverse = Inverse(t);
+            p->entry.hash = hash;
+            p->entry.transform = &p->transform;
+            p->entry.inverse = &p->inverse;
+            p->entry.pinCount = 0;
+            p->entry.pinnable = true;
+            if (entry)
+                transforms.Replace(entry, &p->entry);
+            else
+                transforms.Insert(&p->entry);
+            entry = &p->entry;
+        } else if (!entry) {
+            entry = arena.Alloc<TransformEntry>();
+            entry->hash = hash;
+            entry->transform = arena.Alloc<Transform>();
+            *entry->transform = t;
+            entry->inverse = nullptr;
+            entry->pinCount = 0;
+            entry->pinnable = false;
+            transforms.Insert(entry);
+        }
+        // Consecutive shapes of an object often share a transform, and
+        // one pin covers them all
+        if (pins && (pins->empty() || pins->back() != entry->transform)) {
+            ++entry->pinCount;
+            pins->push_back(entry->transform);
+        }
+    }
+    if (tCached) *tCached = entry->transform;
+    if (!tCachedInverse) return;
+    Transform *inverse = entry->inverse.load(std::memory_order_acquire);
+    if (!inverse) {
+        std::lock_guard<std::mutex> lock(mutex);
+        inverse = entry->inverse.load(std::memory_order_relaxed);
+        if (!inverse) {
+            inverse = arena.Alloc<Transform>();
+            *inverse = Inverse(*entry->transform);
+            entry->inverse.store(inverse, std::memory_order_release);
+        }
+    }
+    *tCachedInverse = inverse;
+}
+
+const AnimatedTransform *TransformCache::Lookup(
+    const TransformSet &ts, Float startTime, Float endTime,
+    std::vector<const Transform *> *pins) {
+    // Animated transforms refer to the interned transforms, so their
+    // pointers identify them
+    Assert(MaxTransforms == 2);
+    Transform *start, *end;
+    Lookup(ts[0], &start, nullptr, pins);
+    Lookup(ts[1], &end, nullptr, pins);
+    const void *key[2] = {start, end};
+    Float times[2] = {startTime, endTime};
+    uint64_t hash = HashBuffer(times, sizeof(times), HashValue(key));
+    auto match = [&](const AnimatedEntry &e) {
+        return e.start == start && e.end == end && e.startTime == startTime &&
+               e.endTime == endTime;
+    };
+    AnimatedEntry *entry = animatedTransforms.Find(hash, match);
+    if (entry) return entry->animated;
+
+    // Decomposing the transforms is costly, so do it outside the lock
+    AnimatedTransform animated(start, startTime, end, endTime);
+    std::lock_guard<std::mutex> lock(mutex);
+    entry = animatedTransforms.Find(hash, match);
+    if (!entry) {
+        entry = arena.Alloc<AnimatedEntry>();
+        entry->hash = hash;
+        entry->start = start;
+        entry->end = end;
+        entry->startTime = startTime;
+        entry->endTime = endTime;
+        entry->animated = ARENA_ALLOC(arena, AnimatedTransform)(animated);
+        animatedTransforms.Insert(entry);
+    }
+    return entry->animated;
+}
+
+void TransformCache::Unpin(const std::vector<const Transform *> &pins) {
+    std::lock_guard<std::mutex> lock(mutex);
+    for (const Transform *t : pins) {
+        const Transform *pinnedTransform = t;
+        TransformEntry *entry = transforms.Find(
+            HashValue(t->GetMatrix()), [&](const TransformEntry &e) {
+                return e.transform == pinnedTransform;
+            });
+        Assert(entry && entry->pinCount > 0);
+        --entry->pinCount;
+    }
+}
+
+void TransformCache::Clear(bool keepPinned) {
+    // Animated transforms are only looked up while shapes are created, so
+    // none need to be kept
+    transforms.Clear();
+    animatedTransforms.Clear();
+    arena.Reset();
+    size_t nKept = 0;
+    for (std::unique_ptr<PinnedTransform> &p : pinned)
+        if (keepPinned && p->entry.pinCount > 0) {
+            transforms.Insert(&p->entry);
+            pinned[nKept++] = std::move(p);
+        }
+    pinned.resize(nKept);
+}
+
 // API Static Data
 enum class APIState { Uninitialized, OptionsBlock, WorldBlock };
 static APIState currentApiState = APIState::Uninitialized;
@@ -244,13 +528,16 @@ static std::vector<TransformSet> pushedTransforms;
 static std::vector<uint32_t> pushedActiveTransformBits;
 static TransformCache transformCache;
 static int catIndentCount = 0;
+static std::unique_ptr<BinarySceneWriter> binarySceneWriter;
 
 // API Forward Declarations
-std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
-                                               const Transform *ObjectToWorld,
-                                               const Transform *WorldToObject,
-                                               bool reverseOrientation,
-                                               const ParamSet &paramSet);
+std::vector<std::shared_ptr<Shape>> MakeShapes(
+    const std::string &name, const Transform *ObjectToWorld,
+    const Transform *WorldToObject, bool reverseOrientation,
+    const ParamSet &paramSet,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures);
+static void AddPendingShapes(
+    const std::vector<std::shared_ptr<Primitive>> *instance = nullptr);
 
 // API Macros
 #define VERIFY_INITIALIZED(func)                           \
@@ -261,6 +548,11 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
             func);                                         \
         return;                                            \
     } else /* swallow trailing semicolon */
+#define RECORD_BINARY(...)                     \
+    if (PbrtOptions.toBinary) {                \
+        binarySceneWriter->Write(__VA_ARGS__); \
+        return;                                \
+    } else /* swallow trailing semicolon */
 #define VERIFY_OPTIONS(func)                             \
     VERIFY_INITIALIZED(func);                            \
     if (currentApiState == APIState::WorldBlock) {       \
@@ -294,11 +586,11 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
     } while (false) /* swallow trailing semicolon */
 
 // Object Creation Function Definitions
-std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
-                                               const Transform *object2world,
-                                               const Transform *world2object,
-                                               bool reverseOrientation,
-                                               const ParamSet &paramSet) {
+std::vector<std::shared_ptr<Shape>> MakeShapes(
+    const std::string &name, const Transform *object2world,
+    const Transform *world2object, bool reverseOrientation,
+    const ParamSet &paramSet,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
     std::vector<std::shared_ptr<Shape>> shapes;
     std::shared_ptr<Shape> s;
     if (name == "sphere")
@@ -387,10 +679,10 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
         } else
             shapes = CreateTriangleMeshShape(object2world, world2object,
                                              reverseOrientation, paramSet,
-                                             &graphicsState.floatTextures);
+                                             floatTextures);
     } else if (name == "plymesh")
         shapes = CreatePLYMesh(object2world, world2object, reverseOrientation,
-                               paramSet, &graphicsState.floatTextures);
+                               paramSet, floatTextures);
     else if (name == "heightfield")
         shapes = CreateHeightfield(object2world, world2object,
                                    reverseOrientation, paramSet);
@@ -402,12 +694,38 @@ std::vector<std::shared_ptr<Shape>> MakeShapes(const std::string &name,
                              paramSet);
     else
         Warning("Shape \"%s\" unknown.", name.c_str());
-    paramSet.ReportUnused();
     return shapes;
 }
 
+// Returns whether _MakeTriangleMesh()_ creates the shape _name_
+static bool IsTriangleMeshShape(const std::string &name) {
+    return name == "trianglemesh" || name == "plymesh" ||
+           name == "heightfield" || name == "loopsubdiv" || name == "nurbs";
+}
+
+// Creates the mesh of a shape that is a triangle mesh, without the _Shape_s
+// of its triangles; returns _nullptr_ if its parameters are in error
+static std::shared_ptr<TriangleMesh> MakeTriangleMesh(
+    const std::string &name, const Transform *object2world,
+    const ParamSet &paramSet,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    if (name == "trianglemesh")
+        return CreateTriangleMeshFromParams(object2world, paramSet,
+                                            floatTextures);
+    else if (name == "plymesh")
+        return ReadPLYMesh(object2world, paramSet, floatTextures);
+    else if (name == "heightfield")
+        return CreateHeightfieldMesh(object2world, paramSet);
+    else if (name == "loopsubdiv")
+        return CreateLoopSubdivMesh(object2world, paramSet);
+    else if (name == "nurbs")
+        return CreateNURBSMesh(object2world, paramSet);
+    return nullptr;
+}
+
 std::shared_ptr<Material> MakeMaterial(const std::string &name,
-                                       const TextureParams &mp) {
+                                       const TextureParams &mp,
+                                       bool reportGeomParams = true) {
     Material *material = nullptr;
     if (name == "" || name == "none")
         return nullptr;
@@ -464,7 +782,11 @@ std::shared_ptr<Material> MakeMaterial(const std::string &name,
             "Use \"path\" or \"volpath\".",
             name.c_str(), renderOptions->IntegratorName.c_str());
 
-    mp.ReportUnused();
+    // Shapes created after their material report their own parameters
+    if (reportGeomParams)
+        mp.ReportUnused();
+    else
+        mp.GetMaterialParams().ReportUnused();
     if (!material) Error("Unable to create material \"%s\"", name.c_str());
     return std::shared_ptr<Material>(material);
 }
@@ -551,11 +873,12 @@ std::shared_ptr<Medium> MakeMedium(const std::string &name,
                 preset.c_str());
     Float scale = paramSet.FindOneFloat("scale", 1.f);
     Float g = paramSet.FindOneFloat("g", 0.0f);
+    Float eta = paramSet.FindOneFloat("eta", 1.f);
     sig_a = paramSet.FindOneSpectrum("sigma_a", sig_a) * scale;
     sig_s = paramSet.FindOneSpectrum("sigma_s", sig_s) * scale;
     Medium *m = NULL;
     if (name == "homogeneous") {
-        m = new HomogeneousMedium(sig_a, sig_s, g);
+        m = new HomogeneousMedium(sig_a, sig_s, g, eta);
     } else if (name == "heterogeneous") {
         int nitems;
         const Float *data = paramSet.FindFloat("density", &nitems);
@@ -578,7 +901,7 @@ std::shared_ptr<Medium> MakeMedium(const std::string &name,
         Transform data2Medium = Translate(Vector3f(p0)) *
                                 Scale(p1.x - p0.x, p1.y - p0.y, p1.z - p0.z);
         m = new GridDensityMedium(sig_a, sig_s, g, nx, ny, nz,
-                                  medium2world * data2Medium, data);
+                                  medium2world * data2Medium, data, eta);
     } else
         Warning("Medium \"%s\" unknown.", name.c_str());
     paramSet.ReportUnused();
@@ -747,6 +1070,8 @@ void pbrtInit(const Options &opt) {
     renderOptions.reset(new RenderOptions);
     graphicsState = GraphicsState();
     catIndentCount = 0;
+    if (PbrtOptions.toBinary)
+        binarySceneWriter.reset(new BinarySceneWriter(stdout));
 
     // General \pbrt Initialization
     SampledSpectrum::Init();
@@ -760,11 +1085,16 @@ void pbrtCleanup() {
     else if (currentApiState == APIState::WorldBlock)
         Error("pbrtCleanup() called while inside world block.");
     currentApiState = APIState::Uninitialized;
+    // Wait for the shapes of an unfinished world block
+    if (renderOptions) AddPendingShapes();
     TerminateWorkerThreads();
     renderOptions.reset(nullptr);
+    transformCache.Clear();
+    binarySceneWriter.reset(nullptr);
 }
 
 void pbrtIdentity() {
+    RECORD_BINARY(BinarySceneOp::Identity);
     VERIFY_INITIALIZED("Identity");
     FOR_ACTIVE_TRANSFORMS(curTransform[i] = Transform();)
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -772,6 +1102,7 @@ void pbrtIdentity() {
 }
 
 void pbrtTranslate(Float dx, Float dy, Float dz) {
+    RECORD_BINARY(BinarySceneOp::Translate, {dx, dy, dz});
     VERIFY_INITIALIZED("Translate");
     FOR_ACTIVE_TRANSFORMS(curTransform[i] = curTransform[i] *
                                             Translate(Vector3f(dx, dy, dz));)
@@ -781,6 +1112,7 @@ void pbrtTranslate(Float dx, Float dy, Float dz) {
 }
 
 void pbrtTransform(Float tr[16]) {
+    RECORD_BINARY(BinarySceneOp::Transform, std::vector<Float>(tr, tr + 16));
     VERIFY_INITIALIZED("Transform");
     FOR_ACTIVE_TRANSFORMS(
         curTransform[i] = Transform(Matrix4x4(
@@ -794,6 +1126,8 @@ void pbrtTransform(Float tr[16]) {
 }
 
 void pbrtConcatTransform(Float tr[16]) {
+    RECORD_BINARY(BinarySceneOp::ConcatTransform,
+                  std::vector<Float>(tr, tr + 16));
     VERIFY_INITIALIZED("ConcatTransform");
     FOR_ACTIVE_TRANSFORMS(
         curTransform[i] =
@@ -809,6 +1143,7 @@ void pbrtConcatTransform(Float tr[16]) {
 }
 
 void pbrtRotate(Float angle, Float dx, Float dy, Float dz) {
+    RECORD_BINARY(BinarySceneOp::Rotate, {angle, dx, dy, dz});
     VERIFY_INITIALIZED("Rotate");
     FOR_ACTIVE_TRANSFORMS(curTransform[i] =
                               curTransform[i] *
@@ -819,6 +1154,7 @@ void pbrtRotate(Float angle, Float dx, Float dy, Float dz) {
 }
 
 void pbrtScale(Float sx, Float sy, Float sz) {
+    RECORD_BINARY(BinarySceneOp::Scale, {sx, sy, sz});
     VERIFY_INITIALIZED("Scale");
     FOR_ACTIVE_TRANSFORMS(curTransform[i] =
                               curTransform[i] * Scale(sx, sy, sz);)
@@ -828,6 +1164,8 @@ void pbrtScale(Float sx, Float sy, Float sz) {
 
 void pbrtLookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz,
                 Float ux, Float uy, Float uz) {
+    RECORD_BINARY(BinarySceneOp::LookAt,
+                  {ex, ey, ez, lx, ly, lz, ux, uy, uz});
     VERIFY_INITIALIZED("LookAt");
     Transform lookAt =
         LookAt(Point3f(ex, ey, ez), Point3f(lx, ly, lz), Vector3f(ux, uy, uz));
@@ -841,6 +1179,7 @@ void pbrtLookAt(Float ex, Float ey, Float ez, Float lx, Float ly, Float lz,
 }
 
 void pbrtCoordinateSystem(const std::string &name) {
+    RECORD_BINARY(BinarySceneOp::CoordinateSystem, {}, {name});
     VERIFY_INITIALIZED("CoordinateSystem");
     namedCoordinateSystems[name] = curTransform;
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -849,6 +1188,7 @@ void pbrtCoordinateSystem(const std::string &name) {
 }
 
 void pbrtCoordSysTransform(const std::string &name) {
+    RECORD_BINARY(BinarySceneOp::CoordSysTransform, {}, {name});
     VERIFY_INITIALIZED("CoordSysTransform");
     if (namedCoordinateSystems.find(name) != namedCoordinateSystems.end())
         curTransform = namedCoordinateSystems[name];
@@ -860,24 +1200,28 @@ void pbrtCoordSysTransform(const std::string &name) {
 }
 
 void pbrtActiveTransformAll() {
+    RECORD_BINARY(BinarySceneOp::ActiveTransformAll);
     activeTransformBits = AllTransformsBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform All\n", catIndentCount, "");
 }
 
 void pbrtActiveTransformEndTime() {
+    RECORD_BINARY(BinarySceneOp::ActiveTransformEndTime);
     activeTransformBits = EndTransformBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform EndTime\n", catIndentCount, "");
 }
 
 void pbrtActiveTransformStartTime() {
+    RECORD_BINARY(BinarySceneOp::ActiveTransformStartTime);
     activeTransformBits = StartTransformBits;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sActiveTransform StartTime\n", catIndentCount, "");
 }
 
 void pbrtTransformTimes(Float start, Float end) {
+    RECORD_BINARY(BinarySceneOp::TransformTimes, {start, end});
     VERIFY_OPTIONS("TransformTimes");
     renderOptions->transformStartTime = start;
     renderOptions->transformEndTime = end;
@@ -887,6 +1231,7 @@ void pbrtTransformTimes(Float start, Float end) {
 }
 
 void pbrtPixelFilter(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::PixelFilter, {}, {name}, &params);
     VERIFY_OPTIONS("PixelFilter");
     renderOptions->FilterName = name;
     renderOptions->FilterParams = params;
@@ -898,6 +1243,7 @@ void pbrtPixelFilter(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtFilm(const std::string &type, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Film, {}, {type}, &params);
     VERIFY_OPTIONS("Film");
     renderOptions->FilmParams = params;
     renderOptions->FilmName = type;
@@ -909,6 +1255,7 @@ void pbrtFilm(const std::string &type, const ParamSet &params) {
 }
 
 void pbrtSampler(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Sampler, {}, {name}, &params);
     VERIFY_OPTIONS("Sampler");
     renderOptions->SamplerName = name;
     renderOptions->SamplerParams = params;
@@ -920,6 +1267,7 @@ void pbrtSampler(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtAccelerator(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Accelerator, {}, {name}, &params);
     VERIFY_OPTIONS("Accelerator");
     renderOptions->AcceleratorName = name;
     renderOptions->AcceleratorParams = params;
@@ -931,6 +1279,7 @@ void pbrtAccelerator(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtIntegrator(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Integrator, {}, {name}, &params);
     VERIFY_OPTIONS("Integrator");
     renderOptions->IntegratorName = name;
     renderOptions->IntegratorParams = params;
@@ -942,6 +1291,7 @@ void pbrtIntegrator(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtCamera(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Camera, {}, {name}, &params);
     VERIFY_OPTIONS("Camera");
     renderOptions->CameraName = name;
     renderOptions->CameraParams = params;
@@ -955,6 +1305,7 @@ void pbrtCamera(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtMakeNamedMedium(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::MakeNamedMedium, {}, {name}, &params);
     VERIFY_INITIALIZED("MakeNamedMedium");
     WARN_IF_ANIMATED_TRANSFORM("MakeNamedMedium");
     std::string type = params.FindOneString("type", "");
@@ -974,6 +1325,8 @@ void pbrtMakeNamedMedium(const std::string &name, const ParamSet &params) {
 
 void pbrtMediumInterface(const std::string &insideName,
                          const std::string &outsideName) {
+    RECORD_BINARY(BinarySceneOp::MediumInterface, {},
+                  {insideName, outsideName});
     VERIFY_INITIALIZED("MediumInterface");
     graphicsState.currentInsideMedium = insideName;
     graphicsState.currentOutsideMedium = outsideName;
@@ -983,6 +1336,7 @@ void pbrtMediumInterface(const std::string &insideName,
 }
 
 void pbrtWorldBegin() {
+    RECORD_BINARY(BinarySceneOp::WorldBegin);
     VERIFY_OPTIONS("WorldBegin");
     currentApiState = APIState::WorldBlock;
     for (int i = 0; i < MaxTransforms; ++i) curTransform[i] = Transform();
@@ -994,6 +1348,7 @@ void pbrtWorldBegin() {
 }
 
 void pbrtAttributeBegin() {
+    RECORD_BINARY(BinarySceneOp::AttributeBegin);
     VERIFY_WORLD("AttributeBegin");
     pushedGraphicsStates.push_back(graphicsState);
     pushedTransforms.push_back(curTransform);
@@ -1005,6 +1360,7 @@ void pbrtAttributeBegin() {
 }
 
 void pbrtAttributeEnd() {
+    RECORD_BINARY(BinarySceneOp::AttributeEnd);
     VERIFY_WORLD("AttributeEnd");
     if (!pushedGraphicsStates.size()) {
         Error(
@@ -1025,6 +1381,7 @@ void pbrtAttributeEnd() {
 }
 
 void pbrtTransformBegin() {
+    RECORD_BINARY(BinarySceneOp::TransformBegin);
     VERIFY_WORLD("TransformBegin");
     pushedTransforms.push_back(curTransform);
     pushedActiveTransformBits.push_back(activeTransformBits);
@@ -1035,6 +1392,7 @@ void pbrtTransformBegin() {
 }
 
 void pbrtTransformEnd() {
+    RECORD_BINARY(BinarySceneOp::TransformEnd);
     VERIFY_WORLD("TransformEnd");
     if (!pushedTransforms.size()) {
         Error(
@@ -1054,6 +1412,8 @@ void pbrtTransformEnd() {
 
 void pbrtTexture(const std::string &name, const std::string &type,
                  const std::string &texname, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Texture, {}, {name, type, texname},
+                  &params);
     VERIFY_WORLD("Texture");
     TextureParams tp(params, params, graphicsState.floatTextures,
                      graphicsState.spectrumTextures);
@@ -1086,6 +1446,7 @@ void pbrtTexture(const std::string &name, const std::string &type,
 }
 
 void pbrtMaterial(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Material, {}, {name}, &params);
     VERIFY_WORLD("Material");
     graphicsState.material = name;
     graphicsState.materialParams = params;
@@ -1098,6 +1459,7 @@ void pbrtMaterial(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtMakeNamedMaterial(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::MakeNamedMaterial, {}, {name}, &params);
     VERIFY_WORLD("MakeNamedMaterial");
     // error checking, warning if replace, what to use for transform?
     ParamSet emptyParams;
@@ -1120,6 +1482,7 @@ void pbrtMakeNamedMaterial(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtNamedMaterial(const std::string &name) {
+    RECORD_BINARY(BinarySceneOp::NamedMaterial, {}, {name});
     VERIFY_WORLD("NamedMaterial");
     graphicsState.currentNamedMaterial = name;
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -1127,6 +1490,7 @@ void pbrtNamedMaterial(const std::string &name) {
 }
 
 void pbrtLightSource(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::LightSource, {}, {name}, &params);
     VERIFY_WORLD("LightSource");
     WARN_IF_ANIMATED_TRANSFORM("LightSource");
     MediumInterface mi = graphicsState.CreateMediumInterface();
@@ -1143,6 +1507,7 @@ void pbrtLightSource(const std::string &name, const ParamSet &params) {
 }
 
 void pbrtAreaLightSource(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::AreaLightSource, {}, {name}, &params);
     VERIFY_WORLD("AreaLightSource");
     graphicsState.areaLight = name;
     graphicsState.areaLightParams = params;
@@ -1153,105 +1518,328 @@ void pbrtAreaLightSource(const std::string &name, const ParamSet &params) {
     }
 }
 
+STAT_COUNTER("Scene/Shapes loaded by tasks", nShapeTasks);
+
 void pbrtShape(const std::string &name, const ParamSet &params) {
+    RECORD_BINARY(BinarySceneOp::Shape, {}, {name}, &params);
     VERIFY_WORLD("Shape");
-    std::vector<std::shared_ptr<Primitive>> prims;
-    std::vector<std::shared_ptr<AreaLight>> areaLights;
     if (PbrtOptions.cat || (PbrtOptions.toPly && name != "trianglemesh")) {
         printf("%*sShape \"%s\" ", catIndentCount, "", name.c_str());
         params.Print(catIndentCount);
         printf("\n");
     }
 
-    if (!curTransform.IsAnimated()) {
-        // Initialize _prims_ and _areaLights_ for static shape
+    // Resolve everything that depends on the graphics state now, so that
+    // the shapes can be created later by a task; the task gets its own
+    // _ParamSet_ and only the float textures its shape may look up
+    PendingShape pending;
+    pending.params = std::make_shared<ParamSet>(params);
+    pending.location = CurrentErrorLocation();
+    pending.instance = renderOptions->currentInstance;
+    pending.material = graphicsState.CreateMaterial(params, false);
+    pending.mediumInterface = graphicsState.CreateMediumInterface();
+    std::shared_ptr<ParamSet> shapeParams = pending.params;
+    std::shared_ptr<Material> mtl = pending.material;
+    MediumInterface mi = pending.mediumInterface;
+    auto floatTextures = std::make_shared<
+        std::map<std::string, std::shared_ptr<Texture<Float>>>>();
+    for (const char *alphaName : {"alpha", "shadowalpha"}) {
+        std::string textureName = params.FindTexture(alphaName);
+        auto iter = graphicsState.floatTextures.find(textureName);
+        if (iter != graphicsState.floatTextures.end())
+            floatTextures->insert(*iter);
+    }
+    bool reverseOrientation = graphicsState.reverseOrientation;
+    ErrorLocation location = pending.location;
+    std::function<PendingShape::Entities()> createEntities;
 
-        // Create shapes for shape _name_
+    if (!curTransform.IsAnimated()) {
+        // Create shapes and primitives for static shape
         Transform *ObjToWorld, *WorldToObj;
-        transformCache.Lookup(curTransform[0], &ObjToWorld, &WorldToObj);
-        std::vector<std::shared_ptr<Shape>> shapes =
-            MakeShapes(name, ObjToWorld, WorldToObj,
-                       graphicsState.reverseOrientation, params);
-        if (shapes.size() == 0) return;
-        std::shared_ptr<Material> mtl = graphicsState.CreateMaterial(params);
-        params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
-        for (auto s : shapes) {
-            // Possibly create area light for shape
-            std::shared_ptr<AreaLight> area;
-            if (graphicsState.areaLight != "") {
-                area = MakeAreaLight(graphicsState.areaLight, curTransform[0],
-                                     mi, graphicsState.areaLightParams, s);
-                areaLights.push_back(area);
-            }
-            prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, area, mi));
+        transformCache.Lookup(curTransform[0], &ObjToWorld, &WorldToObj,
+                              renderOptions->currentInstanceTransforms);
+        bool hasAreaLight = graphicsState.areaLight != "";
+        if (hasAreaLight) {
+            pending.areaLight = graphicsState.areaLight;
+            pending.areaLightParams = graphicsState.areaLightParams;
+            pending.lightToWorld = curTransform[0];
         }
+        createEntities = [=]() -> PendingShape::Entities {
+            ErrorLocationScope errorScope(location);
+            PendingShape::Entities entities;
+            // Triangle meshes without area lights get one primitive that
+            // holds all of their triangles, and no _Shape_ per triangle
+            if (!hasAreaLight && !PbrtOptions.toPly &&
+                IsTriangleMeshShape(name)) {
+                std::shared_ptr<TriangleMesh> mesh = MakeTriangleMesh(
+                    name, ObjToWorld, *shapeParams, floatTextures.get());
+                if (mesh)
+                    entities.prims.push_back(
+                        std::make_shared<TriangleMeshAggregate>(
+                            ObjToWorld, WorldToObj, reverseOrientation, mesh,
+                            mtl, mi));
+                return entities;
+            }
+            entities.shapes =
+                MakeShapes(name, ObjToWorld, WorldToObj, reverseOrientation,
+                           *shapeParams, floatTextures.get());
+            // Shapes with area lights get their primitives once they are
+            // added to the scene
+            if (hasAreaLight) return entities;
+            for (auto s : entities.shapes)
+                entities.prims.push_back(std::make_shared<GeometricPrimitive>(
+                    s, mtl, nullptr, mi));
+            return entities;
+        };
     } else {
-        // Initialize _prims_ and _areaLights_ for animated shape
-
-        // Create initial shape or shapes for animated shape
+        // Create primitives for animated shape
         if (graphicsState.areaLight != "")
             Warning(
                 "Ignoring currently set area light when creating "
                 "animated shape");
         Transform *identity;
-        transformCache.Lookup(Transform(), &identity, nullptr);
-        std::vector<std::shared_ptr<Shape>> shapes = MakeShapes(
-            name, identity, identity, graphicsState.reverseOrientation, params);
-        if (shapes.size() == 0) return;
+        transformCache.Lookup(Transform(), &identity, nullptr,
+                              renderOptions->currentInstanceTransforms);
 
-        // Create _GeometricPrimitive_(s) for animated shape
-        std::shared_ptr<Material> mtl = graphicsState.CreateMaterial(params);
-        params.ReportUnused();
-        MediumInterface mi = graphicsState.CreateMediumInterface();
-        for (auto s : shapes)
-            prims.push_back(
-                std::make_shared<GeometricPrimitive>(s, mtl, nullptr, mi));
+        // Get _animatedObjectToWorld_ transform for shape
+        pending.animatedObjectToWorld = transformCache.Lookup(
+            curTransform, renderOptions->transformStartTime,
+            renderOptions->transformEndTime,
+            renderOptions->currentInstanceTransforms);
+        createEntities = [=]() -> PendingShape::Entities {
+            ErrorLocationScope errorScope(location);
+            PendingShape::Entities entities;
+            if (!PbrtOptions.toPly && IsTriangleMeshShape(name)) {
+                std::shared_ptr<TriangleMesh> mesh = MakeTriangleMesh(
+                    name, identity, *shapeParams, floatTextures.get());
+                if (mesh)
+                    entities.prims.push_back(
+                        std::make_shared<TriangleMeshAggregate>(
+                            identity, identity, reverseOrientation, mesh, mtl,
+                            mi));
+                return entities;
+            }
 
-        // Create single _TransformedPrimitive_ for _prims_
+            // Create initial shape or shapes for animated shape
+            entities.shapes =
+                MakeShapes(name, identity, identity, reverseOrientation,
+                           *shapeParams, floatTextures.get());
+
+            // Create _GeometricPrimitive_(s) for animated shape
+            for (auto s : entities.shapes)
+                entities.prims.push_back(std::make_shared<GeometricPrimitive>(
+                    s, mtl, nullptr, mi));
+            return entities;
+        };
+    }
 
-        // Get _animatedObjectToWorld_ transform for shape
-        Assert(MaxTransforms == 2);
-        Transform *ObjToWorld[2];
-        transformCache.Lookup(curTransform[0], &ObjToWorld[0], nullptr);
-        transformCache.Lookup(curTransform[1], &ObjToWorld[1], nullptr);
-        AnimatedTransform animatedObjectToWorld(
-            ObjToWorld[0], renderOptions->transformStartTime, ObjToWorld[1],
-            renderOptions->transformEndTime);
-        if (prims.size() > 1) {
-            std::shared_ptr<Primitive> bvh = std::make_shared<BVHAccel>(prims);
-            prims.clear();
-            prims.push_back(bvh);
+    // Converting scenes prints as it goes, so it creates shapes in order
+    if (PbrtOptions.cat || PbrtOptions.toPly) {
+        std::promise<PendingShape::Entities> entities;
+        entities.set_value(createEntities());
+        pending.entities =
+            Future<PendingShape::Entities>(entities.get_future());
+    } else {
+        pending.entities = Async(createEntities);
+        ++nShapeTasks;
+    }
+    renderOptions->pendingShapes.push_back(std::move(pending));
+}
+
+STAT_COUNTER("Scene/Duplicate triangle meshes instanced", nDuplicateMeshes);
+STAT_MEMORY_COUNTER("Memory/Duplicate triangle meshes removed",
+                    duplicateMeshBytes);
+
+// Returns the triangles of the mesh that _entities_ holds, if it is one
+static const TriangleMeshAggregate *MeshAggregate(
+    const PendingShape::Entities &entities) {
+    if (entities.prims.size() != 1) return nullptr;
+    return dynamic_cast<const TriangleMeshAggregate *>(
+        entities.prims[0].get());
+}
+
+// Returns whether _prims_ need an aggregate of their own to be placed by a
+// single transform: there are several, or they are a mesh's triangles
+static bool NeedsAccelerator(
+    const std::vector<std::shared_ptr<Primitive>> &prims) {
+    return prims.size() > 1 ||
+           (prims.size() == 1 &&
+            dynamic_cast<const TriangleMeshAggregate *>(prims[0].get()));
+}
+
+// Exporters often write out copies of a mesh with different transforms
+// rather than using _ObjectInstance_. World meshes created from the same
+// object-space data, with the same orientation and alpha textures, are
+// replaced by instances of the first copy, placed by the transform from
+// that copy to each of the others, that keep their own materials.
+static void InstanceDuplicateMeshes(
+    const std::vector<PendingShape> &pendings,
+    std::vector<PendingShape::Entities> &entities) {
+    // Smaller meshes take less memory than an instance of them
+    const int minTriangles = 64;
+    struct FirstCopy {
+        const Triangle *triangle;
+        size_t index;
+        std::shared_ptr<Primitive> accel;
+    };
+    std::unordered_map<uint64_t, FirstCopy> firstCopies;
+    for (size_t i = 0; i < entities.size(); ++i) {
+        const PendingShape &pending = pendings[i];
+        const TriangleMeshAggregate *aggregate = MeshAggregate(entities[i]);
+        if (pending.instance || pending.animatedObjectToWorld || !aggregate ||
+            aggregate->GetMesh()->nTriangles < minTriangles)
+            continue;
+        const Triangle *tri = &aggregate->GetTriangle();
+        const TriangleMesh &mesh = *tri->GetMesh();
+        uint64_t key = HashValue(mesh.alphaMask.get(), mesh.objectHash);
+        key = HashValue(mesh.shadowAlphaMask.get(), key);
+        key = HashValue(tri->reverseOrientation, key);
+        auto iter = firstCopies.find(key);
+        if (iter == firstCopies.end()) {
+            firstCopies[key] = FirstCopy{tri, i, nullptr};
+            continue;
         }
-        prims[0] = std::make_shared<TransformedPrimitive>(
-            prims[0], animatedObjectToWorld);
+
+        // Check that the mesh was created from the same object-space data
+        // as the first copy, not just data with the same hash
+        FirstCopy &first = iter->second;
+        const TriangleMesh &firstMesh = *first.triangle->GetMesh();
+        if (!mesh.SameObjectData(firstMesh) ||
+            mesh.alphaMask != firstMesh.alphaMask ||
+            mesh.shadowAlphaMask != firstMesh.shadowAlphaMask ||
+            tri->reverseOrientation != first.triangle->reverseOrientation)
+            continue;
+
+        // Build an aggregate over the first copy's primitives to share
+        if (!first.accel) {
+            std::vector<std::shared_ptr<Primitive>> &prims =
+                entities[first.index].prims;
+            first.accel = MakeAccelerator(renderOptions->AcceleratorName,
+                                          prims,
+                                          renderOptions->AcceleratorParams);
+            if (!first.accel) first.accel = std::make_shared<BVHAccel>(prims);
+            prims = {first.accel};
+        }
+
+        // Replace the copy with an instance of the first one
+        TransformSet firstToCopy;
+        for (int j = 0; j < MaxTransforms; ++j)
+            firstToCopy[j] =
+                *tri->ObjectToWorld * *first.triangle->WorldToObject;
+        const AnimatedTransform *placement = transformCache.Lookup(
+            firstToCopy, renderOptions->transformStartTime,
+            renderOptions->transformEndTime);
+        duplicateMeshBytes +=
+            mesh.Bytes() + mesh.nTriangles * sizeof(TriangleMeshPrimitive);
+        ++nDuplicateMeshes;
+        entities[i].prims = {std::make_shared<MeshCopyPrimitive>(
+            first.accel, *placement, pending.material,
+            pending.mediumInterface)};
     }
-    // Add _prims_ and _areaLights_ to scene or current instance
-    if (renderOptions->currentInstance) {
-        if (areaLights.size())
-            Warning("Area lights not supported with object instancing");
-        renderOptions->currentInstance->insert(
-            renderOptions->currentInstance->end(), prims.begin(), prims.end());
-    } else {
-        renderOptions->primitives.insert(renderOptions->primitives.end(),
-                                         prims.begin(), prims.end());
-        if (areaLights.size())
-            renderOptions->lights.insert(renderOptions->lights.end(),
-                                         areaLights.begin(), areaLights.end());
+
+    // _ReleaseObjectData()_ can't find the meshes of the first copies that
+    // are now inside an aggregate
+    for (const auto &iter : firstCopies)
+        if (iter.second.accel)
+            iter.second.triangle->GetMesh()->objectData.reset();
+}
+
+// Frees the object-space data that the triangle meshes of _entities_ keep
+// for _InstanceDuplicateMeshes()_
+static void ReleaseObjectData(const PendingShape::Entities &entities) {
+    if (const TriangleMeshAggregate *aggregate = MeshAggregate(entities))
+        aggregate->GetMesh()->objectData.reset();
+    const TriangleMesh *released = nullptr;
+    for (const std::shared_ptr<Shape> &shape : entities.shapes) {
+        const Triangle *tri = dynamic_cast<const Triangle *>(shape.get());
+        if (!tri || tri->GetMesh().get() == released) continue;
+        released = tri->GetMesh().get();
+        tri->GetMesh()->objectData.reset();
     }
 }
 
+// Adds the primitives of pending shapes to the scene or their named object,
+// in the order their directives were given. If _instance_ is given, only
+// that object's shapes are added.
+static void AddPendingShapes(
+    const std::vector<std::shared_ptr<Primitive>> *instance) {
+    std::vector<PendingShape> adding, remaining;
+    for (PendingShape &pending : renderOptions->pendingShapes) {
+        if (instance && pending.instance != instance)
+            remaining.push_back(std::move(pending));
+        else
+            adding.push_back(std::move(pending));
+    }
+    std::vector<PendingShape::Entities> addingEntities;
+    addingEntities.reserve(adding.size());
+    for (PendingShape &pending : adding)
+        addingEntities.push_back(pending.entities.Get());
+    if (!instance) InstanceDuplicateMeshes(adding, addingEntities);
+    for (const PendingShape::Entities &entities : addingEntities)
+        ReleaseObjectData(entities);
+
+    for (size_t i = 0; i < adding.size(); ++i) {
+        PendingShape &pending = adding[i];
+        PendingShape::Entities &entities = addingEntities[i];
+        // Both the shape and its material have looked up their parameters
+        ErrorLocationScope errorScope(pending.location);
+        pending.params->ReportUnused();
+
+        // Create single _TransformedPrimitive_ for an animated shape's
+        // primitives; their BVH is built here rather than by the shape's
+        // task, since the build runs its own parallel loops
+        std::vector<std::shared_ptr<Primitive>> &prims = entities.prims;
+        if (pending.animatedObjectToWorld && !prims.empty()) {
+            if (NeedsAccelerator(prims)) {
+                std::shared_ptr<Primitive> bvh =
+                    std::make_shared<BVHAccel>(prims);
+                prims.clear();
+                prims.push_back(bvh);
+            }
+            prims[0] = std::make_shared<TransformedPrimitive>(
+                prims[0], *pending.animatedObjectToWorld);
+        }
+
+        // Create area lights and their primitives
+        std::vector<std::shared_ptr<AreaLight>> areaLights;
+        if (pending.areaLight != "")
+            for (auto s : entities.shapes) {
+                std::shared_ptr<AreaLight> area = MakeAreaLight(
+                    pending.areaLight, pending.lightToWorld,
+                    pending.mediumInterface, pending.areaLightParams, s);
+                areaLights.push_back(area);
+                prims.push_back(std::make_shared<GeometricPrimitive>(
+                    s, pending.material, area, pending.mediumInterface));
+            }
+
+        // Add _prims_ and _areaLights_ to scene or current instance
+        if (pending.instance) {
+            if (areaLights.size())
+                Warning("Area lights not supported with object instancing");
+            pending.instance->insert(pending.instance->end(), prims.begin(),
+                                     prims.end());
+        } else {
+            renderOptions->primitives.insert(renderOptions->primitives.end(),
+                                             prims.begin(), prims.end());
+            if (areaLights.size())
+                renderOptions->lights.insert(renderOptions->lights.end(),
+                                             areaLights.begin(),
+                                             areaLights.end());
+        }
+    }
+    renderOptions->pendingShapes = std::move(remaining);
+}
+
 std::shared_ptr<Material> GraphicsState::CreateMaterial(
-    const ParamSet &params) {
+    const ParamSet &params, bool reportGeomParams) {
     TextureParams mp(params, materialParams, floatTextures, spectrumTextures);
     std::shared_ptr<Material> mtl;
     if (currentNamedMaterial != "" &&
         namedMaterials.find(currentNamedMaterial) != namedMaterials.end())
         mtl = namedMaterials[graphicsState.currentNamedMaterial];
-    if (!mtl) mtl = MakeMaterial(material, mp);
+    if (!mtl) mtl = MakeMaterial(material, mp, reportGeomParams);
     if (!mtl && material != "" && material != "none")
-        mtl = MakeMaterial("matte", mp);
+        mtl = MakeMaterial("matte", mp, reportGeomParams);
     return mtl;
 }
 
@@ -1277,6 +1865,7 @@ MediumInterface GraphicsState::CreateMediumInterface() {
 }
 
 void pbrtReverseOrientation() {
+    RECORD_BINARY(BinarySceneOp::ReverseOrientation);
     VERIFY_WORLD("ReverseOrientation");
     graphicsState.reverseOrientation = !graphicsState.reverseOrientation;
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -1284,12 +1873,24 @@ void pbrtReverseOrientation() {
 }
 
 void pbrtObjectBegin(const std::string &name) {
+    RECORD_BINARY(BinarySceneOp::ObjectBegin, {}, {name});
     VERIFY_WORLD("ObjectBegin");
     pbrtAttributeBegin();
     if (renderOptions->currentInstance)
         Error("ObjectBegin called inside of instance definition");
+    // Finish the shapes of an earlier definition of the object before
+    // replacing it
+    if (renderOptions->instances.find(name) != renderOptions->instances.end())
+        AddPendingShapes(&renderOptions->instances[name]);
     renderOptions->instances[name] = std::vector<std::shared_ptr<Primitive>>();
     renderOptions->currentInstance = &renderOptions->instances[name];
+    // The earlier definition's transforms are freed at the next _WorldEnd_,
+    // once nothing renders it
+    std::vector<const Transform *> &pins =
+        renderOptions->instanceTransforms[name];
+    transformCache.Unpin(pins);
+    pins.clear();
+    renderOptions->currentInstanceTransforms = &pins;
     if (PbrtOptions.cat || PbrtOptions.toPly)
         printf("%*sObjectBegin \"%s\"\n", catIndentCount, "", name.c_str());
 }
@@ -1297,10 +1898,12 @@ void pbrtObjectBegin(const std::string &name) {
 STAT_COUNTER("Scene/Object instances created", nObjectInstancesCreated);
 
 void pbrtObjectEnd() {
+    RECORD_BINARY(BinarySceneOp::ObjectEnd);
     VERIFY_WORLD("ObjectEnd");
     if (!renderOptions->currentInstance)
         Error("ObjectEnd called outside of instance definition");
     renderOptions->currentInstance = nullptr;
+    renderOptions->currentInstanceTransforms = nullptr;
     pbrtAttributeEnd();
     ++nObjectInstancesCreated;
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -1310,6 +1913,7 @@ void pbrtObjectEnd() {
 STAT_COUNTER("Scene/Object instances used", nObjectInstancesUsed);
 
 void pbrtObjectInstance(const std::string &name) {
+    RECORD_BINARY(BinarySceneOp::ObjectInstance, {}, {name});
     VERIFY_WORLD("ObjectInstance");
     // Perform object instance error checking
     if (PbrtOptions.cat || PbrtOptions.toPly)
@@ -1324,9 +1928,10 @@ void pbrtObjectInstance(const std::string &name) {
     }
     std::vector<std::shared_ptr<Primitive>> &in =
         renderOptions->instances[name];
+    AddPendingShapes(&in);
     if (in.size() == 0) return;
     ++nObjectInstancesUsed;
-    if (in.size() > 1) {
+    if (NeedsAccelerator(in)) {
         // Create aggregate for instance _Primitive_s
         std::shared_ptr<Primitive> accel(
             MakeAccelerator(renderOptions->AcceleratorName, in,
@@ -1335,20 +1940,16 @@ void pbrtObjectInstance(const std::string &name) {
         in.erase(in.begin(), in.end());
         in.push_back(accel);
     }
-    Assert(MaxTransforms == 2);
     // Create _animatedInstanceToWorld_ transform for instance
-    Transform *InstanceToWorld[2];
-    transformCache.Lookup(curTransform[0], &InstanceToWorld[0], nullptr);
-    transformCache.Lookup(curTransform[1], &InstanceToWorld[1], nullptr);
-    AnimatedTransform animatedInstanceToWorld(
-        InstanceToWorld[0], renderOptions->transformStartTime, InstanceToWorld[1],
+    const AnimatedTransform *animatedInstanceToWorld = transformCache.Lookup(
+        curTransform, renderOptions->transformStartTime,
         renderOptions->transformEndTime);
-    std::shared_ptr<Primitive> prim(
-        std::make_shared<TransformedPrimitive>(in[0], animatedInstanceToWorld));
-    renderOptions->primitives.push_back(prim);
+    renderOptions->instanceUses.push_back(
+        InstanceUse(in[0], animatedInstanceToWorld));
 }
 
 void pbrtWorldEnd() {
+    RECORD_BINARY(BinarySceneOp::WorldEnd);
     VERIFY_WORLD("WorldEnd");
     // Ensure there are no pushed graphics states
     while (pushedGraphicsStates.size()) {
@@ -1360,6 +1961,7 @@ void pbrtWorldEnd() {
         Warning("Missing end to pbrtTransformBegin()");
         pushedTransforms.pop_back();
     }
+    AddPendingShapes();
 
     // Create scene and render
     if (PbrtOptions.cat || PbrtOptions.toPly) {
@@ -1371,9 +1973,10 @@ void pbrtWorldEnd() {
         TerminateWorkerThreads();
     }
 
-    // Clean up after rendering
+    // Clean up after rendering; named objects outlive the world block, and
+    // their shapes refer to the cached transforms they pinned
     graphicsState = GraphicsState();
-    transformCache.Clear();
+    transformCache.Clear(true);
     currentApiState = APIState::OptionsBlock;
     ReportThreadStats();
     if (!PbrtOptions.quiet && !PbrtOptions.cat && !PbrtOptions.toPly) {
@@ -1389,16 +1992,71 @@ void pbrtWorldEnd() {
 }
 
 Scene *RenderOptions::MakeScene() {
-    std::shared_ptr<Primitive> accelerator =
-        MakeAccelerator(AcceleratorName, primitives, AcceleratorParams);
-    if (!accelerator) accelerator = std::make_shared<BVHAccel>(primitives);
+    std::shared_ptr<Primitive> accelerator;
+    if (!primitives.empty() || instanceUses.empty()) {
+        accelerator =
+            MakeAccelerator(AcceleratorName, primitives, AcceleratorParams);
+        if (!accelerator) accelerator = std::make_shared<BVHAccel>(primitives);
+    }
+    // Object instances get their own top-level BVH, which can be refit
+    // rather than rebuilt in later world blocks
+    if (!instanceUses.empty()) {
+        std::shared_ptr<Primitive> instanceAccelerator =
+            MakeInstanceAccelerator();
+        if (accelerator)
+            accelerator = std::make_shared<BVHAccel>(
+                std::vector<std::shared_ptr<Primitive>>{accelerator,
+                                                        instanceAccelerator});
+        else
+            accelerator = instanceAccelerator;
+    }
     Scene *scene = new Scene(accelerator, lights);
-    // Erase primitives and lights from _RenderOptions_
+    // Erase primitives, instances and lights from _RenderOptions_
     primitives.erase(primitives.begin(), primitives.end());
+    instanceUses.erase(instanceUses.begin(), instanceUses.end());
     lights.erase(lights.begin(), lights.end());
     return scene;
 }
 
+STAT_COUNTER("Scene/Instance BVH refits", nInstanceAccelRefits);
+STAT_COUNTER("Scene/Instance BVH rebuilds", nInstanceAccelRebuilds);
+
+std::shared_ptr<Primitive> RenderOptions::MakeInstanceAccelerator() {
+    // Refit the previous instance BVH if the same objects are instanced in
+    // the same order, unless moving them has degraded the tree too much
+    bool sameObjects = instanceAccel &&
+                       instancedObjects.size() == instanceUses.size();
+    for (size_t i = 0; sameObjects && i < instanceUses.size(); ++i)
+        sameObjects = instancedObjects[i] == instanceUses[i].object;
+    if (sameObjects) {
+        for (size_t i = 0; i < instanceUses.size(); ++i)
+            instancePrimitives[i]->SetPrimitiveToWorld(
+                *instanceUses[i].instanceToWorld);
+        const Float maxRefitCostRatio = 1.5f;
+        if (instanceAccel->Refit() &&
+            instanceAccel->SAHCost() <=
+                maxRefitCostRatio * instanceAccelBuildCost) {
+            ++nInstanceAccelRefits;
+            return instanceAccel;
+        }
+    }
+
+    // Build a new BVH over the instances
+    ++nInstanceAccelRebuilds;
+    instancePrimitives.clear();
+    instancedObjects.clear();
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (InstanceUse &use : instanceUses) {
+        instancePrimitives.push_back(std::make_shared<TransformedPrimitive>(
+            use.object, *use.instanceToWorld));
+        instancedObjects.push_back(use.object);
+        prims.push_back(instancePrimitives.back());
+    }
+    instanceAccel = std::make_shared<BVHAccel>(prims);
+    instanceAccelBuildCost = instanceAccel->SAHCost();
+    return instanceAccel;
+}
+
 Integrator *RenderOptions::MakeIntegrator() const {
     std::shared_ptr<const Camera> camera(MakeCamera());
     if (!camera) {
@@ -1441,11 +2099,30 @@ Integrator *RenderOptions::MakeIntegrator() const {
 	else if (IntegratorName == "mlttof") {
 		integrator = CreateMLTToFIntegrator(IntegratorParams, camera);
 	}
+	else if (IntegratorName == "volpathtof") {
+		integrator = CreateVolPathToFIntegrator(IntegratorParams, sampler, camera);
+	}
+	else if (IntegratorName == "sppmtof") {
+		integrator = CreateSPPMToFIntegrator(IntegratorParams, camera);
+	}
 	else {
         Error("Integrator \"%s\" unknown.", IntegratorName.c_str());
         return nullptr;
     }
 
+	// Enable adaptive sampling for integrators that render in pixel tiles
+	AdaptiveSamplingOptions adaptive(IntegratorParams, camera->film);
+	if (adaptive.enabled) {
+		if (SamplerIntegrator *si = dynamic_cast<SamplerIntegrator *>(integrator))
+			si->SetAdaptiveSampling(adaptive);
+		else if (BDPTToFIntegrator *bi =
+			dynamic_cast<BDPTToFIntegrator *>(integrator))
+			bi->SetAdaptiveSampling(adaptive);
+		else
+			Warning("Integrator \"%s\" does not support adaptive sampling.",
+				IntegratorName.c_str());
+	}
+
     IntegratorParams.ReportUnused();
     // Warn if no light sources are defined
     if (lights.size() == 0)
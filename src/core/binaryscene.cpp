@@ -0,0 +1,475 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// core/binaryscene.cpp*
+#include "binaryscene.h"
+#include "api.h"
+#include "fileutil.h"
+#include "mappedfile.h"
+#include "paramset.h"
+#include "stats.h"
+#ifdef PBRT_IS_WINDOWS
+#include <fcntl.h>
+#include <io.h>
+#endif
+
+STAT_COUNTER("Scene/Binary scene calls replayed", nBinarySceneCalls);
+STAT_MEMORY_COUNTER("Memory/Binary scene parameters used in place",
+	inPlaceParamBytes);
+
+// Binary Scene Local Declarations
+
+// A binary scene file is a _BinarySceneHeader_ followed by one record per
+// API call. Each record starts with a _BinarySceneRecord_ and holds, in
+// order, the call's _Float_ arguments, its string arguments and the items
+// of its _ParamSet_. Records, strings and arrays are padded to 8 bytes, so
+// that the values of every array are suitably aligned in a memory mapping.
+// Strings are stored as a 32-bit length followed by their characters, and
+// each parameter as its type, value count, name and values.
+static const char binarySceneMagic[8] = {'P', 'B', 'R', 'T', 'B', 'I', 'N', 0};
+static PBRT_CONSTEXPR uint32_t binarySceneVersion = 1;
+static PBRT_CONSTEXPR uint32_t binarySceneByteOrder = 0x01020304;
+
+struct BinarySceneHeader {
+	char magic[8];
+	uint32_t version, byteOrder;
+	// Parameter arrays are used in place, so their layout must match
+	uint32_t floatSize, spectrumSize;
+};
+
+struct BinarySceneRecord {
+	uint32_t op, size, line;
+	uint32_t nArgs, nStrings, nParams;
+};
+
+enum class BinaryParamType : uint32_t {
+	Int, Bool, Float, Point2, Vector2, Point3, Vector3, Normal, Spectrum,
+	String, Texture
+};
+
+static_assert(sizeof(BinarySceneHeader) % 8 == 0 &&
+	sizeof(BinarySceneRecord) % 8 == 0,
+	"Binary scene records must stay 8-byte aligned");
+static_assert(sizeof(Point2f) == 2 * sizeof(Float) &&
+	sizeof(Vector2f) == 2 * sizeof(Float) &&
+	sizeof(Point3f) == 3 * sizeof(Float) &&
+	sizeof(Vector3f) == 3 * sizeof(Float) &&
+	sizeof(Normal3f) == 3 * sizeof(Float),
+	"Binary scene parameters require tightly packed geometry types");
+
+// The number of _Float_ and string arguments of each _BinarySceneOp_
+static const struct {
+	uint32_t nArgs, nStrings;
+} opSignatures[] = {
+	{0, 0}, {3, 0}, {4, 0}, {3, 0}, {9, 0}, {16, 0}, {16, 0},  // Transforms
+	{0, 1}, {0, 1}, {0, 0}, {0, 0}, {0, 0}, {2, 0},
+	{0, 1}, {0, 1}, {0, 1}, {0, 1}, {0, 1}, {0, 1},  // Rendering options
+	{0, 1}, {0, 2}, {0, 0}, {0, 0},
+	{0, 0}, {0, 0}, {0, 0}, {0, 3}, {0, 1},  // Attributes
+	{0, 1}, {0, 1}, {0, 1}, {0, 1}, {0, 1},
+	{0, 0}, {0, 1}, {0, 0}, {0, 1}, {0, 0},  // Instancing, WorldEnd
+	{0, 1}                                   // SourceFile
+};
+static_assert(sizeof(opSignatures) / sizeof(opSignatures[0]) ==
+	(size_t)BinarySceneOp::Count,
+	"Each BinarySceneOp needs a signature");
+
+// Bounds-checked reads from a single record of a mapped binary scene
+class BinaryRecordReader {
+public:
+	BinaryRecordReader(const char *start, const char *end)
+		: start(start), ptr(start), end(end) {}
+	template <typename T>
+	const T *Read(uint32_t count) {
+		size_t size = count * sizeof(T);
+		if (failed || (size_t)(end - ptr) < size) {
+			failed = true;
+			return nullptr;
+		}
+		const T *values = reinterpret_cast<const T *>(ptr);
+		ptr += size;
+		return values;
+	}
+	bool ReadString(std::string *str) {
+		const uint32_t *length = Read<uint32_t>(1);
+		const char *chars = length ? Read<char>(*length) : nullptr;
+		if (!chars) return false;
+		str->assign(chars, *length);
+		return Align();
+	}
+	bool Align() {
+		size_t offset = (ptr - start + 7) & ~(size_t)7;
+		if (failed || offset > (size_t)(end - start))
+			failed = true;
+		else
+			ptr = start + offset;
+		return !failed;
+	}
+
+private:
+	const char *const start;
+	const char *ptr;
+	const char *const end;
+	bool failed = false;
+};
+
+// Binary Scene Local Functions
+template <typename T>
+static bool AddInPlace(BinaryRecordReader &reader, const std::string &name,
+	uint32_t nValues,
+	void (ParamSet::*add)(const std::string &, const T *, int,
+		std::shared_ptr<const void>),
+	const std::shared_ptr<const void> &storage, ParamSet *params) {
+	const T *values = reader.Read<T>(nValues);
+	if (!values || !reader.Align()) return false;
+	(params->*add)(name, values, (int)nValues, storage);
+	inPlaceParamBytes += nValues * sizeof(T);
+	return true;
+}
+
+static bool ReadParams(BinaryRecordReader &reader, uint32_t nParams,
+	const std::shared_ptr<const void> &storage, ParamSet *params) {
+	for (uint32_t i = 0; i < nParams; ++i) {
+		const uint32_t *item = reader.Read<uint32_t>(2);
+		std::string name;
+		if (!item || !reader.ReadString(&name) ||
+			item[1] > (uint32_t)std::numeric_limits<int>::max())
+			return false;
+		uint32_t n = item[1];
+		bool read = false;
+		switch ((BinaryParamType)item[0]) {
+		case BinaryParamType::Int:
+			read = AddInPlace<int>(reader, name, n, &ParamSet::AddInt,
+				storage, params);
+			break;
+		case BinaryParamType::Float:
+			read = AddInPlace<Float>(reader, name, n, &ParamSet::AddFloat,
+				storage, params);
+			break;
+		case BinaryParamType::Point2:
+			read = AddInPlace<Point2f>(reader, name, n, &ParamSet::AddPoint2f,
+				storage, params);
+			break;
+		case BinaryParamType::Vector2:
+			read = AddInPlace<Vector2f>(reader, name, n,
+				&ParamSet::AddVector2f, storage, params);
+			break;
+		case BinaryParamType::Point3:
+			read = AddInPlace<Point3f>(reader, name, n, &ParamSet::AddPoint3f,
+				storage, params);
+			break;
+		case BinaryParamType::Vector3:
+			read = AddInPlace<Vector3f>(reader, name, n,
+				&ParamSet::AddVector3f, storage, params);
+			break;
+		case BinaryParamType::Normal:
+			read = AddInPlace<Normal3f>(reader, name, n,
+				&ParamSet::AddNormal3f, storage, params);
+			break;
+		case BinaryParamType::Spectrum:
+			read = AddInPlace<Spectrum>(reader, name, n,
+				&ParamSet::AddSpectrum, storage, params);
+			break;
+		case BinaryParamType::Bool: {
+			const uint8_t *values = reader.Read<uint8_t>(n);
+			if (!values || !reader.Align()) return false;
+			std::unique_ptr<bool[]> bools(new bool[n]);
+			for (uint32_t j = 0; j < n; ++j) bools[j] = values[j] != 0;
+			params->AddBool(name, std::move(bools), (int)n);
+			read = true;
+			break;
+		}
+		case BinaryParamType::String: {
+			// Read the strings before allocating, so that a corrupt count
+			// fails rather than exhausting memory
+			std::vector<std::string> values;
+			for (uint32_t j = 0; j < n; ++j) {
+				values.push_back(std::string());
+				if (!reader.ReadString(&values.back())) return false;
+			}
+			std::unique_ptr<std::string[]> strings(new std::string[n]);
+			for (uint32_t j = 0; j < n; ++j) strings[j] = std::move(values[j]);
+			params->AddString(name, std::move(strings), (int)n);
+			read = true;
+			break;
+		}
+		case BinaryParamType::Texture: {
+			std::string texture;
+			read = n == 1 && reader.ReadString(&texture);
+			if (read) params->AddTexture(name, texture);
+			break;
+		}
+		}
+		if (!read) return false;
+	}
+	return true;
+}
+
+static bool ReadRecord(const char *start, size_t available,
+	const std::shared_ptr<const void> &storage, BinarySceneRecord *record,
+	const Float **args, std::vector<std::string> *strings,
+	ParamSet *params) {
+	// Validate the record's header before trusting its size
+	if (available < sizeof(*record)) return false;
+	memcpy(record, start, sizeof(*record));
+	if (record->size < sizeof(*record) || record->size % 8 != 0 ||
+		record->size > available ||
+		record->op >= (uint32_t)BinarySceneOp::Count ||
+		record->nArgs != opSignatures[record->op].nArgs ||
+		record->nStrings != opSignatures[record->op].nStrings)
+		return false;
+
+	// Read the record's arguments and parameters
+	BinaryRecordReader reader(start, start + record->size);
+	reader.Read<BinarySceneRecord>(1);
+	*args = reader.Read<Float>(record->nArgs);
+	if (!*args || !reader.Align()) return false;
+	strings->resize(record->nStrings);
+	for (std::string &str : *strings)
+		if (!reader.ReadString(&str)) return false;
+	return ReadParams(reader, record->nParams, storage, params);
+}
+
+static void ReplayCall(BinarySceneOp op, const Float *a,
+	const std::vector<std::string> &s, const ParamSet &params) {
+	Float tr[16];
+	switch (op) {
+	case BinarySceneOp::Identity: pbrtIdentity(); break;
+	case BinarySceneOp::Translate: pbrtTranslate(a[0], a[1], a[2]); break;
+	case BinarySceneOp::Rotate: pbrtRotate(a[0], a[1], a[2], a[3]); break;
+	case BinarySceneOp::Scale: pbrtScale(a[0], a[1], a[2]); break;
+	case BinarySceneOp::LookAt:
+		pbrtLookAt(a[0], a[1], a[2], a[3], a[4], a[5], a[6], a[7], a[8]);
+		break;
+	case BinarySceneOp::ConcatTransform:
+		std::copy(a, a + 16, tr);
+		pbrtConcatTransform(tr);
+		break;
+	case BinarySceneOp::Transform:
+		std::copy(a, a + 16, tr);
+		pbrtTransform(tr);
+		break;
+	case BinarySceneOp::CoordinateSystem: pbrtCoordinateSystem(s[0]); break;
+	case BinarySceneOp::CoordSysTransform: pbrtCoordSysTransform(s[0]); break;
+	case BinarySceneOp::ActiveTransformAll: pbrtActiveTransformAll(); break;
+	case BinarySceneOp::ActiveTransformEndTime:
+		pbrtActiveTransformEndTime();
+		break;
+	case BinarySceneOp::ActiveTransformStartTime:
+		pbrtActiveTransformStartTime();
+		break;
+	case BinarySceneOp::TransformTimes: pbrtTransformTimes(a[0], a[1]); break;
+	case BinarySceneOp::PixelFilter: pbrtPixelFilter(s[0], params); break;
+	case BinarySceneOp::Film: pbrtFilm(s[0], params); break;
+	case BinarySceneOp::Sampler: pbrtSampler(s[0], params); break;
+	case BinarySceneOp::Accelerator: pbrtAccelerator(s[0], params); break;
+	case BinarySceneOp::Integrator: pbrtIntegrator(s[0], params); break;
+	case BinarySceneOp::Camera: pbrtCamera(s[0], params); break;
+	case BinarySceneOp::MakeNamedMedium:
+		pbrtMakeNamedMedium(s[0], params);
+		break;
+	case BinarySceneOp::MediumInterface: pbrtMediumInterface(s[0], s[1]); break;
+	case BinarySceneOp::WorldBegin: pbrtWorldBegin(); break;
+	case BinarySceneOp::AttributeBegin: pbrtAttributeBegin(); break;
+	case BinarySceneOp::AttributeEnd: pbrtAttributeEnd(); break;
+	case BinarySceneOp::TransformBegin: pbrtTransformBegin(); break;
+	case BinarySceneOp::TransformEnd: pbrtTransformEnd(); break;
+	case BinarySceneOp::Texture: pbrtTexture(s[0], s[1], s[2], params); break;
+	case BinarySceneOp::Material: pbrtMaterial(s[0], params); break;
+	case BinarySceneOp::MakeNamedMaterial:
+		pbrtMakeNamedMaterial(s[0], params);
+		break;
+	case BinarySceneOp::NamedMaterial: pbrtNamedMaterial(s[0]); break;
+	case BinarySceneOp::LightSource: pbrtLightSource(s[0], params); break;
+	case BinarySceneOp::AreaLightSource:
+		pbrtAreaLightSource(s[0], params);
+		break;
+	case BinarySceneOp::Shape: pbrtShape(s[0], params); break;
+	case BinarySceneOp::ReverseOrientation: pbrtReverseOrientation(); break;
+	case BinarySceneOp::ObjectBegin: pbrtObjectBegin(s[0]); break;
+	case BinarySceneOp::ObjectEnd: pbrtObjectEnd(); break;
+	case BinarySceneOp::ObjectInstance: pbrtObjectInstance(s[0]); break;
+	case BinarySceneOp::WorldEnd: pbrtWorldEnd(); break;
+	default: break;
+	}
+}
+
+// BinarySceneWriter Method Definitions
+BinarySceneWriter::BinarySceneWriter(FILE *file) : file(file) {
+#ifdef PBRT_IS_WINDOWS
+	_setmode(_fileno(file), _O_BINARY);
+#endif
+	BinarySceneHeader header;
+	memcpy(header.magic, binarySceneMagic, sizeof(header.magic));
+	header.version = binarySceneVersion;
+	header.byteOrder = binarySceneByteOrder;
+	header.floatSize = sizeof(Float);
+	header.spectrumSize = sizeof(Spectrum);
+	record.assign((const char *)&header, (const char *)(&header + 1));
+	if (fwrite(record.data(), record.size(), 1, file) != 1) failed = true;
+}
+
+BinarySceneWriter::~BinarySceneWriter() {
+	if (fflush(file) != 0) failed = true;
+	if (failed) Error("Unable to write the binary scene.");
+}
+
+void BinarySceneWriter::Write(BinarySceneOp op,
+	const std::vector<Float> &args, const std::vector<std::string> &strings,
+	const ParamSet *params) {
+	// Keep track of the text file each call came from for error messages
+	ErrorLocation location = CurrentErrorLocation();
+	if (location.filename != sourceFile) {
+		sourceFile = location.filename;
+		WriteRecord(BinarySceneOp::SourceFile, 0, {}, {sourceFile}, nullptr);
+	}
+	WriteRecord(op, location.line, args, strings, params);
+}
+
+void BinarySceneWriter::WriteRecord(BinarySceneOp op, int line,
+	const std::vector<Float> &args, const std::vector<std::string> &strings,
+	const ParamSet *params) {
+	BinarySceneRecord header;
+	header.op = (uint32_t)op;
+	header.line = (uint32_t)line;
+	header.nArgs = (uint32_t)args.size();
+	header.nStrings = (uint32_t)strings.size();
+	header.nParams = 0;
+	record.assign(sizeof(header), 0);
+	Append(args.data(), args.size() * sizeof(Float));
+	Align();
+	for (const std::string &str : strings) AppendString(str);
+	if (params) {
+		AppendItems((uint32_t)BinaryParamType::Int, params->ints);
+		AppendItems((uint32_t)BinaryParamType::Bool, params->bools);
+		AppendItems((uint32_t)BinaryParamType::Float, params->floats);
+		AppendItems((uint32_t)BinaryParamType::Point2, params->point2fs);
+		AppendItems((uint32_t)BinaryParamType::Vector2, params->vector2fs);
+		AppendItems((uint32_t)BinaryParamType::Point3, params->point3fs);
+		AppendItems((uint32_t)BinaryParamType::Vector3, params->vector3fs);
+		AppendItems((uint32_t)BinaryParamType::Normal, params->normals);
+		AppendItems((uint32_t)BinaryParamType::Spectrum, params->spectra);
+		AppendItems((uint32_t)BinaryParamType::String, params->strings);
+		AppendItems((uint32_t)BinaryParamType::Texture, params->textures);
+		header.nParams = (uint32_t)(params->ints.size() +
+			params->bools.size() + params->floats.size() +
+			params->point2fs.size() + params->vector2fs.size() +
+			params->point3fs.size() + params->vector3fs.size() +
+			params->normals.size() + params->spectra.size() +
+			params->strings.size() + params->textures.size());
+	}
+	header.size = (uint32_t)record.size();
+	memcpy(record.data(), &header, sizeof(header));
+	if (!failed && fwrite(record.data(), record.size(), 1, file) != 1)
+		failed = true;
+}
+
+template <typename T>
+void BinarySceneWriter::AppendItems(uint32_t type,
+	const std::vector<std::shared_ptr<ParamSetItem<T>>> &items) {
+	for (const auto &item : items) {
+		Append(type);
+		Append((uint32_t)item->nValues);
+		AppendString(item->name);
+		AppendValues(item->values, item->nValues);
+		Align();
+	}
+}
+
+void BinarySceneWriter::AppendValues(const bool *values, int nValues) {
+	for (int i = 0; i < nValues; ++i) record.push_back(values[i] ? 1 : 0);
+}
+
+void BinarySceneWriter::AppendValues(const std::string *values, int nValues) {
+	for (int i = 0; i < nValues; ++i) AppendString(values[i]);
+}
+
+void BinarySceneWriter::Append(const void *data, size_t size) {
+	record.insert(record.end(), (const char *)data, (const char *)data + size);
+}
+
+void BinarySceneWriter::AppendString(const std::string &str) {
+	Append((uint32_t)str.size());
+	Append(str.data(), str.size());
+	Align();
+}
+
+void BinarySceneWriter::Align() {
+	record.resize((record.size() + 7) & ~(size_t)7, 0);
+}
+
+// Binary Scene Function Definitions
+bool IsBinarySceneFile(const std::string &filename) {
+	FILE *f = fopen(filename.c_str(), "rb");
+	if (!f) return false;
+	char magic[sizeof(binarySceneMagic)];
+	bool isBinary = fread(magic, sizeof(magic), 1, f) == 1 &&
+		memcmp(magic, binarySceneMagic, sizeof(magic)) == 0;
+	fclose(f);
+	return isBinary;
+}
+
+bool ParseBinarySceneFile(const std::string &filename) {
+	extern std::string current_file;
+	extern int line_num;
+
+	// Map the file; parameter arrays refer to the mapping while it's in use
+	std::shared_ptr<MappedFile> file = std::make_shared<MappedFile>(filename);
+	if (!file->IsValid()) return false;
+	const char *data = file->Data();
+	size_t size = file->Size();
+	BinarySceneHeader header;
+	if (size < sizeof(header)) {
+		Error("Binary scene \"%s\" is truncated.", filename.c_str());
+		return true;
+	}
+	memcpy(&header, data, sizeof(header));
+	if (header.version != binarySceneVersion ||
+		header.byteOrder != binarySceneByteOrder ||
+		header.floatSize != sizeof(Float) ||
+		header.spectrumSize != sizeof(Spectrum)) {
+		Error("Binary scene \"%s\" was written by an incompatible build of "
+			"pbrt. Convert its text scene again.", filename.c_str());
+		return true;
+	}
+
+	// Replay the file's records through the API
+	SetSearchDirectory(DirectoryContaining(filename));
+	current_file = filename;
+	size_t offset = sizeof(header);
+	while (offset < size) {
+		BinarySceneRecord record;
+		const Float *args;
+		std::vector<std::string> strings;
+		ParamSet params;
+		if (!ReadRecord(data + offset, size - offset, file, &record, &args,
+			&strings, &params)) {
+			line_num = 0;
+			Error("Binary scene \"%s\" is corrupt at offset %" PRIu64 ".",
+				filename.c_str(), (uint64_t)offset);
+			break;
+		}
+
+		BinarySceneOp op = (BinarySceneOp)record.op;
+		if (op == BinarySceneOp::SourceFile)
+			current_file = strings[0].empty() ? filename : strings[0];
+		else {
+			line_num = (int)record.line;
+			ReplayCall(op, args, strings, params);
+			++nBinarySceneCalls;
+		}
+		offset += record.size;
+	}
+	current_file = "";
+	line_num = 0;
+	return true;
+}
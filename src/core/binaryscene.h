@@ -0,0 +1,84 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_BINARYSCENE_H
+#define PBRT_CORE_BINARYSCENE_H
+#include "stdafx.h"
+
+// core/binaryscene.h*
+#include "pbrt.h"
+#include <stdio.h>
+#include <vector>
+
+// Binary Scene Declarations
+
+// The calls a binary scene file records, in the order of api.h; their
+// values are stored in the file and must not change
+enum class BinarySceneOp : uint32_t {
+	Identity, Translate, Rotate, Scale, LookAt, ConcatTransform, Transform,
+	CoordinateSystem, CoordSysTransform, ActiveTransformAll,
+	ActiveTransformEndTime, ActiveTransformStartTime, TransformTimes,
+	PixelFilter, Film, Sampler, Accelerator, Integrator, Camera,
+	MakeNamedMedium, MediumInterface, WorldBegin, AttributeBegin,
+	AttributeEnd, TransformBegin, TransformEnd, Texture, Material,
+	MakeNamedMaterial, NamedMaterial, LightSource, AreaLightSource, Shape,
+	ReverseOrientation, ObjectBegin, ObjectEnd, ObjectInstance, WorldEnd,
+	// Names the scene file that the following calls came from
+	SourceFile,
+	Count
+};
+
+// Records API calls to a binary scene file, which _ParseBinarySceneFile()_
+// replays through the same calls. Parameter arrays are stored in a form
+// that the loader can use in place from a memory mapping.
+class BinarySceneWriter {
+public:
+	// BinarySceneWriter Public Methods
+	BinarySceneWriter(FILE *file);
+	~BinarySceneWriter();
+	void Write(BinarySceneOp op, const std::vector<Float> &args = {},
+		const std::vector<std::string> &strings = {},
+		const ParamSet *params = nullptr);
+
+private:
+	// BinarySceneWriter Private Methods
+	void WriteRecord(BinarySceneOp op, int line,
+		const std::vector<Float> &args, const std::vector<std::string> &strings,
+		const ParamSet *params);
+	template <typename T>
+	void AppendItems(uint32_t type,
+		const std::vector<std::shared_ptr<ParamSetItem<T>>> &items);
+	template <typename T>
+	void AppendValues(const T *values, int nValues) {
+		Append(values, nValues * sizeof(T));
+	}
+	void AppendValues(const bool *values, int nValues);
+	void AppendValues(const std::string *values, int nValues);
+	void Append(const void *data, size_t size);
+	void Append(uint32_t value) { Append(&value, sizeof(value)); }
+	void AppendString(const std::string &str);
+	void Align();
+
+	// BinarySceneWriter Private Data
+	FILE *file;
+	std::vector<char> record;
+	std::string sourceFile;
+	bool failed = false;
+};
+
+bool IsBinarySceneFile(const std::string &filename);
+bool ParseBinarySceneFile(const std::string &filename);
+
+#endif  // PBRT_CORE_BINARYSCENE_H
@@ -48,7 +48,27 @@ const char *findWordEnd(const char *buf) {
     return buf;
 }
 
+static PBRT_THREAD_LOCAL const ErrorLocation *threadErrorLocation;
+
 // Error Reporting Functions
+ErrorLocation CurrentErrorLocation() {
+    extern int line_num;
+    extern std::string current_file;
+    ErrorLocation location;
+    if (line_num != 0) {
+        location.filename = current_file;
+        location.line = line_num;
+    }
+    return location;
+}
+
+ErrorLocationScope::ErrorLocationScope(const ErrorLocation &location)
+    : previous(threadErrorLocation) {
+    threadErrorLocation = &location;
+}
+
+ErrorLocationScope::~ErrorLocationScope() { threadErrorLocation = previous; }
+
 static void processError(const char *format, va_list args,
                          const char *errorType, int disposition) {
     // Report error
@@ -60,12 +80,12 @@ static void processError(const char *format, va_list args,
     std::string errorString;
 
     // Print line and position in input file, if available
-    extern int line_num;
-    if (line_num != 0) {
-        extern std::string current_file;
-        errorString += current_file;
+    ErrorLocation location =
+        threadErrorLocation ? *threadErrorLocation : CurrentErrorLocation();
+    if (location.line != 0) {
+        errorString += location.filename;
         char buf[16];
-        sprintf(buf, "(%d): ", line_num);
+        sprintf(buf, "(%d): ", location.line);
         errorString += buf;
     }
 
@@ -55,4 +55,27 @@ void Warning(const char *, ...) PRINTF_FUNC;
 void Error(const char *, ...) PRINTF_FUNC;
 void Severe(const char *, ...) PRINTF_FUNC;
 
+// A position in the scene description that errors are reported at
+struct ErrorLocation {
+    std::string filename;
+    int line = 0;
+};
+
+// Returns the parser's current position
+ErrorLocation CurrentErrorLocation();
+
+// While it exists, errors reported by the calling thread are attributed to
+// _location_ rather than to the parser's current position, for work that
+// runs after the parser has moved past the directive it belongs to
+class ErrorLocationScope {
+  public:
+    ErrorLocationScope(const ErrorLocation &location);
+    ~ErrorLocationScope();
+    ErrorLocationScope(const ErrorLocationScope &) = delete;
+    ErrorLocationScope &operator=(const ErrorLocationScope &) = delete;
+
+  private:
+    const ErrorLocation *previous;
+};
+
 #endif  // PBRT_CORE_ERROR_H
@@ -59,6 +59,7 @@ class Film {
 	virtual std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds) = 0;
 	virtual void MergeFilmTile(std::unique_ptr<FilmTile> tile) = 0;
 	virtual void SetImage(const Spectrum *img) const = 0;
+	virtual void SetImage(const IntegrationResult *img) const = 0;
 	virtual void AddSplat(const Point2f &p, const IntegrationResult &v) = 0;
 	virtual void WriteImage(Float splatScale = 1.) = 0;
 
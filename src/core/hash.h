@@ -0,0 +1,69 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_HASH_H
+#define PBRT_CORE_HASH_H
+#include "stdafx.h"
+
+// core/hash.h*
+#include "pbrt.h"
+#include <string.h>
+
+// Hashing Declarations
+
+// MurmurHash64A by Austin Appleby (public domain). Hashes are stable across
+// runs and platforms of the same endianness, so they may key files on disk.
+inline uint64_t MurmurHash64A(const void *key, size_t len, uint64_t seed) {
+	const uint64_t m = 0xc6a4a7935bd1e995ull;
+	const int r = 47;
+	uint64_t h = seed ^ (len * m);
+	const unsigned char *data = (const unsigned char *)key;
+	const unsigned char *end = data + 8 * (len / 8);
+	for (; data != end; data += 8) {
+		uint64_t k;
+		memcpy(&k, data, sizeof(uint64_t));
+		k *= m;
+		k ^= k >> r;
+		k *= m;
+		h ^= k;
+		h *= m;
+	}
+	switch (len & 7) {
+	case 7: h ^= uint64_t(data[6]) << 48;
+	case 6: h ^= uint64_t(data[5]) << 40;
+	case 5: h ^= uint64_t(data[4]) << 32;
+	case 4: h ^= uint64_t(data[3]) << 24;
+	case 3: h ^= uint64_t(data[2]) << 16;
+	case 2: h ^= uint64_t(data[1]) << 8;
+	case 1:
+		h ^= uint64_t(data[0]);
+		h *= m;
+	}
+	h ^= h >> r;
+	h *= m;
+	h ^= h >> r;
+	return h;
+}
+
+inline uint64_t HashBuffer(const void *data, size_t bytes, uint64_t seed = 0) {
+	return MurmurHash64A(data, bytes, seed);
+}
+
+template <typename T>
+inline uint64_t HashValue(const T &value, uint64_t seed = 0) {
+	return HashBuffer(&value, sizeof(T), seed);
+}
+
+#endif  // PBRT_CORE_HASH_H
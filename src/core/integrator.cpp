@@ -44,74 +44,46 @@
 #include "progressreporter.h"
 #include "camera.h"
 #include "stats.h"
+#include "tilescheduler.h"
+#include "opticalpath.h"
 STAT_COUNTER("Integrator/Camera rays traced", nCameraRays);
 STAT_TIMER("Time/Rendering", renderingTime);
 
 // Integrator Method Definitions
 Integrator::~Integrator() {}
 
-// Integrator Utility Functions
-Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
-                                MemoryArena &arena, Sampler &sampler,
-                                const std::vector<int> &nLightSamples,
-                                bool handleMedia, Float *pathLength) {
-    ProfilePhase p(Prof::DirectLighting);
-    Spectrum L(0.f);
-    for (size_t j = 0; j < scene.lights.size(); ++j) {
-        // Accumulate contribution of _j_th light to _L_
-        const std::shared_ptr<Light> &light = scene.lights[j];
-        int nSamples = nLightSamples[j];
-        const Point2f *uLightArray = sampler.Get2DArray(nSamples);
-        const Point2f *uScatteringArray = sampler.Get2DArray(nSamples);
-        if (!uLightArray || !uScatteringArray) {
-            // Use a single sample for illumination from _light_
-            Point2f uLight = sampler.Get2D();
-            Point2f uScattering = sampler.Get2D();
-            L += EstimateDirect(it, uScattering, *light, uLight, scene, sampler,
-                                arena, handleMedia, false, pathLength);
-        } else {
-            // Estimate direct lighting using sample arrays
-            Spectrum Ld(0.f);
-            for (int k = 0; k < nSamples; ++k)
-                Ld += EstimateDirect(it, uScatteringArray[k], *light,
-                                     uLightArray[k], scene, sampler, arena,
-                                     handleMedia, false, pathLength);
-            L += Ld / nSamples;
-			if (pathLength != nullptr) *pathLength /= nSamples;
-        }
-    }
-    return L;
-}
+// Integrator Local Definitions
 
-Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
-                               MemoryArena &arena, Sampler &sampler,
-                               bool handleMedia, Float *pathLength) {
-    ProfilePhase p(Prof::DirectLighting);
-    // Randomly choose a single light to sample, _light_
-    int nLights = int(scene.lights.size());
-    if (nLights == 0) return Spectrum(0.f);
-    int lightNum = std::min((int)(sampler.Get1D() * nLights), nLights - 1);
-    const std::shared_ptr<Light> &light = scene.lights[lightNum];
-    Point2f uLight = sampler.Get2D();
-    Point2f uScattering = sampler.Get2D();
-    return (Float)nLights * EstimateDirect(it, uScattering, *light, uLight,
-                                           scene, sampler, arena, handleMedia, 
-										   false, pathLength);
-}
-
-Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
-                        const Light &light, const Point2f &uLight,
-                        const Scene &scene, Sampler &sampler,
-                        MemoryArena &arena, bool handleMedia, bool specular,
-						Float *pathLength) {
+// Both sampling strategies of one _EstimateDirect()_ estimate, with the rays
+// whose results they depend on not yet traced
+struct DirectSample {
+    const Light *light = nullptr;
+    // Light sampling contribution, which counts if _visibility_ passes
+    bool traceLight = false;
+    VisibilityTester visibility;
+    Spectrum Ld;
+    // BSDF sampling weight for whatever light _scatteringRay_ finds
+    bool traceScattering = false;
+    Ray scatteringRay;
+    Spectrum fScattering;
+};
+
+// Samples the light and the BSDF or phase function for _EstimateDirect()_
+// without tracing any rays, which consumes no sampler dimensions
+static void SampleDirect(const Interaction &it, const Point2f &uScattering,
+                         const Light &light, const Point2f &uLight,
+                         bool specular, Float *pathLength, DirectSample *ds) {
     BxDFType bsdfFlags =
         specular ? BSDF_ALL : BxDFType(BSDF_ALL & ~BSDF_SPECULAR);
-    Spectrum Ld(0.f);
+    ds->light = &light;
     // Sample light source with multiple importance sampling
     Vector3f wi;
     Float lightPdf = 0, scatteringPdf = 0;
-    VisibilityTester visibility;
-    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf, &visibility, pathLength);
+    Spectrum Li = light.Sample_Li(it, uLight, &wi, &lightPdf,
+                                  &ds->visibility, pathLength);
+    // Report the optical length of the segment to the light, which travels
+    // through whatever lies on the side of _it_ that _wi_ leaves by
+    if (pathLength) *pathLength *= SegmentRefractiveIndex(it, wi);
     if (lightPdf > 0 && !Li.IsBlack()) {
         // Compute BSDF or phase function's value for light sample
         Spectrum f;
@@ -129,21 +101,13 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
             scatteringPdf = p;
         }
         if (!f.IsBlack()) {
-            // Compute effect of visibility for light source sample
-            if (handleMedia)
-                Li *= visibility.Tr(scene, sampler);
-            else if (!visibility.Unoccluded(scene))
-                Li = Spectrum(0.f);
-
-            // Add light's contribution to reflected radiance
-            if (!Li.IsBlack()) {
-                if (IsDeltaLight(light.flags))
-                    Ld += f * Li / lightPdf;
-                else {
-                    Float weight =
-                        PowerHeuristic(1, lightPdf, 1, scatteringPdf);
-                    Ld += f * Li * weight / lightPdf;
-                }
+            // Compute light's contribution if its sample is visible
+            ds->traceLight = true;
+            if (IsDeltaLight(light.flags))
+                ds->Ld = f * Li / lightPdf;
+            else {
+                Float weight = PowerHeuristic(1, lightPdf, 1, scatteringPdf);
+                ds->Ld = f * Li * weight / lightPdf;
             }
         }
     }
@@ -172,31 +136,161 @@ Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
             Float weight = 1;
             if (!sampledSpecular) {
                 lightPdf = light.Pdf_Li(it, wi);
-                if (lightPdf == 0) return Ld;
+                if (lightPdf == 0) return;
                 weight = PowerHeuristic(1, scatteringPdf, 1, lightPdf);
             }
-
-            // Find intersection and compute transmittance
-            SurfaceInteraction lightIsect;
-            Ray ray = it.SpawnRay(wi);
-            Spectrum Tr(1.f);
-            bool foundSurfaceInteraction =
-                handleMedia ? scene.IntersectTr(ray, sampler, &lightIsect, &Tr)
-                            : scene.Intersect(ray, &lightIsect);
-
-            // Add light contribution from material sampling
-            Spectrum Li(0.f);
-            if (foundSurfaceInteraction) {
-                if (lightIsect.primitive->GetAreaLight() == &light)
-                    Li = lightIsect.Le(-wi);
-            } else
-                Li = light.Le(ray);
-            if (!Li.IsBlack()) Ld += f * Li * Tr * weight / scatteringPdf;
+            ds->traceScattering = true;
+            ds->scatteringRay = it.SpawnRay(wi);
+            ds->fScattering = f * weight / scatteringPdf;
         }
     }
+}
+
+// Returns the radiance from _ds_'s light found along its scattering ray
+static Spectrum ScatteredLight(const DirectSample &ds,
+                               bool foundSurfaceInteraction,
+                               const SurfaceInteraction &lightIsect) {
+    if (!foundSurfaceInteraction) return ds.light->Le(ds.scatteringRay);
+    if (lightIsect.primitive->GetAreaLight() == ds.light)
+        return lightIsect.Le(-ds.scatteringRay.d);
+    return Spectrum(0.f);
+}
+
+// Traces _ds_'s rays one at a time and returns its direct lighting estimate
+static Spectrum TraceDirect(const DirectSample &ds, const Scene &scene,
+                            Sampler &sampler, bool handleMedia) {
+    Spectrum Ld(0.f);
+    if (ds.traceLight) {
+        // Compute effect of visibility for light source sample
+        if (handleMedia)
+            Ld += ds.Ld * ds.visibility.Tr(scene, sampler);
+        else if (ds.visibility.Unoccluded(scene))
+            Ld += ds.Ld;
+    }
+    if (ds.traceScattering) {
+        // Find intersection and compute transmittance
+        SurfaceInteraction lightIsect;
+        Ray ray = ds.scatteringRay;
+        Spectrum Tr(1.f);
+        bool foundSurfaceInteraction =
+            handleMedia ? scene.IntersectTr(ray, sampler, &lightIsect, &Tr)
+                        : scene.Intersect(ray, &lightIsect);
+        Spectrum Li = ScatteredLight(ds, foundSurfaceInteraction, lightIsect);
+        if (!Li.IsBlack()) Ld += ds.fScattering * Li * Tr;
+    }
     return Ld;
 }
 
+// Integrator Utility Functions
+Spectrum UniformSampleAllLights(const Interaction &it, const Scene &scene,
+                                MemoryArena &arena, Sampler &sampler,
+                                const std::vector<int> &nLightSamples,
+                                bool handleMedia, Float *pathLength) {
+    ProfilePhase p(Prof::DirectLighting);
+    // Sample every light before tracing, so that the light and scattering
+    // rays of all the samples can be traced together
+    size_t maxSamples = 0;
+    for (size_t j = 0; j < scene.lights.size(); ++j)
+        maxSamples += std::max(1, nLightSamples[j]);
+    DirectSample *samples = arena.Alloc<DirectSample>(maxSamples);
+    Float *weights = arena.Alloc<Float>(maxSamples);
+    int nSamplesTotal = 0;
+    for (size_t j = 0; j < scene.lights.size(); ++j) {
+        // Sample the _j_th light
+        const std::shared_ptr<Light> &light = scene.lights[j];
+        int nSamples = nLightSamples[j];
+        const Point2f *uLightArray = sampler.Get2DArray(nSamples);
+        const Point2f *uScatteringArray = sampler.Get2DArray(nSamples);
+        if (!uLightArray || !uScatteringArray) {
+            // Use a single sample for illumination from _light_
+            Point2f uLight = sampler.Get2D();
+            Point2f uScattering = sampler.Get2D();
+            weights[nSamplesTotal] = 1;
+            SampleDirect(it, uScattering, *light, uLight, false, pathLength,
+                         &samples[nSamplesTotal++]);
+        } else {
+            // Estimate direct lighting using sample arrays
+            for (int k = 0; k < nSamples; ++k) {
+                weights[nSamplesTotal] = (Float)1 / nSamples;
+                SampleDirect(it, uScatteringArray[k], *light, uLightArray[k],
+                             false, pathLength, &samples[nSamplesTotal++]);
+            }
+			if (pathLength != nullptr) *pathLength /= nSamples;
+        }
+    }
+
+    Spectrum L(0.f);
+    if (handleMedia) {
+        // Transmittance is estimated along one ray at a time
+        for (int i = 0; i < nSamplesTotal; ++i)
+            L += weights[i] * TraceDirect(samples[i], scene, sampler, true);
+        return L;
+    }
+
+    // Gather the rays of all samples and trace them as streams
+    Ray *lightRays = arena.Alloc<Ray>(nSamplesTotal);
+    Ray *scatteringRays = arena.Alloc<Ray>(nSamplesTotal);
+    int *lightRaySample = arena.Alloc<int>(nSamplesTotal);
+    int *scatteringRaySample = arena.Alloc<int>(nSamplesTotal);
+    int nLightRays = 0, nScatteringRays = 0;
+    for (int i = 0; i < nSamplesTotal; ++i) {
+        const DirectSample &ds = samples[i];
+        if (ds.traceLight) {
+            lightRaySample[nLightRays] = i;
+            lightRays[nLightRays++] =
+                ds.visibility.P0().SpawnRayTo(ds.visibility.P1());
+        }
+        if (ds.traceScattering) {
+            scatteringRaySample[nScatteringRays] = i;
+            scatteringRays[nScatteringRays++] = ds.scatteringRay;
+        }
+    }
+    bool *occluded = arena.Alloc<bool>(nLightRays);
+    scene.IntersectPStream(nLightRays, lightRays, occluded);
+    SurfaceInteraction *lightIsects =
+        arena.Alloc<SurfaceInteraction>(nScatteringRays);
+    bool *hits = arena.Alloc<bool>(nScatteringRays);
+    scene.IntersectStream(nScatteringRays, scatteringRays, lightIsects, hits);
+
+    // Add up the contributions that the traced rays allow
+    for (int i = 0; i < nLightRays; ++i)
+        if (!occluded[i])
+            L += weights[lightRaySample[i]] * samples[lightRaySample[i]].Ld;
+    for (int i = 0; i < nScatteringRays; ++i) {
+        const DirectSample &ds = samples[scatteringRaySample[i]];
+        Spectrum Li = ScatteredLight(ds, hits[i], lightIsects[i]);
+        if (!Li.IsBlack())
+            L += weights[scatteringRaySample[i]] * ds.fScattering * Li;
+    }
+    return L;
+}
+
+Spectrum UniformSampleOneLight(const Interaction &it, const Scene &scene,
+                               MemoryArena &arena, Sampler &sampler,
+                               bool handleMedia, Float *pathLength) {
+    ProfilePhase p(Prof::DirectLighting);
+    // Randomly choose a single light to sample, _light_
+    int nLights = int(scene.lights.size());
+    if (nLights == 0) return Spectrum(0.f);
+    int lightNum = std::min((int)(sampler.Get1D() * nLights), nLights - 1);
+    const std::shared_ptr<Light> &light = scene.lights[lightNum];
+    Point2f uLight = sampler.Get2D();
+    Point2f uScattering = sampler.Get2D();
+    return (Float)nLights * EstimateDirect(it, uScattering, *light, uLight,
+                                           scene, sampler, arena, handleMedia, 
+										   false, pathLength);
+}
+
+Spectrum EstimateDirect(const Interaction &it, const Point2f &uScattering,
+                        const Light &light, const Point2f &uLight,
+                        const Scene &scene, Sampler &sampler,
+                        MemoryArena &arena, bool handleMedia, bool specular,
+						Float *pathLength) {
+    DirectSample ds;
+    SampleDirect(it, uScattering, light, uLight, specular, pathLength, &ds);
+    return TraceDirect(ds, scene, sampler, handleMedia);
+}
+
 std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
     const Scene &scene) {
     if (scene.lights.size() == 0) return nullptr;
@@ -211,93 +305,93 @@ std::unique_ptr<Distribution1D> ComputeLightPowerDistribution(
 void SamplerIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
     Preprocess(scene, *sampler);
+    if (adaptive.enabled) {
+        // Distribute samples in passes until the pixels converge
+        StatTimer timer(&renderingTime);
+        RenderAdaptive(adaptive, camera->film, *sampler,
+                       [&](const Point2i &pixel, Sampler &tileSampler,
+                           FilmTile &filmTile, MemoryArena &arena) {
+                           CameraSample cameraSample =
+                               tileSampler.GetCameraSample(pixel);
+                           RayDifferential ray;
+                           Float rayWeight = GenerateCameraRay(
+                               cameraSample, tileSampler, &ray);
+                           return RenderSample(scene, cameraSample, ray,
+                                               rayWeight, nullptr, 0,
+                                               tileSampler, filmTile, arena);
+                       });
+        camera->film->WriteImage();
+        return;
+    }
     // Render image tiles in parallel
 
-    // Compute number of tiles, _nTiles_, to use for parallel rendering
+    // Partition the sample bounds into tiles for parallel rendering
     Bounds2i sampleBounds = camera->film->GetSampleBounds();
-    Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
-    Point2i nTiles((sampleExtent.x + tileSize - 1) / tileSize,
-                   (sampleExtent.y + tileSize - 1) / tileSize);
-    ProgressReporter reporter(nTiles.x * nTiles.y, "Rendering");
+    TileScheduler tiles(sampleBounds);
+    ProgressReporter reporter(sampleBounds.Area(), "Rendering");
     {
         StatTimer timer(&renderingTime);
-        ParallelFor2D([&](Point2i tile) {
-            // Render section of image corresponding to _tile_
+        tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
+            // Render section of image corresponding to _tileBounds_
 
             // Allocate _MemoryArena_ for tile
             MemoryArena arena;
 
             // Get sampler instance for tile
-            int seed = tile.y * nTiles.x + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-
-            // Compute sample bounds for tile
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            std::unique_ptr<Sampler> tileSampler =
+                sampler->Clone(tiles.Seed(tileBounds));
 
             // Get _FilmTile_ for tile
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
 
             // Loop over pixels in tile to render them
+            const int64_t samplesPerPixel = tileSampler->samplesPerPixel;
             for (Point2i pixel : tileBounds) {
                 {
                     ProfilePhase pp(Prof::StartPixel);
                     tileSampler->StartPixel(pixel);
                 }
-                do {
-                    // Initialize _CameraSample_ for current sample
-                    CameraSample cameraSample =
-                        tileSampler->GetCameraSample(pixel);
-
-                    // Generate camera ray for current sample
-                    RayDifferential ray;
-                    Float rayWeight =
-                        camera->GenerateRayDifferential(cameraSample, &ray);
-                    ray.ScaleDifferentials(
-                        1 / std::sqrt((Float)tileSampler->samplesPerPixel));
-                    ++nCameraRays;
-
-                    // Evaluate radiance along camera ray
-					IntegrationResult result;
-                    if (rayWeight > 0) result = Li(ray, scene, *tileSampler, arena);
-
-                    // Issue warning if unexpected radiance value returned
-                    if (result.L.HasNaNs()) {
-                        Error(
-                            "Not-a-number radiance value returned "
-                            "for image sample.  Setting to black.");
-                        result.L = Spectrum(0.f);
-                    } else if (result.L.y() < -1e-5) {
-                        Error(
-                            "Negative luminance value, %f, returned "
-                            "for image sample.  Setting to black.",
-                            result.L.y());
-                        result.L = Spectrum(0.f);
-                    } else if (std::isinf(result.L.y())) {
-                        Error(
-                            "Infinite luminance value returned "
-                            "for image sample.  Setting to black.");
-                        result.L = Spectrum(0.f);
+                for (int64_t first = 0; first < samplesPerPixel;
+                     first += MaxRayPacketSize) {
+                    // Trace the camera rays of a batch of the pixel's samples
+                    // as one packet
+                    int n = (int)std::min((int64_t)MaxRayPacketSize,
+                                          samplesPerPixel - first);
+                    CameraSample cameraSamples[MaxRayPacketSize];
+                    RayDifferential rays[MaxRayPacketSize];
+                    Float rayWeights[MaxRayPacketSize];
+                    Ray packet[MaxRayPacketSize];
+                    for (int i = 0; i < n; ++i) {
+                        tileSampler->SetSampleNumber(first + i);
+                        cameraSamples[i] = tileSampler->GetCameraSample(pixel);
+                        rayWeights[i] = GenerateCameraRay(
+                            cameraSamples[i], *tileSampler, &rays[i]);
+                        packet[i] = rays[i];
                     }
+                    PrefetchedIntersections prefetched(scene, n, packet);
 
-                    // Add camera ray's contribution to image
-                    filmTile->AddSample(cameraSample.pFilm, result, rayWeight);
+                    // Render the batch's samples from their camera rays
+                    for (int i = 0; i < n; ++i) {
+                        // Move the sampler past the camera sample's
+                        // dimensions; the sample generated above is used
+                        tileSampler->SetSampleNumber(first + i);
+                        tileSampler->GetCameraSample(pixel);
+                        RenderSample(scene, cameraSamples[i], rays[i],
+                                     rayWeights[i], &prefetched, i,
+                                     *tileSampler, *filmTile, arena);
 
-                    // Free _MemoryArena_ memory from computing image sample
-                    // value
-                    arena.Reset();
-                } while (tileSampler->StartNextSample());
+                        // Free _MemoryArena_ memory from computing image
+                        // sample value
+                        arena.Reset();
+                    }
+                }
             }
 
             // Merge image tile into _Film_
             camera->film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
-        }, nTiles);
+            reporter.Update(tileBounds.Area());
+        });
         reporter.Done();
     }
 
@@ -305,6 +399,52 @@ void SamplerIntegrator::Render(const Scene &scene) {
     camera->film->WriteImage();
 }
 
+IntegrationResult SamplerIntegrator::RenderSample(
+    const Scene &scene, const CameraSample &cameraSample,
+    const RayDifferential &ray, Float rayWeight,
+    PrefetchedIntersections *prefetched, int prefetchedIndex,
+    Sampler &tileSampler, FilmTile &filmTile, MemoryArena &arena) const {
+    // Evaluate radiance along camera ray, whose first intersection is taken
+    // from _prefetched_ when it was traced ahead
+    IntegrationResult result;
+    if (prefetched) prefetched->Select(prefetchedIndex);
+    if (rayWeight > 0) result = Li(ray, scene, tileSampler, arena);
+    if (prefetched) prefetched->Select(-1);
+
+    // Issue warning if unexpected radiance value returned
+    if (result.L.HasNaNs()) {
+        Error(
+            "Not-a-number radiance value returned "
+            "for image sample.  Setting to black.");
+        result.L = Spectrum(0.f);
+    } else if (result.L.y() < -1e-5) {
+        Error(
+            "Negative luminance value, %f, returned "
+            "for image sample.  Setting to black.",
+            result.L.y());
+        result.L = Spectrum(0.f);
+    } else if (std::isinf(result.L.y())) {
+        Error(
+            "Infinite luminance value returned "
+            "for image sample.  Setting to black.");
+        result.L = Spectrum(0.f);
+    }
+
+    // Add camera ray's contribution to image
+    filmTile.AddSample(cameraSample.pFilm, result, rayWeight);
+    return result;
+}
+
+Float SamplerIntegrator::GenerateCameraRay(const CameraSample &cameraSample,
+                                           const Sampler &tileSampler,
+                                           RayDifferential *ray) const {
+    Float rayWeight = camera->GenerateRayDifferential(cameraSample, ray);
+    ++nCameraRays;
+    ray->ScaleDifferentials(1 /
+                            std::sqrt((Float)tileSampler.samplesPerPixel));
+    return rayWeight;
+}
+
 Spectrum SamplerIntegrator::SpecularReflect(
     const RayDifferential &ray, const SurfaceInteraction &isect,
     const Scene &scene, Sampler &sampler, MemoryArena &arena, int depth) const {
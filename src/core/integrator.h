@@ -48,6 +48,7 @@
 #include "sampler.h"
 #include "material.h"
 #include "integrationresult.h"
+#include "adaptive.h"
 
 // Integrator Declarations
 class Integrator {
@@ -83,6 +84,9 @@ class SamplerIntegrator : public Integrator {
         : camera(camera), sampler(sampler) {}
     virtual void Preprocess(const Scene &scene, Sampler &sampler) {}
     void Render(const Scene &scene);
+    void SetAdaptiveSampling(const AdaptiveSamplingOptions &options) {
+        adaptive = options;
+    }
     virtual IntegrationResult Li(const RayDifferential &ray, const Scene &scene,
                         Sampler &sampler, MemoryArena &arena,
                         int depth = 0) const = 0;
@@ -100,8 +104,22 @@ class SamplerIntegrator : public Integrator {
     std::shared_ptr<const Camera> camera;
 
   private:
+    // SamplerIntegrator Private Methods
+    Float GenerateCameraRay(const CameraSample &cameraSample,
+                            const Sampler &tileSampler,
+                            RayDifferential *ray) const;
+    IntegrationResult RenderSample(const Scene &scene,
+                                   const CameraSample &cameraSample,
+                                   const RayDifferential &ray,
+                                   Float rayWeight,
+                                   PrefetchedIntersections *prefetched,
+                                   int prefetchedIndex, Sampler &sampler,
+                                   FilmTile &filmTile,
+                                   MemoryArena &arena) const;
+
     // SamplerIntegrator Private Data
     std::shared_ptr<Sampler> sampler;
+    AdaptiveSamplingOptions adaptive;
 };
 
 #endif  // PBRT_CORE_INTEGRATOR_H
@@ -0,0 +1,64 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// core/mappedfile.cpp*
+#include "mappedfile.h"
+#ifdef PBRT_IS_WINDOWS
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// MappedFile Method Definitions
+#ifdef PBRT_IS_WINDOWS
+MappedFile::MappedFile(const std::string &filename) {
+	HANDLE f = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ,
+		nullptr, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, nullptr);
+	if (f == INVALID_HANDLE_VALUE) return;
+	file = f;
+	LARGE_INTEGER fileSize;
+	if (!GetFileSizeEx(f, &fileSize) || fileSize.QuadPart == 0) return;
+	mapping = CreateFileMappingA(f, nullptr, PAGE_READONLY, 0, 0, nullptr);
+	if (!mapping) return;
+	data = (const char *)MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	if (data) size = (size_t)fileSize.QuadPart;
+}
+
+MappedFile::~MappedFile() {
+	if (data) UnmapViewOfFile(data);
+	if (mapping) CloseHandle(mapping);
+	if (file) CloseHandle(file);
+}
+#else
+MappedFile::MappedFile(const std::string &filename) {
+	int fd = open(filename.c_str(), O_RDONLY);
+	if (fd == -1) return;
+	// Empty files can't be mapped, and are never useful to the callers
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		void *p = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED) {
+			data = (const char *)p;
+			size = (size_t)st.st_size;
+		}
+	}
+	// The mapping keeps the file's contents alive after it is closed
+	close(fd);
+}
+
+MappedFile::~MappedFile() {
+	if (data) munmap((void *)data, size);
+}
+#endif  // PBRT_IS_WINDOWS
@@ -0,0 +1,48 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_MAPPEDFILE_H
+#define PBRT_CORE_MAPPEDFILE_H
+#include "stdafx.h"
+
+// core/mappedfile.h*
+#include "pbrt.h"
+#include <string>
+
+// MappedFile Declarations
+
+// A read-only view of a whole file mapped into memory. The data stays
+// valid, and is paged in on demand, for the lifetime of the object.
+class MappedFile {
+public:
+	// MappedFile Public Methods
+	MappedFile(const std::string &filename);
+	~MappedFile();
+	MappedFile(const MappedFile &) = delete;
+	MappedFile &operator=(const MappedFile &) = delete;
+	bool IsValid() const { return data != nullptr; }
+	const char *Data() const { return data; }
+	size_t Size() const { return size; }
+
+private:
+	// MappedFile Private Data
+	const char *data = nullptr;
+	size_t size = 0;
+#ifdef PBRT_IS_WINDOWS
+	void *file = nullptr, *mapping = nullptr;
+#endif
+};
+
+#endif  // PBRT_CORE_MAPPEDFILE_H
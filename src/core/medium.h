@@ -67,11 +67,15 @@ inline Float PhaseHG(Float cosTheta, Float g) {
 class Medium {
   public:
     // Medium Interface
+    Medium(Float eta = 1) : eta(eta) {}
     virtual ~Medium() {}
     virtual Spectrum Tr(const Ray &ray, Sampler &sampler) const = 0;
     virtual Spectrum Sample(const Ray &ray, Sampler &sampler,
                             MemoryArena &arena,
                             MediumInteraction *mi) const = 0;
+
+    // Medium Public Data
+    const Float eta;
 };
 
 // HenyeyGreenstein Declarations
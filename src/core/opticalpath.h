@@ -0,0 +1,54 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_OPTICALPATH_H
+#define PBRT_CORE_OPTICALPATH_H
+#include "stdafx.h"
+
+// core/opticalpath.h*
+#include "pbrt.h"
+#include "interaction.h"
+#include "medium.h"
+#include "reflection.h"
+
+// Optical Path Length Inline Functions
+
+// Path lengths are accumulated as optical path lengths: each segment's
+// Euclidean length is scaled by the refractive index it is travelled in, so
+// that binned lengths stay proportional to time of flight.
+inline Float MediumRefractiveIndex(const Medium *medium) {
+	return medium ? medium->eta : 1;
+}
+
+// Returns the refractive index along the segment leaving _isect_ in
+// direction _w_. Dielectric materials report their interior index through
+// _BSDF::eta_; leaving into the interior side of such a surface travels in
+// that material, otherwise the adjoining medium determines the index.
+inline Float SegmentRefractiveIndex(const SurfaceInteraction &isect,
+	const Vector3f &w) {
+	if (isect.bsdf && isect.bsdf->eta != 1 && Dot(w, isect.n) < 0)
+		return isect.bsdf->eta;
+	return MediumRefractiveIndex(isect.GetMedium(w));
+}
+
+// Returns the refractive index along the segment leaving the surface or
+// medium interaction _it_ in direction _w_.
+inline Float SegmentRefractiveIndex(const Interaction &it, const Vector3f &w) {
+	if (it.IsSurfaceInteraction())
+		return SegmentRefractiveIndex((const SurfaceInteraction &)it, w);
+	return MediumRefractiveIndex(it.GetMedium(w));
+}
+
+#endif  // PBRT_CORE_OPTICALPATH_H
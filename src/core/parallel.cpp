@@ -36,16 +36,228 @@
 #include "parallel.h"
 #include "memory.h"
 #include "stats.h"
-#include <list>
+#include <deque>
+#include <fstream>
 #include <thread>
 #include <condition_variable>
+#ifdef PBRT_IS_LINUX
+#include <pthread.h>
+#include <sched.h>
+#endif
+#ifdef PBRT_IS_WINDOWS
+#include <windows.h>
+#endif
+
+STAT_COUNTER("Parallel/Tasks run", tasksRun);
+STAT_COUNTER("Parallel/Tasks stolen", tasksStolen);
 
 // Parallel Local Definitions
 static std::vector<std::thread> threads;
-static bool shutdownThreads = false;
-class ParallelForLoop;
-static ParallelForLoop *workList = nullptr;
-static std::mutex workListMutex;
+static std::atomic<bool> shutdownThreads(false);
+
+// NUMA topology: the logical CPUs of each node. Discovered from sysfs on
+// Linux; elsewhere all CPUs are treated as a single node.
+static std::vector<std::vector<int>> numaNodeCPUs;
+static std::once_flag numaTopologyFlag;
+
+static std::vector<int> ParseCPUList(const std::string &list) {
+    // Parse lists such as "0-7,16-23"
+    std::vector<int> cpus;
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t end = list.find(',', pos);
+        if (end == std::string::npos) end = list.size();
+        std::string range = list.substr(pos, end - pos);
+        size_t dash = range.find('-');
+        if (!range.empty() && isdigit(range[0])) {
+            int first = atoi(range.c_str());
+            int last = dash == std::string::npos
+                           ? first
+                           : atoi(range.c_str() + dash + 1);
+            for (int cpu = first; cpu <= last; ++cpu) cpus.push_back(cpu);
+        }
+        pos = end + 1;
+    }
+    return cpus;
+}
+
+static void DiscoverNumaTopology() {
+#ifdef PBRT_IS_LINUX
+    // Only CPUs that the process may run on are used, which excludes those
+    // outside a _taskset_ mask or a container's cpuset
+    cpu_set_t allowed;
+    bool haveAllowed =
+        sched_getaffinity(0, sizeof(allowed), &allowed) == 0;
+    auto isAllowed = [&](int cpu) {
+        return !haveAllowed || (cpu < CPU_SETSIZE && CPU_ISSET(cpu, &allowed));
+    };
+    for (int node = 0;; ++node) {
+        std::ifstream file("/sys/devices/system/node/node" +
+                           std::to_string(node) + "/cpulist");
+        std::string list;
+        if (!file || !std::getline(file, list)) break;
+        std::vector<int> cpus;
+        for (int cpu : ParseCPUList(list))
+            if (isAllowed(cpu)) cpus.push_back(cpu);
+        if (!cpus.empty()) numaNodeCPUs.push_back(cpus);
+    }
+    if (numaNodeCPUs.empty() && haveAllowed) {
+        // No NUMA information in sysfs: use the allowed CPUs as one node
+        std::vector<int> cpus;
+        for (int cpu = 0; cpu < CPU_SETSIZE; ++cpu)
+            if (CPU_ISSET(cpu, &allowed)) cpus.push_back(cpu);
+        if (!cpus.empty()) numaNodeCPUs.push_back(cpus);
+    }
+#endif
+    if (numaNodeCPUs.empty()) {
+        std::vector<int> cpus;
+        for (unsigned int cpu = 0; cpu < std::thread::hardware_concurrency();
+             ++cpu)
+            cpus.push_back(cpu);
+        if (!cpus.empty()) numaNodeCPUs.push_back(cpus);
+    }
+}
+
+static const std::vector<std::vector<int>> &NumaTopology() {
+    std::call_once(numaTopologyFlag, DiscoverNumaTopology);
+    return numaNodeCPUs;
+}
+
+static bool PinCurrentThread(const std::vector<int> &cpus) {
+#if defined(PBRT_IS_LINUX)
+    cpu_set_t cpuSet;
+    CPU_ZERO(&cpuSet);
+    for (int cpu : cpus)
+        if (cpu < CPU_SETSIZE) CPU_SET(cpu, &cpuSet);
+    return pthread_setaffinity_np(pthread_self(), sizeof(cpuSet), &cpuSet) ==
+           0;
+#elif defined(PBRT_IS_WINDOWS)
+    DWORD_PTR mask = 0;
+    for (int cpu : cpus)
+        if (cpu < 8 * (int)sizeof(DWORD_PTR)) mask |= (DWORD_PTR)1 << cpu;
+    return mask != 0 && SetThreadAffinityMask(GetCurrentThread(), mask) != 0;
+#else
+    return false;
+#endif
+}
+
+// Pins the current thread to a single CPU, spreading consecutive thread
+// indices over the nodes' CPUs in order so that neighbouring indices share
+// a node.
+static void PinThread(int tIndex) {
+    const std::vector<std::vector<int>> &topology = NumaTopology();
+    int nCPUs = 0;
+    for (const std::vector<int> &cpus : topology) nCPUs += cpus.size();
+    // Leave the thread unpinned if no usable CPUs were found
+    if (nCPUs == 0) return;
+    int slot = tIndex % nCPUs;
+    for (size_t node = 0; node < topology.size(); ++node) {
+        if (slot < (int)topology[node].size()) {
+            if (PinCurrentThread({topology[node][slot]}))
+                ThreadNumaNode = node;
+            else
+                Warning("Unable to set affinity of thread %d.", tIndex);
+            return;
+        }
+        slot -= topology[node].size();
+    }
+}
+
+// Each worker thread owns a Chase-Lev deque of tasks. The owner pushes and
+// pops at the bottom without locking, so nested work stays cache-warm;
+// other threads steal from the top, which holds the oldest and typically
+// largest pieces of work, with a single compare-and-swap.
+class TaskQueue {
+  public:
+    // TaskQueue Public Methods
+    TaskQueue() : array(new TaskArray(64)) {}
+    ~TaskQueue() {
+        while (Task *task = Pop()) delete task;
+        delete array.load();
+        for (TaskArray *old : retired) delete old;
+    }
+    void Push(Task *task) {
+        // Only the owning thread may call _Push()_ and _Pop()_
+        int64_t b = bottom.load(std::memory_order_relaxed);
+        int64_t t = top.load(std::memory_order_acquire);
+        TaskArray *a = array.load(std::memory_order_relaxed);
+        if (b - t >= a->size) {
+            // Thieves may still be reading the old array, so keep it until
+            // the queue is destroyed
+            TaskArray *grown = new TaskArray(2 * a->size);
+            for (int64_t i = t; i < b; ++i) grown->Put(i, a->Get(i));
+            retired.push_back(a);
+            a = grown;
+            array.store(a, std::memory_order_release);
+        }
+        a->Put(b, task);
+        std::atomic_thread_fence(std::memory_order_release);
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    Task *Pop() {
+        int64_t b = bottom.load(std::memory_order_relaxed) - 1;
+        TaskArray *a = array.load(std::memory_order_relaxed);
+        bottom.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t t = top.load(std::memory_order_relaxed);
+        if (t > b) {
+            bottom.store(b + 1, std::memory_order_relaxed);
+            return nullptr;
+        }
+        Task *task = a->Get(b);
+        if (t == b) {
+            // Race thieves for the last task
+            if (!top.compare_exchange_strong(t, t + 1,
+                                             std::memory_order_seq_cst,
+                                             std::memory_order_relaxed))
+                task = nullptr;
+            bottom.store(b + 1, std::memory_order_relaxed);
+        }
+        return task;
+    }
+    Task *Steal() {
+        int64_t t = top.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        int64_t b = bottom.load(std::memory_order_acquire);
+        if (t >= b) return nullptr;
+        TaskArray *a = array.load(std::memory_order_acquire);
+        Task *task = a->Get(t);
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst,
+                                         std::memory_order_relaxed))
+            return nullptr;
+        return task;
+    }
+
+  private:
+    // TaskQueue Private Data
+    struct TaskArray {
+        TaskArray(int64_t size)
+            : size(size), tasks(new std::atomic<Task *>[size]) {}
+        Task *Get(int64_t i) const {
+            return tasks[i & (size - 1)].load(std::memory_order_relaxed);
+        }
+        void Put(int64_t i, Task *task) {
+            tasks[i & (size - 1)].store(task, std::memory_order_relaxed);
+        }
+        const int64_t size;
+        std::unique_ptr<std::atomic<Task *>[]> tasks;
+    };
+    std::atomic<int64_t> top{0}, bottom{0};
+    std::atomic<TaskArray *> array;
+    std::vector<TaskArray *> retired;
+};
+
+static std::unique_ptr<TaskQueue[]> taskQueues;
+static int nTaskQueues = 0;
+// Queue of the current thread, if it owns one
+static PBRT_THREAD_LOCAL TaskQueue *localQueue;
+// Tasks enqueued by threads that do not own a queue
+static std::mutex sharedTasksMutex;
+static std::deque<Task *> sharedTasks;
+static std::atomic<int64_t> queuedTasks(0);
+static std::mutex sleepMutex;
+static std::condition_variable workAvailableCondition;
+
 class ParallelForLoop {
   public:
     // ParallelForLoop Public Methods
@@ -63,6 +275,38 @@ class ParallelForLoop {
           profilerState(profilerState) {
         nX = count.x;
     }
+    void RunChunks() {
+        while (true) {
+            // Claim the next chunk of loop iterations
+            int64_t indexStart = nextIndex.fetch_add(chunkSize);
+            if (indexStart >= maxIndex) return;
+            int64_t indexEnd = std::min(indexStart + chunkSize, maxIndex);
+
+            // Run loop indices in _[indexStart, indexEnd)_
+            for (int64_t index = indexStart; index < indexEnd; ++index) {
+                uint32_t oldState = ::profilerState;
+                ::profilerState = profilerState;
+                if (func1D) {
+                    func1D(index);
+                }
+                // Handle other types of loops
+                else {
+                    Assert(func2D);
+                    func2D(Point2i(index % nX, index / nX));
+                }
+                ::profilerState = oldState;
+            }
+            if ((completedIndices += indexEnd - indexStart) >= maxIndex) {
+                std::lock_guard<std::mutex> lock(finishedMutex);
+                finishedCondition.notify_all();
+            }
+        }
+    }
+    bool Finished() const { return completedIndices >= maxIndex; }
+    void WaitUntilFinished() {
+        std::unique_lock<std::mutex> lock(finishedMutex);
+        finishedCondition.wait(lock, [this]() { return Finished(); });
+    }
 
   public:
     // ParallelForLoop Private Data
@@ -70,68 +314,113 @@ class ParallelForLoop {
     std::function<void(Point2i)> func2D;
     const int64_t maxIndex;
     const int chunkSize, profilerState;
-    int64_t nextIndex = 0;
-    int activeWorkers = 0;
-    ParallelForLoop *next = nullptr;
+    std::atomic<int64_t> nextIndex{0}, completedIndices{0};
     int nX = -1;
-
-    // ParallelForLoop Private Methods
-    bool Finished() const {
-        return nextIndex >= maxIndex && activeWorkers == 0;
-    }
+    std::mutex finishedMutex;
+    std::condition_variable finishedCondition;
 };
 
-static std::condition_variable workListCondition;
 static void workerThreadFunc(int tIndex) {
     ThreadIndex = tIndex;
-    std::unique_lock<std::mutex> lock(workListMutex);
+    localQueue = &taskQueues[tIndex];
+    if (PbrtOptions.affinity) PinThread(tIndex);
     while (!shutdownThreads) {
-        if (!workList) {
-            // Sleep until there are more tasks to run
-            workListCondition.wait(lock);
-        } else {
-            // Get work from _workList_ and run loop iterations
-            ParallelForLoop &loop = *workList;
+        if (RunPendingTask()) continue;
+        // Sleep until there are more tasks to run
+        std::unique_lock<std::mutex> lock(sleepMutex);
+        workAvailableCondition.wait(
+            lock, []() { return shutdownThreads || queuedTasks > 0; });
+    }
+    // Report thread statistics at worker thread exit
+    ReportThreadStats();
+}
 
-            // Run a chunk of loop iterations for _loop_
+static void LaunchWorkerThreads() {
+    if (taskQueues) return;
+    Assert(PbrtOptions.nThreads != 1);
+    ThreadIndex = 0;
+    if (PbrtOptions.affinity) PinThread(0);
+    nTaskQueues = NumSystemCores();
+    taskQueues.reset(new TaskQueue[nTaskQueues]);
+    localQueue = &taskQueues[0];
+    for (int i = 0; i < nTaskQueues - 1; ++i)
+        threads.push_back(std::thread(workerThreadFunc, i + 1));
+}
 
-            // Find the set of loop iterations to run next
-            int64_t indexStart = loop.nextIndex;
-            int64_t indexEnd =
-                std::min(indexStart + loop.chunkSize, loop.maxIndex);
+static void NotifyWorkers(bool all) {
+    // Taking _sleepMutex_ orders the wakeup after a sleeping worker's
+    // predicate check, so the notification cannot be lost
+    { std::lock_guard<std::mutex> lock(sleepMutex); }
+    if (all)
+        workAvailableCondition.notify_all();
+    else
+        workAvailableCondition.notify_one();
+}
 
-            // Update _loop_ to reflect iterations this thread will run
-            loop.nextIndex = indexEnd;
-            if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-            loop.activeWorkers++;
+static void PushTask(Task *task) {
+    if (localQueue)
+        localQueue->Push(task);
+    else {
+        std::lock_guard<std::mutex> lock(sharedTasksMutex);
+        sharedTasks.push_back(task);
+    }
+}
 
-            // Run loop indices in _[indexStart, indexEnd)_
-            lock.unlock();
-            for (int64_t index = indexStart; index < indexEnd; ++index) {
-                int oldState = profilerState;
-                profilerState = loop.profilerState;
-                if (loop.func1D) {
-                    loop.func1D(index);
-                }
-                // Handle other types of loops
-                else {
-                    Assert(loop.func2D);
-                    loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-                }
-                profilerState = oldState;
-            }
-            lock.lock();
+// Parallel Definitions
+void EnqueueTask(Task task) {
+    // Run the task immediately if not using threads
+    if (PbrtOptions.nThreads == 1) {
+        task();
+        return;
+    }
+    LaunchWorkerThreads();
+    PushTask(new Task(std::move(task)));
+    ++queuedTasks;
+    NotifyWorkers(false);
+}
 
-            // Update _loop_ to reflect completion of iterations
-            loop.activeWorkers--;
-            if (loop.Finished()) workListCondition.notify_all();
+bool RunPendingTask() {
+    if (nTaskQueues == 0) return false;
+    // Prefer the most recent task of this thread, otherwise steal one
+    Task *task = localQueue ? localQueue->Pop() : nullptr;
+    for (int i = 1; !task && i <= nTaskQueues; ++i) {
+        TaskQueue &victim = taskQueues[(ThreadIndex + i) % nTaskQueues];
+        if (&victim == localQueue) continue;
+        task = victim.Steal();
+        if (task) ++tasksStolen;
+    }
+    if (!task) {
+        std::lock_guard<std::mutex> lock(sharedTasksMutex);
+        if (!sharedTasks.empty()) {
+            task = sharedTasks.front();
+            sharedTasks.pop_front();
         }
     }
-    // Report thread statistics at worker thread exit
-    ReportThreadStats();
+    if (!task) return false;
+    --queuedTasks;
+    ++tasksRun;
+    (*task)();
+    delete task;
+    return true;
+}
+
+static void RunParallelForLoop(std::shared_ptr<ParallelForLoop> loop) {
+    // Offer the loop to other threads, at most one helper per thread
+    int64_t nChunks = (loop->maxIndex + loop->chunkSize - 1) / loop->chunkSize;
+    int nHelpers = (int)std::min<int64_t>(nTaskQueues - 1, nChunks - 1);
+    for (int i = 0; i < nHelpers; ++i)
+        PushTask(new Task([loop]() { loop->RunChunks(); }));
+    queuedTasks += nHelpers;
+    if (nHelpers > 0) NotifyWorkers(true);
+
+    // Run loop iterations in the current thread, then wait for the ones
+    // that other threads claimed. The wait doesn't run other tasks: they
+    // would share this thread's _ThreadIndex_ and per-thread scratch memory
+    // with the loop body that is still in progress further up the stack.
+    loop->RunChunks();
+    loop->WaitUntilFinished();
 }
 
-// Parallel Definitions
 void ParallelFor(const std::function<void(int64_t)> &func, int64_t count,
                  int chunkSize) {
     // Run iterations immediately if not using threads or if _count_ is small
@@ -141,70 +430,18 @@ void ParallelFor(const std::function<void(int64_t)> &func, int64_t count,
     }
 
     // Launch worker threads if needed
-    if (threads.size() == 0) {
-        Assert(PbrtOptions.nThreads != 1);
-        ThreadIndex = 0;
-        for (int i = 0; i < NumSystemCores() - 1; ++i)
-            threads.push_back(std::thread(workerThreadFunc, i + 1));
-    }
+    LaunchWorkerThreads();
 
-    // Create and enqueue _ParallelForLoop_ for this loop
-    ParallelForLoop loop(func, count, chunkSize, CurrentProfilerState());
-    workListMutex.lock();
-    loop.next = workList;
-    workList = &loop;
-    workListMutex.unlock();
-
-    // Notify worker threads of work to be done
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            int oldState = profilerState;
-            profilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                Assert(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            profilerState = oldState;
-        }
-        lock.lock();
-
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
-    }
+    // Create _ParallelForLoop_ and share it with the worker threads
+    RunParallelForLoop(std::make_shared<ParallelForLoop>(
+        func, count, chunkSize, CurrentProfilerState()));
 }
 
 PBRT_THREAD_LOCAL int ThreadIndex;
+PBRT_THREAD_LOCAL int ThreadNumaNode;
 int MaxThreadIndex() {
-    if (PbrtOptions.nThreads != 1) {
-        // Launch worker threads if needed
-        if (threads.size() == 0) {
-            Assert(PbrtOptions.nThreads != 1);
-            ThreadIndex = 0;
-            for (int i = 0; i < NumSystemCores() - 1; ++i)
-                threads.push_back(std::thread(workerThreadFunc, i + 1));
-        }
-    }
+    // Launch worker threads if needed
+    if (PbrtOptions.nThreads != 1) LaunchWorkerThreads();
     return 1 + threads.size();
 }
 
@@ -215,56 +452,30 @@ void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count) {
         return;
     }
     // Launch worker threads if needed
-    if (threads.size() == 0) {
-        Assert(PbrtOptions.nThreads != 1);
-        ThreadIndex = 0;
-        for (int i = 0; i < NumSystemCores() - 1; ++i)
-            threads.push_back(std::thread(workerThreadFunc, i + 1));
-    }
+    LaunchWorkerThreads();
 
-    ParallelForLoop loop(std::move(func), count, CurrentProfilerState());
-    {
-        std::lock_guard<std::mutex> lock(workListMutex);
-        loop.next = workList;
-        workList = &loop;
-    }
+    RunParallelForLoop(std::make_shared<ParallelForLoop>(
+        std::move(func), count, CurrentProfilerState()));
+}
 
-    std::unique_lock<std::mutex> lock(workListMutex);
-    workListCondition.notify_all();
-
-    // Help out with parallel loop iterations in the current thread
-    while (!loop.Finished()) {
-        // Run a chunk of loop iterations for _loop_
-
-        // Find the set of loop iterations to run next
-        int64_t indexStart = loop.nextIndex;
-        int64_t indexEnd = std::min(indexStart + loop.chunkSize, loop.maxIndex);
-
-        // Update _loop_ to reflect iterations this thread will run
-        loop.nextIndex = indexEnd;
-        if (loop.nextIndex == loop.maxIndex) workList = loop.next;
-        loop.activeWorkers++;
-
-        // Run loop indices in _[indexStart, indexEnd)_
-        lock.unlock();
-        for (int64_t index = indexStart; index < indexEnd; ++index) {
-            int oldState = profilerState;
-            profilerState = loop.profilerState;
-            if (loop.func1D) {
-                loop.func1D(index);
-            }
-            // Handle other types of loops
-            else {
-                Assert(loop.func2D);
-                loop.func2D(Point2i(index % loop.nX, index / loop.nX));
-            }
-            profilerState = oldState;
-        }
-        lock.lock();
+int NumaNodeCount() {
+    // Threads only stay on one node when they are pinned
+    return PbrtOptions.affinity ? std::max(1, (int)NumaTopology().size())
+                                : 1;
+}
 
-        // Update _loop_ to reflect completion of iterations
-        loop.activeWorkers--;
+void RunOnNumaNode(int node, const std::function<void()> &func) {
+    if (NumaNodeCount() == 1) {
+        func();
+        return;
     }
+    // Run _func_ on a thread bound to _node_, so that memory it first
+    // touches is placed on that node
+    std::thread thread([&]() {
+        if (PinCurrentThread(NumaTopology()[node])) ThreadNumaNode = node;
+        func();
+    });
+    thread.join();
 }
 
 int NumSystemCores() {
@@ -273,15 +484,21 @@ int NumSystemCores() {
 }
 
 void TerminateWorkerThreads() {
-    if (threads.size() == 0) return;
+    if (!taskQueues) return;
 
     {
-        std::lock_guard<std::mutex> lock(workListMutex);
+        std::lock_guard<std::mutex> lock(sleepMutex);
         shutdownThreads = true;
-        workListCondition.notify_all();
     }
+    workAvailableCondition.notify_all();
 
     for (std::thread &thread : threads) thread.join();
     threads.erase(threads.begin(), threads.end());
+    taskQueues.reset();
+    localQueue = nullptr;
+    nTaskQueues = 0;
+    for (Task *task : sharedTasks) delete task;
+    sharedTasks.clear();
+    queuedTasks = 0;
     shutdownThreads = false;
 }
@@ -45,6 +45,10 @@
 #include <mutex>
 #include <functional>
 #include <atomic>
+#include <chrono>
+#include <future>
+#include <memory>
+#include <thread>
 
 // Parallel Declarations
 class AtomicFloat {
@@ -79,9 +83,64 @@ class AtomicFloat {
 void ParallelFor(const std::function<void(int64_t)> &func, int64_t count,
                  int chunkSize = 1);
 extern PBRT_THREAD_LOCAL int ThreadIndex;
+extern PBRT_THREAD_LOCAL int ThreadNumaNode;
 void ParallelFor2D(std::function<void(Point2i)> func, const Point2i &count);
 int MaxThreadIndex();
 int NumSystemCores();
+int NumaNodeCount();
+void RunOnNumaNode(int node, const std::function<void()> &func);
 void TerminateWorkerThreads();
+typedef std::function<void()> Task;
+void EnqueueTask(Task task);
+bool RunPendingTask();
+
+// Future Declarations
+template <typename T>
+class Future {
+  public:
+    // Future Public Methods
+    Future() {}
+    Future(std::future<T> future) : future(std::move(future)) {}
+    Future(std::future<T> future, std::shared_ptr<std::atomic<bool>> started,
+           Task run)
+        : future(std::move(future)),
+          started(std::move(started)),
+          run(std::move(run)) {}
+    bool IsReady() const {
+        return future.wait_for(std::chrono::seconds(0)) ==
+               std::future_status::ready;
+    }
+    T Get() {
+        // Run the task here if no thread has started it yet; otherwise it is
+        // already running, so block until it is done. Waiting threads don't
+        // run unrelated tasks, which would reuse their _ThreadIndex_.
+        if (started && !started->exchange(true)) run();
+        return future.get();
+    }
+
+  private:
+    // Future Private Data
+    std::future<T> future;
+    std::shared_ptr<std::atomic<bool>> started;
+    Task run;
+};
+
+// Runs _func_ asynchronously on the worker threads. Tasks may be spawned
+// from inside _ParallelFor_ bodies and other tasks.
+template <typename F>
+auto Async(F func) -> Future<decltype(func())> {
+    typedef decltype(func()) T;
+    std::shared_ptr<std::packaged_task<T()>> task =
+        std::make_shared<std::packaged_task<T()>>(std::move(func));
+    // Whichever of a worker and _Future::Get()_ starts the task first runs it
+    std::shared_ptr<std::atomic<bool>> started =
+        std::make_shared<std::atomic<bool>>(false);
+    Task run = [task]() { (*task)(); };
+    Future<T> result(task->get_future(), started, run);
+    EnqueueTask([started, run]() {
+        if (!started->exchange(true)) run();
+    });
+    return result;
+}
 
 #endif  // PBRT_CORE_PARALLEL_H
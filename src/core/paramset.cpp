@@ -35,75 +35,178 @@
 // core/paramset.cpp*
 #include "paramset.h"
 #include "floatfile.h"
+#include "hash.h"
 #include "textures/constant.h"
 
 // ParamSet Macros
-#define ADD_PARAM_TYPE(T, vec) \
-    (vec).emplace_back(new ParamSetItem<T>(name, std::move(values), nValues));
-#define LOOKUP_PTR(vec)             \
-    for (const auto &v : vec)       \
-        if (v->name == name) {      \
-            *nValues = v->nValues;  \
-            v->lookedUp = true;     \
-            return v->values.get(); \
-        }                           \
-    return nullptr
-#define LOOKUP_ONE(vec)                           \
-    for (const auto &v : vec)                     \
-        if (v->name == name && v->nValues == 1) { \
-            v->lookedUp = true;                   \
-            return v->values[0];                  \
-        }                                         \
-    return d
+#define ADD_PARAM_TYPE(T, vec, type)                      \
+    AddItem(vec, type, std::make_shared<ParamSetItem<T>>( \
+                           name, std::move(values), nValues))
+#define ADD_SHARED_PARAM_TYPE(T, vec, type)               \
+    AddItem(vec, type, std::make_shared<ParamSetItem<T>>( \
+                           name, values, nValues, std::move(storage)))
+#define LOOKUP_PTR(vec, type)                   \
+    const auto *item = Lookup(vec, type, name); \
+    if (!item) return nullptr;                  \
+    *nValues = item->nValues;                   \
+    item->lookedUp = true;                      \
+    return item->values
+#define LOOKUP_ONE(vec, type)                  \
+    const auto *item = Lookup(vec, type, name); \
+    if (!item || item->nValues != 1) return d;  \
+    item->lookedUp = true;                      \
+    return item->values[0]
+
+// ParamSet Local Functions
+static uint32_t HashName(uint8_t type, const std::string &name) {
+    return (uint32_t)HashBuffer(name.data(), name.size(), type);
+}
 
 // ParamSet Methods
+template <typename T>
+void ParamSet::AddItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                       ParamType type, std::shared_ptr<ParamSetItem<T>> item) {
+    items.push_back(std::move(item));
+    // Small sets are scanned until they first outgrow the threshold; once
+    // the index exists it must cover every item, even after erasures
+    if (++nItems <= maxScannedItems && index.empty()) return;
+    // Growing the index also indexes the new item
+    if (2 * (nIndexed + 1) > index.size())
+        RebuildIndex(std::max<size_t>(4 * maxScannedItems, 2 * index.size()));
+    else
+        InsertSlot(type, items.back()->name, (int)items.size() - 1);
+}
+
+template <typename T>
+bool ParamSet::EraseItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                         ParamType type, const std::string &name) {
+    int position = FindPosition(items, type, name);
+    if (position < 0) return false;
+    items.erase(items.begin() + position);
+    --nItems;
+    // The items after it have moved, so index them all again
+    if (!index.empty()) RebuildIndex(index.size());
+    return true;
+}
+
+template <typename T>
+const ParamSetItem<T> *ParamSet::Lookup(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+    ParamType type, const std::string &name) const {
+    int position = FindPosition(items, type, name);
+    return position < 0 ? nullptr : items[position].get();
+}
+
+template <typename T>
+inline int ParamSet::FindPosition(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+    ParamType type, const std::string &name) const {
+    if (items.size() <= maxScannedItems) {
+        for (size_t i = 0; i < items.size(); ++i)
+            if (items[i]->name == name) return (int)i;
+        return -1;
+    }
+    return FindIndexedPosition(items, type, name);
+}
+
+template <typename T>
+int ParamSet::FindIndexedPosition(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+    ParamType type, const std::string &name) const {
+    uint32_t hash = HashName((uint8_t)type, name);
+    size_t mask = index.size() - 1;
+    for (size_t i = hash & mask; index[i].type != ParamType::None;
+         i = (i + 1) & mask) {
+        const IndexSlot &slot = index[i];
+        if (slot.hash == hash && slot.type == type &&
+            items[slot.position]->name == name)
+            return slot.position;
+    }
+    return -1;
+}
+
+template <typename T>
+void ParamSet::IndexItems(
+    const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+    ParamType type) {
+    for (size_t i = 0; i < items.size(); ++i)
+        InsertSlot(type, items[i]->name, (int)i);
+}
+
+void ParamSet::InsertSlot(ParamType type, const std::string &name,
+                          int position) {
+    uint32_t hash = HashName((uint8_t)type, name);
+    size_t mask = index.size() - 1;
+    size_t i = hash & mask;
+    while (index[i].type != ParamType::None) i = (i + 1) & mask;
+    index[i].hash = hash;
+    index[i].type = type;
+    index[i].position = position;
+    ++nIndexed;
+}
+
+void ParamSet::RebuildIndex(size_t nSlots) {
+    index.assign(nSlots, IndexSlot());
+    nIndexed = 0;
+    IndexItems(bools, ParamType::Bool);
+    IndexItems(ints, ParamType::Int);
+    IndexItems(floats, ParamType::Float);
+    IndexItems(point2fs, ParamType::Point2);
+    IndexItems(vector2fs, ParamType::Vector2);
+    IndexItems(point3fs, ParamType::Point3);
+    IndexItems(vector3fs, ParamType::Vector3);
+    IndexItems(normals, ParamType::Normal);
+    IndexItems(spectra, ParamType::Spectrum);
+    IndexItems(strings, ParamType::String);
+    IndexItems(textures, ParamType::Texture);
+}
+
 void ParamSet::AddFloat(const std::string &name,
                         std::unique_ptr<Float[]> values, int nValues) {
     EraseFloat(name);
-    floats.emplace_back(
-        new ParamSetItem<Float>(name, std::move(values), nValues));
+    ADD_PARAM_TYPE(Float, floats, ParamType::Float);
 }
 
 void ParamSet::AddInt(const std::string &name, std::unique_ptr<int[]> values,
                       int nValues) {
     EraseInt(name);
-    ADD_PARAM_TYPE(int, ints);
+    ADD_PARAM_TYPE(int, ints, ParamType::Int);
 }
 
 void ParamSet::AddBool(const std::string &name, std::unique_ptr<bool[]> values,
                        int nValues) {
     EraseBool(name);
-    ADD_PARAM_TYPE(bool, bools);
+    ADD_PARAM_TYPE(bool, bools, ParamType::Bool);
 }
 
 void ParamSet::AddPoint2f(const std::string &name,
                           std::unique_ptr<Point2f[]> values, int nValues) {
     ErasePoint2f(name);
-    ADD_PARAM_TYPE(Point2f, point2fs);
+    ADD_PARAM_TYPE(Point2f, point2fs, ParamType::Point2);
 }
 
 void ParamSet::AddVector2f(const std::string &name,
                            std::unique_ptr<Vector2f[]> values, int nValues) {
     EraseVector2f(name);
-    ADD_PARAM_TYPE(Vector2f, vector2fs);
+    ADD_PARAM_TYPE(Vector2f, vector2fs, ParamType::Vector2);
 }
 
 void ParamSet::AddPoint3f(const std::string &name,
                           std::unique_ptr<Point3f[]> values, int nValues) {
     ErasePoint3f(name);
-    ADD_PARAM_TYPE(Point3f, point3fs);
+    ADD_PARAM_TYPE(Point3f, point3fs, ParamType::Point3);
 }
 
 void ParamSet::AddVector3f(const std::string &name,
                            std::unique_ptr<Vector3f[]> values, int nValues) {
     EraseVector3f(name);
-    ADD_PARAM_TYPE(Vector3f, vector3fs);
+    ADD_PARAM_TYPE(Vector3f, vector3fs, ParamType::Vector3);
 }
 
 void ParamSet::AddNormal3f(const std::string &name,
                            std::unique_ptr<Normal3f[]> values, int nValues) {
     EraseNormal3f(name);
-    ADD_PARAM_TYPE(Normal3f, normals);
+    ADD_PARAM_TYPE(Normal3f, normals, ParamType::Normal);
 }
 
 void ParamSet::AddRGBSpectrum(const std::string &name,
@@ -115,7 +218,7 @@ void ParamSet::AddRGBSpectrum(const std::string &name,
     for (int i = 0; i < nValues; ++i) s[i] = Spectrum::FromRGB(&values[3 * i]);
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    AddItem(spectra, ParamType::Spectrum, psi);
 }
 
 void ParamSet::AddXYZSpectrum(const std::string &name,
@@ -127,7 +230,7 @@ void ParamSet::AddXYZSpectrum(const std::string &name,
     for (int i = 0; i < nValues; ++i) s[i] = Spectrum::FromXYZ(&values[3 * i]);
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    AddItem(spectra, ParamType::Spectrum, psi);
 }
 
 void ParamSet::AddBlackbodySpectrum(const std::string &name,
@@ -145,7 +248,7 @@ void ParamSet::AddBlackbodySpectrum(const std::string &name,
     }
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    AddItem(spectra, ParamType::Spectrum, psi);
 }
 
 void ParamSet::AddSampledSpectrum(const std::string &name,
@@ -164,7 +267,7 @@ void ParamSet::AddSampledSpectrum(const std::string &name,
     s[0] = Spectrum::FromSampled(wl.get(), v.get(), nValues);
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), 1));
-    spectra.push_back(psi);
+    AddItem(spectra, ParamType::Spectrum, psi);
 }
 
 void ParamSet::AddSampledSpectrumFiles(const std::string &name,
@@ -203,14 +306,62 @@ void ParamSet::AddSampledSpectrumFiles(const std::string &name,
 
     std::shared_ptr<ParamSetItem<Spectrum>> psi(
         new ParamSetItem<Spectrum>(name, std::move(s), nValues));
-    spectra.push_back(psi);
+    AddItem(spectra, ParamType::Spectrum, psi);
+}
+
+void ParamSet::AddFloat(const std::string &name, const Float *values,
+                        int nValues, std::shared_ptr<const void> storage) {
+    EraseFloat(name);
+    ADD_SHARED_PARAM_TYPE(Float, floats, ParamType::Float);
+}
+
+void ParamSet::AddInt(const std::string &name, const int *values, int nValues,
+                      std::shared_ptr<const void> storage) {
+    EraseInt(name);
+    ADD_SHARED_PARAM_TYPE(int, ints, ParamType::Int);
+}
+
+void ParamSet::AddPoint2f(const std::string &name, const Point2f *values,
+                          int nValues, std::shared_ptr<const void> storage) {
+    ErasePoint2f(name);
+    ADD_SHARED_PARAM_TYPE(Point2f, point2fs, ParamType::Point2);
+}
+
+void ParamSet::AddVector2f(const std::string &name, const Vector2f *values,
+                           int nValues, std::shared_ptr<const void> storage) {
+    EraseVector2f(name);
+    ADD_SHARED_PARAM_TYPE(Vector2f, vector2fs, ParamType::Vector2);
+}
+
+void ParamSet::AddPoint3f(const std::string &name, const Point3f *values,
+                          int nValues, std::shared_ptr<const void> storage) {
+    ErasePoint3f(name);
+    ADD_SHARED_PARAM_TYPE(Point3f, point3fs, ParamType::Point3);
+}
+
+void ParamSet::AddVector3f(const std::string &name, const Vector3f *values,
+                           int nValues, std::shared_ptr<const void> storage) {
+    EraseVector3f(name);
+    ADD_SHARED_PARAM_TYPE(Vector3f, vector3fs, ParamType::Vector3);
+}
+
+void ParamSet::AddNormal3f(const std::string &name, const Normal3f *values,
+                           int nValues, std::shared_ptr<const void> storage) {
+    EraseNormal3f(name);
+    ADD_SHARED_PARAM_TYPE(Normal3f, normals, ParamType::Normal);
+}
+
+void ParamSet::AddSpectrum(const std::string &name, const Spectrum *values,
+                           int nValues, std::shared_ptr<const void> storage) {
+    EraseSpectrum(name);
+    ADD_SHARED_PARAM_TYPE(Spectrum, spectra, ParamType::Spectrum);
 }
 
 std::map<std::string, Spectrum> ParamSet::cachedSpectra;
 void ParamSet::AddString(const std::string &name,
                          std::unique_ptr<std::string[]> values, int nValues) {
     EraseString(name);
-    ADD_PARAM_TYPE(std::string, strings);
+    ADD_PARAM_TYPE(std::string, strings, ParamType::String);
 }
 
 void ParamSet::AddTexture(const std::string &name, const std::string &value) {
@@ -219,211 +370,145 @@ void ParamSet::AddTexture(const std::string &name, const std::string &value) {
     str[0] = value;
     std::shared_ptr<ParamSetItem<std::string>> psi(
         new ParamSetItem<std::string>(name, std::move(str), 1));
-    textures.push_back(psi);
+    AddItem(textures, ParamType::Texture, psi);
 }
 
 bool ParamSet::EraseInt(const std::string &n) {
-    for (size_t i = 0; i < ints.size(); ++i)
-        if (ints[i]->name == n) {
-            ints.erase(ints.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(ints, ParamType::Int, n);
 }
 
 bool ParamSet::EraseBool(const std::string &n) {
-    for (size_t i = 0; i < bools.size(); ++i)
-        if (bools[i]->name == n) {
-            bools.erase(bools.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(bools, ParamType::Bool, n);
 }
 
 bool ParamSet::EraseFloat(const std::string &n) {
-    for (size_t i = 0; i < floats.size(); ++i)
-        if (floats[i]->name == n) {
-            floats.erase(floats.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(floats, ParamType::Float, n);
 }
 
 bool ParamSet::ErasePoint2f(const std::string &n) {
-    for (size_t i = 0; i < point2fs.size(); ++i)
-        if (point2fs[i]->name == n) {
-            point2fs.erase(point2fs.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(point2fs, ParamType::Point2, n);
 }
 
 bool ParamSet::EraseVector2f(const std::string &n) {
-    for (size_t i = 0; i < vector2fs.size(); ++i)
-        if (vector2fs[i]->name == n) {
-            vector2fs.erase(vector2fs.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(vector2fs, ParamType::Vector2, n);
 }
 
 bool ParamSet::ErasePoint3f(const std::string &n) {
-    for (size_t i = 0; i < point3fs.size(); ++i)
-        if (point3fs[i]->name == n) {
-            point3fs.erase(point3fs.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(point3fs, ParamType::Point3, n);
 }
 
 bool ParamSet::EraseVector3f(const std::string &n) {
-    for (size_t i = 0; i < vector3fs.size(); ++i)
-        if (vector3fs[i]->name == n) {
-            vector3fs.erase(vector3fs.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(vector3fs, ParamType::Vector3, n);
 }
 
 bool ParamSet::EraseNormal3f(const std::string &n) {
-    for (size_t i = 0; i < normals.size(); ++i)
-        if (normals[i]->name == n) {
-            normals.erase(normals.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(normals, ParamType::Normal, n);
 }
 
 bool ParamSet::EraseSpectrum(const std::string &n) {
-    for (size_t i = 0; i < spectra.size(); ++i)
-        if (spectra[i]->name == n) {
-            spectra.erase(spectra.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(spectra, ParamType::Spectrum, n);
 }
 
 bool ParamSet::EraseString(const std::string &n) {
-    for (size_t i = 0; i < strings.size(); ++i)
-        if (strings[i]->name == n) {
-            strings.erase(strings.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(strings, ParamType::String, n);
 }
 
 bool ParamSet::EraseTexture(const std::string &n) {
-    for (size_t i = 0; i < textures.size(); ++i)
-        if (textures[i]->name == n) {
-            textures.erase(textures.begin() + i);
-            return true;
-        }
-    return false;
+    return EraseItem(textures, ParamType::Texture, n);
 }
 
 Float ParamSet::FindOneFloat(const std::string &name, Float d) const {
-    for (const auto &f : floats)
-        if (f->name == name && f->nValues == 1) {
-            f->lookedUp = true;
-            return f->values[0];
-        }
-    return d;
+    LOOKUP_ONE(floats, ParamType::Float);
 }
 
-const Float *ParamSet::FindFloat(const std::string &name, int *n) const {
-    for (const auto &f : floats)
-        if (f->name == name) {
-            *n = f->nValues;
-            f->lookedUp = true;
-            return f->values.get();
-        }
-    return nullptr;
+const Float *ParamSet::FindFloat(const std::string &name, int *nValues) const {
+    LOOKUP_PTR(floats, ParamType::Float);
 }
 
 const int *ParamSet::FindInt(const std::string &name, int *nValues) const {
-    LOOKUP_PTR(ints);
+    LOOKUP_PTR(ints, ParamType::Int);
 }
 
 const bool *ParamSet::FindBool(const std::string &name, int *nValues) const {
-    LOOKUP_PTR(bools);
+    LOOKUP_PTR(bools, ParamType::Bool);
 }
 
 int ParamSet::FindOneInt(const std::string &name, int d) const {
-    LOOKUP_ONE(ints);
+    LOOKUP_ONE(ints, ParamType::Int);
 }
 
 bool ParamSet::FindOneBool(const std::string &name, bool d) const {
-    LOOKUP_ONE(bools);
+    LOOKUP_ONE(bools, ParamType::Bool);
 }
 
 const Point2f *ParamSet::FindPoint2f(const std::string &name,
                                      int *nValues) const {
-    LOOKUP_PTR(point2fs);
+    LOOKUP_PTR(point2fs, ParamType::Point2);
 }
 
 Point2f ParamSet::FindOnePoint2f(const std::string &name,
                                  const Point2f &d) const {
-    LOOKUP_ONE(point2fs);
+    LOOKUP_ONE(point2fs, ParamType::Point2);
 }
 
 const Vector2f *ParamSet::FindVector2f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(vector2fs);
+    LOOKUP_PTR(vector2fs, ParamType::Vector2);
 }
 
 Vector2f ParamSet::FindOneVector2f(const std::string &name,
                                    const Vector2f &d) const {
-    LOOKUP_ONE(vector2fs);
+    LOOKUP_ONE(vector2fs, ParamType::Vector2);
 }
 
 const Point3f *ParamSet::FindPoint3f(const std::string &name,
                                      int *nValues) const {
-    LOOKUP_PTR(point3fs);
+    LOOKUP_PTR(point3fs, ParamType::Point3);
 }
 
 Point3f ParamSet::FindOnePoint3f(const std::string &name,
                                  const Point3f &d) const {
-    LOOKUP_ONE(point3fs);
+    LOOKUP_ONE(point3fs, ParamType::Point3);
 }
 
 const Vector3f *ParamSet::FindVector3f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(vector3fs);
+    LOOKUP_PTR(vector3fs, ParamType::Vector3);
 }
 
 Vector3f ParamSet::FindOneVector3f(const std::string &name,
                                    const Vector3f &d) const {
-    LOOKUP_ONE(vector3fs);
+    LOOKUP_ONE(vector3fs, ParamType::Vector3);
 }
 
 const Normal3f *ParamSet::FindNormal3f(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(normals);
+    LOOKUP_PTR(normals, ParamType::Normal);
 }
 
 Normal3f ParamSet::FindOneNormal3f(const std::string &name,
                                    const Normal3f &d) const {
-    LOOKUP_ONE(normals);
+    LOOKUP_ONE(normals, ParamType::Normal);
 }
 
 const Spectrum *ParamSet::FindSpectrum(const std::string &name,
                                        int *nValues) const {
-    LOOKUP_PTR(spectra);
+    LOOKUP_PTR(spectra, ParamType::Spectrum);
 }
 
 Spectrum ParamSet::FindOneSpectrum(const std::string &name,
                                    const Spectrum &d) const {
-    LOOKUP_ONE(spectra);
+    LOOKUP_ONE(spectra, ParamType::Spectrum);
 }
 
 const std::string *ParamSet::FindString(const std::string &name,
                                         int *nValues) const {
-    LOOKUP_PTR(strings);
+    LOOKUP_PTR(strings, ParamType::String);
 }
 
 std::string ParamSet::FindOneString(const std::string &name,
                                     const std::string &d) const {
-    LOOKUP_ONE(strings);
+    LOOKUP_ONE(strings, ParamType::String);
 }
 
 std::string ParamSet::FindOneFilename(const std::string &name,
@@ -436,7 +521,7 @@ std::string ParamSet::FindOneFilename(const std::string &name,
 
 std::string ParamSet::FindTexture(const std::string &name) const {
     std::string d = "";
-    LOOKUP_ONE(textures);
+    LOOKUP_ONE(textures, ParamType::Texture);
 }
 
 void ParamSet::ReportUnused() const {
@@ -472,6 +557,8 @@ void ParamSet::Clear() {
     DEL_PARAMS(strings);
     DEL_PARAMS(textures);
 #undef DEL_PARAMS
+    index.clear();
+    nItems = nIndexed = 0;
 }
 
 std::string ParamSet::ToString() const {
@@ -80,6 +80,23 @@ class ParamSet {
                                  int nValues);
     void AddSampledSpectrum(const std::string &, std::unique_ptr<Float[]> v,
                             int nValues);
+    // Variants that refer to _nValues_ values owned by _storage_ in place
+    void AddFloat(const std::string &, const Float *v, int nValues,
+                  std::shared_ptr<const void> storage);
+    void AddInt(const std::string &, const int *v, int nValues,
+                std::shared_ptr<const void> storage);
+    void AddPoint2f(const std::string &, const Point2f *v, int nValues,
+                    std::shared_ptr<const void> storage);
+    void AddVector2f(const std::string &, const Vector2f *v, int nValues,
+                     std::shared_ptr<const void> storage);
+    void AddPoint3f(const std::string &, const Point3f *v, int nValues,
+                    std::shared_ptr<const void> storage);
+    void AddVector3f(const std::string &, const Vector3f *v, int nValues,
+                     std::shared_ptr<const void> storage);
+    void AddNormal3f(const std::string &, const Normal3f *v, int nValues,
+                     std::shared_ptr<const void> storage);
+    void AddSpectrum(const std::string &, const Spectrum *v, int nValues,
+                     std::shared_ptr<const void> storage);
     bool EraseInt(const std::string &);
     bool EraseBool(const std::string &);
     bool EraseFloat(const std::string &);
@@ -120,6 +137,43 @@ class ParamSet {
     void Print(int indent) const;
 
   private:
+    friend class BinarySceneWriter;
+    // ParamSet Private Declarations
+    enum class ParamType : uint8_t {
+        Bool, Int, Float, Point2, Vector2, Point3, Vector3, Normal, Spectrum,
+        String, Texture, None
+    };
+    struct IndexSlot {
+        uint32_t hash = 0;
+        ParamType type = ParamType::None;
+        int position = 0;
+    };
+
+    // ParamSet Private Methods
+    template <typename T>
+    void AddItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                 ParamType type, std::shared_ptr<ParamSetItem<T>> item);
+    template <typename T>
+    bool EraseItem(std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                   ParamType type, const std::string &name);
+    template <typename T>
+    const ParamSetItem<T> *Lookup(
+        const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+        ParamType type, const std::string &name) const;
+    template <typename T>
+    void IndexItems(const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+                    ParamType type);
+    template <typename T>
+    int FindPosition(
+        const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+        ParamType type, const std::string &name) const;
+    template <typename T>
+    int FindIndexedPosition(
+        const std::vector<std::shared_ptr<ParamSetItem<T>>> &items,
+        ParamType type, const std::string &name) const;
+    void InsertSlot(ParamType type, const std::string &name, int position);
+    void RebuildIndex(size_t nSlots);
+
     // ParamSet Private Data
     std::vector<std::shared_ptr<ParamSetItem<bool>>> bools;
     std::vector<std::shared_ptr<ParamSetItem<int>>> ints;
@@ -132,6 +186,14 @@ class ParamSet {
     std::vector<std::shared_ptr<ParamSetItem<Spectrum>>> spectra;
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> strings;
     std::vector<std::shared_ptr<ParamSetItem<std::string>>> textures;
+    // Open-addressed hash table of the items above, keyed by type and name.
+    // Short lists are cheaper to scan than to hash a name for, so it is
+    // only built for sets of more than _maxScannedItems_ items and only
+    // used for types with that many; it is kept at most half full and
+    // rebuilt when an item is erased.
+    static PBRT_CONSTEXPR size_t maxScannedItems = 8;
+    std::vector<IndexSlot> index;
+    size_t nItems = 0, nIndexed = 0;
     static std::map<std::string, Spectrum> cachedSpectra;
 };
 
@@ -140,10 +202,14 @@ struct ParamSetItem {
     // ParamSetItem Public Methods
     ParamSetItem(const std::string &name, std::unique_ptr<T[]> val,
                  int nValues = 1);
+    ParamSetItem(const std::string &name, const T *val, int nValues,
+                 std::shared_ptr<const void> storage);
 
     // ParamSetItem Data
     const std::string name;
-    const std::unique_ptr<T[]> values;
+    const std::unique_ptr<T[]> ownedValues;
+    const std::shared_ptr<const void> storage;
+    const T *const values;
     const int nValues;
     mutable bool lookedUp = false;
 };
@@ -152,7 +218,15 @@ struct ParamSetItem {
 template <typename T>
 ParamSetItem<T>::ParamSetItem(const std::string &name, std::unique_ptr<T[]> v,
                               int nValues)
-    : name(name), values(std::move(v)), nValues(nValues) {}
+    : name(name),
+      ownedValues(std::move(v)),
+      values(ownedValues.get()),
+      nValues(nValues) {}
+
+template <typename T>
+ParamSetItem<T>::ParamSetItem(const std::string &name, const T *v,
+                              int nValues, std::shared_ptr<const void> storage)
+    : name(name), storage(std::move(storage)), values(v), nValues(nValues) {}
 
 // TextureParams Declarations
 class TextureParams {
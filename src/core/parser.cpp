@@ -34,6 +34,7 @@
 
 // core/parser.cpp*
 #include "parser.h"
+#include "binaryscene.h"
 #include "fileutil.h"
 
 // Parsing Global Interface
@@ -46,6 +47,10 @@ bool ParseFile(const std::string &filename) {
 
     if (getenv("PBRT_YYDEBUG") != nullptr) yydebug = 1;
 
+    // Binary scenes are replayed directly rather than parsed
+    if (filename != "-" && IsBinarySceneFile(filename))
+        return ParseBinarySceneFile(filename);
+
     if (filename == "-")
         yyin = stdin;
     else {
@@ -77,6 +77,7 @@
 
 // Global Forward Declarations
 class Scene;
+class PrefetchedIntersections;
 class Integrator;
 class SamplerIntegrator;
 template <typename T>
@@ -101,6 +102,7 @@ class SurfaceInteraction;
 class Shape;
 class Primitive;
 class GeometricPrimitive;
+struct TriangleMesh;
 template <int nSpectrumSamples>
 class CoefficientSpectrum;
 class RGBSpectrum;
@@ -151,8 +153,12 @@ struct Options {
     int nThreads = 0;
     bool quickRender = false;
     bool quiet = false, verbose = false;
-    bool cat = false, toPly = false;
+    bool cat = false, toPly = false, toBinary = false;
+    bool affinity = false;
+    bool compactMeshes = false;
     std::string imageFile;
+    std::string tileOrder;
+    std::string bvhCacheDir;
 };
 
 extern Options PbrtOptions;
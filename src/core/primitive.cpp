@@ -40,6 +40,39 @@
 
 // Primitive Method Definitions
 Primitive::~Primitive() {}
+
+void Primitive::SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                                Bounds3f *left, Bounds3f *right) const {
+    *left = *right = bounds;
+    left->pMax[axis] = std::min(left->pMax[axis], plane);
+    right->pMin[axis] = std::max(right->pMin[axis], plane);
+}
+
+void Primitive::IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                                bool *hits) const {
+    for (int i = 0; i < n; ++i) hits[i] = Intersect(rays[i], &isects[i]);
+}
+
+void Primitive::IntersectPPacket(int n, const Ray *rays,
+                                 bool *occluded) const {
+    for (int i = 0; i < n; ++i) occluded[i] = IntersectP(rays[i]);
+}
+
+bool Primitive::MotionInterval(Float *startTime, Float *endTime) const {
+    return false;
+}
+
+void Primitive::LinearBounds(Float time0, Float time1, Bounds3f *b0,
+                             Bounds3f *b1) const {
+    *b0 = *b1 = WorldBound();
+}
+
+// Appends the primitives that an accelerator builds over in place of this
+// one; primitives that stand for a group of others append those instead
+void Primitive::Flatten(std::vector<const Primitive *> *prims) const {
+    prims->push_back(this);
+}
+
 const AreaLight *Aggregate::GetAreaLight() const {
     Severe(
         "Aggregate::GetAreaLight() method"
@@ -86,9 +119,65 @@ bool TransformedPrimitive::IntersectP(const Ray &r) const {
     return primitive->IntersectP(InterpolatedWorldToPrim(r));
 }
 
+bool TransformedPrimitive::MotionInterval(Float *startTime,
+                                          Float *endTime) const {
+    bool moving = primitive->MotionInterval(startTime, endTime);
+    if (!PrimitiveToWorld.IsAnimated()) return moving;
+    if (!moving) {
+        *startTime = PrimitiveToWorld.StartTime();
+        *endTime = PrimitiveToWorld.EndTime();
+    } else {
+        *startTime = std::min(*startTime, PrimitiveToWorld.StartTime());
+        *endTime = std::max(*endTime, PrimitiveToWorld.EndTime());
+    }
+    return true;
+}
+
+void TransformedPrimitive::LinearBounds(Float time0, Float time1,
+                                        Bounds3f *b0, Bounds3f *b1) const {
+    // Motion inside _primitive_ is bounded over the whole interval
+    Bounds3f primBounds;
+    Float start, end;
+    if (primitive->MotionInterval(&start, &end)) {
+        primitive->LinearBounds(time0, time1, b0, b1);
+        primBounds = Union(*b0, *b1);
+    } else
+        primBounds = primitive->WorldBound();
+    PrimitiveToWorld.LinearBounds(primBounds, time0, time1, b0, b1);
+}
+
+// MeshCopyPrimitive Method Definitions
+bool MeshCopyPrimitive::Intersect(const Ray &r,
+                                  SurfaceInteraction *isect) const {
+    if (!TransformedPrimitive::Intersect(r, isect)) return false;
+    // Shade the hit with this copy's material and medium interface
+    isect->primitive = this;
+    if (mediumInterface.IsMediumTransition())
+        isect->mediumInterface = mediumInterface;
+    else
+        isect->mediumInterface = MediumInterface(r.medium);
+    return true;
+}
+
+void MeshCopyPrimitive::ComputeScatteringFunctions(
+    SurfaceInteraction *isect, MemoryArena &arena, TransportMode mode,
+    bool allowMultipleLobes) const {
+    ProfilePhase p(Prof::ComputeScatteringFuncs);
+    if (material)
+        material->ComputeScatteringFunctions(isect, arena, mode,
+                                             allowMultipleLobes);
+    Assert(Dot(isect->n, isect->shading.n) >= 0.);
+}
+
 // GeometricPrimitive Method Definitions
 Bounds3f GeometricPrimitive::WorldBound() const { return shape->WorldBound(); }
 
+void GeometricPrimitive::SplitWorldBound(const Bounds3f &bounds, int axis,
+                                         Float plane, Bounds3f *left,
+                                         Bounds3f *right) const {
+    shape->SplitWorldBound(bounds, axis, plane, left, right);
+}
+
 bool GeometricPrimitive::IntersectP(const Ray &r) const {
     return shape->IntersectP(r);
 }
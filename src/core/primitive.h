@@ -46,13 +46,25 @@
 #include "medium.h"
 
 // Primitive Declarations
+static PBRT_CONSTEXPR int MaxRayPacketSize = 16;
+
 class Primitive {
   public:
     // Primitive Interface
     virtual ~Primitive();
     virtual Bounds3f WorldBound() const = 0;
+    virtual void SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                                 Bounds3f *left, Bounds3f *right) const;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *) const = 0;
     virtual bool IntersectP(const Ray &r) const = 0;
+    virtual void IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                                 bool *hits) const;
+    virtual void IntersectPPacket(int n, const Ray *rays,
+                                  bool *occluded) const;
+    virtual bool MotionInterval(Float *startTime, Float *endTime) const;
+    virtual void LinearBounds(Float time0, Float time1, Bounds3f *b0,
+                              Bounds3f *b1) const;
+    virtual void Flatten(std::vector<const Primitive *> *prims) const;
     virtual const AreaLight *GetAreaLight() const = 0;
     virtual const Material *GetMaterial() const = 0;
     virtual void ComputeScatteringFunctions(SurfaceInteraction *isect,
@@ -66,6 +78,8 @@ class GeometricPrimitive : public Primitive {
   public:
     // GeometricPrimitive Public Methods
     virtual Bounds3f WorldBound() const;
+    virtual void SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                                 Bounds3f *left, Bounds3f *right) const;
     virtual bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
     virtual bool IntersectP(const Ray &r) const;
     GeometricPrimitive(const std::shared_ptr<Shape> &shape,
@@ -111,11 +125,42 @@ class TransformedPrimitive : public Primitive {
     Bounds3f WorldBound() const {
         return PrimitiveToWorld.MotionBounds(primitive->WorldBound());
     }
+    bool MotionInterval(Float *startTime, Float *endTime) const;
+    void LinearBounds(Float time0, Float time1, Bounds3f *b0,
+                      Bounds3f *b1) const;
+    void SetPrimitiveToWorld(const AnimatedTransform &PrimitiveToWorld) {
+        this->PrimitiveToWorld = PrimitiveToWorld;
+    }
 
   private:
     // TransformedPrimitive Private Data
     std::shared_ptr<Primitive> primitive;
-    const AnimatedTransform PrimitiveToWorld;
+    AnimatedTransform PrimitiveToWorld;
+};
+
+// A copy of a mesh placed by _PrimitiveToWorld_ that has its own material
+// and medium interface, so that copies of a mesh that differ only in those
+// can share one aggregate of its primitives
+class MeshCopyPrimitive : public TransformedPrimitive {
+  public:
+    // MeshCopyPrimitive Public Methods
+    MeshCopyPrimitive(std::shared_ptr<Primitive> &primitive,
+                      const AnimatedTransform &PrimitiveToWorld,
+                      const std::shared_ptr<Material> &material,
+                      const MediumInterface &mediumInterface)
+        : TransformedPrimitive(primitive, PrimitiveToWorld),
+          material(material),
+          mediumInterface(mediumInterface) {}
+    bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
+    const Material *GetMaterial() const { return material.get(); }
+    void ComputeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const;
+
+  private:
+    // MeshCopyPrimitive Private Data
+    std::shared_ptr<Material> material;
+    MediumInterface mediumInterface;
 };
 
 // Aggregate Declarations
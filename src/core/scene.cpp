@@ -43,9 +43,17 @@
 STAT_COUNTER("Intersections/Regular ray intersection tests",
              nIntersectionTests);
 STAT_COUNTER("Intersections/Shadow ray intersection tests", nShadowTests);
+STAT_COUNTER("Intersections/Ray packets traced", nRayPackets);
+STAT_PERCENT("Intersections/Prefetched intersections used", nPrefetchHits,
+             nPrefetched);
+
+// Scene Local Definitions
+static PBRT_THREAD_LOCAL PrefetchedIntersections *prefetched = nullptr;
 
 // Scene Method Definitions
 bool Scene::Intersect(const Ray &ray, SurfaceInteraction *isect) const {
+    bool hit;
+    if (prefetched && prefetched->Lookup(ray, isect, &hit)) return hit;
     ++nIntersectionTests;
     return aggregate->Intersect(ray, isect);
 }
@@ -69,3 +77,102 @@ bool Scene::IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
         ray = isect->SpawnRay(ray.d);
     }
 }
+
+void Scene::IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                            bool *hits) const {
+    Assert(n <= MaxRayPacketSize);
+    nIntersectionTests += n;
+    ++nRayPackets;
+    aggregate->IntersectPacket(n, rays, isects, hits);
+}
+
+void Scene::IntersectPPacket(int n, const Ray *rays, bool *occluded) const {
+    Assert(n <= MaxRayPacketSize);
+    nShadowTests += n;
+    ++nRayPackets;
+    aggregate->IntersectPPacket(n, rays, occluded);
+}
+
+// Returns the octant of the ray's direction; rays that share one traverse
+// the BVH in the same order
+static int DirectionOctant(const Ray &ray) {
+    return (ray.d.x < 0) | ((ray.d.y < 0) << 1) | ((ray.d.z < 0) << 2);
+}
+
+// Orders the indices of _rays_ by direction octant so that consecutive rays
+// can be traced together in coherent packets
+static std::vector<int> SortByOctant(int n, const Ray *rays) {
+    int octantStart[9] = {0};
+    for (int i = 0; i < n; ++i) ++octantStart[DirectionOctant(rays[i]) + 1];
+    for (int o = 1; o < 9; ++o) octantStart[o] += octantStart[o - 1];
+    std::vector<int> order(n);
+    for (int i = 0; i < n; ++i)
+        order[octantStart[DirectionOctant(rays[i])]++] = i;
+    return order;
+}
+
+void Scene::IntersectStream(int n, Ray *rays, SurfaceInteraction *isects,
+                            bool *hits) const {
+    std::vector<int> order = SortByOctant(n, rays);
+    for (int start = 0; start < n; start += MaxRayPacketSize) {
+        // Gather the next packet of rays, trace it, and scatter the results
+        int packetSize = std::min(MaxRayPacketSize, n - start);
+        Ray packet[MaxRayPacketSize];
+        SurfaceInteraction packetIsects[MaxRayPacketSize];
+        bool packetHits[MaxRayPacketSize];
+        for (int i = 0; i < packetSize; ++i) packet[i] = rays[order[start + i]];
+        IntersectPacket(packetSize, packet, packetIsects, packetHits);
+        for (int i = 0; i < packetSize; ++i) {
+            int index = order[start + i];
+            rays[index].tMax = packet[i].tMax;
+            hits[index] = packetHits[i];
+            if (packetHits[i]) isects[index] = packetIsects[i];
+        }
+    }
+}
+
+void Scene::IntersectPStream(int n, const Ray *rays, bool *occluded) const {
+    std::vector<int> order = SortByOctant(n, rays);
+    for (int start = 0; start < n; start += MaxRayPacketSize) {
+        int packetSize = std::min(MaxRayPacketSize, n - start);
+        Ray packet[MaxRayPacketSize];
+        bool packetOccluded[MaxRayPacketSize];
+        for (int i = 0; i < packetSize; ++i) packet[i] = rays[order[start + i]];
+        IntersectPPacket(packetSize, packet, packetOccluded);
+        for (int i = 0; i < packetSize; ++i)
+            occluded[order[start + i]] = packetOccluded[i];
+    }
+}
+
+// PrefetchedIntersections Method Definitions
+PrefetchedIntersections::PrefetchedIntersections(const Scene &scene, int n,
+                                                 const Ray *rays)
+    : previous(prefetched), n(n) {
+    for (int i = 0; i < n; ++i) {
+        this->rays[i] = rays[i];
+        tMax[i] = rays[i].tMax;
+    }
+    scene.IntersectPacket(n, this->rays, isects, hits);
+    nPrefetched += n;
+    prefetched = this;
+}
+
+PrefetchedIntersections::~PrefetchedIntersections() { prefetched = previous; }
+
+bool PrefetchedIntersections::Lookup(const Ray &ray, SurfaceInteraction *isect,
+                                     bool *hit) {
+    // Only the selected sample's ray, unchanged since it was traced, matches
+    if (selected < 0 || selected >= n) return false;
+    const Ray &r = rays[selected];
+    if (ray.o != r.o || ray.d != r.d || ray.time != r.time ||
+        ray.tMax != tMax[selected])
+        return false;
+    ++nPrefetchHits;
+    *hit = hits[selected];
+    if (*hit) {
+        *isect = isects[selected];
+        ray.tMax = r.tMax;
+    }
+    selected = -1;
+    return true;
+}
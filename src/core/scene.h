@@ -60,6 +60,12 @@ class Scene {
     bool IntersectP(const Ray &ray) const;
     bool IntersectTr(Ray ray, Sampler &sampler, SurfaceInteraction *isect,
                      Spectrum *transmittance) const;
+    void IntersectPacket(int n, Ray *rays, SurfaceInteraction *isects,
+                         bool *hits) const;
+    void IntersectPPacket(int n, const Ray *rays, bool *occluded) const;
+    void IntersectStream(int n, Ray *rays, SurfaceInteraction *isects,
+                         bool *hits) const;
+    void IntersectPStream(int n, const Ray *rays, bool *occluded) const;
 
     // Scene Public Data
     std::vector<std::shared_ptr<Light>> lights;
@@ -70,4 +76,26 @@ class Scene {
     Bounds3f worldBound;
 };
 
+// Intersections of a packet of rays traced ahead of time, typically the
+// camera rays of a batch of samples. While one is alive on a thread,
+// _Scene::Intersect()_ answers the ray of the selected sample from the
+// stored result instead of traversing the scene again.
+class PrefetchedIntersections {
+  public:
+    // PrefetchedIntersections Public Methods
+    PrefetchedIntersections(const Scene &scene, int n, const Ray *rays);
+    ~PrefetchedIntersections();
+    void Select(int i) { selected = i; }
+    bool Lookup(const Ray &ray, SurfaceInteraction *isect, bool *hit);
+
+  private:
+    // PrefetchedIntersections Private Data
+    PrefetchedIntersections *previous;
+    int n, selected = -1;
+    Ray rays[MaxRayPacketSize];
+    Float tMax[MaxRayPacketSize];
+    SurfaceInteraction isects[MaxRayPacketSize];
+    bool hits[MaxRayPacketSize];
+};
+
 #endif  // PBRT_CORE_SCENE_H
@@ -51,6 +51,14 @@ Shape::Shape(const Transform *ObjectToWorld, const Transform *WorldToObject,
 
 Bounds3f Shape::WorldBound() const { return (*ObjectToWorld)(ObjectBound()); }
 
+void Shape::SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                            Bounds3f *left, Bounds3f *right) const {
+    // Without knowing the shape's surface, split _bounds_ itself
+    *left = *right = bounds;
+    left->pMax[axis] = std::min(left->pMax[axis], plane);
+    right->pMin[axis] = std::max(right->pMin[axis], plane);
+}
+
 Float Shape::Pdf(const Interaction &ref, const Vector3f &wi) const {
     // Intersect sample ray with area light geometry
     Ray ray = ref.SpawnRay(wi);
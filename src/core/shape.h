@@ -55,6 +55,8 @@ class Shape {
     virtual ~Shape();
     virtual Bounds3f ObjectBound() const = 0;
     virtual Bounds3f WorldBound() const;
+    virtual void SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                                 Bounds3f *left, Bounds3f *right) const;
     virtual bool Intersect(const Ray &ray, Float *tHit,
                            SurfaceInteraction *isect,
                            bool testAlphaTexture = true) const = 0;
@@ -0,0 +1,153 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// core/tilescheduler.cpp*
+#include "tilescheduler.h"
+#include "parallel.h"
+#include "stats.h"
+#include <chrono>
+
+STAT_COUNTER("Integrator/Tiles subdivided", tilesSubdivided);
+
+// Tile Scheduler Local Definitions
+static Point2i HilbertToXY(int n, int d) {
+	// Map distance _d_ along a Hilbert curve over an _n_ x _n_ grid to a cell
+	int x = 0, y = 0;
+	for (int s = 1; s < n; s *= 2) {
+		int rx = 1 & (d / 2);
+		int ry = 1 & (d ^ rx);
+		if (ry == 0) {
+			if (rx == 1) {
+				x = s - 1 - x;
+				y = s - 1 - y;
+			}
+			std::swap(x, y);
+		}
+		x += s * rx;
+		y += s * ry;
+		d /= 4;
+	}
+	return Point2i(x, y);
+}
+
+// Tile Scheduler Method Definitions
+TileOrder TileOrderFromString(const std::string &name) {
+	if (name == "" || name == "hilbert") return TileOrder::Hilbert;
+	if (name == "spiral") return TileOrder::Spiral;
+	if (name == "raster") return TileOrder::Raster;
+	Warning("Tile order \"%s\" unknown. Using \"hilbert\".", name.c_str());
+	return TileOrder::Hilbert;
+}
+
+TileScheduler::TileScheduler(const Bounds2i &bounds, int tileSize,
+	TileOrder order)
+	: bounds(bounds) {
+	// Compute the grid of base tiles covering _bounds_
+	Vector2i extent = bounds.Diagonal();
+	Point2i nTiles((extent.x + tileSize - 1) / tileSize,
+		(extent.y + tileSize - 1) / tileSize);
+	std::vector<Point2i> order2D;
+	if (order == TileOrder::Hilbert) {
+		// Walk a power-of-two Hilbert curve, skipping cells outside the grid
+		int n = RoundUpPow2(std::max(1, std::max(nTiles.x, nTiles.y)));
+		for (int d = 0; d < n * n; ++d) {
+			Point2i p = HilbertToXY(n, d);
+			if (p.x < nTiles.x && p.y < nTiles.y) order2D.push_back(p);
+		}
+	}
+	else {
+		for (int y = 0; y < nTiles.y; ++y)
+			for (int x = 0; x < nTiles.x; ++x) order2D.push_back(Point2i(x, y));
+		if (order == TileOrder::Spiral) {
+			// Order tiles by square rings around the image center, then by
+			// angle within each ring
+			Float cx = (nTiles.x - 1) * 0.5f, cy = (nTiles.y - 1) * 0.5f;
+			auto ring = [&](const Point2i &p) -> Float {
+				return std::max(std::abs(p.x - cx), std::abs(p.y - cy));
+			};
+			std::stable_sort(order2D.begin(), order2D.end(),
+				[&](const Point2i &a, const Point2i &b) -> bool {
+				Float ra = std::floor(ring(a)), rb = std::floor(ring(b));
+				if (ra != rb) return ra < rb;
+				return std::atan2(a.y - cy, a.x - cx) <
+					std::atan2(b.y - cy, b.x - cx);
+			});
+		}
+	}
+
+	// Create the initial, undivided tiles
+	for (const Point2i &t : order2D) {
+		int x0 = bounds.pMin.x + t.x * tileSize;
+		int x1 = std::min(x0 + tileSize, bounds.pMax.x);
+		int y0 = bounds.pMin.y + t.y * tileSize;
+		int y1 = std::min(y0 + tileSize, bounds.pMax.y);
+		Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+		tiles.push_back(Tile(tileBounds, (int)baseTiles.size()));
+		baseTiles.push_back(tileBounds);
+	}
+	tileCosts.resize(tiles.size(), 0.);
+}
+
+void TileScheduler::ParallelForTiles(
+	const std::function<void(const Bounds2i &tileBounds)> &func) {
+	ParallelFor([&](int64_t i) {
+		// Render the tile and record the time it took
+		std::chrono::steady_clock::time_point start =
+			std::chrono::steady_clock::now();
+		func(tiles[i].bounds);
+		tileCosts[i] += std::chrono::duration<double>(
+			std::chrono::steady_clock::now() - start).count();
+	}, tiles.size());
+}
+
+void TileScheduler::Refine() {
+	// Gather the cost of each base tile from its current subdivision
+	std::vector<double> baseCosts(baseTiles.size(), 0.);
+	double totalCost = 0;
+	for (size_t i = 0; i < tiles.size(); ++i) {
+		baseCosts[tiles[i].baseTile] += tileCosts[i];
+		totalCost += tileCosts[i];
+	}
+	if (totalCost == 0 || MaxThreadIndex() == 1) return;
+
+	// Limit each tile to a small fraction of a thread's share of the pass,
+	// assuming cost is spread evenly over a base tile's pixels
+	double maxTileCost = totalCost / (4 * MaxThreadIndex());
+	tiles.clear();
+	for (size_t b = 0; b < baseTiles.size(); ++b) {
+		int levels = 0;
+		for (double cost = baseCosts[b]; cost > maxTileCost; cost /= 4)
+			++levels;
+		Subdivide(baseTiles[b], (int)b, levels);
+	}
+	tileCosts.assign(tiles.size(), 0.);
+}
+
+void TileScheduler::Subdivide(const Bounds2i &tileBounds, int baseTile,
+	int levels) {
+	Vector2i extent = tileBounds.Diagonal();
+	if (levels == 0 || extent.x < 2 * minTileSize ||
+		extent.y < 2 * minTileSize) {
+		tiles.push_back(Tile(tileBounds, baseTile));
+		return;
+	}
+	// Split into quadrants, visited in a U shape to preserve locality
+	++tilesSubdivided;
+	Point2i pMid = tileBounds.pMin + extent / 2;
+	const Point2i &p0 = tileBounds.pMin, &p1 = tileBounds.pMax;
+	Subdivide(Bounds2i(p0, pMid), baseTile, levels - 1);
+	Subdivide(Bounds2i(Point2i(pMid.x, p0.y), Point2i(p1.x, pMid.y)),
+		baseTile, levels - 1);
+	Subdivide(Bounds2i(pMid, p1), baseTile, levels - 1);
+	Subdivide(Bounds2i(Point2i(p0.x, pMid.y), Point2i(pMid.x, p1.y)),
+		baseTile, levels - 1);
+}
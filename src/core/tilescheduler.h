@@ -0,0 +1,70 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_CORE_TILESCHEDULER_H
+#define PBRT_CORE_TILESCHEDULER_H
+#include "stdafx.h"
+
+// core/tilescheduler.h*
+#include "pbrt.h"
+#include "geometry.h"
+#include <functional>
+
+// Tile Scheduler Declarations
+enum class TileOrder { Hilbert, Spiral, Raster };
+
+TileOrder TileOrderFromString(const std::string &name);
+
+// Partitions an image region into tiles that are handed out along a
+// space-filling order, so that concurrently rendered tiles are neighbours.
+// Tiles record how long they took to render; _Refine()_ uses those timings
+// to subdivide tiles that would otherwise dominate the tail of a pass.
+class TileScheduler {
+public:
+	// TileScheduler Public Methods
+	TileScheduler(const Bounds2i &bounds, int tileSize = 16,
+		TileOrder order = TileOrderFromString(PbrtOptions.tileOrder));
+	void ParallelForTiles(
+		const std::function<void(const Bounds2i &tileBounds)> &func);
+	void Refine();
+	size_t TileCount() const { return tiles.size(); }
+	int Seed(const Bounds2i &tileBounds) const {
+		// Seeds depend only on the tile origin, so they stay unique however
+		// the tiles are subdivided
+		Point2i p = Point2i(tileBounds.pMin - bounds.pMin);
+		return p.y * (bounds.pMax.x - bounds.pMin.x) + p.x;
+	}
+
+private:
+	// TileScheduler Private Declarations
+	struct Tile {
+		Tile(const Bounds2i &bounds, int baseTile)
+			: bounds(bounds), baseTile(baseTile) {}
+		Bounds2i bounds;
+		int baseTile;
+	};
+
+	// TileScheduler Private Methods
+	void Subdivide(const Bounds2i &tileBounds, int baseTile, int levels);
+
+	// TileScheduler Private Data
+	static PBRT_CONSTEXPR int minTileSize = 4;
+	const Bounds2i bounds;
+	std::vector<Bounds2i> baseTiles;
+	std::vector<Tile> tiles;
+	std::vector<double> tileCosts;
+};
+
+#endif  // PBRT_CORE_TILESCHEDULER_H
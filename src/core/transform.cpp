@@ -1231,7 +1231,7 @@ Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const {
         IntervalFindZeros(c1[c].Eval(p), c2[c].Eval(p), c3[c].Eval(p),
                           c4[c].Eval(p), c5[c].Eval(p), theta, Interval(0., 1.),
                           zeros, &nZeros);
-        Assert(nZeros <= sizeof(zeros) / sizeof(zeros[0]));
+        Assert(nZeros <= (int)(sizeof(zeros) / sizeof(zeros[0])));
 
         // Expand bounding box for any motion derivative zeros found
         for (int i = 0; i < nZeros; ++i) {
@@ -1241,3 +1241,79 @@ Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p) const {
     }
     return bounds;
 }
+
+Bounds3f AnimatedTransform::BoundPointMotion(const Point3f &p, Float time0,
+                                             Float time1) const {
+    // Bound the motion of _p_ over the part of the animation that lies
+    // between _time0_ and _time1_
+    Bounds3f bounds((*this)(time0, p), (*this)(time1, p));
+    if (!actuallyAnimated || !hasRotation) return bounds;
+    Float u0 = Clamp((time0 - startTime) / (endTime - startTime), 0, 1);
+    Float u1 = Clamp((time1 - startTime) / (endTime - startTime), 0, 1);
+    if (u0 >= u1) return bounds;
+    Float cosTheta = Dot(R[0], R[1]);
+    Float theta = std::acos(Clamp(cosTheta, -1, 1));
+    // Search intervals as wide as those used for the whole motion; narrower
+    // ones find the same zero several times
+    int depth = Clamp(8 + (int)std::floor(Log2(u1 - u0)), 0, 8);
+    for (int c = 0; c < 3; ++c) {
+        Float zeros[8];
+        int nZeros = 0;
+        IntervalFindZeros(c1[c].Eval(p), c2[c].Eval(p), c3[c].Eval(p),
+                          c4[c].Eval(p), c5[c].Eval(p), theta,
+                          Interval(u0, u1), zeros, &nZeros, depth);
+        Assert(nZeros <= (int)(sizeof(zeros) / sizeof(zeros[0])));
+        for (int i = 0; i < nZeros; ++i) {
+            Point3f pz = (*this)(Lerp(zeros[i], startTime, endTime), p);
+            bounds = Union(bounds, pz);
+        }
+    }
+    return bounds;
+}
+
+void AnimatedTransform::LinearBounds(const Bounds3f &b, Float time0,
+                                     Float time1, Bounds3f *b0,
+                                     Bounds3f *b1) const {
+    // Bound _b_ at _time0_ and _time1_ so that interpolating the two bounds
+    // gives a bound of _b_ at any time in between
+    if (!actuallyAnimated) {
+        *b0 = *b1 = (*startTransform)(b);
+        return;
+    }
+    Transform t;
+    Interpolate(time0, &t);
+    *b0 = t(b);
+    Interpolate(time1, &t);
+    *b1 = t(b);
+
+    // Points move linearly while only translation and scale are
+    // interpolated, so the bounds at the two ends are enough
+    if (!hasRotation && time0 >= startTime && time1 <= endTime) return;
+
+    // Otherwise bound the motion over a few steps and push the interpolated
+    // bounds out until they enclose each step's bound at both of its ends
+    const int nSteps = 8;
+    Vector3f growMin, growMax;
+    for (int step = 0; step < nSteps; ++step) {
+        Float s[2] = {(Float)step / nSteps, (Float)(step + 1) / nSteps};
+        Float ta = Lerp(s[0], time0, time1), tb = Lerp(s[1], time0, time1);
+        Bounds3f stepBounds;
+        for (int corner = 0; corner < 8; ++corner)
+            stepBounds = Union(stepBounds,
+                               BoundPointMotion(b.Corner(corner), ta, tb));
+        for (int e = 0; e < 2; ++e) {
+            Point3f pMin = Lerp(s[e], b0->pMin, b1->pMin);
+            Point3f pMax = Lerp(s[e], b0->pMax, b1->pMax);
+            for (int c = 0; c < 3; ++c) {
+                growMin[c] =
+                    std::max(growMin[c], pMin[c] - stepBounds.pMin[c]);
+                growMax[c] =
+                    std::max(growMax[c], stepBounds.pMax[c] - pMax[c]);
+            }
+        }
+    }
+    b0->pMin -= growMin;
+    b1->pMin -= growMin;
+    b0->pMax += growMax;
+    b1->pMax += growMax;
+}
@@ -404,12 +404,19 @@ class AnimatedTransform {
     }
     Bounds3f MotionBounds(const Bounds3f &b) const;
     Bounds3f BoundPointMotion(const Point3f &p) const;
+    Bounds3f BoundPointMotion(const Point3f &p, Float time0,
+                              Float time1) const;
+    void LinearBounds(const Bounds3f &b, Float time0, Float time1,
+                      Bounds3f *b0, Bounds3f *b1) const;
+    bool IsAnimated() const { return actuallyAnimated; }
+    Float StartTime() const { return startTime; }
+    Float EndTime() const { return endTime; }
 
   private:
     // AnimatedTransform Private Data
     const Transform *startTransform, *endTransform;
-    const Float startTime, endTime;
-    const bool actuallyAnimated;
+    Float startTime, endTime;
+    bool actuallyAnimated;
     Vector3f T[2];
     Quaternion R[2];
     Matrix4x4 S[2];
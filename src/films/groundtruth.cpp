@@ -60,6 +60,26 @@ void GroundTruthFilm::SetImage(const Spectrum *img) const {
 	// It doesn't make sense to just load radiance from images.
 }
 
+void GroundTruthFilm::SetImage(const IntegrationResult *img) const {
+	int nPixels = croppedPixelBounds.Area();
+	for (int i = 0; i < nPixels; ++i) {
+		Pixel &pixel = pixels[i];
+
+		// Reduce the samples to a radiance-weighted mean path length
+		Float pathLength = 0.f, weightSum = 0.f;
+		for (const HistogramSample &sample : img[i].histogramSamples) {
+			pathLength += sample.L.y() * sample.pathLength;
+			weightSum += sample.L.y();
+		}
+		if (weightSum > 0) pathLength /= weightSum;
+
+		pixel.value = HistogramSample(img[i].L, pathLength);
+		pixel.splatValue = HistogramSample();
+		pixel.filterWeightSum = 1;
+		pixel.nContribs = 1;
+	}
+}
+
 void GroundTruthFilm::AddSplat(const Point2f &p, const IntegrationResult &v) {
 	if (v.L.HasNaNs()) {
 		Warning("Film ignoring splatted spectrum with NaN values");
@@ -12,6 +12,7 @@ Author: Phil Pitts
 
 #include "films/histogramfilm.h"
 #include "stats.h"
+#include "parallel.h"
 
 // HistogramFilm Method Definitions
 HistogramFilm::HistogramFilm(const Point2i &resolution, const Bounds2f &cropWindow,
@@ -22,9 +23,11 @@ HistogramFilm::HistogramFilm(const Point2i &resolution, const Bounds2f &cropWind
 	maxPathLength(maxPathLength),
 	minL(minL) {
 	pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-	for (int i = 0; i < croppedPixelBounds.Area(); i++) {
+	// Allocate the histograms from all threads so that, with pinned
+	// threads, their memory is interleaved across NUMA nodes
+	ParallelFor([&](int64_t i) {
 		pixels[i].Initialize(binSize, maxPathLength);
-	}
+	}, croppedPixelBounds.Area(), 4096);
 }
 
 std::unique_ptr<FilmTile> HistogramFilm::GetFilmTile(const Bounds2i &sampleBounds) {
@@ -72,6 +75,26 @@ void HistogramFilm::SetImage(const Spectrum *img) const {
 	// It doesn't make sense to just load radiance from images.
 }
 
+void HistogramFilm::SetImage(const IntegrationResult *img) const {
+	int nPixels = croppedPixelBounds.Area();
+	for (int i = 0; i < nPixels; ++i) {
+		Pixel &pixel = pixels[i];
+		size_t nBins = pixel.histogram.bins.size();
+		for (size_t j = 0; j < nBins; ++j) {
+			pixel.histogram.bins[j] = Spectrum(0.f);
+			pixel.splatHistogram.bins[j] = Spectrum(0.f);
+		}
+		pixel.filterWeightSum = 1;
+
+		for (const HistogramSample &sample : img[i].histogramSamples) {
+			size_t binIdx = (size_t)(sample.pathLength / binSize);
+			if (binIdx < nBins) {
+				pixel.histogram.bins[binIdx] += sample.L;
+			}
+		}
+	}
+}
+
 void HistogramFilm::AddSplat(const Point2f &p, const IntegrationResult &v) {
 	if (v.L.HasNaNs()) {
 		Warning("Film ignoring splatted spectrum with NaN values");
@@ -89,6 +89,16 @@ void ImageFilm::SetImage(const Spectrum *img) const {
     }
 }
 
+void ImageFilm::SetImage(const IntegrationResult *img) const {
+    int nPixels = croppedPixelBounds.Area();
+    for (int i = 0; i < nPixels; ++i) {
+        Pixel &p = pixels[i];
+        img[i].L.ToXYZ(p.xyz);
+        p.filterWeightSum = 1;
+        p.splatXYZ[0] = p.splatXYZ[1] = p.splatXYZ[2] = 0;
+    }
+}
+
 void ImageFilm::AddSplat(const Point2f &p, const IntegrationResult &v) {
     if (v.L.HasNaNs()) {
         Warning("Film ignoring splatted spectrum with NaN values");
@@ -12,6 +12,7 @@ Author: Phil Pitts
 
 #include "films/signal.h"
 #include "stats.h"
+#include "parallel.h"
 
 // SignalFilm Method Definitions
 SignalFilm::SignalFilm(const Point2i &resolution, const Bounds2f &cropWindow,
@@ -21,9 +22,11 @@ SignalFilm::SignalFilm(const Point2i &resolution, const Bounds2f &cropWindow,
 	frequencies(frequencies),
 	phases(phases) {
 	pixels = std::unique_ptr<Pixel[]>(new Pixel[croppedPixelBounds.Area()]);
-	for (int i = 0; i < croppedPixelBounds.Area(); i++) {
+	// Allocate the signal buffers from all threads so that, with pinned
+	// threads, their memory is interleaved across NUMA nodes
+	ParallelFor([&](int64_t i) {
 		pixels[i].Initialize(frequencies.size(), phases.size());
-	}
+	}, croppedPixelBounds.Area(), 4096);
 }
 
 std::unique_ptr<FilmTile> SignalFilm::GetFilmTile(const Bounds2i &sampleBounds) {
@@ -71,6 +74,29 @@ void SignalFilm::SetImage(const Spectrum *img) const {
 	// It doesn't make sense to just load radiance from images.
 }
 
+void SignalFilm::SetImage(const IntegrationResult *img) const {
+	int nPixels = croppedPixelBounds.Area();
+	for (int i = 0; i < nPixels; ++i) {
+		Pixel &pixel = pixels[i];
+		for (size_t j = 0; j < pixel.values.size(); ++j) {
+			pixel.values[j] = 0.f;
+			pixel.splatValues[j] = 0.f;
+		}
+		pixel.filterWeightSum = 1;
+
+		for (const HistogramSample &sample : img[i].histogramSamples) {
+			for (size_t j = 0; j < frequencies.size(); ++j) {
+				for (size_t k = 0; k < phases.size(); ++k) {
+					float kernel =
+						GetKernel(frequencies[j], phases[k], sample.pathLength);
+					size_t idx = j * phases.size() + k;
+					pixel.values[idx] += sample.L.y() * kernel;
+				}
+			}
+		}
+	}
+}
+
 void SignalFilm::AddSplat(const Point2f &p, const IntegrationResult &v) {
 	if (v.L.HasNaNs()) {
 		Warning("Film ignoring splatted spectrum with NaN values");
@@ -71,6 +71,7 @@ public:
 	std::unique_ptr<FilmTile> GetFilmTile(const Bounds2i &sampleBounds);
 	void MergeFilmTile(std::unique_ptr<FilmTile> tile);
 	void SetImage(const Spectrum *img) const;
+	void SetImage(const IntegrationResult *img) const;
 	void AddSplat(const Point2f &p, const IntegrationResult &v);
 	void WriteImage(Float splatScale);
 
@@ -41,6 +41,7 @@
 #include "filters/box.h"
 #include "paramset.h"
 #include "progressreporter.h"
+#include "tilescheduler.h"
 
 STAT_TIMER("Time/Rendering", renderingTime);
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
@@ -281,11 +282,8 @@ void BDPTIntegrator::Render(const Scene &scene) {
     // Partition the image into tiles
     Film *film = camera->film;
     const Bounds2i sampleBounds = film->GetSampleBounds();
-    const Vector2i sampleExtent = sampleBounds.Diagonal();
-    const int tileSize = 16;
-    const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
-    const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
-    ProgressReporter reporter(nXTiles * nYTiles, "Rendering");
+    TileScheduler tiles(sampleBounds);
+    ProgressReporter reporter(sampleBounds.Area(), "Rendering");
 
     // Allocate buffers for debug visualization
     const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
@@ -312,16 +310,11 @@ void BDPTIntegrator::Render(const Scene &scene) {
     // Render and write the output image to disk
     if (scene.lights.size() > 0) {
         StatTimer timer(&renderingTime);
-        ParallelFor2D([&](const Point2i tile) {
+        tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
             // Render a single tile using BDPT
             MemoryArena arena;
-            int seed = tile.y * nXTiles + tile.x;
-            std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-            int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-            int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-            int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-            int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-            Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+            std::unique_ptr<Sampler> tileSampler =
+                sampler->Clone(tiles.Seed(tileBounds));
             std::unique_ptr<FilmTile> filmTile =
                 camera->film->GetFilmTile(tileBounds);
             for (Point2i pPixel : tileBounds) {
@@ -376,8 +369,8 @@ void BDPTIntegrator::Render(const Scene &scene) {
                 } while (tileSampler->StartNextSample());
             }
             film->MergeFilmTile(std::move(filmTile));
-            reporter.Update();
-        }, Point2i(nXTiles, nYTiles));
+            reporter.Update(tileBounds.Area());
+        });
         reporter.Done();
     }
     film->WriteImage(1.0f / sampler->samplesPerPixel);
@@ -19,6 +19,8 @@ Author: Phil Pitts
 #include "filters/box.h"
 #include "paramset.h"
 #include "progressreporter.h"
+#include "opticalpath.h"
+#include "tilescheduler.h"
 
 STAT_TIMER("Time/Rendering", renderingTime);
 STAT_PERCENT("Integrator/Zero-radiance paths", zeroRadiancePaths, totalPaths);
@@ -35,11 +37,7 @@ void BDPTToFIntegrator::Render(const Scene &scene) {
 	// Partition the image into tiles
 	Film *film = camera->film;
 	const Bounds2i sampleBounds = film->GetSampleBounds();
-	const Vector2i sampleExtent = sampleBounds.Diagonal();
-	const int tileSize = 16;
-	const int nXTiles = (sampleExtent.x + tileSize - 1) / tileSize;
-	const int nYTiles = (sampleExtent.y + tileSize - 1) / tileSize;
-	ProgressReporter reporter(nXTiles * nYTiles, "Rendering");
+	TileScheduler tiles(sampleBounds);
 
 	// Allocate buffers for debug visualization
 	const int bufferCount = (1 + maxDepth) * (6 + maxDepth) / 2;
@@ -63,93 +61,120 @@ void BDPTToFIntegrator::Render(const Scene &scene) {
 		}
 	}
 
+	// Define the per-sample BDPT evaluation shared by both render loops
+	auto renderSample = [&](const Point2i &pPixel, Sampler &tileSampler,
+		FilmTile &filmTile, MemoryArena &arena) -> IntegrationResult {
+		// Generate a single sample using BDPT
+		Point2f pFilm = (Point2f)pPixel + tileSampler.Get2D();
+
+		// Trace the camera and light subpaths
+		Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
+		Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
+		int nCamera = GenerateCameraSubpath(
+			scene, tileSampler, arena, maxDepth + 2, *camera,
+			pFilm, cameraVertices);
+		int nLight = GenerateLightSubpath(
+			scene, tileSampler, arena, maxDepth + 1,
+			cameraVertices[0].time(), *lightDistr, lightVertices);
+
+		std::vector<HistogramSample> samples((nCamera + 1) * (nLight + 1));
+
+		// Execute all BDPT connection strategies
+		Spectrum L(0.f);
+		for (int t = 1; t <= nCamera; ++t) {
+			for (int s = 0; s <= nLight; ++s) {
+				int depth = t + s - 2;
+				if ((s == 1 && t == 1) || depth < 0 ||
+					depth > maxDepth)
+					continue;
+				// Execute the $(s, t)$ connection strategy and
+				// update _L_
+				Point2f pFilmNew = pFilm;
+				Float misWeight = 0.f;
+				HistogramSample sample = ConnectBDPTToF(
+					scene, lightVertices, cameraVertices, s, t,
+					*lightDistr, *camera, tileSampler, &pFilmNew,
+					&misWeight);
+				if (visualizeStrategies || visualizeWeights) {
+					Spectrum value;
+					if (visualizeStrategies)
+						value =
+						misWeight == 0 ? 0 : sample.L / misWeight;
+					if (visualizeWeights) value = sample.L;
+					weightFilms[BufferIndex(s, t)]->AddSplat(
+						pFilmNew, value);
+				}
+				if (t != 1) {
+					L += sample.L;
+					samples[t * (nLight + 1) + s] = sample;
+				}
+				else {
+					film->AddSplat(pFilmNew, 
+						IntegrationResult(sample.L, sample));
+				}
+			}
+		}
+		IntegrationResult result(L, samples);
+		filmTile.AddSample(pFilm, result);
+		return result;
+	};
+
 	// Render and write the output image to disk
-	if (scene.lights.size() > 0) {
+	Float splatScale = 1.0f / sampler->samplesPerPixel;
+	if (scene.lights.size() > 0 && adaptive.enabled) {
+		// Distribute samples in passes until the pixels converge. Every
+		// sample traces one light subpath, so splats are normalized by the
+		// average number of samples per pixel.
 		StatTimer timer(&renderingTime);
-		ParallelFor2D([&](const Point2i tile) {
+		int64_t nSamples = RenderAdaptive(adaptive, film, *sampler,
+			renderSample);
+		if (nSamples > 0) splatScale = (Float)sampleBounds.Area() / nSamples;
+	}
+	else if (scene.lights.size() > 0) {
+		StatTimer timer(&renderingTime);
+		ProgressReporter reporter(sampleBounds.Area(), "Rendering");
+		tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
 			// Render a single tile using BDPT
 			MemoryArena arena;
-			int seed = tile.y * nXTiles + tile.x;
-			std::unique_ptr<Sampler> tileSampler = sampler->Clone(seed);
-			int x0 = sampleBounds.pMin.x + tile.x * tileSize;
-			int x1 = std::min(x0 + tileSize, sampleBounds.pMax.x);
-			int y0 = sampleBounds.pMin.y + tile.y * tileSize;
-			int y1 = std::min(y0 + tileSize, sampleBounds.pMax.y);
-			Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+			std::unique_ptr<Sampler> tileSampler =
+				sampler->Clone(tiles.Seed(tileBounds));
 			std::unique_ptr<FilmTile> filmTile =
 				camera->film->GetFilmTile(tileBounds);
 			for (Point2i pPixel : tileBounds) {
 				tileSampler->StartPixel(pPixel);
 				do {
-					// Generate a single sample using BDPT
-					Point2f pFilm = (Point2f)pPixel + tileSampler->Get2D();
-
-					// Trace the camera and light subpaths
-					Vertex *cameraVertices = arena.Alloc<Vertex>(maxDepth + 2);
-					Vertex *lightVertices = arena.Alloc<Vertex>(maxDepth + 1);
-					int nCamera = GenerateCameraSubpath(
-						scene, *tileSampler, arena, maxDepth + 2, *camera,
-						pFilm, cameraVertices);
-					int nLight = GenerateLightSubpath(
-						scene, *tileSampler, arena, maxDepth + 1,
-						cameraVertices[0].time(), *lightDistr, lightVertices);
-
-					std::vector<HistogramSample> samples((nCamera + 1) * (nLight + 1));
-
-					// Execute all BDPT connection strategies
-					Spectrum L(0.f);
-					for (int t = 1; t <= nCamera; ++t) {
-						for (int s = 0; s <= nLight; ++s) {
-							int depth = t + s - 2;
-							if ((s == 1 && t == 1) || depth < 0 ||
-								depth > maxDepth)
-								continue;
-							// Execute the $(s, t)$ connection strategy and
-							// update _L_
-							Point2f pFilmNew = pFilm;
-							Float misWeight = 0.f;
-							HistogramSample sample = ConnectBDPTToF(
-								scene, lightVertices, cameraVertices, s, t,
-								*lightDistr, *camera, *tileSampler, &pFilmNew,
-								&misWeight);
-							if (visualizeStrategies || visualizeWeights) {
-								Spectrum value;
-								if (visualizeStrategies)
-									value =
-									misWeight == 0 ? 0 : sample.L / misWeight;
-								if (visualizeWeights) value = sample.L;
-								weightFilms[BufferIndex(s, t)]->AddSplat(
-									pFilmNew, value);
-							}
-							if (t != 1) {
-								L += sample.L;
-								samples[t * (nLight + 1) + s] = sample;
-							}
-							else {
-								film->AddSplat(pFilmNew, 
-									IntegrationResult(sample.L, sample));
-							}
-						}
-					}
-					filmTile->AddSample(pFilm, IntegrationResult(L, samples));
+					renderSample(pPixel, *tileSampler, *filmTile, arena);
 					arena.Reset();
 				} while (tileSampler->StartNextSample());
 			}
 			film->MergeFilmTile(std::move(filmTile));
-			reporter.Update();
-		}, Point2i(nXTiles, nYTiles));
+			reporter.Update(tileBounds.Area());
+		});
 		reporter.Done();
 	}
-	film->WriteImage(1.0f / sampler->samplesPerPixel);
+	film->WriteImage(splatScale);
 
 	// Write buffers for debug visualization
 	if (visualizeStrategies || visualizeWeights) {
-		const Float invSampleCount = 1.0f / sampler->samplesPerPixel;
 		for (size_t i = 0; i < weightFilms.size(); ++i)
-			if (weightFilms[i]) weightFilms[i]->WriteImage(invSampleCount);
+			if (weightFilms[i]) weightFilms[i]->WriteImage(splatScale);
 	}
 }
 
+// Returns the optical length of the segment between _a_ and _b_. Surface
+// vertices know which side of a dielectric the segment lies on; any other
+// vertex falls back to the medium it belongs to.
+static Float OpticalDistance(const Vertex &a, const Vertex &b) {
+	Float eta;
+	if (a.type == VertexType::Surface && a.si.bsdf)
+		eta = SegmentRefractiveIndex(a.si, b.p() - a.p());
+	else if (b.type == VertexType::Surface && b.si.bsdf)
+		eta = SegmentRefractiveIndex(b.si, a.p() - b.p());
+	else
+		eta = MediumRefractiveIndex(a.GetInteraction().GetMedium(b.p() - a.p()));
+	return eta * Distance(a.p(), b.p());
+}
+
 HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
 	Vertex *cameraVertices, int s, int t,
 	const Distribution1D &lightDistr, const Camera &camera,
@@ -183,7 +208,7 @@ HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
 					sampled.beta;
 				if (qs.IsOnSurface()) sample.L *= AbsDot(wi, qs.ns());
 				sample.pathLength = PathLength(lightVertices, s - 1);
-				sample.pathLength += Distance(qs.p(), sampled.p());
+				sample.pathLength += OpticalDistance(qs, sampled);
 			}
 		}
 	}
@@ -210,7 +235,7 @@ HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
 				// Only check visibility if the path would carry radiance.
 				if (!sample.L.IsBlack()) sample.L *= vis.Tr(scene, sampler);
 				sample.pathLength = PathLength(cameraVertices, t - 1);
-				sample.pathLength += Distance(pt.p(), sampled.p());
+				sample.pathLength += OpticalDistance(pt, sampled);
 			}
 		}
 	}
@@ -220,7 +245,7 @@ HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
 		if (qs.IsConnectible() && pt.IsConnectible()) {
 			sample.L = qs.beta * qs.f(pt) * pt.f(qs) * pt.beta;
 			if (!sample.L.IsBlack()) sample.L *= G(scene, sampler, qs, pt);
-			sample.pathLength = Distance(qs.p(), pt.p());
+			sample.pathLength = OpticalDistance(qs, pt);
 			sample.pathLength += PathLength(cameraVertices, t - 1);
 			sample.pathLength += PathLength(lightVertices, s - 1);
 		}
@@ -242,7 +267,7 @@ HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
 Float PathLength(Vertex* vertices, int lastIndex) {
 	Float result = 0.f;
 	for (int i = 0; i < lastIndex; ++i) {
-		result += Distance(vertices[i].p(), vertices[i + 1].p());
+		result += OpticalDistance(vertices[i], vertices[i + 1]);
 	}
 	return result;
 }
@@ -22,6 +22,7 @@ Author: Phil Pitts
 #include "pbrt.h"
 #include "integrators/bdpt.h"
 #include "histogram.h"
+#include "adaptive.h"
 
 // BDPT ToF Declarations
 class BDPTToFIntegrator : public Integrator {
@@ -36,6 +37,9 @@ public:
 		visualizeStrategies(visualizeStrategies),
 		visualizeWeights(visualizeWeights) {}
 	void Render(const Scene &scene);
+	void SetAdaptiveSampling(const AdaptiveSamplingOptions &options) {
+		adaptive = options;
+	}
 
 private:
 	// BDPTToFIntegrator Private Data
@@ -44,6 +48,7 @@ private:
 	const int maxDepth;
 	const bool visualizeStrategies;
 	const bool visualizeWeights;
+	AdaptiveSamplingOptions adaptive;
 };
 
 HistogramSample ConnectBDPTToF(const Scene &scene, Vertex *lightVertices,
@@ -14,6 +14,7 @@ Author: Phil Pitts
 #include "integrators/directtof.h"
 #include "paramset.h"
 #include "stats.h"
+#include "opticalpath.h"
 
 // DirectToFIntegrator Method Definitions
 void DirectToFIntegrator::Preprocess(const Scene &scene,
@@ -42,8 +43,9 @@ IntegrationResult DirectToFIntegrator::Li(const RayDifferential &ray,
 		return L;
 	}
 
-	// Compute distance from camera to surface interaction
-	Float pathLength = Distance(ray.o, isect.p);
+	// Compute optical distance from camera to surface interaction
+	Float eta = MediumRefractiveIndex(ray.medium);
+	Float pathLength = eta * Distance(ray.o, isect.p);
 	// Compute scattering functions for surface interaction
 	isect.ComputeScatteringFunctions(ray, arena);
 	if (!isect.bsdf)
@@ -52,7 +54,7 @@ IntegrationResult DirectToFIntegrator::Li(const RayDifferential &ray,
 	// Compute emitted light if ray hit an area light source
 	L += isect.Le(wo);
 	if (scene.lights.size() > 0) {
-		// Compute direct lighting and distance from surface to light
+		// Compute direct lighting and optical distance from surface to light
 		Float lightDistance = 0.;
 		if (strategy == LightStrategy::UniformSampleAll)
 			L += UniformSampleAllLights(isect, scene, arena, sampler,
@@ -18,6 +18,7 @@ Author: Phil Pitts
 #include "bssrdf.h"
 #include "stats.h"
 #include "histogram.h"
+#include "opticalpath.h"
 
 #include <queue>
 
@@ -33,6 +34,7 @@ IntegrationResult PathToFIntegrator::Li(const RayDifferential &r, const Scene &s
     RayDifferential ray(r);
     bool specularBounce = false;
 	Float pathLength = 0.f;
+	Float eta = MediumRefractiveIndex(ray.medium);
 
 	std::queue<HistogramSample> histogram;
 	
@@ -59,18 +61,19 @@ IntegrationResult PathToFIntegrator::Li(const RayDifferential &r, const Scene &s
         // Terminate path if ray escaped or _maxDepth_ was reached
         if (!foundIntersection || bounces >= maxDepth) break;
 
-		// Update the length of the path traced so far
-		pathLength += (ray.o - isect.p).Length();
+		// Update the optical length of the path traced so far
+		pathLength += eta * (ray.o - isect.p).Length();
 
         // Compute scattering functions and skip over medium boundaries
         isect.ComputeScatteringFunctions(ray, arena, true);
         if (!isect.bsdf) {
+            eta = MediumRefractiveIndex(isect.GetMedium(ray.d));
             ray = isect.SpawnRay(ray.d);
             bounces--;
             continue;
         }
 
-		Float lightPathLength;
+		Float lightPathLength = 0.f;
 
         // Sample illumination from lights to find path contribution.
         // (But skip this for perfectly specular BSDFs.)
@@ -95,6 +98,7 @@ IntegrationResult PathToFIntegrator::Li(const RayDifferential &r, const Scene &s
         Assert(beta.y() >= 0.f);
         Assert(std::isinf(beta.y()) == false);
         specularBounce = (flags & BSDF_SPECULAR) != 0;
+        eta = SegmentRefractiveIndex(isect, wi);
         ray = isect.SpawnRay(wi);
 
         // Subsurface scattering is currently unsupported
@@ -45,6 +45,7 @@
 #include "sampling.h"
 #include "samplers/halton.h"
 #include "stats.h"
+#include "tilescheduler.h"
 
 STAT_TIMER("Time/SPPM camera pass", hitPointTimer);
 STAT_TIMER("Time/SPPM visible point grid construction", gridConstructionTimer);
@@ -60,6 +61,7 @@ STAT_INT_DISTRIBUTION(
     "Stochastic Progressive Photon Mapping/Grid cells per visible point",
     gridCellsPerVisiblePoint);
 STAT_MEMORY_COUNTER("Memory/SPPM Pixels", pixelMemoryBytes);
+STAT_MEMORY_COUNTER("Memory/SPPM Sorted Grid", sortedGridMemoryBytes);
 STAT_FLOAT_DISTRIBUTION("Memory/SPPM BSDF and Grid Memory", memoryArenaMB);
 
 // SPPM Local Definitions
@@ -92,6 +94,11 @@ struct SPPMPixelListNode {
     SPPMPixelListNode *next;
 };
 
+struct SPPMGridPoint {
+    Point3f p;
+    Float radius2;
+};
+
 static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
                    const int gridRes[3], Point3i *pi) {
     bool inBounds = true;
@@ -110,6 +117,36 @@ inline unsigned int hash(const Point3i &p, int hashSize) {
            hashSize;
 }
 
+// Calls _f_ once for each distinct hash of the grid cells from _pMin_ to
+// _pMax_. Cells whose hashes collide share a list, which must hold a visible
+// point only once, or the photons found there would count twice.
+template <typename Func>
+static void ForEachCellHash(const Point3i &pMin, const Point3i &pMax,
+                            int hashSize, const Func &f) {
+    // Cells are at least as wide as the largest radius, so a visible point
+    // overlaps at most 3x3x3 of them
+    unsigned int hashes[27];
+    int nHashes = 0;
+    for (int z = pMin.z; z <= pMax.z; ++z)
+        for (int y = pMin.y; y <= pMax.y; ++y)
+            for (int x = pMin.x; x <= pMax.x; ++x) {
+                unsigned int h = hash(Point3i(x, y, z), hashSize);
+                if (std::find(hashes, hashes + nHashes, h) != hashes + nHashes)
+                    continue;
+                if (nHashes < 27) hashes[nHashes++] = h;
+                f(h);
+            }
+}
+
+static inline void AddPhotonContribution(SPPMPixel &pixel,
+                                         const Spectrum &beta,
+                                         const Vector3f &wi) {
+    // Update _pixel_ $\Phi$ and $M$ for nearby photon
+    Spectrum Phi = beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
+    for (int i = 0; i < Spectrum::nSamples; ++i) pixel.Phi[i].Add(Phi[i]);
+    ++pixel.M;
+}
+
 // SPPM Method Definitions
 void SPPMIntegrator::Render(const Scene &scene) {
     ProfilePhase p(Prof::IntegratorRender);
@@ -127,29 +164,19 @@ void SPPMIntegrator::Render(const Scene &scene) {
     // Perform _nIterations_ of SPPM integration
     HaltonSampler sampler(nIterations, pixelBounds);
 
-    // Compute number of tiles to use for SPPM camera pass
-    Vector2i pixelExtent = pixelBounds.Diagonal();
-    const int tileSize = 16;
-    Point2i nTiles((pixelExtent.x + tileSize - 1) / tileSize,
-                   (pixelExtent.y + tileSize - 1) / tileSize);
+    // Partition the image into tiles for the SPPM camera pass
+    TileScheduler tiles(pixelBounds);
     ProgressReporter progress(2 * nIterations, "Rendering");
     for (int iter = 0; iter < nIterations; ++iter) {
         // Generate SPPM visible points
         std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
         {
             StatTimer timer(&hitPointTimer);
-            ParallelFor2D([&](Point2i tile) {
+            tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
                 MemoryArena &arena = perThreadArenas[ThreadIndex];
-                // Follow camera paths for _tile_ in image for SPPM
-                int tileIndex = tile.y * nTiles.x + tile.x;
-                std::unique_ptr<Sampler> tileSampler = sampler.Clone(tileIndex);
-
-                // Compute _tileBounds_ for SPPM tile
-                int x0 = pixelBounds.pMin.x + tile.x * tileSize;
-                int x1 = std::min(x0 + tileSize, pixelBounds.pMax.x);
-                int y0 = pixelBounds.pMin.y + tile.y * tileSize;
-                int y1 = std::min(y0 + tileSize, pixelBounds.pMax.y);
-                Bounds2i tileBounds(Point2i(x0, y0), Point2i(x1, y1));
+                // Follow camera paths for _tileBounds_ in image for SPPM
+                std::unique_ptr<Sampler> tileSampler =
+                    sampler.Clone(tiles.Seed(tileBounds));
                 for (Point2i pPixel : tileBounds) {
                     // Prepare _tileSampler_ for _pPixel_
                     tileSampler->StartPixel(pPixel);
@@ -235,7 +262,9 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         }
                     }
                 }
-            }, nTiles);
+            });
+            // Subdivide expensive tiles for the next camera pass
+            tiles.Refine();
         }
         progress.Update();
 
@@ -243,7 +272,10 @@ void SPPMIntegrator::Render(const Scene &scene) {
 
         // Allocate grid for SPPM visible points
         int hashSize = nPixels;
-        std::vector<std::atomic<SPPMPixelListNode *>> grid(hashSize);
+        std::vector<std::atomic<SPPMPixelListNode *>> grid(
+            sortedGrid ? 0 : hashSize);
+        std::vector<int> cellOffsets, cellEntries;
+        std::vector<SPPMGridPoint> gridPoints;
 
         // Compute grid bounds for SPPM visible points
         Bounds3f gridBounds;
@@ -266,7 +298,61 @@ void SPPMIntegrator::Render(const Scene &scene) {
             gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
 
         // Add visible points to SPPM grid
-        {
+        if (sortedGrid) {
+            // Counting sort visible points by hash cell into _cellEntries_
+            StatTimer timer(&gridConstructionTimer);
+            gridPoints.resize(nPixels);
+            std::vector<std::atomic<int>> cellCounts(hashSize);
+            auto forEachCell = [&](int pixelIndex,
+                                   const std::function<void(int)> &f) -> int {
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                Float radius = pixel.radius;
+                Point3i pMin, pMax;
+                ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
+                       gridBounds, gridRes, &pMin);
+                ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
+                       gridBounds, gridRes, &pMax);
+                ForEachCellHash(pMin, pMax, hashSize, f);
+                return (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
+                       (1 + pMax.z - pMin.z);
+            };
+
+            // Count the visible points that overlap each grid cell
+            ParallelFor([&](int pixelIndex) {
+                const SPPMPixel &pixel = pixels[pixelIndex];
+                if (pixel.vp.beta.IsBlack()) return;
+                gridPoints[pixelIndex] = {pixel.vp.p,
+                                          pixel.radius * pixel.radius};
+                int nCells = forEachCell(pixelIndex, [&](int h) {
+                    cellCounts[h].fetch_add(1, std::memory_order_relaxed);
+                });
+                ReportValue(gridCellsPerVisiblePoint, nCells);
+            }, nPixels, 4096);
+
+            // Compute cell offsets and reuse _cellCounts_ as write cursors
+            cellOffsets.resize(hashSize + 1);
+            cellOffsets[0] = 0;
+            for (int h = 0; h < hashSize; ++h) {
+                cellOffsets[h + 1] = cellOffsets[h] + cellCounts[h];
+                cellCounts[h] = cellOffsets[h];
+            }
+            cellEntries.resize(cellOffsets[hashSize]);
+
+            // Scatter visible point indices into their cells' ranges
+            ParallelFor([&](int pixelIndex) {
+                if (pixels[pixelIndex].vp.beta.IsBlack()) return;
+                forEachCell(pixelIndex, [&](int h) {
+                    int slot =
+                        cellCounts[h].fetch_add(1, std::memory_order_relaxed);
+                    cellEntries[slot] = pixelIndex;
+                });
+            }, nPixels, 4096);
+            sortedGridMemoryBytes =
+                std::max(sortedGridMemoryBytes,
+                         (int64_t)(cellOffsets.size() * sizeof(int) +
+                                   cellEntries.size() * sizeof(int) +
+                                   gridPoints.size() * sizeof(SPPMGridPoint)));
+        } else {
             StatTimer timer(&gridConstructionTimer);
             ParallelFor([&](int pixelIndex) {
                 MemoryArena &arena = perThreadArenas[ThreadIndex];
@@ -279,22 +365,19 @@ void SPPMIntegrator::Render(const Scene &scene) {
                            gridBounds, gridRes, &pMin);
                     ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
                            gridBounds, gridRes, &pMax);
-                    for (int z = pMin.z; z <= pMax.z; ++z)
-                        for (int y = pMin.y; y <= pMax.y; ++y)
-                            for (int x = pMin.x; x <= pMax.x; ++x) {
-                                // Add visible point to grid cell $(x, y, z)$
-                                int h = hash(Point3i(x, y, z), hashSize);
-                                SPPMPixelListNode *node =
-                                    arena.Alloc<SPPMPixelListNode>();
-                                node->pixel = &pixel;
-
-                                // Atomically add _node_ to the start of
-                                // _grid[h]_'s linked list
-                                node->next = grid[h];
-                                while (grid[h].compare_exchange_weak(
-                                           node->next, node) == false)
-                                    ;
-                            }
+                    ForEachCellHash(pMin, pMax, hashSize, [&](int h) {
+                        // Add visible point to grid cell list _h_
+                        SPPMPixelListNode *node =
+                            arena.Alloc<SPPMPixelListNode>();
+                        node->pixel = &pixel;
+
+                        // Atomically add _node_ to the start of _grid[h]_'s
+                        // linked list
+                        node->next = grid[h];
+                        while (grid[h].compare_exchange_weak(node->next,
+                                                             node) == false)
+                            ;
+                    });
                     ReportValue(gridCellsPerVisiblePoint,
                                 (1 + pMax.x - pMin.x) * (1 + pMax.y - pMin.y) *
                                     (1 + pMax.z - pMin.z));
@@ -354,25 +437,37 @@ void SPPMIntegrator::Render(const Scene &scene) {
                         if (ToGrid(isect.p, gridBounds, gridRes,
                                    &photonGridIndex)) {
                             int h = hash(photonGridIndex, hashSize);
-                            // Add photon contribution to visible points in
-                            // _grid[h]_
-                            for (SPPMPixelListNode *node =
-                                     grid[h].load(std::memory_order_relaxed);
-                                 node != nullptr; node = node->next) {
-                                ++visiblePointsChecked;
-                                SPPMPixel &pixel = *node->pixel;
-                                Float radius = pixel.radius;
-                                if (DistanceSquared(pixel.vp.p, isect.p) >
-                                    radius * radius)
-                                    continue;
-                                // Update _pixel_ $\Phi$ and $M$ for nearby
-                                // photon
-                                Vector3f wi = -photonRay.d;
-                                Spectrum Phi =
-                                    beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
-                                for (int i = 0; i < Spectrum::nSamples; ++i)
-                                    pixel.Phi[i].Add(Phi[i]);
-                                ++pixel.M;
+                            Vector3f wi = -photonRay.d;
+                            if (sortedGrid) {
+                                // Add photon contribution to visible points in
+                                // _h_'s contiguous range of _cellEntries_
+                                for (int j = cellOffsets[h];
+                                     j < cellOffsets[h + 1]; ++j) {
+                                    ++visiblePointsChecked;
+                                    int pixelIndex = cellEntries[j];
+                                    const SPPMGridPoint &gp =
+                                        gridPoints[pixelIndex];
+                                    if (DistanceSquared(gp.p, isect.p) >
+                                        gp.radius2)
+                                        continue;
+                                    AddPhotonContribution(pixels[pixelIndex],
+                                                          beta, wi);
+                                }
+                            } else {
+                                // Add photon contribution to visible points in
+                                // _grid[h]_
+                                for (SPPMPixelListNode *node =
+                                         grid[h].load(
+                                             std::memory_order_relaxed);
+                                     node != nullptr; node = node->next) {
+                                    ++visiblePointsChecked;
+                                    SPPMPixel &pixel = *node->pixel;
+                                    Float radius = pixel.radius;
+                                    if (DistanceSquared(pixel.vp.p, isect.p) >
+                                        radius * radius)
+                                        continue;
+                                    AddPhotonContribution(pixel, beta, wi);
+                                }
                             }
                         }
                     }
@@ -508,7 +603,14 @@ Integrator *CreateSPPMIntegrator(const ParamSet &params,
     int photonsPerIter = params.FindOneInt("photonsperiteration", -1);
     int writeFreq = params.FindOneInt("imagewritefrequency", 1 << 31);
     Float radius = params.FindOneFloat("radius", 1.f);
+    std::string gridType = params.FindOneString("grid", "hash");
+    bool sortedGrid = false;
+    if (gridType == "sorted")
+        sortedGrid = true;
+    else if (gridType != "hash")
+        Warning("SPPM grid \"%s\" unknown. Using \"hash\".",
+                gridType.c_str());
     if (PbrtOptions.quickRender) nIterations = std::max(1, nIterations / 16);
     return new SPPMIntegrator(camera, nIterations, photonsPerIter, maxDepth,
-                              radius, writeFreq);
+                              radius, writeFreq, sortedGrid);
 }
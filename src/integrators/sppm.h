@@ -51,7 +51,8 @@ class SPPMIntegrator : public Integrator {
     // SPPMIntegrator Public Methods
     SPPMIntegrator(std::shared_ptr<const Camera> &camera, int nIterations,
                    int photonsPerIteration, int maxDepth,
-                   Float initialSearchRadius, int writeFrequency)
+                   Float initialSearchRadius, int writeFrequency,
+                   bool sortedGrid)
         : camera(camera),
           initialSearchRadius(initialSearchRadius),
           nIterations(nIterations),
@@ -59,7 +60,8 @@ class SPPMIntegrator : public Integrator {
           photonsPerIteration(photonsPerIteration > 0
                                   ? photonsPerIteration
                                   : camera->film->croppedPixelBounds.Area()),
-          writeFrequency(writeFrequency) {}
+          writeFrequency(writeFrequency),
+          sortedGrid(sortedGrid) {}
     void Render(const Scene &scene);
 
   private:
@@ -70,6 +72,7 @@ class SPPMIntegrator : public Integrator {
     const int maxDepth;
     const int photonsPerIteration;
     const int writeFrequency;
+    const bool sortedGrid;
 };
 
 Integrator *CreateSPPMIntegrator(const ParamSet &params,
@@ -0,0 +1,546 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// integrators/sppmtof.cpp*
+#include "integrators/sppmtof.h"
+#include "parallel.h"
+#include "scene.h"
+#include "spectrum.h"
+#include "paramset.h"
+#include "progressreporter.h"
+#include "interaction.h"
+#include "sampling.h"
+#include "samplers/halton.h"
+#include "histogram.h"
+#include "opticalpath.h"
+#include "stats.h"
+#include "tilescheduler.h"
+
+STAT_TIMER("Time/SPPM ToF camera pass", hitPointTimer);
+STAT_TIMER("Time/SPPM ToF visible point grid construction", gridConstructionTimer);
+STAT_TIMER("Time/SPPM ToF photon pass", photonTimer);
+STAT_TIMER("Time/SPPM ToF statistics update", statsUpdateTimer);
+STAT_RATIO(
+	"Stochastic Progressive Photon Mapping ToF/Visible points checked per "
+	"photon intersection",
+	visiblePointsChecked, totalPhotonSurfaceInteractions);
+STAT_PERCENT(
+	"Stochastic Progressive Photon Mapping ToF/Grid cells skipped by time "
+	"window",
+	windowSkippedCells, windowTestedCells);
+STAT_COUNTER("Stochastic Progressive Photon Mapping ToF/Photon paths followed",
+	photonPaths);
+STAT_MEMORY_COUNTER("Memory/SPPM ToF Pixels", pixelMemoryBytes);
+
+// SPPM ToF Local Definitions
+struct SPPMToFPixel {
+	// SPPMToFPixel Public Methods
+	SPPMToFPixel() : M(0) {}
+	void Initialize(Float initialRadius, int nBins) {
+		radius = initialRadius;
+		Ld.resize(nBins);
+		tau.resize(nBins);
+		Phi.reset(new AtomicFloat[nBins * Spectrum::nSamples]);
+	}
+
+	// SPPMToFPixel Public Data
+	Float radius = 0;
+	std::vector<Spectrum> Ld;
+	struct VisiblePoint {
+		// VisiblePoint Public Methods
+		VisiblePoint() {}
+		VisiblePoint(const Point3f &p, const Vector3f &wo, const BSDF *bsdf,
+			const Spectrum &beta, Float pathLength)
+			: p(p), wo(wo), bsdf(bsdf), beta(beta), pathLength(pathLength) {}
+		Point3f p;
+		Vector3f wo;
+		const BSDF *bsdf = nullptr;
+		Spectrum beta;
+		Float pathLength = 0;
+	} vp;
+	std::unique_ptr<AtomicFloat[]> Phi;
+	std::atomic<int> M;
+	Float N = 0;
+	std::vector<Spectrum> tau;
+};
+
+struct SPPMToFPixelListNode {
+	SPPMToFPixel *pixel;
+	SPPMToFPixelListNode *next;
+};
+
+static bool ToGrid(const Point3f &p, const Bounds3f &bounds,
+	const int gridRes[3], Point3i *pi) {
+	bool inBounds = true;
+	Vector3f pg = bounds.Offset(p);
+	for (int i = 0; i < 3; ++i) {
+		(*pi)[i] = (int)(gridRes[i] * pg[i]);
+		inBounds &= ((*pi)[i] >= 0 && (*pi)[i] < gridRes[i]);
+		(*pi)[i] = Clamp((*pi)[i], 0, gridRes[i] - 1);
+	}
+	return inBounds;
+}
+
+inline unsigned int hash(const Point3i &p, int hashSize) {
+	return (unsigned int)((p.x * 73856093) ^ (p.y * 19349663) ^
+		(p.z * 83492791)) %
+		hashSize;
+}
+
+// Calls _f_ once for each distinct hash of the grid cells from _pMin_ to
+// _pMax_. Cells whose hashes collide share a list, which must hold a visible
+// point only once, or the photons found there would count twice.
+template <typename Func>
+static void ForEachCellHash(const Point3i &pMin, const Point3i &pMax,
+	int hashSize, const Func &f) {
+	// Cells are at least as wide as the largest radius, so a visible point
+	// overlaps at most 3x3x3 of them
+	unsigned int hashes[27];
+	int nHashes = 0;
+	for (int z = pMin.z; z <= pMax.z; ++z)
+		for (int y = pMin.y; y <= pMax.y; ++y)
+			for (int x = pMin.x; x <= pMax.x; ++x) {
+				unsigned int h = hash(Point3i(x, y, z), hashSize);
+				if (std::find(hashes, hashes + nHashes, h) !=
+					hashes + nHashes)
+					continue;
+				if (nHashes < 27) hashes[nHashes++] = h;
+				f(h);
+			}
+}
+
+// Returns the histogram bin for _pathLength_, or -1 if the path length
+// falls outside of the time window covered by the histogram.
+inline int PathLengthBin(Float pathLength, Float binSize, int nBins) {
+	if (pathLength < 0 || std::isinf(pathLength)) return -1;
+	int bin = (int)(pathLength / binSize);
+	return bin < nBins ? bin : -1;
+}
+
+// SPPM ToF Method Definitions
+void SPPMToFIntegrator::Render(const Scene &scene) {
+	ProfilePhase p(Prof::IntegratorRender);
+	// Initialize _pixelBounds_ and _pixels_ array for SPPM ToF
+	Bounds2i pixelBounds = camera->film->croppedPixelBounds;
+	int nPixels = pixelBounds.Area();
+	const int nBins = std::max(1, (int)(maxPathLength / binSize));
+	std::unique_ptr<SPPMToFPixel[]> pixels(new SPPMToFPixel[nPixels]);
+	for (int i = 0; i < nPixels; ++i)
+		pixels[i].Initialize(initialSearchRadius, nBins);
+	const Float invSqrtSPP = 1.f / std::sqrt(nIterations);
+	pixelMemoryBytes = nPixels * (sizeof(SPPMToFPixel) +
+		nBins * (2 * sizeof(Spectrum) + Spectrum::nSamples * sizeof(AtomicFloat)));
+	// Compute _lightDistr_ for sampling lights proportional to power
+	std::unique_ptr<Distribution1D> lightDistr =
+		ComputeLightPowerDistribution(scene);
+
+	// Perform _nIterations_ of SPPM ToF integration
+	HaltonSampler sampler(nIterations, pixelBounds);
+
+	// Partition the image into tiles for the SPPM ToF camera pass
+	TileScheduler tiles(pixelBounds);
+	ProgressReporter progress(2 * nIterations, "Rendering");
+	for (int iter = 0; iter < nIterations; ++iter) {
+		// Generate SPPM ToF visible points
+		std::vector<MemoryArena> perThreadArenas(MaxThreadIndex());
+		{
+			StatTimer timer(&hitPointTimer);
+			tiles.ParallelForTiles([&](const Bounds2i &tileBounds) {
+				MemoryArena &arena = perThreadArenas[ThreadIndex];
+				// Follow camera paths for _tileBounds_ in image for SPPM ToF
+				std::unique_ptr<Sampler> tileSampler =
+					sampler.Clone(tiles.Seed(tileBounds));
+				for (Point2i pPixel : tileBounds) {
+					// Prepare _tileSampler_ for _pPixel_
+					tileSampler->StartPixel(pPixel);
+					tileSampler->SetSampleNumber(iter);
+
+					// Generate camera ray for pixel for SPPM ToF
+					CameraSample cameraSample =
+						tileSampler->GetCameraSample(pPixel);
+					RayDifferential ray;
+					Spectrum beta =
+						camera->GenerateRayDifferential(cameraSample, &ray);
+					ray.ScaleDifferentials(invSqrtSPP);
+
+					// Follow camera ray path until a visible point is created
+
+					// Get _SPPMToFPixel_ for _pPixel_
+					Point2i pPixelO = Point2i(pPixel - pixelBounds.pMin);
+					int pixelOffset =
+						pPixelO.x +
+						pPixelO.y * (pixelBounds.pMax.x - pixelBounds.pMin.x);
+					SPPMToFPixel &pixel = pixels[pixelOffset];
+					bool specularBounce = false;
+					Float pathLength = 0.f;
+					Float eta = MediumRefractiveIndex(ray.medium);
+					for (int depth = 0; depth < maxDepth; ++depth) {
+						SurfaceInteraction isect;
+						++totalPhotonSurfaceInteractions;
+						// Light arriving from infinitely far away has no
+						// finite path length and falls outside every bin
+						if (!scene.Intersect(ray, &isect)) break;
+
+						// Update the optical length of the camera path
+						pathLength += eta * Distance(ray.o, isect.p);
+
+						// Compute BSDF at SPPM ToF camera ray intersection
+						isect.ComputeScatteringFunctions(ray, arena, true);
+						if (!isect.bsdf) {
+							ray = isect.SpawnRay(ray.d);
+							eta = MediumRefractiveIndex(ray.medium);
+							--depth;
+							continue;
+						}
+						const BSDF &bsdf = *isect.bsdf;
+
+						// Accumulate direct illumination at SPPM ToF camera ray
+						// intersection
+						Vector3f wo = -ray.d;
+						if (depth == 0 || specularBounce) {
+							int bin = PathLengthBin(pathLength, binSize, nBins);
+							if (bin >= 0) pixel.Ld[bin] += beta * isect.Le(wo);
+						}
+						Float lightPathLength = 0.f;
+						Spectrum Ld = beta * UniformSampleOneLight(isect, scene,
+							arena, *tileSampler, false, &lightPathLength);
+						int bin = PathLengthBin(pathLength + lightPathLength,
+							binSize, nBins);
+						if (bin >= 0) pixel.Ld[bin] += Ld;
+
+						// Possibly create visible point and end camera path
+						bool isDiffuse = bsdf.NumComponents(BxDFType(
+							BSDF_DIFFUSE | BSDF_REFLECTION |
+							BSDF_TRANSMISSION)) > 0;
+						bool isGlossy = bsdf.NumComponents(BxDFType(
+							BSDF_GLOSSY | BSDF_REFLECTION |
+							BSDF_TRANSMISSION)) > 0;
+						if (isDiffuse || (isGlossy && depth == maxDepth - 1)) {
+							pixel.vp = { isect.p, wo, &bsdf, beta, pathLength };
+							break;
+						}
+
+						// Spawn ray from SPPM ToF camera path vertex
+						if (depth < maxDepth - 1) {
+							Float pdf;
+							Vector3f wi;
+							BxDFType type;
+							Spectrum f =
+								bsdf.Sample_f(wo, &wi, tileSampler->Get2D(),
+									&pdf, BSDF_ALL, &type);
+							if (pdf == 0. || f.IsBlack()) break;
+							specularBounce = (type & BSDF_SPECULAR) != 0;
+							beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+							if (beta.y() < 0.25) {
+								Float continueProb =
+									std::min((Float)1, beta.y());
+								if (tileSampler->Get1D() > continueProb) break;
+								beta /= continueProb;
+							}
+							eta = SegmentRefractiveIndex(isect, wi);
+							ray = (RayDifferential)isect.SpawnRay(wi);
+						}
+					}
+				}
+			});
+			// Subdivide expensive tiles for the next camera pass
+			tiles.Refine();
+		}
+		progress.Update();
+
+		// Create grid of all SPPM ToF visible points
+
+		// Allocate grid for SPPM ToF visible points
+		int hashSize = nPixels;
+		std::vector<std::atomic<SPPMToFPixelListNode *>> grid(hashSize);
+
+		// Compute grid bounds and shortest camera path for visible points
+		Bounds3f gridBounds;
+		Float maxRadius = 0.;
+		Float minVisiblePathLength = Infinity;
+		for (int i = 0; i < nPixels; ++i) {
+			const SPPMToFPixel &pixel = pixels[i];
+			if (pixel.vp.beta.IsBlack()) continue;
+			Bounds3f vpBound = Expand(Bounds3f(pixel.vp.p), pixel.radius);
+			gridBounds = Union(gridBounds, vpBound);
+			maxRadius = std::max(maxRadius, pixel.radius);
+			minVisiblePathLength =
+				std::min(minVisiblePathLength, pixel.vp.pathLength);
+		}
+
+		// Compute resolution of SPPM ToF grid in each dimension
+		Vector3f diag = gridBounds.Diagonal();
+		Float maxDiag = MaxComponent(diag);
+		int baseGridRes = (int)(maxDiag / maxRadius);
+		Assert(baseGridRes > 0);
+		int gridRes[3];
+		for (int i = 0; i < 3; ++i)
+			gridRes[i] = std::max((int)(baseGridRes * diag[i] / maxDiag), 1);
+
+		// Add visible points to SPPM ToF grid
+		std::vector<Float> gridMinPathLength(hashSize, Infinity);
+		{
+			StatTimer timer(&gridConstructionTimer);
+			ParallelFor([&](int pixelIndex) {
+				MemoryArena &arena = perThreadArenas[ThreadIndex];
+				SPPMToFPixel &pixel = pixels[pixelIndex];
+				if (!pixel.vp.beta.IsBlack()) {
+					// Add pixel's visible point to applicable grid cells
+					Float radius = pixel.radius;
+					Point3i pMin, pMax;
+					ToGrid(pixel.vp.p - Vector3f(radius, radius, radius),
+						gridBounds, gridRes, &pMin);
+					ToGrid(pixel.vp.p + Vector3f(radius, radius, radius),
+						gridBounds, gridRes, &pMax);
+					ForEachCellHash(pMin, pMax, hashSize, [&](int h) {
+						// Add visible point to grid cell list _h_
+						SPPMToFPixelListNode *node =
+							arena.Alloc<SPPMToFPixelListNode>();
+						node->pixel = &pixel;
+
+						// Atomically add _node_ to the start of _grid[h]_'s
+						// linked list
+						node->next = grid[h];
+						while (grid[h].compare_exchange_weak(
+							node->next, node) == false)
+							;
+					});
+				}
+			}, nPixels, 4096);
+
+			// Record the shortest camera path length stored in each grid
+			// cell so that photons can skip cells outside the time window
+			ParallelFor([&](int h) {
+				Float minPathLength = Infinity;
+				for (SPPMToFPixelListNode *node =
+					grid[h].load(std::memory_order_relaxed);
+					node != nullptr; node = node->next)
+					minPathLength =
+						std::min(minPathLength, node->pixel->vp.pathLength);
+				gridMinPathLength[h] = minPathLength;
+			}, hashSize, 4096);
+		}
+
+		// Trace photons and accumulate contributions
+		{
+			StatTimer timer(&photonTimer);
+			std::vector<MemoryArena> photonShootArenas(MaxThreadIndex());
+			ParallelFor([&](int photonIndex) {
+				MemoryArena &arena = photonShootArenas[ThreadIndex];
+				// Follow photon path for _photonIndex_
+				uint64_t haltonIndex =
+					(uint64_t)iter * (uint64_t)photonsPerIteration +
+					photonIndex;
+				int haltonDim = 0;
+
+				// Choose light to shoot photon from
+				Float lightPdf;
+				Float lightSample = RadicalInverse(haltonDim++, haltonIndex);
+				int lightNum =
+					lightDistr->SampleDiscrete(lightSample, &lightPdf);
+				const std::shared_ptr<Light> &light = scene.lights[lightNum];
+
+				// Compute sample values for photon ray leaving light source
+				Point2f uLight0(RadicalInverse(haltonDim, haltonIndex),
+					RadicalInverse(haltonDim + 1, haltonIndex));
+				Point2f uLight1(RadicalInverse(haltonDim + 2, haltonIndex),
+					RadicalInverse(haltonDim + 3, haltonIndex));
+				Float uLightTime =
+					Lerp(RadicalInverse(haltonDim + 4, haltonIndex),
+						camera->shutterOpen, camera->shutterClose);
+				haltonDim += 5;
+
+				// Generate _photonRay_ from light source and initialize _beta_
+				RayDifferential photonRay;
+				Normal3f nLight;
+				Float pdfPos, pdfDir;
+				Spectrum Le =
+					light->Sample_Le(uLight0, uLight1, uLightTime, &photonRay,
+						&nLight, &pdfPos, &pdfDir);
+				if (pdfPos == 0 || pdfDir == 0 || Le.IsBlack()) return;
+				Spectrum beta = (AbsDot(nLight, photonRay.d) * Le) /
+					(lightPdf * pdfPos * pdfDir);
+				if (beta.IsBlack()) return;
+
+				// Follow photon path through scene and record intersections
+				SurfaceInteraction isect;
+				Float photonPathLength = 0.f;
+				Float photonEta = MediumRefractiveIndex(photonRay.medium);
+				for (int depth = 0; depth < maxDepth; ++depth) {
+					if (!scene.Intersect(photonRay, &isect)) break;
+					++totalPhotonSurfaceInteractions;
+
+					// Terminate the photon once no visible point can place
+					// its contribution inside the histogram's time window
+					photonPathLength +=
+						photonEta * Distance(photonRay.o, isect.p);
+					if (photonPathLength + minVisiblePathLength >= maxPathLength)
+						break;
+
+					if (depth > 0) {
+						// Add photon contribution to nearby visible points
+						Point3i photonGridIndex;
+						if (ToGrid(isect.p, gridBounds, gridRes,
+							&photonGridIndex)) {
+							int h = hash(photonGridIndex, hashSize);
+							++windowTestedCells;
+							if (photonPathLength + gridMinPathLength[h] >=
+								maxPathLength) {
+								++windowSkippedCells;
+							}
+							else {
+								// Add photon contribution to visible points in
+								// _grid[h]_
+								for (SPPMToFPixelListNode *node =
+									grid[h].load(std::memory_order_relaxed);
+									node != nullptr; node = node->next) {
+									++visiblePointsChecked;
+									SPPMToFPixel &pixel = *node->pixel;
+									Float radius = pixel.radius;
+									if (DistanceSquared(pixel.vp.p, isect.p) >
+										radius * radius)
+										continue;
+									int bin = PathLengthBin(
+										photonPathLength + pixel.vp.pathLength,
+										binSize, nBins);
+									if (bin < 0) continue;
+									// Update _pixel_ $\Phi$ and $M$ for nearby
+									// photon
+									Vector3f wi = -photonRay.d;
+									Spectrum Phi =
+										beta * pixel.vp.bsdf->f(pixel.vp.wo, wi);
+									AtomicFloat *binPhi =
+										&pixel.Phi[bin * Spectrum::nSamples];
+									for (int i = 0; i < Spectrum::nSamples; ++i)
+										binPhi[i].Add(Phi[i]);
+									++pixel.M;
+								}
+							}
+						}
+					}
+					// Sample new photon ray direction
+
+					// Compute BSDF at photon intersection point
+					isect.ComputeScatteringFunctions(photonRay, arena, true,
+						TransportMode::Importance);
+					if (!isect.bsdf) {
+						--depth;
+						photonRay = isect.SpawnRay(photonRay.d);
+						photonEta = MediumRefractiveIndex(photonRay.medium);
+						continue;
+					}
+					const BSDF &photonBSDF = *isect.bsdf;
+
+					// Sample BSDF _fr_ and direction _wi_ for reflected photon
+					Vector3f wi, wo = -photonRay.d;
+					Float pdf;
+					BxDFType flags;
+
+					// Generate _bsdfSample_ for outgoing photon sample
+					Point2f bsdfSample(
+						RadicalInverse(haltonDim, haltonIndex),
+						RadicalInverse(haltonDim + 1, haltonIndex));
+					haltonDim += 2;
+					Spectrum fr = photonBSDF.Sample_f(wo, &wi, bsdfSample, &pdf,
+						BSDF_ALL, &flags);
+					if (fr.IsBlack() || pdf == 0.f) break;
+					Spectrum bnew =
+						beta * fr * AbsDot(wi, isect.shading.n) / pdf;
+
+					// Possibly terminate photon path with Russian roulette
+					Float q = std::max((Float)0, 1 - bnew.y() / beta.y());
+					if (RadicalInverse(haltonDim++, haltonIndex) < q) break;
+					beta = bnew / (1 - q);
+					photonEta = SegmentRefractiveIndex(isect, wi);
+					photonRay = (RayDifferential)isect.SpawnRay(wi);
+				}
+				arena.Reset();
+			}, photonsPerIteration, 8192);
+			progress.Update();
+			photonPaths += photonsPerIteration;
+		}
+
+		// Update pixel values from this pass's photons
+		{
+			StatTimer timer(&statsUpdateTimer);
+			ParallelFor([&](int i) {
+				SPPMToFPixel &p = pixels[i];
+				if (p.M > 0) {
+					// Update pixel photon count, search radius, and per-bin
+					// $\tau$ from photons
+					Float gamma = (Float)2 / (Float)3;
+					Float Nnew = p.N + gamma * p.M;
+					Float Rnew = p.radius * std::sqrt(Nnew / (p.N + p.M));
+					Float radiusScale = (Rnew * Rnew) / (p.radius * p.radius);
+					for (int b = 0; b < nBins; ++b) {
+						AtomicFloat *binPhi = &p.Phi[b * Spectrum::nSamples];
+						Spectrum Phi;
+						for (int j = 0; j < Spectrum::nSamples; ++j) {
+							Phi[j] = binPhi[j];
+							binPhi[j] = (Float)0;
+						}
+						p.tau[b] = (p.tau[b] + p.vp.beta * Phi) * radiusScale;
+					}
+					p.N = Nnew;
+					p.radius = Rnew;
+					p.M = 0;
+				}
+				// Reset _VisiblePoint_ in pixel
+				p.vp.beta = 0.;
+				p.vp.bsdf = nullptr;
+			}, nPixels, 4096);
+		}
+
+		// Periodically store SPPM ToF histograms in film and write them
+		if (iter + 1 == nIterations || ((iter + 1) % writeFrequency) == 0) {
+			uint64_t Np = (uint64_t)(iter + 1) * (uint64_t)photonsPerIteration;
+			std::unique_ptr<IntegrationResult[]> image(
+				new IntegrationResult[nPixels]);
+			ParallelFor([&](int i) {
+				// Compute histogram and radiance _L_ for SPPM ToF pixel
+				const SPPMToFPixel &pixel = pixels[i];
+				IntegrationResult &result = image[i];
+				result.L = Spectrum(0.f);
+				for (int b = 0; b < nBins; ++b) {
+					Spectrum L = pixel.Ld[b] / (iter + 1);
+					L += pixel.tau[b] /
+						(Np * Pi * pixel.radius * pixel.radius);
+					if (L.IsBlack()) continue;
+					result.L += L;
+					result.histogramSamples.push_back(
+						HistogramSample(L, (b + (Float)0.5) * binSize));
+				}
+			}, nPixels, 4096);
+			camera->film->SetImage(image.get());
+			camera->film->WriteImage();
+		}
+	}
+	progress.Done();
+}
+
+Integrator *CreateSPPMToFIntegrator(const ParamSet &params,
+	std::shared_ptr<const Camera> camera) {
+	int nIterations = params.FindOneInt("numiterations", 4);
+	int maxDepth = params.FindOneInt("maxdepth", 5);
+	int photonsPerIter = params.FindOneInt("photonsperiteration", -1);
+	int writeFreq = params.FindOneInt("imagewritefrequency", 1 << 31);
+	Float radius = params.FindOneFloat("radius", 1.f);
+	Float binSize = params.FindOneFloat("binsize", 0.1);
+	Float maxPathLength = params.FindOneFloat("maxpathlength", 10.);
+	if (binSize <= 0) {
+		Error("\"binsize\" must be positive. Using 0.1.");
+		binSize = 0.1;
+	}
+	if (PbrtOptions.quickRender) nIterations = std::max(1, nIterations / 16);
+	return new SPPMToFIntegrator(camera, nIterations, photonsPerIter, maxDepth,
+		radius, writeFreq, binSize, maxPathLength);
+}
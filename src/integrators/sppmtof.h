@@ -0,0 +1,61 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_SPPMTOF_H
+#define PBRT_INTEGRATORS_SPPMTOF_H
+#include "stdafx.h"
+
+// integrators/sppmtof.h*
+#include "pbrt.h"
+#include "integrator.h"
+#include "camera.h"
+#include "film.h"
+
+// SPPM ToF Declarations
+class SPPMToFIntegrator : public Integrator {
+public:
+	// SPPMToFIntegrator Public Methods
+	SPPMToFIntegrator(std::shared_ptr<const Camera> &camera, int nIterations,
+		int photonsPerIteration, int maxDepth,
+		Float initialSearchRadius, int writeFrequency,
+		Float binSize, Float maxPathLength)
+		: camera(camera),
+		initialSearchRadius(initialSearchRadius),
+		nIterations(nIterations),
+		maxDepth(maxDepth),
+		photonsPerIteration(photonsPerIteration > 0
+			? photonsPerIteration
+			: camera->film->croppedPixelBounds.Area()),
+		writeFrequency(writeFrequency),
+		binSize(binSize),
+		maxPathLength(maxPathLength) {}
+	void Render(const Scene &scene);
+
+private:
+	// SPPMToFIntegrator Private Data
+	std::shared_ptr<const Camera> camera;
+	const Float initialSearchRadius;
+	const int nIterations;
+	const int maxDepth;
+	const int photonsPerIteration;
+	const int writeFrequency;
+	const Float binSize;
+	const Float maxPathLength;
+};
+
+Integrator *CreateSPPMToFIntegrator(const ParamSet &params,
+	std::shared_ptr<const Camera> camera);
+
+#endif  // PBRT_INTEGRATORS_SPPMTOF_H
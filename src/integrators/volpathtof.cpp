@@ -0,0 +1,188 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#include "stdafx.h"
+
+// integrators/volpathtof.cpp*
+#include "integrators/volpathtof.h"
+#include "scene.h"
+#include "interaction.h"
+#include "paramset.h"
+#include "bssrdf.h"
+#include "stats.h"
+#include "histogram.h"
+#include "opticalpath.h"
+
+STAT_INT_DISTRIBUTION("Integrator/Path length", pathBounces);
+STAT_COUNTER("Integrator/Volume interactions", volumeInteractions);
+STAT_COUNTER("Integrator/Surface interactions", surfaceInteractions);
+
+// VolPathToFIntegrator Method Definitions
+IntegrationResult VolPathToFIntegrator::Li(const RayDifferential &r,
+	const Scene &scene, Sampler &sampler, MemoryArena &arena,
+	int depth) const {
+	ProfilePhase p(Prof::SamplerIntegratorLi);
+	Spectrum L(0.f), beta(1.f);
+	RayDifferential ray(r);
+	bool specularBounce = false;
+	Float pathLength = 0.f;
+	Float eta = MediumRefractiveIndex(ray.medium);
+
+	// Each scattering vertex contributes one histogram sample
+	std::vector<HistogramSample> histogram;
+
+	int bounces;
+	for (bounces = 0;; ++bounces) {
+		// Intersect _ray_ with scene and store intersection in _isect_
+		SurfaceInteraction isect;
+		bool foundIntersection = scene.Intersect(ray, &isect);
+
+		// Sample the participating medium, if present
+		MediumInteraction mi;
+		if (ray.medium) beta *= ray.medium->Sample(ray, sampler, arena, &mi);
+		if (beta.IsBlack()) break;
+
+		// Handle an interaction with a medium or a surface
+		if (mi.IsValid()) {
+			++volumeInteractions;
+			// Update the optical length of the path traced so far
+			pathLength += eta * Distance(ray.o, mi.p);
+
+			// Handle scattering at point in medium for volumetric path tracer
+			Float lightPathLength = 0.f;
+			Spectrum Ld = beta * UniformSampleOneLight(mi, scene, arena,
+				sampler, true, &lightPathLength);
+			if (!Ld.IsBlack()) {
+				histogram.push_back(
+					HistogramSample(Ld, pathLength + lightPathLength));
+				L += Ld;
+			}
+
+			// Terminate path if _maxDepth_ was reached
+			if (bounces >= maxDepth) break;
+
+			Vector3f wo = -ray.d, wi;
+			mi.phase->Sample_p(wo, &wi, sampler.Get2D());
+			ray = mi.SpawnRay(wi);
+			eta = MediumRefractiveIndex(ray.medium);
+		}
+		else {
+			++surfaceInteractions;
+			// Handle scattering at point on surface for volumetric path tracer
+			if (foundIntersection) pathLength += eta * Distance(ray.o, isect.p);
+
+			// Possibly add emitted light at intersection
+			if (bounces == 0 || specularBounce) {
+				// Add emitted light at path vertex or from the environment.
+				// Light from the environment has no finite path length, so
+				// it contributes to _L_ but not to the histogram.
+				if (foundIntersection) {
+					Spectrum Le = beta * isect.Le(-ray.d);
+					if (!Le.IsBlack()) {
+						histogram.push_back(HistogramSample(Le, pathLength));
+						L += Le;
+					}
+				}
+				else
+					for (const auto &light : scene.lights)
+						L += beta * light->Le(ray);
+			}
+
+			// Terminate path if ray escaped or _maxDepth_ was reached
+			if (!foundIntersection || bounces >= maxDepth) break;
+
+			// Compute scattering functions and skip over medium boundaries
+			isect.ComputeScatteringFunctions(ray, arena, true);
+			if (!isect.bsdf) {
+				ray = isect.SpawnRay(ray.d);
+				eta = MediumRefractiveIndex(ray.medium);
+				bounces--;
+				continue;
+			}
+
+			// Sample illumination from lights to find attenuated path
+			// contribution
+			Float lightPathLength = 0.f;
+			Spectrum Ld = beta * UniformSampleOneLight(isect, scene, arena,
+				sampler, true, &lightPathLength);
+			if (!Ld.IsBlack()) {
+				histogram.push_back(
+					HistogramSample(Ld, pathLength + lightPathLength));
+				L += Ld;
+			}
+
+			// Sample BSDF to get new path direction
+			Vector3f wo = -ray.d, wi;
+			Float pdf;
+			BxDFType flags;
+			Spectrum f = isect.bsdf->Sample_f(wo, &wi, sampler.Get2D(), &pdf,
+				BSDF_ALL, &flags);
+			if (f.IsBlack() || pdf == 0.f) break;
+			beta *= f * AbsDot(wi, isect.shading.n) / pdf;
+			Assert(std::isinf(beta.y()) == false);
+			specularBounce = (flags & BSDF_SPECULAR) != 0;
+			eta = SegmentRefractiveIndex(isect, wi);
+			ray = isect.SpawnRay(wi);
+
+			// Account for attenuated subsurface scattering, if applicable
+			if (isect.bssrdf && (flags & BSDF_TRANSMISSION)) {
+				// Importance sample the BSSRDF
+				SurfaceInteraction pi;
+				Spectrum S = isect.bssrdf->Sample_S(
+					scene, sampler.Get1D(), sampler.Get2D(), arena, &pi, &pdf);
+				if (S.IsBlack() || pdf == 0) break;
+				beta *= S / pdf;
+
+				// Approximate the subsurface path by its entry-exit distance,
+				// travelled inside the scattering material
+				pathLength += eta * Distance(isect.p, pi.p);
+				eta = MediumRefractiveIndex(pi.GetMedium(Vector3f(pi.n)));
+
+				// Account for the attenuated direct subsurface scattering
+				// component
+				Float lightPathLength = 0.f;
+				Spectrum Ld = beta * UniformSampleOneLight(pi, scene, arena,
+					sampler, true, &lightPathLength);
+				if (!Ld.IsBlack()) {
+					histogram.push_back(
+						HistogramSample(Ld, pathLength + lightPathLength));
+					L += Ld;
+				}
+
+				// Account for the indirect subsurface scattering component
+				Spectrum f = pi.bsdf->Sample_f(pi.wo, &wi, sampler.Get2D(),
+					&pdf, BSDF_ALL, &flags);
+				if (f.IsBlack() || pdf == 0) break;
+				beta *= f * AbsDot(wi, pi.shading.n) / pdf;
+				Assert(std::isinf(beta.y()) == false);
+				specularBounce = (flags & BSDF_SPECULAR) != 0;
+				eta = MediumRefractiveIndex(pi.GetMedium(wi));
+				ray = pi.SpawnRay(wi);
+			}
+		}
+
+		// Possibly terminate the path with Russian roulette
+		if (bounces > 3) {
+			Float q = std::max((Float).05, 1 - beta.y());
+			if (sampler.Get1D() < q) break;
+			beta /= 1 - q;
+			Assert(std::isinf(beta.y()) == false);
+		}
+	}
+	ReportValue(pathBounces, bounces);
+	return IntegrationResult(L, histogram);
+}
+
+VolPathToFIntegrator *CreateVolPathToFIntegrator(const ParamSet &params,
+	std::shared_ptr<Sampler> sampler,
+	std::shared_ptr<const Camera> camera) {
+	int maxDepth = params.FindOneInt("maxdepth", 5);
+	return new VolPathToFIntegrator(maxDepth, camera, sampler);
+}
@@ -0,0 +1,43 @@
+/*
+This file is part of the Time-of-Flight Tracer program. It is not part of
+the original PBRT source distribution. See the included license file for
+more information.
+
+Copyright(c) 2016 Microsoft Corporation
+
+Author: Phil Pitts
+*/
+
+#if defined(_MSC_VER)
+#define NOMINMAX
+#pragma once
+#endif
+
+#ifndef PBRT_INTEGRATORS_VOLPATHTOF_H
+#define PBRT_INTEGRATORS_VOLPATHTOF_H
+#include "stdafx.h"
+
+// integrators/volpathtof.h*
+#include "pbrt.h"
+#include "integrator.h"
+
+// VolPathToFIntegrator Declarations
+class VolPathToFIntegrator : public SamplerIntegrator {
+  public:
+    // VolPathToFIntegrator Public Methods
+	VolPathToFIntegrator(int maxDepth, std::shared_ptr<const Camera> camera,
+		std::shared_ptr<Sampler> sampler)
+		: SamplerIntegrator(camera, sampler), maxDepth(maxDepth) {}
+	IntegrationResult Li(const RayDifferential &ray, const Scene &scene,
+		Sampler &sampler, MemoryArena &arena, int depth) const;
+
+  private:
+    // VolPathToFIntegrator Private Data
+    const int maxDepth;
+};
+
+VolPathToFIntegrator *CreateVolPathToFIntegrator(const ParamSet &params,
+	std::shared_ptr<Sampler> sampler,
+	std::shared_ptr<const Camera> camera);
+
+#endif  // PBRT_INTEGRATORS_VOLPATHTOF_H
@@ -48,8 +48,16 @@ int main(int argc, char *argv[]) {
             options.nThreads = atoi(argv[++i]);
         else if (!strcmp(argv[i], "--outfile"))
             options.imageFile = argv[++i];
+        else if (!strcmp(argv[i], "--tileorder"))
+            options.tileOrder = argv[++i];
+        else if (!strcmp(argv[i], "--bvhcache"))
+            options.bvhCacheDir = argv[++i];
         else if (!strcmp(argv[i], "--quick"))
             options.quickRender = true;
+        else if (!strcmp(argv[i], "--affinity"))
+            options.affinity = true;
+        else if (!strcmp(argv[i], "--compactmeshes"))
+            options.compactMeshes = true;
         else if (!strcmp(argv[i], "--quiet"))
             options.quiet = true;
         else if (!strcmp(argv[i], "--verbose"))
@@ -58,10 +66,14 @@ int main(int argc, char *argv[]) {
             options.cat = true;
         else if (!strcmp(argv[i], "--toply"))
             options.toPly = true;
+        else if (!strcmp(argv[i], "--tobinary"))
+            options.toBinary = true;
         else if (!strcmp(argv[i], "--help") || !strcmp(argv[i], "-h")) {
             printf(
                 "usage: pbrt [--nthreads n] [--outfile filename] [--quick] "
-                "[--quiet] [--cat] [--toply] [--verbose] [--help] "
+                "[--quiet] [--cat] [--toply] [--tobinary] [--verbose] "
+                "[--tileorder hilbert|spiral|raster] [--affinity] "
+                "[--bvhcache dir] [--compactmeshes] [--help] "
                 "<filename.pbrt> ...\n");
             return 0;
         } else
@@ -69,7 +81,8 @@ int main(int argc, char *argv[]) {
     }
 
     // Print welcome banner
-    if (!options.quiet && !options.cat && !options.toPly) {
+    if (!options.quiet && !options.cat && !options.toPly &&
+        !options.toBinary) {
         printf("pbrt version 3 (built %s at %s) [Detected %d cores]\n",
                __DATE__, __TIME__, NumSystemCores());
         printf(
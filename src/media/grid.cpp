@@ -39,6 +39,34 @@
 #include "interaction.h"
 
 // GridDensityMedium Method Definitions
+void GridDensityMedium::ComputeMajorantGrid() {
+    // Store the maximum density that trilinear interpolation can reach in
+    // each majorant voxel, so that tracking takes long steps through thin
+    // regions instead of stepping by the global maximum everywhere
+    const int res = majorantGridRes;
+    maxDensityGrid.reset(new Float[res * res * res]);
+    auto sampleRange = [](int v, int n, int res, int *lo, int *hi) {
+        *lo = std::max(0, (int)std::floor(Float(v) * n / res - .5f));
+        *hi = std::min(n - 1,
+                       (int)std::floor(Float(v + 1) * n / res - .5f) + 1);
+    };
+    for (int z = 0; z < res; ++z)
+        for (int y = 0; y < res; ++y)
+            for (int x = 0; x < res; ++x) {
+                int x0, x1, y0, y1, z0, z1;
+                sampleRange(x, nx, res, &x0, &x1);
+                sampleRange(y, ny, res, &y0, &y1);
+                sampleRange(z, nz, res, &z0, &z1);
+                Float maxDensity = 0;
+                for (int iz = z0; iz <= z1; ++iz)
+                    for (int iy = y0; iy <= y1; ++iy)
+                        for (int ix = x0; ix <= x1; ++ix)
+                            maxDensity =
+                                std::max(maxDensity, D(Point3i(ix, iy, iz)));
+                maxDensityGrid[(z * res + y) * res + x] = maxDensity;
+            }
+}
+
 Float GridDensityMedium::Density(const Point3f &p) const {
     // Compute voxel coordinates and offsets for _p_
     Point3f pSamples(p.x * nx - .5f, p.y * ny - .5f, p.z * nz - .5f);
@@ -65,20 +93,26 @@ Spectrum GridDensityMedium::Sample(const Ray &rWorld, Sampler &sampler,
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Run delta-tracking iterations to sample a medium interaction
-    Float t = tMin;
-    while (true) {
-        t -= std::log(1 - sampler.Get1D()) * invMaxDensity;
-        if (t >= tMax) break;
-        if (Density(ray(t)) * invMaxDensity * sigma_t > sampler.Get1D()) {
-            // Populate _mi_ with medium interaction information and return
-            PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
-            *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time, this,
-                                    phase);
-            return sigma_s / sigma_t;
+    // Run delta-tracking iterations against each voxel's majorant
+    bool scattered = false;
+    TraverseMajorants(ray, tMin, tMax, [&](Float t0, Float t1,
+                                           Float sigma_maj) -> bool {
+        if (sigma_maj == 0) return true;
+        Float t = t0;
+        while (true) {
+            t -= std::log(1 - sampler.Get1D()) / sigma_maj;
+            if (t >= t1) return true;
+            if (Density(ray(t)) * sigma_t > sampler.Get1D() * sigma_maj) {
+                // Populate _mi_ with medium interaction information
+                PhaseFunction *phase = ARENA_ALLOC(arena, HenyeyGreenstein)(g);
+                *mi = MediumInteraction(rWorld(t), -rWorld.d, rWorld.time,
+                                        this, phase);
+                scattered = true;
+                return false;
+            }
         }
-    }
-    return Spectrum(1.f);
+    });
+    return scattered ? sigma_s / sigma_t : Spectrum(1.f);
 }
 
 Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
@@ -89,13 +123,20 @@ Spectrum GridDensityMedium::Tr(const Ray &rWorld, Sampler &sampler) const {
     Float tMin, tMax;
     if (!b.IntersectP(ray, &tMin, &tMax)) return Spectrum(1.f);
 
-    // Perform ratio tracking to estimate the transmittance value
-    Float Tr = 1, t = tMin;
-    while (true) {
-        t += -std::log(1 - sampler.Get1D()) * invMaxDensity;
-        if (t >= tMax) break;
-        Float density = Density(ray(t));
-        Tr *= 1 - std::max((Float)0, sigma_t * density * invMaxDensity);
-    }
+    // Perform ratio tracking against each voxel's majorant
+    Float Tr = 1;
+    TraverseMajorants(ray, tMin, tMax, [&](Float t0, Float t1,
+                                           Float sigma_maj) -> bool {
+        if (sigma_maj == 0) return true;
+        Float t = t0;
+        while (true) {
+            t -= std::log(1 - sampler.Get1D()) / sigma_maj;
+            if (t >= t1) return true;
+            Float density = Density(ray(t));
+            Tr *= 1 - std::max((Float)0, sigma_t * density / sigma_maj);
+            // Stop once the estimate can no longer change
+            if (Tr == 0) return false;
+        }
+    });
     return Spectrum(Tr);
 }
@@ -49,8 +49,9 @@ class GridDensityMedium : public Medium {
     // GridDensityMedium Public Methods
     GridDensityMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
                       int nx, int ny, int nz, const Transform &mediumToWorld,
-                      const Float *d)
-        : sigma_a(sigma_a),
+                      const Float *d, Float eta = 1)
+        : Medium(eta),
+          sigma_a(sigma_a),
           sigma_s(sigma_s),
           g(g),
           nx(nx),
@@ -65,10 +66,7 @@ class GridDensityMedium : public Medium {
             Error(
                 "GridDensityMedium requires a spectrally uniform attenuation "
                 "coefficient!");
-        Float maxDensity = 0;
-        for (int i = 0; i < nx * ny * nz; ++i)
-            maxDensity = std::max(maxDensity, density[i]);
-        invMaxDensity = 1 / (maxDensity * sigma_t);
+        ComputeMajorantGrid();
     }
 
     Float Density(const Point3f &p) const;
@@ -80,8 +78,14 @@ class GridDensityMedium : public Medium {
     Spectrum Sample(const Ray &ray, Sampler &sampler, MemoryArena &arena,
                     MediumInteraction *mi) const;
     Spectrum Tr(const Ray &ray, Sampler &sampler) const;
+    template <typename Func>
+    void TraverseMajorants(const Ray &ray, Float tMin, Float tMax,
+                           Func func) const;
 
   private:
+    // GridDensityMedium Private Methods
+    void ComputeMajorantGrid();
+
     // GridDensityMedium Private Data
     const Spectrum sigma_a, sigma_s;
     const Float g;
@@ -89,7 +93,59 @@ class GridDensityMedium : public Medium {
     const Transform WorldToMedium;
     std::unique_ptr<Float[]> density;
     Float sigma_t;
-    Float invMaxDensity;
+    static PBRT_CONSTEXPR int majorantGridRes = 16;
+    std::unique_ptr<Float[]> maxDensityGrid;
 };
 
+// GridDensityMedium Inline Functions
+template <typename Func>
+void GridDensityMedium::TraverseMajorants(const Ray &ray, Float tMin,
+                                          Float tMax, Func func) const {
+    // Set up 3D DDA through the majorant grid for _ray_ in medium space
+    const int res = majorantGridRes;
+    Point3f pEntry = ray(tMin);
+    int voxel[3], step[3], out[3];
+    Float nextCrossingT[3], deltaT[3];
+    for (int axis = 0; axis < 3; ++axis) {
+        voxel[axis] = Clamp((int)(pEntry[axis] * res), 0, res - 1);
+        if (ray.d[axis] == 0) {
+            nextCrossingT[axis] = Infinity;
+            deltaT[axis] = 0;
+            step[axis] = 0;
+            out[axis] = -1;
+        } else if (ray.d[axis] > 0) {
+            Float nextVoxelPos = Float(voxel[axis] + 1) / res;
+            nextCrossingT[axis] =
+                tMin + (nextVoxelPos - pEntry[axis]) / ray.d[axis];
+            deltaT[axis] = 1 / (res * ray.d[axis]);
+            step[axis] = 1;
+            out[axis] = res;
+        } else {
+            Float nextVoxelPos = Float(voxel[axis]) / res;
+            nextCrossingT[axis] =
+                tMin + (nextVoxelPos - pEntry[axis]) / ray.d[axis];
+            deltaT[axis] = -1 / (res * ray.d[axis]);
+            step[axis] = -1;
+            out[axis] = -1;
+        }
+    }
+
+    // Walk majorant voxels until _func_ stops or the ray leaves the medium
+    Float t0 = tMin;
+    while (t0 < tMax) {
+        int stepAxis = 0;
+        if (nextCrossingT[1] < nextCrossingT[stepAxis]) stepAxis = 1;
+        if (nextCrossingT[2] < nextCrossingT[stepAxis]) stepAxis = 2;
+        Float t1 = std::min(tMax, nextCrossingT[stepAxis]);
+        int offset = (voxel[2] * res + voxel[1]) * res + voxel[0];
+        Float sigma_maj = sigma_t * maxDensityGrid[offset];
+        if (!func(t0, t1, sigma_maj)) return;
+        if (t1 >= tMax) return;
+        voxel[stepAxis] += step[stepAxis];
+        if (voxel[stepAxis] == out[stepAxis]) return;
+        nextCrossingT[stepAxis] += deltaT[stepAxis];
+        t0 = t1;
+    }
+}
+
 #endif  // PBRT_MEDIA_GRID_H
@@ -46,8 +46,10 @@
 class HomogeneousMedium : public Medium {
   public:
     // HomogeneousMedium Public Methods
-    HomogeneousMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g)
-        : sigma_a(sigma_a),
+    HomogeneousMedium(const Spectrum &sigma_a, const Spectrum &sigma_s, Float g,
+                      Float eta = 1)
+        : Medium(eta),
+          sigma_a(sigma_a),
           sigma_s(sigma_s),
           sigma_t(sigma_s + sigma_a),
           g(g) {}
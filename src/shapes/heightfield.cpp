@@ -41,6 +41,12 @@
 std::vector<std::shared_ptr<Shape>> CreateHeightfield(
     const Transform *ObjectToWorld, const Transform *WorldToObject,
     bool reverseOrientation, const ParamSet &params) {
+    return CreateTriangles(ObjectToWorld, WorldToObject, reverseOrientation,
+                           CreateHeightfieldMesh(ObjectToWorld, params));
+}
+
+std::shared_ptr<TriangleMesh> CreateHeightfieldMesh(
+    const Transform *ObjectToWorld, const ParamSet &params) {
     int nx = params.FindOneInt("nu", -1);
     int ny = params.FindOneInt("nv", -1);
     int nitems;
@@ -80,7 +86,7 @@ std::vector<std::shared_ptr<Shape>> CreateHeightfield(
 #undef VERT
     }
 
-    return CreateTriangleMesh(ObjectToWorld, WorldToObject, reverseOrientation,
-                              ntris, indices.get(), nverts, P.get(), nullptr,
-                              nullptr, uvs.get(), nullptr, nullptr);
+    return std::make_shared<TriangleMesh>(
+        *ObjectToWorld, ntris, indices.get(), nverts, P.get(), nullptr, nullptr,
+        uvs.get(), nullptr, nullptr, PbrtOptions.compactMeshes);
 }
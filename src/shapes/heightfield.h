@@ -47,5 +47,7 @@ std::vector<std::shared_ptr<Shape>> CreateHeightfield(const Transform *o2w,
                                                       const Transform *w2o,
                                                       bool ro,
                                                       const ParamSet &params);
+std::shared_ptr<TriangleMesh> CreateHeightfieldMesh(const Transform *o2w,
+                                                    const ParamSet &params);
 
 #endif  // PBRT_SHAPES_HEIGHTFIELD_H
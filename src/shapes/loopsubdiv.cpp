@@ -144,10 +144,10 @@ inline Float loopGamma(int valence) {
 }
 
 // LoopSubdiv Function Definitions
-std::vector<std::shared_ptr<Shape>> LoopSubdivide(
-    const Transform *ObjectToWorld, const Transform *WorldToObject,
-    bool reverseOrientation, int nLevels, int nIndices,
-    const int *vertexIndices, int nVertices, const Point3f *p) {
+std::shared_ptr<TriangleMesh> LoopSubdivide(const Transform *ObjectToWorld,
+                                            int nLevels, int nIndices,
+                                            const int *vertexIndices,
+                                            int nVertices, const Point3f *p) {
     std::vector<SDVertex *> vertices;
     std::vector<SDFace *> faces;
     // Allocate _LoopSubdiv_ vertices and faces
@@ -390,10 +390,10 @@ std::vector<std::shared_ptr<Shape>> LoopSubdivide(
                 ++vp;
             }
         }
-        return CreateTriangleMesh(ObjectToWorld, WorldToObject,
-                                  reverseOrientation, ntris, verts.get(),
-                                  totVerts, pLimit.get(), nullptr, &Ns[0],
-                                  nullptr, nullptr, nullptr);
+        return std::make_shared<TriangleMesh>(
+            *ObjectToWorld, ntris, verts.get(), totVerts, pLimit.get(),
+            nullptr, &Ns[0], nullptr, nullptr, nullptr,
+            PbrtOptions.compactMeshes);
     }
 }
 
@@ -401,23 +401,28 @@ std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
                                                      const Transform *w2o,
                                                      bool reverseOrientation,
                                                      const ParamSet &params) {
+    return CreateTriangles(o2w, w2o, reverseOrientation,
+                           CreateLoopSubdivMesh(o2w, params));
+}
+
+std::shared_ptr<TriangleMesh> CreateLoopSubdivMesh(const Transform *o2w,
+                                                   const ParamSet &params) {
     int nLevels = params.FindOneInt("nlevels", 3);
     int nps, nIndices;
     const int *vertexIndices = params.FindInt("indices", &nIndices);
     const Point3f *P = params.FindPoint3f("P", &nps);
     if (!vertexIndices) {
         Error("Vertex indices \"indices\" not provided for LoopSubdiv shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     if (!P) {
         Error("Vertex positions \"P\" not provided for LoopSubdiv shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     // don't actually use this for now...
     std::string scheme = params.FindOneString("scheme", "loop");
-    return LoopSubdivide(o2w, w2o, reverseOrientation, nLevels, nIndices,
-                         vertexIndices, nps, P);
+    return LoopSubdivide(o2w, nLevels, nIndices, vertexIndices, nps, P);
 }
 
 static Point3f weightOneRing(SDVertex *vert, Float beta) {
@@ -43,13 +43,15 @@
 #include "shape.h"
 
 // LoopSubdiv Declarations
-std::vector<std::shared_ptr<Shape>> LoopSubdivide(
-    const Transform *ObjectToWorld, const Transform *WorldToObject,
-    bool reverseOrientation, int nLevels, int nIndices,
-    const int *vertexIndices, int nVertices, const Point3f *p);
+std::shared_ptr<TriangleMesh> LoopSubdivide(const Transform *ObjectToWorld,
+                                            int nLevels, int nIndices,
+                                            const int *vertexIndices,
+                                            int nVertices, const Point3f *p);
 std::vector<std::shared_ptr<Shape>> CreateLoopSubdiv(const Transform *o2w,
                                                      const Transform *w2o,
                                                      bool reverseOrientation,
                                                      const ParamSet &params);
+std::shared_ptr<TriangleMesh> CreateLoopSubdivMesh(const Transform *o2w,
+                                                   const ParamSet &params);
 
 #endif  // PBRT_SHAPES_LOOPSUBDIV_H
@@ -145,22 +145,28 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
                                                 const Transform *w2o,
                                                 bool reverseOrientation,
                                                 const ParamSet &params) {
+    return CreateTriangles(o2w, w2o, reverseOrientation,
+                           CreateNURBSMesh(o2w, params));
+}
+
+std::shared_ptr<TriangleMesh> CreateNURBSMesh(const Transform *o2w,
+                                              const ParamSet &params) {
     int nu = params.FindOneInt("nu", -1);
     if (nu == -1) {
         Error("Must provide number of control points \"nu\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     int uorder = params.FindOneInt("uorder", -1);
     if (uorder == -1) {
         Error("Must provide u order \"uorder\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     int nuknots, nvknots;
     const Float *uknots = params.FindFloat("uknots", &nuknots);
     if (!uknots) {
         Error("Must provide u knot vector \"uknots\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     if (nuknots != nu + uorder) {
@@ -168,7 +174,7 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
             "Number of knots in u knot vector %d doesn't match sum of "
             "number of u control points %d and u order %d.",
             nuknots, nu, uorder);
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     Float u0 = params.FindOneFloat("u0", uknots[uorder - 1]);
@@ -177,19 +183,19 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
     int nv = params.FindOneInt("nv", -1);
     if (nv == -1) {
         Error("Must provide number of control points \"nv\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     int vorder = params.FindOneInt("vorder", -1);
     if (vorder == -1) {
         Error("Must provide v order \"vorder\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     const Float *vknots = params.FindFloat("vknots", &nvknots);
     if (!vknots) {
         Error("Must provide v knot vector \"vknots\" with NURBS shape.");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     if (nvknots != nv + vorder) {
@@ -197,7 +203,7 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
             "Number of knots in v knot vector %d doesn't match sum of "
             "number of v control points %d and v order %d.",
             nvknots, nv, vorder);
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     Float v0 = params.FindOneFloat("v0", vknots[vorder - 1]);
@@ -212,14 +218,14 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
             Error(
                 "Must provide control points via \"P\" or \"Pw\" parameter to "
                 "NURBS shape.");
-            return std::vector<std::shared_ptr<Shape>>();
+            return nullptr;
         }
         if ((npts % 4) != 0) {
             Error(
                 "Number of \"Pw\" control points provided to NURBS shape must "
                 "be "
                 "multiple of four");
-            return std::vector<std::shared_ptr<Shape>>();
+            return nullptr;
         }
         npts /= 4;
         isHomogeneous = true;
@@ -227,7 +233,7 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
     if (npts != nu * nv) {
         Error("NURBS shape was expecting %dx%d=%d control points, was given %d",
               nu, nv, nu * nv, npts);
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
 
     // Compute NURBS dicing rates
@@ -301,7 +307,7 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
     }
     int nVerts = diceu * dicev;
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation, nTris,
-                              vertices.get(), nVerts, evalPs.get(), nullptr,
-                              evalNs.get(), uvs.get(), nullptr, nullptr);
+    return std::make_shared<TriangleMesh>(
+        *o2w, nTris, vertices.get(), nVerts, evalPs.get(), nullptr,
+        evalNs.get(), uvs.get(), nullptr, nullptr, PbrtOptions.compactMeshes);
 }
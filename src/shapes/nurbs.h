@@ -48,5 +48,7 @@ std::vector<std::shared_ptr<Shape>> CreateNURBS(const Transform *o2w,
                                                 const Transform *w2o,
                                                 bool reverseOrientation,
                                                 const ParamSet &params);
+std::shared_ptr<TriangleMesh> CreateNURBSMesh(const Transform *o2w,
+                                              const ParamSet &params);
 
 #endif  // PBRT_SHAPES_NURBS_H
@@ -33,14 +33,22 @@
 #include "stdafx.h"
 
 // shapes/plymesh.cpp*
-#include "shapes/triangle.h"
+#include "shapes/plymesh.h"
 #include "textures/constant.h"
 #include "paramset.h"
+#include "mappedfile.h"
+#include "parallel.h"
+#include "stats.h"
 #include "ext/rply.h"
 
+#include <atomic>
 #include <iostream>
+#include <sstream>
 using namespace std;
 
+STAT_COUNTER("Scene/PLY files read from a mapping", nMappedPlyFiles);
+STAT_COUNTER("Scene/PLY files read with rply", nRplyFiles);
+
 struct CallbackContext {
     Point3f *p;
     Normal3f *n;
@@ -136,20 +144,390 @@ int rply_face_callback(p_ply_argument argument) {
     return 1;
 }
 
-std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
-    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
-    const ParamSet &params,
-    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
-    const std::string filename = params.FindOneFilename("filename", "");
+// Mapped PLY Local Declarations
+enum class PlyType {
+    Int8,
+    UInt8,
+    Int16,
+    UInt16,
+    Int32,
+    UInt32,
+    Float32,
+    Float64,
+    Invalid
+};
+
+struct PlyProperty {
+    std::string name;
+    // Lists store their length as _countType_, followed by that many values
+    // of _type_
+    PlyType type, countType = PlyType::Invalid;
+    bool IsList() const { return countType != PlyType::Invalid; }
+};
+
+struct PlyElement {
+    std::string name;
+    long count;
+    std::vector<PlyProperty> properties;
+};
+
+// Mapped PLY Local Definitions
+static PlyType PlyTypeFromString(const std::string &name) {
+    if (name == "char" || name == "int8") return PlyType::Int8;
+    if (name == "uchar" || name == "uint8") return PlyType::UInt8;
+    if (name == "short" || name == "int16") return PlyType::Int16;
+    if (name == "ushort" || name == "uint16") return PlyType::UInt16;
+    if (name == "int" || name == "int32") return PlyType::Int32;
+    if (name == "uint" || name == "uint32") return PlyType::UInt32;
+    if (name == "float" || name == "float32") return PlyType::Float32;
+    if (name == "double" || name == "float64") return PlyType::Float64;
+    return PlyType::Invalid;
+}
+
+static int PlyTypeSize(PlyType type) {
+    switch (type) {
+    case PlyType::Int8:
+    case PlyType::UInt8:
+        return 1;
+    case PlyType::Int16:
+    case PlyType::UInt16:
+        return 2;
+    case PlyType::Int32:
+    case PlyType::UInt32:
+    case PlyType::Float32:
+        return 4;
+    case PlyType::Float64:
+        return 8;
+    default:
+        return 0;
+    }
+}
+
+template <typename T>
+static T LoadPly(const char *ptr) {
+    // Values are unaligned in the file
+    T value;
+    memcpy(&value, ptr, sizeof(T));
+    return value;
+}
+
+static double ReadPlyValue(const char *ptr, PlyType type) {
+    switch (type) {
+    case PlyType::Int8:
+        return LoadPly<int8_t>(ptr);
+    case PlyType::UInt8:
+        return LoadPly<uint8_t>(ptr);
+    case PlyType::Int16:
+        return LoadPly<int16_t>(ptr);
+    case PlyType::UInt16:
+        return LoadPly<uint16_t>(ptr);
+    case PlyType::Int32:
+        return LoadPly<int32_t>(ptr);
+    case PlyType::UInt32:
+        return LoadPly<uint32_t>(ptr);
+    case PlyType::Float32:
+        return LoadPly<float>(ptr);
+    default:
+        return LoadPly<double>(ptr);
+    }
+}
+
+static bool HostIsLittleEndian() {
+    const uint16_t one = 1;
+    uint8_t firstByte;
+    memcpy(&firstByte, &one, 1);
+    return firstByte == 1;
+}
+
+// Parses the header of a binary little-endian PLY file, returning the
+// offset of its data, or 0 if it isn't one
+static size_t ParsePlyHeader(const char *data, size_t size,
+                             std::vector<PlyElement> *elements) {
+    // Find the end of the header
+    const char *endHeader = "end_header";
+    size_t headerEnd = 0;
+    for (size_t lineStart = 0; lineStart < size;) {
+        const char *newline = (const char *)memchr(data + lineStart, '\n',
+                                                   size - lineStart);
+        if (!newline) return 0;
+        size_t lineEnd = newline - data;
+        if (lineEnd - lineStart >= strlen(endHeader) &&
+            !strncmp(data + lineStart, endHeader, strlen(endHeader))) {
+            headerEnd = lineEnd + 1;
+            break;
+        }
+        lineStart = lineEnd + 1;
+    }
+    if (headerEnd == 0) return 0;
+
+    std::istringstream header(std::string(data, headerEnd));
+    std::string line;
+    if (!std::getline(header, line) || line.compare(0, 3, "ply") != 0)
+        return 0;
+    bool binaryLittleEndian = false;
+    while (std::getline(header, line)) {
+        std::istringstream tokens(line);
+        std::string keyword;
+        tokens >> keyword;
+        if (keyword == "format") {
+            std::string format;
+            tokens >> format;
+            binaryLittleEndian = format == "binary_little_endian";
+        } else if (keyword == "element") {
+            PlyElement element;
+            if (!(tokens >> element.name >> element.count) ||
+                element.count < 0)
+                return 0;
+            elements->push_back(element);
+        } else if (keyword == "property") {
+            if (elements->empty()) return 0;
+            PlyProperty property;
+            std::string type;
+            tokens >> type;
+            if (type == "list") {
+                std::string countType;
+                tokens >> countType >> type;
+                property.countType = PlyTypeFromString(countType);
+                if (property.countType == PlyType::Invalid) return 0;
+            }
+            property.type = PlyTypeFromString(type);
+            if (property.type == PlyType::Invalid || !(tokens >> property.name))
+                return 0;
+            elements->back().properties.push_back(property);
+        } else if (keyword == "end_header")
+            break;
+        else if (keyword != "comment" && keyword != "obj_info" &&
+                 !keyword.empty())
+            return 0;
+    }
+    return binaryLittleEndian ? headerEnd : 0;
+}
+
+// Reads a binary little-endian PLY file straight from a mapping of it,
+// converting vertex properties in parallel. Returns false, leaving
+// _context_ untouched, for files it doesn't handle, which are left to
+// rply; as with rply, out-of-bounds vertex indices set _context->error_.
+static bool ReadMappedPLY(const std::string &filename,
+                          CallbackContext *context) {
+    if (!HostIsLittleEndian()) return false;
+    MappedFile file(filename);
+    if (!file.IsValid()) return false;
+    const char *data = file.Data();
+    const size_t size = file.Size();
+    std::vector<PlyElement> elements;
+    size_t offset = ParsePlyHeader(data, size, &elements);
+    if (offset == 0) return false;
+
+    // Find the vertex and face elements and where their data starts; any
+    // elements before them must have a fixed size so they can be skipped
+    const PlyElement *vertices = nullptr, *faces = nullptr;
+    size_t vertexOffset = 0, faceOffset = 0, vertexStride = 0;
+    for (const PlyElement &element : elements) {
+        if (vertices && faces) break;
+        size_t stride = 0;
+        bool hasList = false;
+        for (const PlyProperty &property : element.properties) {
+            stride += PlyTypeSize(property.type);
+            hasList |= property.IsList();
+        }
+        if (element.name == "face" && !faces) {
+            faces = &element;
+            faceOffset = offset;
+            // Face records vary in size; only the vertices may follow them
+            if (!vertices) return false;
+            continue;
+        }
+        if (hasList) return false;
+        if (element.name == "vertex" && !vertices) {
+            vertices = &element;
+            vertexOffset = offset;
+            vertexStride = stride;
+        }
+        if (element.count > 0 && stride > (size - offset) / element.count)
+            return false;
+        offset += stride * element.count;
+    }
+    if (!vertices || !faces || vertices->count == 0 || faces->count == 0)
+        return false;
+
+    // Locate the vertex properties that are read
+    auto findProperty = [&](const char *name) -> const PlyProperty * {
+        for (const PlyProperty &property : vertices->properties)
+            if (property.name == name) return &property;
+        return nullptr;
+    };
+    auto propertyOffset = [&](const PlyProperty *property) -> size_t {
+        size_t offset = 0;
+        for (const PlyProperty &p : vertices->properties) {
+            if (&p == property) break;
+            offset += PlyTypeSize(p.type);
+        }
+        return offset;
+    };
+    const PlyProperty *pProps[3] = {findProperty("x"), findProperty("y"),
+                                    findProperty("z")};
+    if (!pProps[0] || !pProps[1] || !pProps[2]) return false;
+    const PlyProperty *nProps[3] = {findProperty("nx"), findProperty("ny"),
+                                    findProperty("nz")};
+    bool hasNormals = nProps[0] && nProps[1] && nProps[2];
+    const char *uvNames[4][2] = {{"u", "v"},
+                                 {"s", "t"},
+                                 {"texture_u", "texture_v"},
+                                 {"texture_s", "texture_t"}};
+    const PlyProperty *uvProps[2] = {nullptr, nullptr};
+    for (int i = 0; i < 4 && !uvProps[0]; ++i) {
+        uvProps[0] = findProperty(uvNames[i][0]);
+        uvProps[1] = findProperty(uvNames[i][1]);
+        if (!uvProps[1]) uvProps[0] = nullptr;
+    }
+    const PlyProperty *faceIndices = nullptr;
+    for (const PlyProperty &property : faces->properties)
+        if (property.IsList() && property.name == "vertex_indices")
+            faceIndices = &property;
+    if (!faceIndices) return false;
+
+    // Convert the vertices in parallel
+    const long vertexCount = vertices->count, faceCount = faces->count;
+    std::unique_ptr<Point3f[]> p(new Point3f[vertexCount]);
+    std::unique_ptr<Normal3f[]> n(hasNormals ? new Normal3f[vertexCount]
+                                             : nullptr);
+    std::unique_ptr<Point2f[]> uv(uvProps[0] ? new Point2f[vertexCount]
+                                             : nullptr);
+    size_t pOffsets[3], nOffsets[3], uvOffsets[2];
+    for (int c = 0; c < 3; ++c) {
+        pOffsets[c] = propertyOffset(pProps[c]);
+        if (hasNormals) nOffsets[c] = propertyOffset(nProps[c]);
+        if (c < 2 && uv) uvOffsets[c] = propertyOffset(uvProps[c]);
+    }
+    const int64_t chunkSize = 16384;
+    ParallelFor([&](int64_t chunk) {
+        int64_t start = chunk * chunkSize;
+        int64_t last = std::min(start + chunkSize, (int64_t)vertexCount);
+        for (int64_t i = start; i < last; ++i) {
+            const char *vertex = data + vertexOffset + i * vertexStride;
+            for (int c = 0; c < 3; ++c) {
+                p[i][c] = ReadPlyValue(vertex + pOffsets[c], pProps[c]->type);
+                if (n)
+                    n[i][c] =
+                        ReadPlyValue(vertex + nOffsets[c], nProps[c]->type);
+                if (c < 2 && uv)
+                    uv[i][c] =
+                        ReadPlyValue(vertex + uvOffsets[c], uvProps[c]->type);
+            }
+        }
+    }, (vertexCount + chunkSize - 1) / chunkSize);
+
+    // Most files hold only triangles, with one-byte lengths and 32-bit
+    // indices; those records have a fixed size, so try converting them in
+    // parallel first
+    std::unique_ptr<int[]> indices(new int[faceCount * 6]);
+    int indexCtr = 0;
+    long facesRead = 0;
+    bool error = false;
+    const char *face = data + faceOffset, *end = data + size;
+    const size_t triangleSize = 1 + 3 * sizeof(int32_t);
+    if (faces->properties.size() == 1 &&
+        PlyTypeSize(faceIndices->countType) == 1 &&
+        (faceIndices->type == PlyType::Int32 ||
+         faceIndices->type == PlyType::UInt32) &&
+        (size_t)(end - face) / triangleSize >= (size_t)faceCount) {
+        std::atomic<bool> allTriangles(true);
+        ParallelFor([&](int64_t chunk) {
+            int64_t start = chunk * chunkSize;
+            int64_t last = std::min(start + chunkSize, (int64_t)faceCount);
+            for (int64_t f = start; f < last; ++f) {
+                const char *record = face + f * triangleSize;
+                if (record[0] != 3) {
+                    allTriangles = false;
+                    return;
+                }
+                for (int i = 0; i < 3; ++i) {
+                    // Bad indices are left for the general path to report
+                    uint32_t v = LoadPly<uint32_t>(record + 1 + 4 * i);
+                    if (v >= (uint32_t)vertexCount) {
+                        allTriangles = false;
+                        return;
+                    }
+                    indices[3 * f + i] = (int)v;
+                }
+            }
+        }, (faceCount + chunkSize - 1) / chunkSize);
+        if (allTriangles) {
+            indexCtr = 3 * faceCount;
+            facesRead = faceCount;
+        }
+    }
+
+    // Otherwise read the faces one at a time, splitting quads into two
+    // triangles
+    for (long f = facesRead; f < faceCount; ++f) {
+        for (const PlyProperty &property : faces->properties) {
+            int valueSize = PlyTypeSize(property.type);
+            if (!property.IsList()) {
+                if (end - face < valueSize) return false;
+                face += valueSize;
+                continue;
+            }
+            int countSize = PlyTypeSize(property.countType);
+            if (end - face < countSize) return false;
+            double length = ReadPlyValue(face, property.countType);
+            face += countSize;
+            if (length < 0 || (end - face) / valueSize < length) return false;
+            const char *values = face;
+            face += (size_t)length * valueSize;
+            if (&property != faceIndices) continue;
+            if (length != 3 && length != 4) {
+                Warning(
+                    "plymesh: Ignoring face with %i vertices (only triangles "
+                    "and quads are supported!)",
+                    (int)length);
+                continue;
+            }
+            int v[4];
+            for (int i = 0; i < length; ++i) {
+                double value = ReadPlyValue(values + i * valueSize,
+                                            property.type);
+                if (value < 0 || value >= vertexCount) {
+                    Error(
+                        "plymesh: Vertex reference %i is out of bounds! "
+                        "Valid range is [0..%i)",
+                        (int)value, (int)vertexCount);
+                    error = true;
+                }
+                v[i] = (int)value;
+            }
+            for (int i = 0; i < 3; ++i) indices[indexCtr++] = v[i];
+            if (length == 4) {
+                indices[indexCtr++] = v[3];
+                indices[indexCtr++] = v[0];
+                indices[indexCtr++] = v[2];
+            }
+        }
+    }
+
+    // Hand the buffers over to _context_
+    context->p = p.release();
+    context->n = n.release();
+    context->uv = uv.release();
+    context->indices = indices.release();
+    context->indexCtr = indexCtr;
+    context->vertexCount = vertexCount;
+    context->error = error;
+    ++nMappedPlyFiles;
+    return true;
+}
+
+static bool ReadPLYWithRply(const std::string &filename,
+                            CallbackContext *context) {
     p_ply ply = ply_open(filename.c_str(), rply_message_callback, 0, nullptr);
     if (!ply) {
         Error("Couldn't open PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     if (!ply_read_header(ply)) {
         Error("Unable to read the header of PLY file \"%s\"", filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     p_ply_element element = nullptr;
@@ -170,69 +548,89 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     if (vertexCount == 0 || faceCount == 0) {
         Error("PLY file \"%s\" is invalid! No face/vertex elements found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
-    CallbackContext context;
-
-    if (ply_set_read_cb(ply, "vertex", "x", rply_vertex_callback, &context,
+    if (ply_set_read_cb(ply, "vertex", "x", rply_vertex_callback, context,
                         0x030) &&
-        ply_set_read_cb(ply, "vertex", "y", rply_vertex_callback, &context,
+        ply_set_read_cb(ply, "vertex", "y", rply_vertex_callback, context,
                         0x031) &&
-        ply_set_read_cb(ply, "vertex", "z", rply_vertex_callback, &context,
+        ply_set_read_cb(ply, "vertex", "z", rply_vertex_callback, context,
                         0x032)) {
-        context.p = new Point3f[vertexCount];
+        context->p = new Point3f[vertexCount];
     } else {
         Error("PLY file \"%s\": Vertex coordinate property not found!",
               filename.c_str());
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
-    if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, &context,
+    if (ply_set_read_cb(ply, "vertex", "nx", rply_vertex_callback, context,
                         0x130) &&
-        ply_set_read_cb(ply, "vertex", "ny", rply_vertex_callback, &context,
+        ply_set_read_cb(ply, "vertex", "ny", rply_vertex_callback, context,
                         0x131) &&
-        ply_set_read_cb(ply, "vertex", "nz", rply_vertex_callback, &context,
+        ply_set_read_cb(ply, "vertex", "nz", rply_vertex_callback, context,
                         0x132))
-        context.n = new Normal3f[vertexCount];
+        context->n = new Normal3f[vertexCount];
 
     /* There seem to be lots of different conventions regarding UV coordinate
      * names */
-    if ((ply_set_read_cb(ply, "vertex", "u", rply_vertex_callback, &context,
+    if ((ply_set_read_cb(ply, "vertex", "u", rply_vertex_callback, context,
                          0x220) &&
-         ply_set_read_cb(ply, "vertex", "v", rply_vertex_callback, &context,
+         ply_set_read_cb(ply, "vertex", "v", rply_vertex_callback, context,
                          0x221)) ||
-        (ply_set_read_cb(ply, "vertex", "s", rply_vertex_callback, &context,
+        (ply_set_read_cb(ply, "vertex", "s", rply_vertex_callback, context,
                          0x220) &&
-         ply_set_read_cb(ply, "vertex", "t", rply_vertex_callback, &context,
+         ply_set_read_cb(ply, "vertex", "t", rply_vertex_callback, context,
                          0x221)) ||
         (ply_set_read_cb(ply, "vertex", "texture_u", rply_vertex_callback,
-                         &context, 0x220) &&
+                         context, 0x220) &&
          ply_set_read_cb(ply, "vertex", "texture_v", rply_vertex_callback,
-                         &context, 0x221)) ||
+                         context, 0x221)) ||
         (ply_set_read_cb(ply, "vertex", "texture_s", rply_vertex_callback,
-                         &context, 0x220) &&
+                         context, 0x220) &&
          ply_set_read_cb(ply, "vertex", "texture_t", rply_vertex_callback,
-                         &context, 0x221)))
-        context.uv = new Point2f[vertexCount];
+                         context, 0x221)))
+        context->uv = new Point2f[vertexCount];
 
     /* Allocate enough space in case all faces are quads */
-    context.indices = new int[faceCount * 6];
-    context.vertexCount = vertexCount;
+    context->indices = new int[faceCount * 6];
+    context->vertexCount = vertexCount;
 
-    ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback, &context,
+    ply_set_read_cb(ply, "face", "vertex_indices", rply_face_callback, context,
                     0);
 
     if (!ply_read(ply)) {
         Error("Unable to read the contents of PLY file \"%s\"",
               filename.c_str());
         ply_close(ply);
-        return std::vector<std::shared_ptr<Shape>>();
+        return false;
     }
 
     ply_close(ply);
+    ++nRplyFiles;
+    return true;
+}
+
+std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    return CreateTriangles(o2w, w2o, reverseOrientation,
+                           ReadPLYMesh(o2w, params, floatTextures));
+}
+
+std::shared_ptr<TriangleMesh> ReadPLYMesh(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    const std::string filename = params.FindOneFilename("filename", "");
+    // Read binary little-endian files directly, falling back to rply for
+    // the others
+    CallbackContext context;
+    if (!ReadMappedPLY(filename, &context) &&
+        !ReadPLYWithRply(filename, &context))
+        return nullptr;
 
-    if (context.error) return std::vector<std::shared_ptr<Shape>>();
+    if (context.error) return nullptr;
 
     // Look up an alpha texture, if applicable
     std::shared_ptr<Texture<Float>> alphaTex;
@@ -286,8 +684,9 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
         }
     }
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation,
-                              context.indexCtr / 3, context.indices,
-                              vertexCount, context.p, nullptr, context.n,
-                              context.uv, alphaTex, shadowAlphaTex);
+    bool compact = params.FindOneBool("compact", PbrtOptions.compactMeshes);
+    return std::make_shared<TriangleMesh>(
+        *o2w, context.indexCtr / 3, context.indices, context.vertexCount,
+        context.p, nullptr, context.n, context.uv, alphaTex, shadowAlphaTex,
+        compact);
 }
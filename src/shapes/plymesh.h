@@ -47,5 +47,9 @@ std::vector<std::shared_ptr<Shape>> CreatePLYMesh(
     const ParamSet &params,
     std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
         nullptr);
+std::shared_ptr<TriangleMesh> ReadPLYMesh(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
+        nullptr);
 
 #endif  // PBRT_SHAPES_PLYMESH_H
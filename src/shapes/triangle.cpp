@@ -39,49 +39,158 @@
 #include "paramset.h"
 #include "sampling.h"
 #include "efloat.h"
+#include "hash.h"
 #include "ext/rply.h"
+#if !defined(PBRT_FLOAT_AS_DOUBLE) && \
+    (defined(__SSE__) || defined(_M_X64) || _M_IX86_FP >= 1)
+#define PBRT_TRIANGLE_PACKET_SSE
+#include <xmmintrin.h>
+#endif
 STAT_PERCENT("Intersections/Ray-triangle intersection tests", nHits, nTests);
+STAT_MEMORY_COUNTER("Memory/Triangle mesh primitives", meshPrimitiveBytes);
 
 // Triangle Local Definitions
 static void PlyErrorCallback(p_ply, const char *message) {
     Error("PLY writing error: %s", message);
 }
 
+// Octahedral Encoding Definitions
+uint32_t EncodeOctahedral(const Vector3f &v) {
+    // Project _v_ onto the octahedron and fold the lower hemisphere over
+    Float l1 = std::abs(v.x) + std::abs(v.y) + std::abs(v.z);
+    if (l1 == 0) return EncodeOctahedral(Vector3f(0, 0, 1));
+    Float x = v.x / l1, y = v.y / l1;
+    if (v.z < 0) {
+        Float xf = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+        Float yf = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+        x = xf;
+        y = yf;
+    }
+    auto quantize = [](Float f) -> uint32_t {
+        return (uint32_t)std::round(Clamp((f + 1) * 0.5f, 0, 1) * 65535);
+    };
+    return quantize(x) | (quantize(y) << 16);
+}
+
 // Triangle Method Definitions
 STAT_RATIO("Scene/Triangles per triangle mesh", nTris, nMeshes);
+STAT_COUNTER("Scene/Compact triangle meshes", nCompactMeshes);
 TriangleMesh::TriangleMesh(
     const Transform &ObjectToWorld, int nTriangles, const int *vertexIndices,
     int nVertices, const Point3f *P, const Vector3f *S, const Normal3f *N,
     const Point2f *UV, const std::shared_ptr<Texture<Float>> &alphaMask,
-    const std::shared_ptr<Texture<Float>> &shadowAlphaMask)
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask, bool compact)
     : nTriangles(nTriangles),
       nVertices(nVertices),
-      vertexIndices(vertexIndices, vertexIndices + 3 * nTriangles),
       alphaMask(alphaMask),
       shadowAlphaMask(shadowAlphaMask) {
     ++nMeshes;
     nTris += nTriangles;
-    triMeshBytes += sizeof(*this) + (3 * nTriangles * sizeof(int)) +
-                    nVertices * (sizeof(*P) + (N ? sizeof(*N) : 0) +
-                                 (S ? sizeof(*S) : 0) + (UV ? sizeof(*UV) : 0));
+    triMeshBytes += sizeof(*this) + nVertices * sizeof(*P);
+
+    // Hash the object-space data; the seeds tell absent arrays apart
+    objectHash = HashBuffer(vertexIndices, 3 * nTriangles * sizeof(int));
+    objectHash = HashBuffer(P, nVertices * sizeof(*P), objectHash);
+    if (S) objectHash = HashBuffer(S, nVertices * sizeof(*S), objectHash + 1);
+    if (N) objectHash = HashBuffer(N, nVertices * sizeof(*N), objectHash + 2);
+    if (UV)
+        objectHash = HashBuffer(UV, nVertices * sizeof(*UV), objectHash + 3);
+    objectData.reset(new ObjectData);
+    objectData->P.assign(P, P + nVertices);
+    if (S) objectData->S.assign(S, S + nVertices);
+    if (N) objectData->N.assign(N, N + nVertices);
+    if (UV) objectData->UV.assign(UV, UV + nVertices);
+
+    // Copy vertex indices, using 16 bits for each if they fit
+    if (compact && nVertices <= 65536) {
+        vertexIndices16.reset(new uint16_t[3 * nTriangles]);
+        for (int i = 0; i < 3 * nTriangles; ++i)
+            vertexIndices16[i] = (uint16_t)vertexIndices[i];
+        triMeshBytes += 3 * nTriangles * sizeof(uint16_t);
+    } else {
+        this->vertexIndices.reset(new int[3 * nTriangles]);
+        memcpy(this->vertexIndices.get(), vertexIndices,
+               3 * nTriangles * sizeof(int));
+        triMeshBytes += 3 * nTriangles * sizeof(int);
+    }
 
     // Transform mesh vertices to world space
     p.reset(new Point3f[nVertices]);
     for (int i = 0; i < nVertices; ++i) p[i] = ObjectToWorld(P[i]);
 
     // Copy _UV_, _N_, and _S_ vertex data, if present
-    if (UV) {
+    if (UV && compact) {
+        // Quantize _UV_ to 16 bits within its bounds
+        Bounds2f uvBounds(UV[0]);
+        for (int i = 1; i < nVertices; ++i)
+            uvBounds = Union(uvBounds, UV[i]);
+        Vector2f extent = uvBounds.Diagonal();
+        uvMin = uvBounds.pMin;
+        uvScale = extent / 65535;
+        uv16.reset(new uint16_t[2 * nVertices]);
+        for (int i = 0; i < nVertices; ++i)
+            for (int c = 0; c < 2; ++c)
+                uv16[2 * i + c] =
+                    extent[c] > 0
+                        ? (uint16_t)std::round((UV[i][c] - uvMin[c]) /
+                                               extent[c] * 65535)
+                        : 0;
+        triMeshBytes += 2 * nVertices * sizeof(uint16_t);
+    } else if (UV) {
         uv.reset(new Point2f[nVertices]);
-        memcpy(uv.get(), UV, nVertices * sizeof(Point2f));
+        std::copy(UV, UV + nVertices, uv.get());
+        triMeshBytes += nVertices * sizeof(Point2f);
     }
-    if (N) {
+    if (N && compact) {
+        nOct.reset(new uint32_t[nVertices]);
+        for (int i = 0; i < nVertices; ++i)
+            nOct[i] = EncodeOctahedral(Vector3f(ObjectToWorld(N[i])));
+        triMeshBytes += nVertices * sizeof(uint32_t);
+    } else if (N) {
         n.reset(new Normal3f[nVertices]);
         for (int i = 0; i < nVertices; ++i) n[i] = ObjectToWorld(N[i]);
+        triMeshBytes += nVertices * sizeof(Normal3f);
     }
-    if (S) {
+    if (S && compact) {
+        sOct.reset(new uint32_t[nVertices]);
+        for (int i = 0; i < nVertices; ++i)
+            sOct[i] = EncodeOctahedral(ObjectToWorld(S[i]));
+        triMeshBytes += nVertices * sizeof(uint32_t);
+    } else if (S) {
         s.reset(new Vector3f[nVertices]);
         for (int i = 0; i < nVertices; ++i) s[i] = ObjectToWorld(S[i]);
+        triMeshBytes += nVertices * sizeof(Vector3f);
+    }
+    if (compact) ++nCompactMeshes;
+}
+
+size_t TriangleMesh::Bytes() const {
+    size_t bytes = sizeof(*this) + nVertices * sizeof(Point3f);
+    if (vertexIndices) bytes += 3 * nTriangles * sizeof(int);
+    if (vertexIndices16) bytes += 3 * nTriangles * sizeof(uint16_t);
+    if (n) bytes += nVertices * sizeof(Normal3f);
+    if (s) bytes += nVertices * sizeof(Vector3f);
+    if (uv) bytes += nVertices * sizeof(Point2f);
+    if (nOct) bytes += nVertices * sizeof(uint32_t);
+    if (sOct) bytes += nVertices * sizeof(uint32_t);
+    if (uv16) bytes += 2 * nVertices * sizeof(uint16_t);
+    return bytes;
+}
+
+// Returns whether _mesh_ was created from the same object-space indices and
+// vertex data as this mesh; both must still have their _objectData_
+bool TriangleMesh::SameObjectData(const TriangleMesh &mesh) const {
+    if (objectHash != mesh.objectHash || nTriangles != mesh.nTriangles ||
+        nVertices != mesh.nVertices || !objectData || !mesh.objectData)
+        return false;
+    for (int i = 0; i < nTriangles; ++i) {
+        int v[3], w[3];
+        GetVertexIndices(i, v);
+        mesh.GetVertexIndices(i, w);
+        if (v[0] != w[0] || v[1] != w[1] || v[2] != w[2]) return false;
     }
+    const ObjectData &a = *objectData, &b = *mesh.objectData;
+    return a.P == b.P && a.S == b.S && a.N == b.N && a.UV == b.UV;
 }
 
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
@@ -89,18 +198,117 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     bool reverseOrientation, int nTriangles, const int *vertexIndices,
     int nVertices, const Point3f *p, const Vector3f *s, const Normal3f *n,
     const Point2f *uv, const std::shared_ptr<Texture<Float>> &alphaMask,
-    const std::shared_ptr<Texture<Float>> &shadowAlphaMask) {
-    std::shared_ptr<TriangleMesh> mesh = std::make_shared<TriangleMesh>(
-        *ObjectToWorld, nTriangles, vertexIndices, nVertices, p, s, n, uv,
-        alphaMask, shadowAlphaMask);
+    const std::shared_ptr<Texture<Float>> &shadowAlphaMask, bool compact) {
+    return CreateTriangles(
+        ObjectToWorld, WorldToObject, reverseOrientation,
+        std::make_shared<TriangleMesh>(*ObjectToWorld, nTriangles,
+                                       vertexIndices, nVertices, p, s, n, uv,
+                                       alphaMask, shadowAlphaMask, compact));
+}
+
+std::vector<std::shared_ptr<Shape>> CreateTriangles(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh) {
     std::vector<std::shared_ptr<Shape>> tris;
-    tris.reserve(nTriangles);
-    for (int i = 0; i < nTriangles; ++i)
-        tris.push_back(std::make_shared<Triangle>(ObjectToWorld, WorldToObject,
-                                                  reverseOrientation, mesh, i));
+    if (!mesh) return tris;
+    // Allocate the triangles in a single block that they share ownership of
+    std::shared_ptr<std::vector<Triangle>> block =
+        std::make_shared<std::vector<Triangle>>();
+    block->reserve(mesh->nTriangles);
+    for (int i = 0; i < mesh->nTriangles; ++i)
+        block->emplace_back(ObjectToWorld, WorldToObject, reverseOrientation,
+                            mesh, i);
+    tris.reserve(mesh->nTriangles);
+    for (Triangle &tri : *block)
+        tris.push_back(std::shared_ptr<Shape>(block, &tri));
     return tris;
 }
 
+// TriangleMeshAggregate Method Definitions
+TriangleMeshAggregate::TriangleMeshAggregate(
+    const Transform *ObjectToWorld, const Transform *WorldToObject,
+    bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh,
+    const std::shared_ptr<Material> &material,
+    const MediumInterface &mediumInterface)
+    : triangle(ObjectToWorld, WorldToObject, reverseOrientation, mesh, 0),
+      material(material),
+      mediumInterface(mediumInterface) {
+    triangles.reserve(mesh->nTriangles);
+    for (int i = 0; i < mesh->nTriangles; ++i) {
+        triangles.push_back(TriangleMeshPrimitive(this, i));
+        bounds = Union(bounds, triangles.back().WorldBound());
+    }
+    meshPrimitiveBytes +=
+        sizeof(*this) + mesh->nTriangles * sizeof(TriangleMeshPrimitive);
+}
+
+bool TriangleMeshAggregate::Intersect(const Ray &r,
+                                      SurfaceInteraction *isect) const {
+    // Accelerators test the triangles individually; this is only reached
+    // by callers that don't build one
+    bool hit = false;
+    for (const TriangleMeshPrimitive &tri : triangles)
+        hit |= tri.Intersect(r, isect);
+    return hit;
+}
+
+bool TriangleMeshAggregate::IntersectP(const Ray &r) const {
+    for (const TriangleMeshPrimitive &tri : triangles)
+        if (tri.IntersectP(r)) return true;
+    return false;
+}
+
+void TriangleMeshAggregate::Flatten(
+    std::vector<const Primitive *> *prims) const {
+    prims->reserve(prims->size() + triangles.size());
+    for (const TriangleMeshPrimitive &tri : triangles) prims->push_back(&tri);
+}
+
+// TriangleMeshPrimitive Method Definitions
+bool TriangleMeshPrimitive::Intersect(const Ray &r,
+                                      SurfaceInteraction *isect) const {
+    Float tHit;
+    int v[3];
+    GetVertexIndices(v);
+    if (!group->triangle.IntersectTriangle(v, r, &tHit, isect, true))
+        return false;
+    r.tMax = tHit;
+    InitInteraction(r, isect);
+    return true;
+}
+
+void TriangleMeshPrimitive::InteractionFromHit(
+    const Ray &r, const TriangleHit &hit, SurfaceInteraction *isect) const {
+    // Packets only hold triangles without alpha textures
+    int v[3];
+    GetVertexIndices(v);
+    group->triangle.InteractionFromHit(v, r, hit.b0, hit.b1, hit.b2, false,
+                                      isect);
+    InitInteraction(r, isect);
+}
+
+void TriangleMeshPrimitive::InitInteraction(const Ray &r,
+                                            SurfaceInteraction *isect) const {
+    isect->primitive = this;
+    Assert(Dot(isect->n, isect->shading.n) >= 0.);
+    // Initialize _SurfaceInteraction::mediumInterface_ after _Shape_
+    // intersection
+    if (group->mediumInterface.IsMediumTransition())
+        isect->mediumInterface = group->mediumInterface;
+    else
+        isect->mediumInterface = MediumInterface(r.medium);
+}
+
+void TriangleMeshPrimitive::ComputeScatteringFunctions(
+    SurfaceInteraction *isect, MemoryArena &arena, TransportMode mode,
+    bool allowMultipleLobes) const {
+    ProfilePhase p(Prof::ComputeScatteringFuncs);
+    if (group->material)
+        group->material->ComputeScatteringFunctions(isect, arena, mode,
+                                                     allowMultipleLobes);
+    Assert(Dot(isect->n, isect->shading.n) >= 0.);
+}
+
 bool WritePlyFile(const std::string &filename, int nTriangles,
                   const int *vertexIndices, int nVertices, const Point3f *P,
                   const Vector3f *S, const Normal3f *N, const Point2f *UV) {
@@ -157,6 +365,8 @@ bool WritePlyFile(const std::string &filename, int nTriangles,
 
 Bounds3f Triangle::ObjectBound() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
+    int v[3];
+    mesh->GetVertexIndices(triNumber, v);
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
@@ -164,7 +374,7 @@ Bounds3f Triangle::ObjectBound() const {
                  (*WorldToObject)(p2));
 }
 
-Bounds3f Triangle::WorldBound() const {
+Bounds3f Triangle::TriangleBound(const int *v) const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
@@ -172,8 +382,42 @@ Bounds3f Triangle::WorldBound() const {
     return Union(Bounds3f(p0, p1), p2);
 }
 
-bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
-                         bool testAlphaTexture) const {
+void Triangle::SplitTriangleBound(const int *v, const Bounds3f &bounds,
+                                  int axis, Float plane, Bounds3f *left,
+                                  Bounds3f *right) const {
+    // Bound the vertices and edge crossings on each side of _plane_
+    const Point3f *p[3] = {&mesh->p[v[0]], &mesh->p[v[1]], &mesh->p[v[2]]};
+    Bounds3f l, r;
+    for (int i = 0; i < 3; ++i) {
+        const Point3f &a = *p[i], &b = *p[(i + 1) % 3];
+        if (a[axis] <= plane) l = Union(l, a);
+        if (a[axis] >= plane) r = Union(r, a);
+        if ((a[axis] < plane && b[axis] > plane) ||
+            (a[axis] > plane && b[axis] < plane)) {
+            Point3f pc = Lerp((plane - a[axis]) / (b[axis] - a[axis]), a, b);
+            pc[axis] = plane;
+            l = Union(l, pc);
+            r = Union(r, pc);
+        }
+    }
+
+    // Allow for error in the crossings and restrict the bounds to each side
+    // of _bounds_
+    auto pad = [](const Bounds3f &b) -> Bounds3f {
+        if (b.pMin.x > b.pMax.x) return b;
+        Vector3f err = gamma(3) * Vector3f(Max(Abs(b.pMin), Abs(b.pMax)));
+        return Bounds3f(b.pMin - err, b.pMax + err);
+    };
+    *left = *right = bounds;
+    left->pMax[axis] = std::min(left->pMax[axis], plane);
+    right->pMin[axis] = std::max(right->pMin[axis], plane);
+    *left = ::Intersect(*left, pad(l));
+    *right = ::Intersect(*right, pad(r));
+}
+
+bool Triangle::IntersectTriangle(const int *v, const Ray &ray, Float *tHit,
+                                 SurfaceInteraction *isect,
+                                 bool testAlphaTexture) const {
     ProfilePhase p(Prof::TriIntersect);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
@@ -277,10 +521,26 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
                    std::abs(invDet);
     if (t <= deltaT) return false;
 
+    // Fill in _SurfaceInteraction_ unless the alpha texture rejects the hit
+    if (!InteractionFromHit(v, ray, b0, b1, b2, testAlphaTexture, isect))
+        return false;
+    *tHit = t;
+    ++nHits;
+    return true;
+}
+
+bool Triangle::InteractionFromHit(const int *v, const Ray &ray, Float b0,
+                                  Float b1, Float b2, bool testAlphaTexture,
+                                  SurfaceInteraction *isect) const {
+    // Get triangle vertices in _p0_, _p1_, and _p2_
+    const Point3f &p0 = mesh->p[v[0]];
+    const Point3f &p1 = mesh->p[v[1]];
+    const Point3f &p2 = mesh->p[v[2]];
+
     // Compute triangle partial derivatives
     Vector3f dpdu, dpdv;
     Point2f uv[3];
-    GetUVs(uv);
+    GetUVs(v, uv);
 
     // Compute deltas for triangle partial derivatives
     Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -323,14 +583,14 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
     // Override surface normal in _isect_ for triangle
     isect->n = isect->shading.n = Normal3f(Normalize(Cross(dp02, dp12)));
-    if (mesh->n || mesh->s) {
+    if (mesh->HasNormals() || mesh->HasTangents()) {
         // Initialize _Triangle_ shading geometry
 
         // Compute shading normal _ns_ for triangle
         Normal3f ns;
-        if (mesh->n) {
-            ns = (b0 * mesh->n[v[0]] + b1 * mesh->n[v[1]] +
-                  b2 * mesh->n[v[2]]);
+        if (mesh->HasNormals()) {
+            ns = (b0 * mesh->GetNormal(v[0]) + b1 * mesh->GetNormal(v[1]) +
+                  b2 * mesh->GetNormal(v[2]));
             if (ns.LengthSquared() > 0)
                 ns = Normalize(ns);
             else
@@ -340,9 +600,9 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute shading tangent _ss_ for triangle
         Vector3f ss;
-        if (mesh->s) {
-            ss = (b0 * mesh->s[v[0]] + b1 * mesh->s[v[1]] +
-                  b2 * mesh->s[v[2]]);
+        if (mesh->HasTangents()) {
+            ss = (b0 * mesh->GetTangent(v[0]) + b1 * mesh->GetTangent(v[1]) +
+                  b2 * mesh->GetTangent(v[2]));
             if (ss.LengthSquared() > 0)
                 ss = Normalize(ss);
             else
@@ -361,12 +621,13 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
 
         // Compute $\dndu$ and $\dndv$ for triangle shading geometry
         Normal3f dndu, dndv;
-        if (mesh->n) {
+        if (mesh->HasNormals()) {
             // Compute deltas for triangle partial derivatives of normal
             Vector2f duv02 = uv[0] - uv[2];
             Vector2f duv12 = uv[1] - uv[2];
-            Normal3f dn1 = mesh->n[v[0]] - mesh->n[v[2]];
-            Normal3f dn2 = mesh->n[v[1]] - mesh->n[v[2]];
+            Normal3f n2 = mesh->GetNormal(v[2]);
+            Normal3f dn1 = mesh->GetNormal(v[0]) - n2;
+            Normal3f dn2 = mesh->GetNormal(v[1]) - n2;
             Float determinant = duv02[0] * duv12[1] - duv02[1] * duv12[0];
             if (determinant == 0)
                 dndu = dndv = Normal3f(0, 0, 0);
@@ -381,16 +642,15 @@ bool Triangle::Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
     }
 
     // Ensure correct orientation of the geometric normal
-    if (mesh->n)
+    if (mesh->HasNormals())
         isect->n = Faceforward(isect->n, isect->shading.n);
     else if (reverseOrientation ^ transformSwapsHandedness)
         isect->n = isect->shading.n = -isect->n;
-    *tHit = t;
-    ++nHits;
     return true;
 }
 
-bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
+bool Triangle::IntersectPTriangle(const int *v, const Ray &ray,
+                                  bool testAlphaTexture) const {
     ProfilePhase p(Prof::TriIntersectP);
     ++nTests;
     // Get triangle vertices in _p0_, _p1_, and _p2_
@@ -499,7 +759,7 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
         // Compute triangle partial derivatives
         Vector3f dpdu, dpdv;
         Point2f uv[3];
-        GetUVs(uv);
+        GetUVs(v, uv);
 
         // Compute deltas for triangle partial derivatives
         Vector2f duv02 = uv[0] - uv[2], duv12 = uv[1] - uv[2];
@@ -530,8 +790,286 @@ bool Triangle::IntersectP(const Ray &ray, bool testAlphaTexture) const {
     return true;
 }
 
+// TrianglePacket Method Definitions
+TriangleRay::TriangleRay(const Ray &ray) : o(ray.o) {
+    // Permute components of ray direction and compute shear
+    kz = MaxDimension(Abs(ray.d));
+    kx = kz + 1;
+    if (kx == 3) kx = 0;
+    ky = kx + 1;
+    if (ky == 3) ky = 0;
+    Vector3f d = Permute(ray.d, kx, ky, kz);
+    Sx = -d.x / d.z;
+    Sy = -d.y / d.z;
+    Sz = 1.f / d.z;
+}
+
+// The hits of a packet's triangles, with each one's scaled hit distance and
+// determinant so that they can be accepted in turn as scalar tests would
+struct TrianglePacketHits {
+    Float t[TrianglePacket::Width], b[3][TrianglePacket::Width];
+    Float tScaled[TrianglePacket::Width], det[TrianglePacket::Width];
+};
+
+// Tests one triangle of _packet_ exactly as _Triangle::IntersectTriangle()_
+// does, for the triangles the vectorized test can't decide
+static bool IntersectPacketTriangle(const TrianglePacket &packet, int i,
+                                    const TriangleRay &ray, Float tMax,
+                                    TrianglePacketHits *hits) {
+    // Transform triangle vertices to ray coordinate space
+    Point3f pt[3];
+    for (int j = 0; j < 3; ++j) {
+        pt[j] = Point3f(packet.p[j][ray.kx][i] - ray.o[ray.kx],
+                        packet.p[j][ray.ky][i] - ray.o[ray.ky],
+                        packet.p[j][ray.kz][i] - ray.o[ray.kz]);
+        pt[j].x += ray.Sx * pt[j].z;
+        pt[j].y += ray.Sy * pt[j].z;
+    }
+    const Point3f &p0t = pt[0], &p1t = pt[1], &p2t = pt[2];
+
+    // Compute edge function coefficients _e0_, _e1_, and _e2_
+    Float e0 = p1t.x * p2t.y - p1t.y * p2t.x;
+    Float e1 = p2t.x * p0t.y - p2t.y * p0t.x;
+    Float e2 = p0t.x * p1t.y - p0t.y * p1t.x;
+
+    // Fall back to double precision test at triangle edges
+    if (sizeof(Float) == sizeof(float) &&
+        (e0 == 0.0f || e1 == 0.0f || e2 == 0.0f)) {
+        double p2txp1ty = (double)p2t.x * (double)p1t.y;
+        double p2typ1tx = (double)p2t.y * (double)p1t.x;
+        e0 = (float)(p2typ1tx - p2txp1ty);
+        double p0txp2ty = (double)p0t.x * (double)p2t.y;
+        double p0typ2tx = (double)p0t.y * (double)p2t.x;
+        e1 = (float)(p0typ2tx - p0txp2ty);
+        double p1txp0ty = (double)p1t.x * (double)p0t.y;
+        double p1typ0tx = (double)p1t.y * (double)p0t.x;
+        e2 = (float)(p1typ0tx - p1txp0ty);
+    }
+
+    // Perform triangle edge and determinant tests
+    if ((e0 < 0 || e1 < 0 || e2 < 0) && (e0 > 0 || e1 > 0 || e2 > 0))
+        return false;
+    Float det = e0 + e1 + e2;
+    if (det == 0) return false;
+
+    // Compute scaled hit distance to triangle and test against ray $t$ range
+    Float z0 = p0t.z * ray.Sz, z1 = p1t.z * ray.Sz, z2 = p2t.z * ray.Sz;
+    Float tScaled = e0 * z0 + e1 * z1 + e2 * z2;
+    if (det < 0 && (tScaled >= 0 || tScaled < tMax * det))
+        return false;
+    else if (det > 0 && (tScaled <= 0 || tScaled > tMax * det))
+        return false;
+
+    // Compute barycentric coordinates and $t$ value for triangle intersection
+    Float invDet = 1 / det;
+    Float t = tScaled * invDet;
+
+    // Ensure that computed triangle $t$ is conservatively greater than zero
+    Float maxZt = MaxComponent(Abs(Vector3f(z0, z1, z2)));
+    Float deltaZ = gamma(3) * maxZt;
+    Float maxXt = MaxComponent(Abs(Vector3f(p0t.x, p1t.x, p2t.x)));
+    Float maxYt = MaxComponent(Abs(Vector3f(p0t.y, p1t.y, p2t.y)));
+    Float deltaX = gamma(5) * (maxXt + maxZt);
+    Float deltaY = gamma(5) * (maxYt + maxZt);
+    Float deltaE =
+        2 * (gamma(2) * maxXt * maxYt + deltaY * maxXt + deltaX * maxYt);
+    Float maxE = MaxComponent(Abs(Vector3f(e0, e1, e2)));
+    Float deltaT = 3 *
+                   (gamma(3) * maxE * maxZt + deltaE * maxZt + deltaZ * maxE) *
+                   std::abs(invDet);
+    if (t <= deltaT) return false;
+    hits->t[i] = t;
+    hits->b[0][i] = e0 * invDet;
+    hits->b[1][i] = e1 * invDet;
+    hits->b[2][i] = e2 * invDet;
+    hits->tScaled[i] = tScaled;
+    hits->det[i] = det;
+    return true;
+}
+
+// Tests all the triangles of _packet_, returning a mask of those hit
+static int IntersectPacket(const TrianglePacket &packet,
+                           const TriangleRay &ray, Float tMax,
+                           TrianglePacketHits *hits) {
+    int validMask = 0;
+    for (int i = 0; i < TrianglePacket::Width; ++i)
+        if (packet.index[i] >= 0) {
+            validMask |= 1 << i;
+            ++nTests;
+        }
+#ifdef PBRT_TRIANGLE_PACKET_SSE
+    // Transform triangle vertices to ray coordinate space, exactly as the
+    // scalar test does so that shared edges remain watertight
+    __m128 o[3] = {_mm_set1_ps(ray.o[ray.kx]), _mm_set1_ps(ray.o[ray.ky]),
+                   _mm_set1_ps(ray.o[ray.kz])};
+    __m128 Sx = _mm_set1_ps(ray.Sx), Sy = _mm_set1_ps(ray.Sy);
+    __m128 Sz = _mm_set1_ps(ray.Sz);
+    __m128 px[3], py[3], pz[3];
+    for (int j = 0; j < 3; ++j) {
+        pz[j] = _mm_sub_ps(_mm_loadu_ps(packet.p[j][ray.kz]), o[2]);
+        px[j] = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(packet.p[j][ray.kx]), o[0]),
+                           _mm_mul_ps(Sx, pz[j]));
+        py[j] = _mm_add_ps(_mm_sub_ps(_mm_loadu_ps(packet.p[j][ray.ky]), o[1]),
+                           _mm_mul_ps(Sy, pz[j]));
+    }
+
+    // Compute edge function coefficients and hand triangles with an edge
+    // through the ray to the scalar test's double precision fallback
+    __m128 e0 = _mm_sub_ps(_mm_mul_ps(px[1], py[2]), _mm_mul_ps(py[1], px[2]));
+    __m128 e1 = _mm_sub_ps(_mm_mul_ps(px[2], py[0]), _mm_mul_ps(py[2], px[0]));
+    __m128 e2 = _mm_sub_ps(_mm_mul_ps(px[0], py[1]), _mm_mul_ps(py[0], px[1]));
+    __m128 zero = _mm_setzero_ps();
+    int edgeMask =
+        validMask &
+        _mm_movemask_ps(_mm_or_ps(
+            _mm_or_ps(_mm_cmpeq_ps(e0, zero), _mm_cmpeq_ps(e1, zero)),
+            _mm_cmpeq_ps(e2, zero)));
+    int hitMask = 0;
+    for (int m = edgeMask; m; m &= m - 1) {
+        int i = CountTrailingZeros(m);
+        if (IntersectPacketTriangle(packet, i, ray, tMax, hits))
+            hitMask |= 1 << i;
+    }
+    int mask = validMask & ~edgeMask;
+    if (!mask) return hitMask;
+
+    // Perform triangle edge and determinant tests
+    __m128 anyNeg = _mm_or_ps(_mm_or_ps(_mm_cmplt_ps(e0, zero),
+                                        _mm_cmplt_ps(e1, zero)),
+                              _mm_cmplt_ps(e2, zero));
+    __m128 anyPos = _mm_or_ps(_mm_or_ps(_mm_cmpgt_ps(e0, zero),
+                                        _mm_cmpgt_ps(e1, zero)),
+                              _mm_cmpgt_ps(e2, zero));
+    __m128 det = _mm_add_ps(_mm_add_ps(e0, e1), e2);
+    __m128 ok = _mm_andnot_ps(_mm_and_ps(anyNeg, anyPos),
+                              _mm_cmpneq_ps(det, zero));
+
+    // Compute scaled hit distance to triangle and test against ray $t$ range
+    for (int j = 0; j < 3; ++j) pz[j] = _mm_mul_ps(pz[j], Sz);
+    __m128 tScaled = _mm_add_ps(
+        _mm_add_ps(_mm_mul_ps(e0, pz[0]), _mm_mul_ps(e1, pz[1])),
+        _mm_mul_ps(e2, pz[2]));
+    __m128 tMaxDet = _mm_mul_ps(_mm_set1_ps(tMax), det);
+    __m128 inRangeNeg = _mm_and_ps(
+        _mm_cmplt_ps(det, zero),
+        _mm_and_ps(_mm_cmplt_ps(tScaled, zero),
+                   _mm_cmpge_ps(tScaled, tMaxDet)));
+    __m128 inRangePos = _mm_and_ps(
+        _mm_cmpgt_ps(det, zero),
+        _mm_and_ps(_mm_cmpgt_ps(tScaled, zero),
+                   _mm_cmple_ps(tScaled, tMaxDet)));
+    ok = _mm_and_ps(ok, _mm_or_ps(inRangeNeg, inRangePos));
+    mask &= _mm_movemask_ps(ok);
+    if (!mask) return hitMask;
+
+    // Compute barycentric coordinates and $t$ values for the hits
+    __m128 invDet = _mm_div_ps(_mm_set1_ps(1.f), det);
+    __m128 tv = _mm_mul_ps(tScaled, invDet);
+
+    // Ensure that computed triangle $t$ is conservatively greater than zero
+    __m128 signMask = _mm_set1_ps(-0.f);
+    auto absolute = [&](__m128 v) -> __m128 {
+        return _mm_andnot_ps(signMask, v);
+    };
+    auto maxAbsolute = [&](const __m128 v[3]) -> __m128 {
+        return _mm_max_ps(absolute(v[0]),
+                          _mm_max_ps(absolute(v[1]), absolute(v[2])));
+    };
+    __m128 maxZt = maxAbsolute(pz), maxXt = maxAbsolute(px);
+    __m128 maxYt = maxAbsolute(py);
+    __m128 deltaZ = _mm_mul_ps(_mm_set1_ps(gamma(3)), maxZt);
+    __m128 deltaX = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxXt, maxZt));
+    __m128 deltaY = _mm_mul_ps(_mm_set1_ps(gamma(5)), _mm_add_ps(maxYt, maxZt));
+    __m128 deltaE = _mm_mul_ps(
+        _mm_set1_ps(2.f),
+        _mm_add_ps(
+            _mm_add_ps(
+                _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(2)), maxXt), maxYt),
+                _mm_mul_ps(deltaY, maxXt)),
+            _mm_mul_ps(deltaX, maxYt)));
+    __m128 e[3] = {e0, e1, e2};
+    __m128 maxE = maxAbsolute(e);
+    __m128 deltaT = _mm_mul_ps(
+        _mm_mul_ps(
+            _mm_set1_ps(3.f),
+            _mm_add_ps(
+                _mm_add_ps(
+                    _mm_mul_ps(_mm_mul_ps(_mm_set1_ps(gamma(3)), maxE), maxZt),
+                    _mm_mul_ps(deltaE, maxZt)),
+                _mm_mul_ps(deltaZ, maxE))),
+        absolute(invDet));
+    mask &= _mm_movemask_ps(_mm_cmpgt_ps(tv, deltaT));
+    if (!mask) return hitMask;
+
+    // Store the hits along with those of the scalar test
+    TrianglePacketHits vectorHits;
+    _mm_storeu_ps(vectorHits.t, tv);
+    _mm_storeu_ps(vectorHits.b[0], _mm_mul_ps(e0, invDet));
+    _mm_storeu_ps(vectorHits.b[1], _mm_mul_ps(e1, invDet));
+    _mm_storeu_ps(vectorHits.b[2], _mm_mul_ps(e2, invDet));
+    _mm_storeu_ps(vectorHits.tScaled, tScaled);
+    _mm_storeu_ps(vectorHits.det, det);
+    for (int m = mask; m; m &= m - 1) {
+        int i = CountTrailingZeros(m);
+        hits->t[i] = vectorHits.t[i];
+        for (int j = 0; j < 3; ++j) hits->b[j][i] = vectorHits.b[j][i];
+        hits->tScaled[i] = vectorHits.tScaled[i];
+        hits->det[i] = vectorHits.det[i];
+    }
+    return hitMask | mask;
+#else
+    int hitMask = 0;
+    for (int m = validMask; m; m &= m - 1) {
+        int i = CountTrailingZeros(m);
+        if (IntersectPacketTriangle(packet, i, ray, tMax, hits))
+            hitMask |= 1 << i;
+    }
+    return hitMask;
+#endif  // PBRT_TRIANGLE_PACKET_SSE
+}
+
+bool IntersectTrianglePacket(const TrianglePacket &packet,
+                             const TriangleRay &ray, Float tMax,
+                             TriangleHit *hit) {
+    ProfilePhase p(Prof::TriIntersect);
+    TrianglePacketHits hits;
+    int hitMask = IntersectPacket(packet, ray, tMax, &hits);
+    if (!hitMask) return false;
+    // Accept each hit in turn if it's within the closest one so far, as
+    // successive scalar tests would, so that ties are broken the same way
+    int closest = -1;
+    for (int m = hitMask; m; m &= m - 1) {
+        int i = CountTrailingZeros(m);
+        if (closest != -1) {
+            Float tMaxDet = hits.t[closest] * hits.det[i];
+            if (hits.det[i] < 0 ? hits.tScaled[i] < tMaxDet
+                                : hits.tScaled[i] > tMaxDet)
+                continue;
+        }
+        closest = i;
+    }
+    hit->t = hits.t[closest];
+    hit->b0 = hits.b[0][closest];
+    hit->b1 = hits.b[1][closest];
+    hit->b2 = hits.b[2][closest];
+    hit->index = packet.index[closest];
+    ++nHits;
+    return true;
+}
+
+bool IntersectPTrianglePacket(const TrianglePacket &packet,
+                              const TriangleRay &ray, Float tMax) {
+    ProfilePhase p(Prof::TriIntersectP);
+    TrianglePacketHits hits;
+    if (!IntersectPacket(packet, ray, tMax, &hits)) return false;
+    ++nHits;
+    return true;
+}
+
 Float Triangle::Area() const {
     // Get triangle vertices in _p0_, _p1_, and _p2_
+    int v[3];
+    mesh->GetVertexIndices(triNumber, v);
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
@@ -541,15 +1079,18 @@ Float Triangle::Area() const {
 Interaction Triangle::Sample(const Point2f &u) const {
     Point2f b = UniformSampleTriangle(u);
     // Get triangle vertices in _p0_, _p1_, and _p2_
+    int v[3];
+    mesh->GetVertexIndices(triNumber, v);
     const Point3f &p0 = mesh->p[v[0]];
     const Point3f &p1 = mesh->p[v[1]];
     const Point3f &p2 = mesh->p[v[2]];
     Interaction it;
     it.p = b[0] * p0 + b[1] * p1 + (1 - b[0] - b[1]) * p2;
     // Compute surface normal for sampled point on triangle
-    if (mesh->n)
-        it.n = Normalize(b[0] * mesh->n[v[0]] + b[1] * mesh->n[v[1]] +
-                         (1 - b[0] - b[1]) * mesh->n[v[2]]);
+    if (mesh->HasNormals())
+        it.n = Normalize(b[0] * mesh->GetNormal(v[0]) +
+                         b[1] * mesh->GetNormal(v[1]) +
+                         (1 - b[0] - b[1]) * mesh->GetNormal(v[2]));
     else
         it.n = Normalize(Normal3f(Cross(p1 - p0, p2 - p0)));
     if (reverseOrientation) it.n *= -1;
@@ -565,6 +1106,14 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
     std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
+    return CreateTriangles(o2w, w2o, reverseOrientation,
+                           CreateTriangleMeshFromParams(o2w, params,
+                                                        floatTextures));
+}
+
+std::shared_ptr<TriangleMesh> CreateTriangleMeshFromParams(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures) {
     int nvi, npi, nuvi, nsi, nni;
     const int *vi = params.FindInt("indices", &nvi);
     const Point3f *P = params.FindPoint3f("P", &npi);
@@ -600,11 +1149,11 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     if (!vi) {
         Error(
             "Vertex indices \"indices\" not provided with triangle mesh shape");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     if (!P) {
         Error("Vertex positions \"P\" not provided with triangle mesh shape");
-        return std::vector<std::shared_ptr<Shape>>();
+        return nullptr;
     }
     const Vector3f *S = params.FindVector3f("S", &nsi);
     if (S && nsi != npi) {
@@ -644,7 +1193,7 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
                 "trianglemesh has out of-bounds vertex index %d (%d \"P\" "
                 "values were given",
                 vi[i], npi);
-            return std::vector<std::shared_ptr<Shape>>();
+            return nullptr;
         }
 
     std::shared_ptr<Texture<Float>> alphaTex;
@@ -671,6 +1220,7 @@ std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     } else if (params.FindOneFloat("shadowalpha", 1.f) == 0.f)
         shadowAlphaTex.reset(new ConstantTexture<Float>(0.f));
 
-    return CreateTriangleMesh(o2w, w2o, reverseOrientation, nvi / 3, vi, npi, P,
-                              S, N, uvs, alphaTex, shadowAlphaTex);
+    bool compact = params.FindOneBool("compact", PbrtOptions.compactMeshes);
+    return std::make_shared<TriangleMesh>(*o2w, nvi / 3, vi, npi, P, S, N, uvs,
+                                          alphaTex, shadowAlphaTex, compact);
 }
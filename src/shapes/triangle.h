@@ -41,27 +41,98 @@
 
 // shapes/triangle.h*
 #include "shape.h"
+#include "primitive.h"
 #include "stats.h"
 #include <map>
 STAT_MEMORY_COUNTER("Memory/Triangle meshes", triMeshBytes);
 
 // Triangle Declarations
+// Octahedral Encoding Declarations
+
+// Packs a unit vector into 32 bits: 16 bits for each coordinate of its
+// projection onto the octahedron, with the lower hemisphere folded over.
+uint32_t EncodeOctahedral(const Vector3f &v);
+inline Vector3f DecodeOctahedral(uint32_t e) {
+    Float x = (e & 0xffff) * (Float(2) / 65535) - 1;
+    Float y = (e >> 16) * (Float(2) / 65535) - 1;
+    Float z = 1 - std::abs(x) - std::abs(y);
+    if (z < 0) {
+        Float xf = (1 - std::abs(y)) * (x >= 0 ? 1 : -1);
+        Float yf = (1 - std::abs(x)) * (y >= 0 ? 1 : -1);
+        x = xf;
+        y = yf;
+    }
+    return Normalize(Vector3f(x, y, z));
+}
+
+// TriangleMesh Declarations
+
+// When created compact, a mesh stores its normals and tangents as
+// octahedral unit vectors, its uvs as 16-bit offsets within their bounds
+// and, when it has few enough vertices, 16-bit vertex indices. Positions
+// are always kept at full precision for the watertight intersection test.
 struct TriangleMesh {
     // TriangleMesh Public Methods
     TriangleMesh(const Transform &ObjectToWorld, int nTriangles,
                  const int *vertexIndices, int nVertices, const Point3f *P,
                  const Vector3f *S, const Normal3f *N, const Point2f *uv,
                  const std::shared_ptr<Texture<Float>> &alphaMask,
-                 const std::shared_ptr<Texture<Float>> &shadowAlphaMask);
+                 const std::shared_ptr<Texture<Float>> &shadowAlphaMask,
+                 bool compact = false);
+    void GetVertexIndices(int triNumber, int v[3]) const {
+        if (vertexIndices16) {
+            const uint16_t *vi = &vertexIndices16[3 * triNumber];
+            v[0] = vi[0];
+            v[1] = vi[1];
+            v[2] = vi[2];
+        } else {
+            const int *vi = &vertexIndices[3 * triNumber];
+            v[0] = vi[0];
+            v[1] = vi[1];
+            v[2] = vi[2];
+        }
+    }
+    bool HasNormals() const { return n || nOct; }
+    Normal3f GetNormal(int i) const {
+        return n ? n[i] : Normal3f(DecodeOctahedral(nOct[i]));
+    }
+    bool HasTangents() const { return s || sOct; }
+    Vector3f GetTangent(int i) const {
+        return s ? s[i] : DecodeOctahedral(sOct[i]);
+    }
+    bool HasUVs() const { return uv || uv16; }
+    Point2f GetUV(int i) const {
+        if (uv) return uv[i];
+        return Point2f(uvMin.x + uv16[2 * i] * uvScale.x,
+                       uvMin.y + uv16[2 * i + 1] * uvScale.y);
+    }
+    size_t Bytes() const;
+    bool SameObjectData(const TriangleMesh &mesh) const;
 
     // TriangleMesh Data
     const int nTriangles, nVertices;
-    std::vector<int> vertexIndices;
+    std::unique_ptr<int[]> vertexIndices;
+    std::unique_ptr<uint16_t[]> vertexIndices16;
     std::unique_ptr<Point3f[]> p;
     std::unique_ptr<Normal3f[]> n;
     std::unique_ptr<Vector3f[]> s;
     std::unique_ptr<Point2f[]> uv;
+    std::unique_ptr<uint32_t[]> nOct, sOct;
+    std::unique_ptr<uint16_t[]> uv16;
+    Point2f uvMin;
+    Vector2f uvScale;
     std::shared_ptr<Texture<Float>> alphaMask, shadowAlphaMask;
+    // The object-space vertex data the mesh was created from and a hash of
+    // it and the indices, which identify copies of the mesh placed with
+    // other transforms. The data is only kept while the scene is built.
+    struct ObjectData {
+        std::vector<Point3f> P;
+        std::vector<Vector3f> S;
+        std::vector<Normal3f> N;
+        std::vector<Point2f> UV;
+    };
+    std::unique_ptr<ObjectData> objectData;
+    uint64_t objectHash;
 };
 
 class Triangle : public Shape {
@@ -70,25 +141,60 @@ class Triangle : public Shape {
     Triangle(const Transform *ObjectToWorld, const Transform *WorldToObject,
              bool reverseOrientation, const std::shared_ptr<TriangleMesh> &mesh,
              int triNumber)
-        : Shape(ObjectToWorld, WorldToObject, reverseOrientation), mesh(mesh) {
-        v = &mesh->vertexIndices[3 * triNumber];
+        : Shape(ObjectToWorld, WorldToObject, reverseOrientation),
+          mesh(mesh),
+          triNumber(triNumber) {
         triMeshBytes += sizeof(*this);
     }
     Bounds3f ObjectBound() const;
-    Bounds3f WorldBound() const;
+    Bounds3f WorldBound() const {
+        int v[3];
+        mesh->GetVertexIndices(triNumber, v);
+        return TriangleBound(v);
+    }
+    void SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                         Bounds3f *left, Bounds3f *right) const {
+        int v[3];
+        mesh->GetVertexIndices(triNumber, v);
+        SplitTriangleBound(v, bounds, axis, plane, left, right);
+    }
     bool Intersect(const Ray &ray, Float *tHit, SurfaceInteraction *isect,
-                   bool testAlphaTexture) const;
-    bool IntersectP(const Ray &ray, bool testAlphaTexture) const;
+                   bool testAlphaTexture) const {
+        int v[3];
+        mesh->GetVertexIndices(triNumber, v);
+        return IntersectTriangle(v, ray, tHit, isect, testAlphaTexture);
+    }
+    bool IntersectP(const Ray &ray, bool testAlphaTexture) const {
+        int v[3];
+        mesh->GetVertexIndices(triNumber, v);
+        return IntersectPTriangle(v, ray, testAlphaTexture);
+    }
     Float Area() const;
     Interaction Sample(const Point2f &u) const;
+    const std::shared_ptr<TriangleMesh> &GetMesh() const { return mesh; }
 
   private:
     // Triangle Private Methods
-    void GetUVs(Point2f uv[3]) const {
-        if (mesh->uv) {
-            uv[0] = mesh->uv[v[0]];
-            uv[1] = mesh->uv[v[1]];
-            uv[2] = mesh->uv[v[2]];
+
+    // These operate on the triangle of this one's mesh with vertex indices
+    // _v_, so that a mesh's _TriangleMeshPrimitive_s can share one _Triangle_
+    Bounds3f TriangleBound(const int *v) const;
+    void SplitTriangleBound(const int *v, const Bounds3f &bounds, int axis,
+                            Float plane, Bounds3f *left,
+                            Bounds3f *right) const;
+    bool IntersectTriangle(const int *v, const Ray &ray, Float *tHit,
+                           SurfaceInteraction *isect,
+                           bool testAlphaTexture) const;
+    bool IntersectPTriangle(const int *v, const Ray &ray,
+                            bool testAlphaTexture) const;
+    bool InteractionFromHit(const int *v, const Ray &ray, Float b0, Float b1,
+                            Float b2, bool testAlphaTexture,
+                            SurfaceInteraction *isect) const;
+    void GetUVs(const int *v, Point2f uv[3]) const {
+        if (mesh->HasUVs()) {
+            uv[0] = mesh->GetUV(v[0]);
+            uv[1] = mesh->GetUV(v[1]);
+            uv[2] = mesh->GetUV(v[2]);
         } else {
             uv[0] = Point2f(0, 0);
             uv[1] = Point2f(1, 0);
@@ -98,20 +204,173 @@ class Triangle : public Shape {
 
     // Triangle Private Data
     std::shared_ptr<TriangleMesh> mesh;
-    const int *v;
+    int triNumber;
+    friend class TriangleMeshPrimitive;
+};
+
+// TrianglePacket Declarations
+
+// The permutation and shear that take a ray to the coordinate system of the
+// watertight ray--triangle test, computed once for all the triangles the
+// ray is tested against
+struct TriangleRay {
+    TriangleRay() {}
+    TriangleRay(const Ray &ray);
+    Point3f o;
+    int kx, ky, kz;
+    Float Sx, Sy, Sz;
+};
+
+// The closest hit found by _IntersectTrianglePacket()_: its parametric
+// distance, barycentric coordinates and the index stored with the triangle
+struct TriangleHit {
+    Float t, b0, b1, b2;
+    int32_t index = -1;
+};
+
+// The world-space vertices of up to four triangles, laid out to test them
+// against a ray at once
+struct TrianglePacket {
+    static PBRT_CONSTEXPR int Width = 4;
+    Float p[3][3][Width];  // [vertex][axis][triangle]
+    int32_t index[Width];  // -1 -> empty
+};
+
+bool IntersectTrianglePacket(const TrianglePacket &packet,
+                             const TriangleRay &ray, Float tMax,
+                             TriangleHit *hit);
+bool IntersectPTrianglePacket(const TrianglePacket &packet,
+                              const TriangleRay &ray, Float tMax);
+
+// TriangleMeshPrimitive Declarations
+
+// One triangle of a mesh that has no area light, identified by its mesh and
+// vertex indices. All of a mesh's triangles belong to a
+// _TriangleMeshAggregate_, whose single _Triangle_ supplies the mesh and its
+// orientation and which holds the material and medium interface, so each
+// one is little larger than the accelerator's pointer to it.
+class TriangleMeshAggregate;
+class TriangleMeshPrimitive : public Primitive {
+  public:
+    // TriangleMeshPrimitive Public Methods
+    TriangleMeshPrimitive(const TriangleMeshAggregate *group, int triNumber)
+        : group(group), triNumber(triNumber) {}
+    Bounds3f WorldBound() const;
+    void SplitWorldBound(const Bounds3f &bounds, int axis, Float plane,
+                         Bounds3f *left, Bounds3f *right) const;
+    bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &r) const;
+    const AreaLight *GetAreaLight() const { return nullptr; }
+    const Material *GetMaterial() const;
+    void ComputeScatteringFunctions(SurfaceInteraction *isect,
+                                    MemoryArena &arena, TransportMode mode,
+                                    bool allowMultipleLobes) const;
+    bool HasAlphaTexture() const;
+    void GetVertices(Point3f p[3]) const;
+    void InteractionFromHit(const Ray &r, const TriangleHit &hit,
+                            SurfaceInteraction *isect) const;
+
+  private:
+    // TriangleMeshPrimitive Private Methods
+    void GetVertexIndices(int v[3]) const;
+    void InitInteraction(const Ray &r, SurfaceInteraction *isect) const;
+
+    // TriangleMeshPrimitive Private Data
+    const TriangleMeshAggregate *group;
+    int triNumber;
+};
+
+// All the triangles of a mesh that has no area light, created straight from
+// the _TriangleMesh_ without a _Triangle_ shape for each. Accelerators build
+// over the triangles themselves, which _Flatten()_ gives them.
+class TriangleMeshAggregate : public Aggregate {
+  public:
+    // TriangleMeshAggregate Public Methods
+    TriangleMeshAggregate(const Transform *ObjectToWorld,
+                          const Transform *WorldToObject,
+                          bool reverseOrientation,
+                          const std::shared_ptr<TriangleMesh> &mesh,
+                          const std::shared_ptr<Material> &material,
+                          const MediumInterface &mediumInterface);
+    Bounds3f WorldBound() const { return bounds; }
+    bool Intersect(const Ray &r, SurfaceInteraction *isect) const;
+    bool IntersectP(const Ray &r) const;
+    void Flatten(std::vector<const Primitive *> *prims) const;
+    const Triangle &GetTriangle() const { return triangle; }
+    const std::shared_ptr<TriangleMesh> &GetMesh() const {
+        return triangle.GetMesh();
+    }
+
+  private:
+    // TriangleMeshAggregate Private Data
+    Triangle triangle;
+    std::shared_ptr<Material> material;
+    MediumInterface mediumInterface;
+    std::vector<TriangleMeshPrimitive> triangles;
+    Bounds3f bounds;
+    friend class TriangleMeshPrimitive;
 };
 
+// TriangleMeshPrimitive Inline Methods
+inline Bounds3f TriangleMeshPrimitive::WorldBound() const {
+    int v[3];
+    GetVertexIndices(v);
+    return group->triangle.TriangleBound(v);
+}
+
+inline void TriangleMeshPrimitive::SplitWorldBound(const Bounds3f &bounds,
+                                                   int axis, Float plane,
+                                                   Bounds3f *left,
+                                                   Bounds3f *right) const {
+    int v[3];
+    GetVertexIndices(v);
+    group->triangle.SplitTriangleBound(v, bounds, axis, plane, left, right);
+}
+
+inline bool TriangleMeshPrimitive::IntersectP(const Ray &r) const {
+    int v[3];
+    GetVertexIndices(v);
+    return group->triangle.IntersectPTriangle(v, r, true);
+}
+
+inline const Material *TriangleMeshPrimitive::GetMaterial() const {
+    return group->material.get();
+}
+
+inline bool TriangleMeshPrimitive::HasAlphaTexture() const {
+    const TriangleMesh &mesh = *group->triangle.mesh;
+    return mesh.alphaMask || mesh.shadowAlphaMask;
+}
+
+inline void TriangleMeshPrimitive::GetVertices(Point3f p[3]) const {
+    int v[3];
+    GetVertexIndices(v);
+    for (int i = 0; i < 3; ++i) p[i] = group->triangle.mesh->p[v[i]];
+}
+
+inline void TriangleMeshPrimitive::GetVertexIndices(int v[3]) const {
+    group->triangle.mesh->GetVertexIndices(triNumber, v);
+}
+
 std::vector<std::shared_ptr<Shape>> CreateTriangleMesh(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     int nTriangles, const int *vertexIndices, int nVertices, const Point3f *p,
     const Vector3f *s, const Normal3f *n, const Point2f *uv,
     const std::shared_ptr<Texture<Float>> &alphaTexture,
-    const std::shared_ptr<Texture<Float>> &shadowAlphaTexture);
+    const std::shared_ptr<Texture<Float>> &shadowAlphaTexture,
+    bool compact = PbrtOptions.compactMeshes);
+std::vector<std::shared_ptr<Shape>> CreateTriangles(
+    const Transform *o2w, const Transform *w2o, bool reverseOrientation,
+    const std::shared_ptr<TriangleMesh> &mesh);
 std::vector<std::shared_ptr<Shape>> CreateTriangleMeshShape(
     const Transform *o2w, const Transform *w2o, bool reverseOrientation,
     const ParamSet &params,
     std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
         nullptr);
+std::shared_ptr<TriangleMesh> CreateTriangleMeshFromParams(
+    const Transform *o2w, const ParamSet &params,
+    std::map<std::string, std::shared_ptr<Texture<Float>>> *floatTextures =
+        nullptr);
 
 bool WritePlyFile(const std::string &filename, int nTriangles,
                   const int *vertexIndices, int nVertices, const Point3f *P,
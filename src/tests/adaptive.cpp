@@ -0,0 +1,123 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "adaptive.h"
+#include "camera.h"
+#include "film.h"
+#include "films/image.h"
+#include "filters/box.h"
+#include "samplers/random.h"
+#include "samplers/stratified.h"
+#include "spectrum.h"
+
+// Renders a 24x8 image adaptively, where the luminance of each sample of
+// a pixel is given by _luminance_ from the pixel and the sample's number
+// within it, and returns how many samples each pixel took
+static std::vector<int> AdaptiveSampleCounts(
+    const std::function<Float(const Point2i &pixel, int64_t sample)>
+        &luminance,
+    const AdaptiveSamplingOptions &options, int maxSamples,
+    int64_t *totalSamples) {
+    Point2i resolution(24, 8);
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+    ImageFilm film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                   std::move(filter), 1., "adaptive.exr", 1.);
+    RandomSampler sampler(maxSamples);
+    // Each pixel is sampled by one tile at a time, in sample order
+    std::vector<int> counts(resolution.x * resolution.y, 0);
+    bool quiet = PbrtOptions.quiet;
+    PbrtOptions.quiet = true;
+    *totalSamples = RenderAdaptive(
+        options, &film, sampler,
+        [&](const Point2i &pixel, Sampler &sampler, FilmTile &filmTile,
+            MemoryArena &arena) {
+            int64_t sample = counts[pixel.y * resolution.x + pixel.x]++;
+            Spectrum L(luminance(pixel, sample));
+            IntegrationResult result(L);
+            filmTile.AddSample(Point2f(pixel) + Vector2f(.5f, .5f), result);
+            return result;
+        });
+    PbrtOptions.quiet = quiet;
+    return counts;
+}
+
+TEST(Adaptive, StoppingRule) {
+    // Constant pixels converge after their first pass, pixels alternating
+    // between 1 and 1.1 once their relative standard error reaches 1%, after
+    // 24 samples, and noisy pixels use the whole budget
+    AdaptiveSamplingOptions options;
+    options.enabled = true;
+    options.samplesPerPass = 8;
+    options.targetError = .01f;
+    const int maxSamples = 64;
+    auto luminance = [](const Point2i &pixel, int64_t sample) -> Float {
+        if (pixel.x < 8) return 1;
+        if (pixel.x < 16) return (sample & 1) ? 1.1f : 1.f;
+        return (sample & 1) ? 10.f : 0.f;
+    };
+    int64_t totalSamples;
+    std::vector<int> counts =
+        AdaptiveSampleCounts(luminance, options, maxSamples, &totalSamples);
+    int64_t sum = 0;
+    for (int y = 0; y < 8; ++y)
+        for (int x = 0; x < 24; ++x) {
+            int expected = x < 8 ? 8 : (x < 16 ? 24 : maxSamples);
+            EXPECT_EQ(expected, counts[y * 24 + x]) << x << ", " << y;
+            sum += counts[y * 24 + x];
+        }
+    EXPECT_EQ(sum, totalSamples);
+}
+
+TEST(Adaptive, PassLargerThanBudget) {
+    // A pass can't take more samples than the sampler has
+    AdaptiveSamplingOptions options;
+    options.enabled = true;
+    options.samplesPerPass = 32;
+    auto luminance = [](const Point2i &pixel, int64_t sample) -> Float {
+        return (sample & 1) ? 10.f : 0.f;
+    };
+    int64_t totalSamples;
+    std::vector<int> counts =
+        AdaptiveSampleCounts(luminance, options, 4, &totalSamples);
+    for (int count : counts) EXPECT_EQ(4, count);
+    EXPECT_EQ(4 * (int64_t)counts.size(), totalSamples);
+}
+
+TEST(Adaptive, PassesContinueStrata) {
+    // Samples taken over several passes fill each pixel's 4x4 strata once,
+    // as a single pass would
+    Point2i resolution(24, 8);
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+    ImageFilm film(resolution, Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                   std::move(filter), 1., "strata.exr", 1.);
+    StratifiedSampler sampler(4, 4, true, 1);
+    AdaptiveSamplingOptions options;
+    options.enabled = true;
+    options.samplesPerPass = 4;
+    std::vector<std::vector<int>> strata(resolution.x * resolution.y,
+                                         std::vector<int>(16, 0));
+    bool quiet = PbrtOptions.quiet;
+    PbrtOptions.quiet = true;
+    RenderAdaptive(options, &film, sampler,
+                   [&](const Point2i &pixel, Sampler &sampler,
+                       FilmTile &filmTile, MemoryArena &arena) {
+                       CameraSample cs = sampler.GetCameraSample(pixel);
+                       Point2f u = cs.pFilm - Vector2f(pixel);
+                       int stratum = std::min((int)(4 * u.y), 3) * 4 +
+                                     std::min((int)(4 * u.x), 3);
+                       std::vector<int> &pixelStrata =
+                           strata[pixel.y * resolution.x + pixel.x];
+                       // Noisy, so that every pixel takes every pass
+                       int nTaken = 0;
+                       for (int n : pixelStrata) nTaken += n;
+                       ++pixelStrata[stratum];
+                       Spectrum L(nTaken & 1 ? 10.f : 0.f);
+                       IntegrationResult result(L);
+                       filmTile.AddSample(cs.pFilm, result);
+                       return result;
+                   });
+    PbrtOptions.quiet = quiet;
+    for (size_t p = 0; p < strata.size(); ++p)
+        for (int i = 0; i < 16; ++i)
+            EXPECT_EQ(1, strata[p][i]) << "pixel " << p << ", stratum " << i;
+}
@@ -14,6 +14,8 @@
 #include "integrators/directlighting.h"
 #include "integrators/mlt.h"
 #include "integrators/path.h"
+#include "integrators/sppm.h"
+#include "integrators/sppmtof.h"
 #include "integrators/volpath.h"
 #include "lights/diffuse.h"
 #include "lights/point.h"
@@ -401,6 +403,27 @@ std::vector<TestIntegrator> GetIntegrators() {
                 {integrator, film,
                  "MLT, depth 8, Perspective, " + scene.description, scene});
         }
+
+        // Transient SPPM; the film gets the sum of each pixel's histogram
+        {
+            std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+            Film *film = new ImageFilm(resolution,
+                                       Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                                       std::move(filter), 1., "test.exr", 1.);
+            std::shared_ptr<const Camera> camera =
+                std::make_shared<PerspectiveCamera>(
+                    identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1.,
+                    0., 10., 45, film, nullptr);
+            Integrator *integrator = new SPPMToFIntegrator(
+                camera, 16 /* iterations */, 20000 /* photons per iter */,
+                8 /* depth */, 0.05 /* search radius */,
+                64 /* write frequency */, 1 /* bin size */,
+                20 /* max path length */);
+            integrators.push_back({integrator, film,
+                                   "SPPM ToF, depth 8, Perspective, " +
+                                       scene.description,
+                                   scene});
+        }
     }
 
     return integrators;
@@ -422,3 +445,53 @@ TEST_P(RenderTest, RadianceMatches) {
 
 INSTANTIATE_TEST_CASE_P(AnalyticTestScenes, RenderTest,
                         testing::ValuesIn(GetIntegrators()));
+
+// Renders _scene_ with SPPM into _filename_, using the sorted or hash grid
+static void RenderSPPM(const TestScene &scene, bool sortedGrid,
+                       const char *filename) {
+    Point2i resolution(10, 10);
+    AnimatedTransform identity(new Transform, 0, new Transform, 1);
+    std::unique_ptr<Filter> filter(new BoxFilter(Vector2f(0.5, 0.5)));
+    Film *film = new ImageFilm(resolution,
+                               Bounds2f(Point2f(0, 0), Point2f(1, 1)),
+                               std::move(filter), 1., filename, 1.);
+    std::shared_ptr<const Camera> camera = std::make_shared<PerspectiveCamera>(
+        identity, Bounds2f(Point2f(-1, -1), Point2f(1, 1)), 0., 1., 0., 10.,
+        45, film, nullptr);
+    SPPMIntegrator integrator(camera, 4 /* iterations */,
+                              10000 /* photons per iter */, 8 /* depth */,
+                              0.05 /* search radius */,
+                              64 /* write frequency */, sortedGrid);
+    integrator.Render(*scene.scene);
+}
+
+TEST(SPPM, SortedGridMatchesHashGrid) {
+    Options options;
+    options.quiet = true;
+    pbrtInit(options);
+
+    for (const TestScene &scene : GetScenes()) {
+        SCOPED_TRACE(scene.description);
+        RenderSPPM(scene, false, "sppmhash.exr");
+        RenderSPPM(scene, true, "sppmsorted.exr");
+
+        // Both grids find the same photons for every visible point, so only
+        // the order of the sums can differ
+        Point2i hashResolution, sortedResolution;
+        std::unique_ptr<RGBSpectrum[]> hashImage =
+            ReadImage("sppmhash.exr", &hashResolution);
+        std::unique_ptr<RGBSpectrum[]> sortedImage =
+            ReadImage("sppmsorted.exr", &sortedResolution);
+        ASSERT_TRUE(hashImage && sortedImage);
+        ASSERT_EQ(hashResolution, sortedResolution);
+        for (int i = 0; i < hashResolution.x * hashResolution.y; ++i)
+            for (int c = 0; c < 3; ++c)
+                EXPECT_NEAR(hashImage[i][c], sortedImage[i][c],
+                            1e-4f * std::max(1.f, hashImage[i][c]))
+                    << "pixel " << i << ", channel " << c;
+    }
+    remove("sppmhash.exr");
+    remove("sppmsorted.exr");
+
+    pbrtCleanup();
+}
@@ -66,3 +66,42 @@ TEST(AnimatedTransform, Randoms) {
         }
     }
 }
+
+TEST(AnimatedTransform, LinearBounds) {
+    RNG rng;
+    auto r = [&rng]() { return -10. + 20. * rng.UniformFloat(); };
+
+    for (int i = 0; i < 200; ++i) {
+        Transform t0 = RandomTransform(rng);
+        Transform t1 = RandomTransform(rng);
+        AnimatedTransform at(&t0, 0., &t1, 1.);
+        // Intervals that extend past the animation see it stop moving
+        Float time0 = rng.UniformFloat() - .5f;
+        Float time1 = time0 + .25f + rng.UniformFloat();
+
+        for (int j = 0; j < 5; ++j) {
+            // The bounds interpolated between the bounds at the ends of the
+            // interval must hold the transformed box at every time in it.
+            Bounds3f bounds(Point3f(r(), r(), r()), Point3f(r(), r(), r()));
+            Bounds3f b0, b1;
+            at.LinearBounds(bounds, time0, time1, &b0, &b1);
+
+            for (Float s = 0.; s <= 1.; s += 1e-3 * rng.UniformFloat()) {
+                Transform tr;
+                at.Interpolate(Lerp(s, time0, time1), &tr);
+                Bounds3f tb = tr(bounds);
+                tb.pMin += (Float)1e-4 * tb.Diagonal();
+                tb.pMax -= (Float)1e-4 * tb.Diagonal();
+
+                Point3f pMin = Lerp(s, b0.pMin, b1.pMin);
+                Point3f pMax = Lerp(s, b0.pMax, b1.pMax);
+                EXPECT_GE(tb.pMin.x, pMin.x);
+                EXPECT_LE(tb.pMax.x, pMax.x);
+                EXPECT_GE(tb.pMin.y, pMin.y);
+                EXPECT_LE(tb.pMax.y, pMax.y);
+                EXPECT_GE(tb.pMin.z, pMin.z);
+                EXPECT_LE(tb.pMax.z, pMax.z);
+            }
+        }
+    }
+}
@@ -0,0 +1,297 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "api.h"
+#include "imageio.h"
+#include "parser.h"
+#include "spectrum.h"
+#include "stats.h"
+#include <algorithm>
+#include <sstream>
+#include <stdio.h>
+#include <string.h>
+
+// Parses the scene description _scene_, which renders any world blocks in it
+static void ParseScene(const std::string &scene, bool quiet = true,
+                       int nThreads = 0) {
+    const char *filename = "apitest.pbrt";
+    FILE *f = fopen(filename, "w");
+    ASSERT_TRUE(f != nullptr);
+    fputs(scene.c_str(), f);
+    fclose(f);
+    Options options;
+    options.quiet = quiet;
+    options.nThreads = nThreads;
+    pbrtInit(options);
+    ParseFile(filename);
+    pbrtCleanup();
+    remove(filename);
+}
+
+// Returns the total so far of the statistics counter with the given title
+static int64_t CounterValue(const char *title) {
+    ReportThreadStats();
+    FILE *f = tmpfile();
+    PrintStats(f);
+    rewind(f);
+    char line[1024];
+    int64_t value = 0;
+    while (fgets(line, sizeof(line), f)) {
+        const char *s = strstr(line, title);
+        if (s) value = strtoll(s + strlen(title), nullptr, 10);
+    }
+    fclose(f);
+    return value;
+}
+
+// Returns the fraction of pixels that differ noticeably between two images
+static Float DifferingPixels(const char *filenameA, const char *filenameB) {
+    Point2i resA, resB;
+    std::unique_ptr<RGBSpectrum[]> a = ReadImage(filenameA, &resA);
+    std::unique_ptr<RGBSpectrum[]> b = ReadImage(filenameB, &resB);
+    EXPECT_TRUE(a && b && resA == resB);
+    if (!a || !b || resA != resB) return 1;
+    int nPixels = resA.x * resA.y, nDiffering = 0;
+    for (int i = 0; i < nPixels; ++i)
+        for (int c = 0; c < 3; ++c)
+            if (std::abs(a[i][c] - b[i][c]) > .01f * (1 + b[i][c])) {
+                ++nDiffering;
+                break;
+            }
+    return (Float)nDiffering / nPixels;
+}
+
+// Returns a trianglemesh of 2 * n * n triangles over [-1,1]^2 in the xy
+// plane, with its vertices bumped in z by _bump_. If _uOffset_ is not
+// negative, the mesh has uvs offset by it, which tell copies apart.
+static std::string GridMesh(int n, Float bump = 0, Float uOffset = -1) {
+    std::ostringstream s;
+    s << "Shape \"trianglemesh\" \"integer indices\" [";
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x) {
+            int v = y * (n + 1) + x;
+            s << v << " " << v + 1 << " " << v + n + 2 << " " << v << " "
+              << v + n + 2 << " " << v + n + 1 << " ";
+        }
+    s << "] \"point P\" [";
+    for (int y = 0; y <= n; ++y)
+        for (int x = 0; x <= n; ++x)
+            s << 2. * x / n - 1 << " " << 2. * y / n - 1 << " "
+              << ((x + y) % 2 ? bump : 0) << " ";
+    s << "]";
+    if (uOffset >= 0) {
+        s << " \"float uv\" [";
+        for (int y = 0; y <= n; ++y)
+            for (int x = 0; x <= n; ++x)
+                s << uOffset + (Float)x / n << " " << (Float)y / n << " ";
+        s << "]";
+    }
+    s << "\n";
+    return s.str();
+}
+
+static std::string SceneHeader(const char *filename, const char *integrator) {
+    return std::string("LookAt 0 0 0  0 0 -1  0 1 0\n"
+                       "Camera \"perspective\" \"float fov\" 60\n"
+                       "Sampler \"halton\" \"integer pixelsamples\" 4\n"
+                       "Integrator \"") +
+           integrator +
+           "\"\n"
+           "Film \"image\" \"integer xresolution\" 48 "
+           "\"integer yresolution\" 32 \"string filename\" \"" +
+           filename + "\"\nWorldBegin\n";
+}
+
+static const char *duplicateMeshes = "Duplicate triangle meshes instanced";
+
+// Renders copies of a mesh, with their uvs made distinct when _reference_
+// is set so that they are not instanced, and returns how many were
+static int64_t RenderCopies(const char *filename, bool reference,
+                            const char *integrator, const std::string &light,
+                            const std::string copies[], int nCopies) {
+    int64_t before = CounterValue(duplicateMeshes);
+    std::string scene = SceneHeader(filename, integrator) + light;
+    for (int i = 0; i < nCopies; ++i)
+        scene += "AttributeBegin\n" + copies[i] +
+                 GridMesh(6, 0, reference ? i : -1) + "AttributeEnd\n";
+    ParseScene(scene + "WorldEnd\n");
+    return CounterValue(duplicateMeshes) - before;
+}
+
+TEST(DuplicateMeshes, Instanced) {
+    const std::string light =
+        "LightSource \"point\" \"rgb I\" [10 10 10]\n";
+    const std::string copies[] = {
+        "Translate -2 0 -5\n", "Translate 2 0 -5\nRotate 30 0 1 0\n",
+        "Translate 0 2 -6\nScale .5 .5 .5\n"};
+    EXPECT_EQ(2, RenderCopies("dedup.exr", false, "directlighting", light,
+                              copies, 3));
+    EXPECT_EQ(0, RenderCopies("dedup_ref.exr", true, "directlighting", light,
+                              copies, 3));
+    EXPECT_LT(DifferingPixels("dedup.exr", "dedup_ref.exr"), .02f);
+
+    // A mesh with the same number of vertices and triangles but other
+    // positions is not a copy
+    std::string scene = SceneHeader("dedup_bump.exr", "directlighting") +
+                        light + "Translate 0 0 -5\n" + GridMesh(6) +
+                        GridMesh(6, .25f) + "WorldEnd\n";
+    int64_t before = CounterValue(duplicateMeshes);
+    ParseScene(scene);
+    EXPECT_EQ(0, CounterValue(duplicateMeshes) - before);
+}
+
+TEST(DuplicateMeshes, KeepMaterials) {
+    const std::string light =
+        "LightSource \"point\" \"rgb I\" [10 10 10]\n";
+    const std::string copies[] = {
+        "Material \"matte\" \"rgb Kd\" [.2 .2 .2]\nTranslate -2 0 -5\n",
+        "Material \"matte\" \"rgb Kd\" [.8 .1 .1]\nTranslate 2 0 -5\n"};
+    EXPECT_EQ(1, RenderCopies("material.exr", false, "directlighting", light,
+                              copies, 2));
+    EXPECT_EQ(0, RenderCopies("material_ref.exr", true, "directlighting",
+                              light, copies, 2));
+    EXPECT_LT(DifferingPixels("material.exr", "material_ref.exr"), .02f);
+}
+
+TEST(DuplicateMeshes, Mirrored) {
+    // Glass sheets seen at a grazing angle, with a lit wall behind them;
+    // which way their normals face decides whether rays enter the glass or
+    // are totally internally reflected
+    const std::string light =
+        "LightSource \"point\" \"rgb I\" [50 50 50] \"point from\" [0 0 -8]\n"
+        "AttributeBegin\nTranslate 0 0 -12\nScale 20 20 1\n"
+        "Shape \"trianglemesh\" \"integer indices\" [0 1 2 0 2 3] "
+        "\"point P\" [-1 -1 0 1 -1 0 1 1 0 -1 1 0]\nAttributeEnd\n"
+        "Material \"glass\"\n";
+    std::string copies[] = {"Translate -1.5 0 -4\nRotate 60 0 1 0\n",
+                            "Scale -1 1 1\nTranslate -1.5 0 -4\n"
+                            "Rotate 60 0 1 0\n"};
+    EXPECT_EQ(1, RenderCopies("mirror.exr", false, "whitted", light, copies,
+                              2));
+    EXPECT_EQ(0, RenderCopies("mirror_ref.exr", true, "whitted", light,
+                              copies, 2));
+    EXPECT_LT(DifferingPixels("mirror.exr", "mirror_ref.exr"), .02f);
+
+    // The scene does tell the orientation of the mirrored copy
+    copies[1] = "ReverseOrientation\n" + copies[1];
+    RenderCopies("mirror_flipped.exr", true, "whitted", light, copies, 2);
+    EXPECT_GT(DifferingPixels("mirror_flipped.exr", "mirror_ref.exr"), .05f);
+}
+
+// Parses _scene_ with _nThreads_ threads and returns the warnings and errors
+// it printed, with wrapped messages joined into single lines
+static std::vector<std::string> ParseMessages(const std::string &scene,
+                                              int nThreads) {
+    testing::internal::CaptureStdout();
+    testing::internal::CaptureStderr();
+    ParseScene(scene, false, nThreads);
+    std::string err = testing::internal::GetCapturedStderr();
+    testing::internal::GetCapturedStdout();
+    std::vector<std::string> messages;
+    std::istringstream lines(err);
+    std::string line;
+    while (std::getline(lines, line)) {
+        if (line.compare(0, 4, "    ") == 0 && !messages.empty())
+            messages.back() += line.substr(3);
+        else
+            messages.push_back(line);
+    }
+    return messages;
+}
+
+TEST(ParallelLoading, MatchesSerial) {
+    // Static and animated spheres and meshes, each with a parameter that no
+    // one looks up, and a shape that can't be created
+    const int nShapes = 16;
+    std::string scene = "LightSource \"point\" \"rgb I\" [10 10 10]\n";
+    for (int i = 0; i < nShapes; ++i) {
+        std::ostringstream s;
+        s << "AttributeBegin\nTranslate " << (i % 4) - 1.5f << " "
+          << (i / 4) - 1.5f << " -6\nScale .4 .4 .4\n";
+        if (i & 2)
+            s << "ActiveTransform EndTime\nTranslate .5 0 0\n"
+                 "ActiveTransform All\n";
+        std::string shape = (i & 1) ? GridMesh(4, .2f)
+                                    : "Shape \"sphere\"\n";
+        s << shape.substr(0, shape.size() - 1) << " \"float unused" << i
+          << "\" [1]\nAttributeEnd\n";
+        if (i == nShapes / 2) s << "Shape \"bogus\"\n";
+        scene += s.str();
+    }
+    scene += "WorldEnd\n";
+
+    std::vector<std::string> serial = ParseMessages(
+        SceneHeader("serial.exr", "directlighting") + scene, 1);
+    std::vector<std::string> parallel = ParseMessages(
+        SceneHeader("parallel.exr", "directlighting") + scene, 4);
+    EXPECT_EQ(0, DifferingPixels("parallel.exr", "serial.exr"));
+    Point2i res;
+    std::unique_ptr<RGBSpectrum[]> image = ReadImage("parallel.exr", &res);
+    ASSERT_TRUE(image != nullptr);
+    int nLit = 0;
+    for (int i = 0; i < res.x * res.y; ++i) nLit += !image[i].IsBlack();
+    EXPECT_GT(nLit, res.x * res.y / 10);
+
+    // Shapes report their unused parameters in the order they were given,
+    // with the same locations however they were loaded
+    std::vector<std::string> unused;
+    for (const std::string &message : parallel)
+        if (message.find("not used") != std::string::npos)
+            unused.push_back(message);
+    ASSERT_EQ(nShapes, (int)unused.size());
+    for (int i = 0; i < nShapes; ++i) {
+        std::ostringstream name;
+        name << "\"unused" << i << "\"";
+        EXPECT_NE(std::string::npos, unused[i].find(name.str())) << unused[i];
+        EXPECT_EQ(0, unused[i].find("apitest.pbrt(")) << unused[i];
+    }
+
+    // Errors from the shapes' tasks may be printed in any order, but they
+    // carry the locations of their directives
+    std::sort(serial.begin(), serial.end());
+    std::sort(parallel.begin(), parallel.end());
+    EXPECT_EQ(serial, parallel);
+    int nBogus = 0;
+    for (const std::string &message : parallel)
+        if (message.find("\"bogus\" unknown") != std::string::npos) {
+            EXPECT_EQ(0, message.find("apitest.pbrt(")) << message;
+            ++nBogus;
+        }
+    EXPECT_EQ(1, nBogus);
+}
+
+TEST(TransformCache, NamedObjectsOutliveWorld) {
+    // An object defined in one world block and placed in the next one,
+    // after the other block's own transforms have reused the cache
+    const std::string light = "LightSource \"point\" \"rgb I\" [10 10 10]\n";
+    const std::string object =
+        "ObjectBegin \"thing\"\n"
+        "Translate 0 0 -1\nRotate 20 0 0 1\n" +
+        GridMesh(4, .2f) +
+        "AttributeBegin\nTranslate .6 0 1\n"
+        "Shape \"sphere\" \"float radius\" .4\nAttributeEnd\n"
+        "AttributeBegin\nTranslate -.6 0 1\nActiveTransform EndTime\n"
+        "Translate 0 .2 0\nActiveTransform All\n"
+        "Shape \"sphere\" \"float radius\" .4\nAttributeEnd\n"
+        "ObjectEnd\n";
+    std::string others;
+    for (int i = 0; i < 40; ++i) {
+        std::ostringstream s;
+        s << "AttributeBegin\nTranslate " << .1f * i - 2 << " -1.5 -7\n"
+          << "Rotate " << 9 * i << " 1 1 0\n"
+          << "Shape \"sphere\" \"float radius\" .1\nAttributeEnd\n";
+        others += s.str();
+    }
+    const std::string placement = "Translate 0 .5 -5\nRotate 30 0 1 0\n";
+
+    ParseScene(SceneHeader("defined.exr", "directlighting") + light +
+               object + "AttributeBegin\nTranslate 0 0 -5\n"
+                        "ObjectInstance \"thing\"\nAttributeEnd\n"
+                        "WorldEnd\n" +
+               SceneHeader("placed.exr", "directlighting") + light + others +
+               placement + "ObjectInstance \"thing\"\nWorldEnd\n");
+    ParseScene(SceneHeader("placed_ref.exr", "directlighting") + light +
+               others + object + placement +
+               "ObjectInstance \"thing\"\nWorldEnd\n");
+    EXPECT_EQ(0, DifferingPixels("placed.exr", "placed_ref.exr"));
+}
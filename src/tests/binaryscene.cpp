@@ -0,0 +1,146 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "api.h"
+#include "parser.h"
+#include <stdio.h>
+#include <string>
+
+// A scene that uses every kind of parameter and most directives
+static const char *roundTripScene =
+    "LookAt 0 0 5  0 0 0  0 1 0\n"
+    "Camera \"perspective\" \"float fov\" [45] \"float screenwindow\" "
+    "[-1 1 -.75 .75]\n"
+    "Sampler \"halton\" \"integer pixelsamples\" 4\n"
+    "PixelFilter \"gaussian\" \"float xwidth\" 2 \"float ywidth\" 2\n"
+    "Film \"image\" \"integer xresolution\" [32] \"integer yresolution\" "
+    "[24] \"string filename\" \"roundtrip.exr\"\n"
+    "Integrator \"path\" \"integer maxdepth\" 3 \"bool regularize\" "
+    "\"true\"\n"
+    "Accelerator \"bvh\" \"string splitmethod\" \"sah\"\n"
+    "TransformTimes 0 .5\n"
+    "MakeNamedMedium \"fog\" \"string type\" \"homogeneous\" "
+    "\"rgb sigma_a\" [.1 .2 .3] \"spectrum sigma_s\" [400 .5 700 .25]\n"
+    "WorldBegin\n"
+    "CoordinateSystem \"origin\"\n"
+    "LightSource \"point\" \"blackbody I\" [3000 2] \"point from\" [0 4 0]\n"
+    "AttributeBegin\n"
+    "MediumInterface \"fog\" \"\"\n"
+    "Texture \"checks\" \"spectrum\" \"checkerboard\" \"float uscale\" 4 "
+    "\"rgb tex1\" [1 0 0] \"rgb tex2\" [0 0 1]\n"
+    "MakeNamedMaterial \"red\" \"string type\" \"matte\" "
+    "\"texture Kd\" \"checks\" \"float sigma\" 10\n"
+    "NamedMaterial \"red\"\n"
+    "ActiveTransform EndTime\n"
+    "Translate 0 .5 0\n"
+    "ActiveTransform All\n"
+    "Rotate 30 0 1 0\n"
+    "Shape \"trianglemesh\" \"integer indices\" [0 1 2 0 2 3] "
+    "\"point P\" [-1 -1 0 1 -1 0 1 1 0 -1 1 0] "
+    "\"normal N\" [0 0 1 0 0 1 0 0 1 0 0 1] "
+    "\"vector S\" [1 0 0 1 0 0 1 0 0 1 0 0] "
+    "\"float uv\" [0 0 1 0 1 1 0 1]\n"
+    "AttributeEnd\n"
+    "ObjectBegin \"ball\"\n"
+    "Material \"plastic\" \"float roughness\" .1 \"bool remaproughness\" "
+    "\"false\"\n"
+    "Shape \"sphere\" \"float radius\" .25\n"
+    "ObjectEnd\n"
+    "TransformBegin\n"
+    "Scale 2 2 2\n"
+    "ConcatTransform [1 0 0 0 0 1 0 0 0 0 1 0 .1 .2 .3 1]\n"
+    "ReverseOrientation\n"
+    "ObjectInstance \"ball\"\n"
+    "TransformEnd\n"
+    "AttributeBegin\n"
+    "CoordSysTransform \"origin\"\n"
+    "Transform [1 0 0 0 0 1 0 0 0 0 1 0 0 0 -2 1]\n"
+    "AreaLightSource \"diffuse\" \"rgb L\" [4 4 4] \"bool twosided\" "
+    "\"true\"\n"
+    "Shape \"disk\" \"float radius\" 1\n"
+    "AttributeEnd\n"
+    "WorldEnd\n";
+
+// Writes _contents_ to the file _filename_
+static void WriteFile(const char *filename, const std::string &contents) {
+    FILE *f = fopen(filename, "wb");
+    ASSERT_TRUE(f != nullptr);
+    fwrite(contents.data(), 1, contents.size(), f);
+    fclose(f);
+}
+
+// Runs _filename_ through the API with _options_ and returns what it printed
+static std::string RunScene(const char *filename, Options options) {
+    options.quiet = true;
+    fflush(stdout);
+    testing::internal::CaptureStdout();
+    pbrtInit(options);
+    ParseFile(filename);
+    pbrtCleanup();
+    return testing::internal::GetCapturedStdout();
+}
+
+// Converts the text scene _scene_ as --tobinary does
+static std::string ToBinary(const std::string &scene) {
+    WriteFile("binarytest.pbrt", scene);
+    Options options;
+    options.toBinary = true;
+    std::string binary = RunScene("binarytest.pbrt", options);
+    remove("binarytest.pbrt");
+    return binary;
+}
+
+// Prints the directives and parameters that the scene file _filename_ makes,
+// as --cat does
+static std::string CatScene(const char *filename) {
+    Options options;
+    options.cat = true;
+    return RunScene(filename, options);
+}
+
+TEST(BinaryScene, RoundTrip) {
+    std::string binary = ToBinary(roundTripScene);
+    ASSERT_GT(binary.size(), (size_t)8);
+    EXPECT_EQ(0, binary.compare(0, 7, "PBRTBIN"));
+
+    // The binary scene makes the same calls with the same parameters
+    WriteFile("binarytest.pbrt", roundTripScene);
+    std::string text = CatScene("binarytest.pbrt");
+    remove("binarytest.pbrt");
+    WriteFile("binarytest.pbrtb", binary);
+    std::string replayed = CatScene("binarytest.pbrtb");
+    remove("binarytest.pbrtb");
+    EXPECT_NE(std::string::npos, text.find("ObjectInstance \"ball\""));
+    EXPECT_EQ(text, replayed);
+
+    // Converting the binary scene again gives the same file
+    WriteFile("binarytest.pbrtb", binary);
+    Options options;
+    options.toBinary = true;
+    std::string again = RunScene("binarytest.pbrtb", options);
+    remove("binarytest.pbrtb");
+    EXPECT_TRUE(binary == again);
+}
+
+TEST(BinaryScene, Truncated) {
+    // Cutting the file anywhere after its magic number reports an error and
+    // replays only the calls of the records before the cut. Records are
+    // padded to 8 bytes, so odd lengths always cut one in two.
+    std::string binary = ToBinary(roundTripScene);
+    WriteFile("binarytest.pbrtb", binary);
+    std::string full = CatScene("binarytest.pbrtb");
+    for (size_t length : {(size_t)13, (size_t)31, binary.size() / 3 + 3,
+                          binary.size() / 2 + 5, binary.size() - 7,
+                          binary.size() - 1}) {
+        WriteFile("binarytest.pbrtb", binary.substr(0, length));
+        testing::internal::CaptureStderr();
+        std::string replayed = CatScene("binarytest.pbrtb");
+        std::string errors = testing::internal::GetCapturedStderr();
+        EXPECT_TRUE(errors.find("is truncated") != std::string::npos ||
+                    errors.find("is corrupt at offset") != std::string::npos)
+            << length << ": " << errors;
+        EXPECT_LT(replayed.size(), full.size()) << length;
+        EXPECT_EQ(0, full.compare(0, replayed.size(), replayed)) << length;
+    }
+    remove("binarytest.pbrtb");
+}
@@ -0,0 +1,574 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "parallel.h"
+#include "primitive.h"
+#include "interaction.h"
+#include "accelerators/bvh.h"
+#include "shapes/sphere.h"
+#include "shapes/triangle.h"
+#include <fstream>
+#ifndef PBRT_IS_WINDOWS
+#include <dirent.h>
+#include <stdlib.h>
+#include <unistd.h>
+#endif
+
+// Random spheres scattered through a box, with some overlap and a wide
+// range of sizes.
+static std::vector<std::shared_ptr<Primitive>> RandomSpheres(int n, RNG &rng) {
+    static std::vector<std::unique_ptr<Transform>> transforms;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (int i = 0; i < n; ++i) {
+        Vector3f p(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat());
+        transforms.push_back(std::unique_ptr<Transform>(
+            new Transform(Translate(20 * p - Vector3f(10, 10, 10)))));
+        transforms.push_back(std::unique_ptr<Transform>(
+            new Transform(Inverse(*transforms.back()))));
+        Float radius = 0.05f + rng.UniformFloat() * rng.UniformFloat();
+        std::shared_ptr<Shape> sphere = std::make_shared<Sphere>(
+            transforms[transforms.size() - 2].get(), transforms.back().get(),
+            false, radius, -radius, radius, 360);
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            sphere, nullptr, nullptr, MediumInterface()));
+    }
+    return prims;
+}
+
+// Long, thin triangles at random orientations, whose bounds overlap heavily.
+static std::vector<std::shared_ptr<Primitive>> RandomSlivers(int n,
+                                                             RNG &rng) {
+    static Transform identity;
+    auto randomPoint = [&]() {
+        return Point3f(20 * rng.UniformFloat() - 10,
+                       20 * rng.UniformFloat() - 10,
+                       20 * rng.UniformFloat() - 10);
+    };
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < n; ++i) {
+        Point3f p0 = randomPoint(), p1 = randomPoint();
+        Vector3f offset(rng.UniformFloat(), rng.UniformFloat(),
+                        rng.UniformFloat());
+        p.insert(p.end(), {p0, p1, p0 + .05f * offset});
+        indices.insert(indices.end(), {3 * i, 3 * i + 1, 3 * i + 2});
+    }
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (const std::shared_ptr<Shape> &tri : CreateTriangleMesh(
+             &identity, &identity, false, n, &indices[0], p.size(), &p[0],
+             nullptr, nullptr, nullptr, nullptr, nullptr))
+        prims.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    return prims;
+}
+
+// Spheres from _RandomSpheres()_ that move, some of them also rotating and
+// some only during part of the shutter interval.
+static std::vector<std::shared_ptr<Primitive>> MovingSpheres(int n,
+                                                             RNG &rng) {
+    static std::vector<std::unique_ptr<Transform>> transforms;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (std::shared_ptr<Primitive> &sphere : RandomSpheres(n, rng)) {
+        Vector3f move(rng.UniformFloat() - .5f, rng.UniformFloat() - .5f,
+                      rng.UniformFloat() - .5f);
+        Transform end = Translate(4 * move);
+        if (rng.UniformFloat() < .25f)
+            end = end * Rotate(90 * rng.UniformFloat(), Vector3f(1, 2, 3));
+        transforms.push_back(std::unique_ptr<Transform>(new Transform));
+        transforms.push_back(std::unique_ptr<Transform>(new Transform(end)));
+        Float startTime = rng.UniformFloat() < .25f ? .25f : 0;
+        AnimatedTransform motion(transforms[transforms.size() - 2].get(),
+                                 startTime, transforms.back().get(),
+                                 1 - startTime);
+        prims.push_back(std::make_shared<TransformedPrimitive>(sphere, motion));
+    }
+    return prims;
+}
+
+static Ray RandomRay(RNG &rng) {
+    Point3f o(30 * rng.UniformFloat() - 15, 30 * rng.UniformFloat() - 15,
+              30 * rng.UniformFloat() - 15);
+    Point3f target(20 * rng.UniformFloat() - 10, 20 * rng.UniformFloat() - 10,
+                   20 * rng.UniformFloat() - 10);
+    Float tMax = rng.UniformFloat() < .25f ? 0.5f : Infinity;
+    return Ray(o, target - o, tMax);
+}
+
+// Every BVH variant must find exactly the hits of the default binary BVH.
+static void CompareToBinaryBVH(
+    const std::vector<std::shared_ptr<Primitive>> &prims, const BVHAccel &bvh,
+    RNG &rng) {
+    BVHAccel reference(prims);
+    EXPECT_EQ(reference.WorldBound(), bvh.WorldBound());
+    for (int i = 0; i < 10000; ++i) {
+        Ray ray = RandomRay(rng);
+        Ray refRay = ray;
+        SurfaceInteraction isect, refIsect;
+        bool hit = bvh.Intersect(ray, &isect);
+        ASSERT_EQ(reference.Intersect(refRay, &refIsect), hit);
+        EXPECT_EQ(refRay.tMax, ray.tMax);
+        if (hit) {
+            EXPECT_EQ(refIsect.p, isect.p);
+            EXPECT_EQ(refIsect.primitive, isect.primitive);
+        }
+        Ray shadowRay = RandomRay(rng);
+        EXPECT_EQ(reference.IntersectP(shadowRay), bvh.IntersectP(shadowRay));
+    }
+}
+
+// The BVH must find the same closest hit and occlusion for _ray_ as testing
+// every primitive does.
+static void CompareToBruteForce(
+    const std::vector<std::shared_ptr<Primitive>> &prims, const BVHAccel &bvh,
+    const Ray &ray) {
+    Ray bvhRay = ray, bruteRay = ray;
+    SurfaceInteraction isect, bruteIsect;
+    bool bruteHit = false, occluded = false;
+    for (const auto &prim : prims) {
+        bruteHit |= prim->Intersect(bruteRay, &bruteIsect);
+        occluded |= prim->IntersectP(ray);
+    }
+    ASSERT_EQ(bruteHit, bvh.Intersect(bvhRay, &isect));
+    EXPECT_EQ(bruteRay.tMax, bvhRay.tMax);
+    if (bruteHit) {
+        EXPECT_EQ(bruteIsect.primitive, isect.primitive);
+    }
+    EXPECT_EQ(occluded, bvh.IntersectP(ray));
+}
+
+TEST(BVH, WideMatchesBinary) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(2000, rng);
+    for (int width : {4, 8})
+        for (int maxPrims : {1, 4}) {
+            BVHAccel bvh(prims, maxPrims, BVHAccel::SplitMethod::SAH, width);
+            CompareToBinaryBVH(prims, bvh, rng);
+        }
+}
+
+TEST(BVH, WideSmallScenes) {
+    RNG rng;
+    for (int n : {1, 2, 3, 7}) {
+        std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(n, rng);
+        for (int width : {4, 8}) {
+            BVHAccel bvh(prims, 1, BVHAccel::SplitMethod::SAH, width);
+            CompareToBinaryBVH(prims, bvh, rng);
+        }
+    }
+}
+
+TEST(BVH, SpatialSplitsMatchBinary) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSlivers(500, rng);
+    for (Float budget : {0.f, 1.f})
+        for (int width : {2, 4}) {
+            BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SBVH, width, budget);
+            CompareToBinaryBVH(prims, bvh, rng);
+        }
+}
+
+TEST(BVH, QuantizedMatchesBinary) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> spheres = RandomSpheres(2000, rng);
+    for (int maxPrims : {1, 4}) {
+        BVHAccel bvh(spheres, maxPrims, BVHAccel::SplitMethod::SAH, 2, 0,
+                     true);
+        CompareToBinaryBVH(spheres, bvh, rng);
+    }
+    std::vector<std::shared_ptr<Primitive>> slivers = RandomSlivers(500, rng);
+    BVHAccel sbvh(slivers, 4, BVHAccel::SplitMethod::SBVH, 2, 1, true);
+    CompareToBinaryBVH(slivers, sbvh, rng);
+
+    // Small scenes, and one with a leaf too large for a quantized node
+    for (int n : {1, 2, 3, 7}) {
+        std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(n, rng);
+        BVHAccel bvh(prims, 1, BVHAccel::SplitMethod::SAH, 2, 0, true);
+        CompareToBinaryBVH(prims, bvh, rng);
+    }
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(20, rng);
+    for (int i = 0; i < 300; ++i) prims.push_back(prims.back());
+    BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, 2, 0, true);
+    CompareToBinaryBVH(prims, bvh, rng);
+}
+
+TEST(BVH, CachedMatchesBinary) {
+    // The first BVH of each kind writes the cache and the second loads it
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(500, rng);
+    for (auto splitMethod :
+         {BVHAccel::SplitMethod::SAH, BVHAccel::SplitMethod::HLBVH})
+        for (int width : {2, 4, 8})
+            for (bool quantized : {false, true}) {
+                if (quantized && width != 2) continue;
+                for (int pass = 0; pass < 2; ++pass) {
+                    BVHAccel bvh(prims, 4, splitMethod, width, 0, quantized,
+                                 "/tmp");
+                    CompareToBinaryBVH(prims, bvh, rng);
+                }
+            }
+}
+
+#ifndef PBRT_IS_WINDOWS
+// Returns the name of the cache file that a BVH wrote to the directory _dir_
+static std::string CacheFileIn(const char *dir) {
+    std::string filename;
+    DIR *d = opendir(dir);
+    EXPECT_TRUE(d != nullptr);
+    if (!d) return filename;
+    while (struct dirent *entry = readdir(d))
+        if (entry->d_name[0] != '.')
+            filename = std::string(dir) + "/" + entry->d_name;
+    closedir(d);
+    return filename;
+}
+
+TEST(BVH, CorruptCacheRebuilt) {
+    // Point the root's first child back at the root in each written cache;
+    // loading it must fall back to building the BVH
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(200, rng);
+    for (int width : {2, 4}) {
+        char dir[] = "/tmp/bvhcacheXXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != nullptr);
+        {
+            BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, width, 0,
+                         false, dir);
+        }
+        std::string filename = CacheFileIn(dir);
+        ASSERT_FALSE(filename.empty());
+
+        // The node bytes follow the header's magic, version, layout, key,
+        // primitive count and primitive number count, and end the file
+        std::fstream f(filename, std::ios::in | std::ios::out |
+                                     std::ios::binary);
+        uint64_t nodeBytes;
+        f.seekg(40);
+        f.read((char *)&nodeBytes, sizeof(nodeBytes));
+        f.seekg(0, std::ios::end);
+        std::streamoff root = (std::streamoff)f.tellg() - nodeBytes;
+        // Interior linear nodes store their second child after their
+        // bounds; wide nodes store child offsets after the child bounds
+        f.seekp(root + (width == 2 ? sizeof(Bounds3f)
+                                   : 6 * width * sizeof(Float)));
+        int32_t zero = 0;
+        f.write((const char *)&zero, sizeof(zero));
+        f.close();
+
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, width, 0, false,
+                     dir);
+        CompareToBinaryBVH(prims, bvh, rng);
+        remove(filename.c_str());
+        rmdir(dir);
+    }
+}
+
+TEST(BVH, ParallelBuildDeterministic) {
+    // The treelets are built in parallel, but the cache files, which hold
+    // the primitives in the order the leaves reference them, must match;
+    // use several threads even on machines with a single core
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims =
+        RandomSpheres(20000, rng);
+    int nThreads = PbrtOptions.nThreads;
+    TerminateWorkerThreads();
+    PbrtOptions.nThreads = 8;
+    std::string contents[2];
+    for (int build = 0; build < 2; ++build) {
+        char dir[] = "/tmp/bvhcacheXXXXXX";
+        ASSERT_TRUE(mkdtemp(dir) != nullptr);
+        {
+            BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::HLBVH, 2, 0, false,
+                         dir);
+        }
+        std::string filename = CacheFileIn(dir);
+        ASSERT_FALSE(filename.empty());
+        std::ifstream f(filename, std::ios::binary);
+        contents[build].assign(std::istreambuf_iterator<char>(f),
+                               std::istreambuf_iterator<char>());
+        remove(filename.c_str());
+        rmdir(dir);
+    }
+    TerminateWorkerThreads();
+    PbrtOptions.nThreads = nThreads;
+    EXPECT_FALSE(contents[0].empty());
+    EXPECT_TRUE(contents[0] == contents[1]);
+}
+#endif  // !PBRT_IS_WINDOWS
+
+TEST(BVH, RefitMatchesRebuild) {
+    // Instances of a small BVH that move between two refits
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> spheres = RandomSpheres(20, rng);
+    std::shared_ptr<Primitive> object = std::make_shared<BVHAccel>(spheres);
+    static std::vector<std::unique_ptr<Transform>> transforms;
+    auto randomPlacement = [&]() -> AnimatedTransform {
+        Vector3f p(rng.UniformFloat(), rng.UniformFloat(), rng.UniformFloat());
+        transforms.push_back(std::unique_ptr<Transform>(new Transform(
+            Translate(10 * p - Vector3f(5, 5, 5)) *
+            Scale(.2f, .2f, .2f))));
+        return AnimatedTransform(transforms.back().get(), 0,
+                                 transforms.back().get(), 1);
+    };
+    std::vector<std::shared_ptr<TransformedPrimitive>> instances;
+    std::vector<std::shared_ptr<Primitive>> prims;
+    for (int i = 0; i < 200; ++i) {
+        instances.push_back(
+            std::make_shared<TransformedPrimitive>(object, randomPlacement()));
+        prims.push_back(instances.back());
+    }
+    for (int maxPrims : {1, 4}) {
+        BVHAccel bvh(prims, maxPrims);
+        for (int frame = 0; frame < 2; ++frame) {
+            for (const auto &instance : instances)
+                instance->SetPrimitiveToWorld(randomPlacement());
+            ASSERT_TRUE(bvh.Refit());
+            CompareToBinaryBVH(prims, bvh, rng);
+        }
+    }
+}
+
+TEST(BVH, MeshPrimitivesMatchShapes) {
+    // Triangles sharing per-mesh state must be hit exactly like separate
+    // _Triangle_ shapes
+    static Transform identity;
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < 1000; ++i) {
+        Point3f p0(20 * rng.UniformFloat() - 10, 20 * rng.UniformFloat() - 10,
+                   20 * rng.UniformFloat() - 10);
+        for (int j = 0; j < 3; ++j) {
+            p.push_back(p0 + Vector3f(rng.UniformFloat(), rng.UniformFloat(),
+                                      rng.UniformFloat()));
+            indices.push_back(3 * i + j);
+        }
+    }
+    std::shared_ptr<TriangleMesh> triMesh = std::make_shared<TriangleMesh>(
+        identity, 1000, &indices[0], p.size(), &p[0], nullptr, nullptr,
+        nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> geometric, mesh = {
+        std::make_shared<TriangleMeshAggregate>(
+            &identity, &identity, false, triMesh, nullptr, MediumInterface())};
+    for (const std::shared_ptr<Shape> &tri :
+         CreateTriangles(&identity, &identity, false, triMesh))
+        geometric.push_back(std::make_shared<GeometricPrimitive>(
+            tri, nullptr, nullptr, MediumInterface()));
+    ASSERT_EQ(1000u, geometric.size());
+
+    BVHAccel geometricBVH(geometric), meshBVH(mesh);
+    EXPECT_EQ(geometricBVH.WorldBound(), meshBVH.WorldBound());
+    for (int i = 0; i < 10000; ++i) {
+        Ray ray = RandomRay(rng), meshRay = ray;
+        SurfaceInteraction isect, meshIsect;
+        bool hit = geometricBVH.Intersect(ray, &isect);
+        ASSERT_EQ(hit, meshBVH.Intersect(meshRay, &meshIsect));
+        EXPECT_EQ(ray.tMax, meshRay.tMax);
+        if (hit) {
+            EXPECT_EQ(isect.p, meshIsect.p);
+            EXPECT_EQ(isect.n, meshIsect.n);
+            EXPECT_EQ(isect.uv, meshIsect.uv);
+        }
+        Ray shadowRay = RandomRay(rng);
+        EXPECT_EQ(geometricBVH.IntersectP(shadowRay),
+                  meshBVH.IntersectP(shadowRay));
+    }
+}
+
+TEST(BVH, TrianglePacketsMatchScalar) {
+    // A bumpy grid, so that rays through its shared vertices and edges test
+    // that the packet test is as watertight as the scalar one
+    static Transform identity;
+    RNG rng;
+    const int n = 40;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int y = 0; y < n; ++y)
+        for (int x = 0; x < n; ++x)
+            p.push_back(Point3f(-10 + 20.f * x / (n - 1),
+                                -10 + 20.f * y / (n - 1),
+                                rng.UniformFloat()));
+    for (int y = 0; y < n - 1; ++y)
+        for (int x = 0; x < n - 1; ++x) {
+            int v = y * n + x;
+            indices.insert(indices.end(),
+                           {v, v + 1, v + n, v + 1, v + n + 1, v + n});
+        }
+    std::vector<std::shared_ptr<Primitive>> prims = {
+        std::make_shared<TriangleMeshAggregate>(
+            &identity, &identity, false,
+            std::make_shared<TriangleMesh>(identity, indices.size() / 3,
+                                           &indices[0], p.size(), &p[0],
+                                           nullptr, nullptr, nullptr,
+                                           nullptr, nullptr),
+            nullptr, MediumInterface())};
+
+    for (int width : {2, 4, 8})
+        for (bool quantized : {false, true}) {
+            if (quantized && width != 2) continue;
+            BVHAccel scalar(prims, 4, BVHAccel::SplitMethod::SAH, width, 0,
+                            quantized, "", false);
+            BVHAccel packed(prims, 4, BVHAccel::SplitMethod::SAH, width, 0,
+                            quantized, "", true);
+            for (int i = 0; i < 10000; ++i) {
+                Ray ray;
+                if (i & 1)
+                    ray = RandomRay(rng);
+                else {
+                    // Aim at an interior vertex of the grid, or the middle
+                    // of an edge between two, which no ray can slip through
+                    int x = 1 + rng.UniformUInt32(n - 3);
+                    int y = 1 + rng.UniformUInt32(n - 2);
+                    const Point3f &p0 = p[y * n + x], &p1 = p[y * n + x + 1];
+                    Point3f target = (i & 2) ? p0 : (p0 + p1) / 2;
+                    Point3f o(rng.UniformFloat(), rng.UniformFloat(), 20);
+                    ray = Ray(o, target - o);
+                    EXPECT_TRUE(packed.IntersectP(ray));
+                }
+                Ray shadowRay = RandomRay(rng);
+                EXPECT_EQ(scalar.IntersectP(shadowRay),
+                          packed.IntersectP(shadowRay));
+
+                // Triangles that meet at a hit may report $t$ values an ulp
+                // apart, so they may be accepted in a different order
+                Ray packedRay = ray;
+                SurfaceInteraction isect, packedIsect;
+                bool hit = scalar.Intersect(ray, &isect);
+                ASSERT_EQ(hit, packed.Intersect(packedRay, &packedIsect));
+                if (!hit) continue;
+                EXPECT_NEAR(ray.tMax, packedRay.tMax, 1e-6f * ray.tMax);
+                if (isect.primitive == packedIsect.primitive) {
+                    EXPECT_EQ(ray.tMax, packedRay.tMax);
+                    EXPECT_EQ(isect.p, packedIsect.p);
+                    EXPECT_EQ(isect.n, packedIsect.n);
+                    EXPECT_EQ(isect.uv, packedIsect.uv);
+                }
+            }
+        }
+}
+
+TEST(BVH, RefitUpdatesTrianglePackets) {
+    // Move the vertices of a mesh after building a BVH with packed
+    // triangles; after a refit, it must find the triangles where they are now
+    static Transform identity;
+    RNG rng;
+    std::vector<Point3f> p;
+    std::vector<int> indices;
+    for (int i = 0; i < 1500; ++i) {
+        p.push_back(Point3f(20 * rng.UniformFloat() - 10,
+                            20 * rng.UniformFloat() - 10,
+                            20 * rng.UniformFloat() - 10));
+        indices.push_back(i);
+    }
+    std::shared_ptr<TriangleMesh> triMesh = std::make_shared<TriangleMesh>(
+        identity, indices.size() / 3, &indices[0], p.size(), &p[0], nullptr,
+        nullptr, nullptr, nullptr, nullptr);
+    std::vector<std::shared_ptr<Primitive>> prims = {
+        std::make_shared<TriangleMeshAggregate>(
+            &identity, &identity, false, triMesh, nullptr, MediumInterface())};
+    BVHAccel packed(prims, 4, BVHAccel::SplitMethod::SAH, 2, 0, false, "",
+                    true);
+    TriangleMesh &mesh = *triMesh;
+    for (int i = 0; i < mesh.nVertices; ++i)
+        mesh.p[i] = Point3f(mesh.p[i].y, -mesh.p[i].x, mesh.p[i].z + 1);
+    ASSERT_TRUE(packed.Refit());
+    CompareToBinaryBVH(prims, packed, rng);
+}
+
+TEST(BVH, PacketsMatchSingleRays) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(2000, rng);
+    for (int width : {2, 4}) {
+        BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, width);
+        for (int trial = 0; trial < 1000; ++trial) {
+            // Alternate between coherent packets, as from a camera, and
+            // random ones
+            int n = 1 + trial % MaxRayPacketSize;
+            Ray rays[MaxRayPacketSize], single[MaxRayPacketSize];
+            Point3f o(-15, rng.UniformFloat(), rng.UniformFloat());
+            Vector3f d(1, rng.UniformFloat() - .5f, rng.UniformFloat() - .5f);
+            for (int i = 0; i < n; ++i) {
+                if (trial & 1)
+                    rays[i] = RandomRay(rng);
+                else
+                    rays[i] = Ray(o, d + .01f * Vector3f(rng.UniformFloat(),
+                                                         rng.UniformFloat(),
+                                                         rng.UniformFloat()));
+                single[i] = rays[i];
+            }
+
+            SurfaceInteraction isects[MaxRayPacketSize];
+            bool hits[MaxRayPacketSize], occluded[MaxRayPacketSize];
+            bvh.IntersectPPacket(n, rays, occluded);
+            bvh.IntersectPacket(n, rays, isects, hits);
+            for (int i = 0; i < n; ++i) {
+                SurfaceInteraction isect;
+                EXPECT_EQ(bvh.IntersectP(single[i]), occluded[i]);
+                ASSERT_EQ(bvh.Intersect(single[i], &isect), hits[i]);
+                EXPECT_EQ(single[i].tMax, rays[i].tMax);
+                if (hits[i]) {
+                    EXPECT_EQ(isect.primitive, isects[i].primitive);
+                }
+            }
+        }
+    }
+}
+
+TEST(BVH, ParallelBuildMatchesBruteForce) {
+    // Large enough for the top of the tree to be built in parallel
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = RandomSpheres(100000, rng);
+    for (auto splitMethod :
+         {BVHAccel::SplitMethod::SAH, BVHAccel::SplitMethod::Middle}) {
+        BVHAccel bvh(prims, 4, splitMethod);
+        Bounds3f bounds;
+        for (const auto &prim : prims)
+            bounds = Union(bounds, prim->WorldBound());
+        EXPECT_EQ(bounds, bvh.WorldBound());
+        for (int i = 0; i < 25; ++i)
+            CompareToBruteForce(prims, bvh, RandomRay(rng));
+    }
+}
+
+TEST(BVH, MotionBlurMatchesBruteForce) {
+    RNG rng;
+    std::vector<std::shared_ptr<Primitive>> prims = MovingSpheres(1000, rng);
+    std::vector<std::shared_ptr<Primitive>> still = RandomSpheres(200, rng);
+    prims.insert(prims.end(), still.begin(), still.end());
+    auto compare = [&](const BVHAccel &bvh) {
+        for (int i = 0; i < 500; ++i) {
+            // Include times outside the motion, where primitives stay put
+            Ray ray = RandomRay(rng);
+            ray.time = 1.5f * rng.UniformFloat() - .25f;
+            CompareToBruteForce(prims, bvh, ray);
+            ray.tMax = .5f;
+            CompareToBruteForce(prims, bvh, ray);
+        }
+    };
+
+    // Layouts without bounds at the ends of the motion fall back to the
+    // binary one
+    for (int width : {2, 4})
+        for (bool quantized : {false, true}) {
+            BVHAccel bvh(prims, 4, BVHAccel::SplitMethod::SAH, width, 0.3f,
+                         quantized);
+            Float start, end;
+            ASSERT_TRUE(bvh.MotionInterval(&start, &end));
+            EXPECT_EQ(0, start);
+            EXPECT_EQ(1, end);
+            compare(bvh);
+        }
+    BVHAccel sbvh(prims, 4, BVHAccel::SplitMethod::SBVH);
+    compare(sbvh);
+
+    // Refitting after the primitives stop moving leaves a static tree
+    BVHAccel bvh(prims, 4);
+    static Transform identity;
+    for (int i = 0; i < 1000; ++i)
+        static_cast<TransformedPrimitive &>(*prims[i])
+            .SetPrimitiveToWorld(AnimatedTransform(&identity, 0, &identity, 1));
+    ASSERT_TRUE(bvh.Refit());
+    Float start, end;
+    EXPECT_FALSE(bvh.MotionInterval(&start, &end));
+    compare(bvh);
+}
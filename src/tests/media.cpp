@@ -0,0 +1,129 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "rng.h"
+#include "sampling.h"
+#include "media/grid.h"
+#include "memory.h"
+#include "interaction.h"
+#include "samplers/random.h"
+
+// A grid that is thin everywhere except for a dense block in one corner, so
+// the per-voxel majorants differ widely from the global one
+static const int nGrid = 8;
+static const Float maxGridDensity = 10;
+static std::unique_ptr<GridDensityMedium> NonUniformGrid(RNG &rng) {
+    std::vector<Float> density(nGrid * nGrid * nGrid);
+    for (int z = 0; z < nGrid; ++z)
+        for (int y = 0; y < nGrid; ++y)
+            for (int x = 0; x < nGrid; ++x) {
+                bool dense = x >= 5 && y >= 5 && z >= 5;
+                density[(z * nGrid + y) * nGrid + x] =
+                    dense ? maxGridDensity * (.5f + .5f * rng.UniformFloat())
+                          : .1f * rng.UniformFloat();
+            }
+    density[nGrid * nGrid * nGrid - 1] = maxGridDensity;
+    return std::unique_ptr<GridDensityMedium>(new GridDensityMedium(
+        Spectrum(.5), Spectrum(.5), 0, nGrid, nGrid, nGrid, Transform(),
+        density.data()));
+}
+
+// Returns a ray from outside the unit cube that passes through it
+static Ray RayThroughGrid(RNG &rng) {
+    Point3f center(.5, .5, .5);
+    Point3f o = center + 2 * UniformSampleSphere(
+                                 {rng.UniformFloat(), rng.UniformFloat()});
+    Point3f target(rng.UniformFloat(), rng.UniformFloat(),
+                   rng.UniformFloat());
+    return Ray(o, Normalize(target - o));
+}
+
+TEST(GridDensityMedium, MajorantsBoundDensity) {
+    RNG rng;
+    std::unique_ptr<GridDensityMedium> medium = NonUniformGrid(rng);
+    const Bounds3f b(Point3f(0, 0, 0), Point3f(1, 1, 1));
+    for (int i = 0; i < 1000; ++i) {
+        Ray ray = RayThroughGrid(rng);
+        Float tMin, tMax;
+        ASSERT_TRUE(b.IntersectP(ray, &tMin, &tMax));
+        // Also stop some rays inside the medium
+        if (i % 2) tMax = Lerp(rng.UniformFloat(), tMin, tMax);
+
+        // The voxels cover $[\tmin, \tmax]$ in order, and each majorant
+        // bounds the density everywhere in its voxel; $\sigma_t = 1$
+        Float tPrev = tMin;
+        auto checkVoxel = [&](Float t0, Float t1, Float sigma_maj) -> bool {
+            EXPECT_FLOAT_EQ(tPrev, t0);
+            EXPECT_LE(t0, t1);
+            tPrev = t1;
+            for (int j = 0; j < 16; ++j) {
+                Float t = Lerp((j + .5f) / 16, t0, t1);
+                EXPECT_LE(medium->Density(ray(t)), sigma_maj * (1 + 1e-5f))
+                    << "ray " << i << ", t = " << t;
+            }
+            return true;
+        };
+        medium->TraverseMajorants(ray, tMin, tMax, checkVoxel);
+        // _IntersectP()_ pads _tMax_ a little past the far face, where the
+        // density is zero and the traversal may stop early
+        EXPECT_NEAR(tMax, tPrev, 1e-5f * tMax) << "ray " << i;
+    }
+}
+
+TEST(GridDensityMedium, TrMatchesGlobalMajorant) {
+    RNG rng;
+    std::unique_ptr<GridDensityMedium> medium = NonUniformGrid(rng);
+    RandomSampler sampler(1);
+    sampler.StartPixel(Point2i(0, 0));
+    const Bounds3f b(Point3f(0, 0, 0), Point3f(1, 1, 1));
+    const int nSamples = 20000;
+    for (int i = 0; i < 16; ++i) {
+        Ray ray = RayThroughGrid(rng);
+        Float tMin, tMax;
+        ASSERT_TRUE(b.IntersectP(ray, &tMin, &tMax));
+
+        // Ratio tracking against each voxel's majorant
+        double sum = 0, sumSq = 0;
+        for (int j = 0; j < nSamples; ++j) {
+            Float Tr = medium->Tr(ray, sampler)[0];
+            sum += Tr;
+            sumSq += Tr * Tr;
+        }
+
+        // Ratio tracking against the largest density in the grid, with
+        // $\sigma_t = 1$
+        double sumGlobal = 0, sumSqGlobal = 0;
+        for (int j = 0; j < nSamples; ++j) {
+            Float Tr = 1, t = tMin;
+            while (true) {
+                t -= std::log(1 - rng.UniformFloat()) / maxGridDensity;
+                if (t >= tMax) break;
+                Tr *= 1 - medium->Density(ray(t)) / maxGridDensity;
+            }
+            sumGlobal += Tr;
+            sumSqGlobal += Tr * Tr;
+        }
+
+        double mean = sum / nSamples, meanGlobal = sumGlobal / nSamples;
+        double var = sumSq / nSamples - mean * mean;
+        double varGlobal = sumSqGlobal / nSamples - meanGlobal * meanGlobal;
+        double sigma = std::sqrt((var + varGlobal) / nSamples);
+        EXPECT_NEAR(mean, meanGlobal, 5 * sigma + 1e-4)
+            << "ray " << i << " from " << ray.o << " toward " << ray.d;
+
+        // Delta tracking leaves the medium with probability $\Tr$; unlike
+        // ratio tracking, it is biased if a majorant is too small
+        int nEscaped = 0;
+        MemoryArena arena;
+        for (int j = 0; j < nSamples; ++j) {
+            MediumInteraction mi;
+            medium->Sample(ray, sampler, arena, &mi);
+            if (!mi.IsValid()) ++nEscaped;
+            arena.Reset();
+        }
+        double escaped = Float(nEscaped) / nSamples;
+        sigma = std::sqrt((escaped * (1 - escaped) + varGlobal) / nSamples);
+        EXPECT_NEAR(escaped, meanGlobal, 5 * sigma + 1e-4)
+            << "ray " << i << " from " << ray.o << " toward " << ray.d;
+    }
+}
@@ -0,0 +1,59 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "integrator.h"
+#include "interaction.h"
+#include "memory.h"
+#include "primitive.h"
+#include "scene.h"
+#include "accelerators/bvh.h"
+#include "lights/point.h"
+#include "materials/glass.h"
+#include "media/homogeneous.h"
+#include "samplers/random.h"
+#include "shapes/disk.h"
+#include "textures/constant.h"
+
+// Optical length reported for the segment from a point on a glass disk in
+// water to a point light at _pLight_.
+static Float LightPathLength(const Point3f &pLight) {
+    static Transform identity;
+    static HomogeneousMedium water(Spectrum(0.f), Spectrum(0.f), 0, 1.33f);
+    std::shared_ptr<Shape> disk =
+        std::make_shared<Disk>(&identity, &identity, false, 0, 10, 0, 360);
+    std::shared_ptr<Material> glass = std::make_shared<GlassMaterial>(
+        std::make_shared<ConstantTexture<Spectrum>>(Spectrum(1.f)),
+        std::make_shared<ConstantTexture<Spectrum>>(Spectrum(1.f)),
+        std::make_shared<ConstantTexture<Float>>(0),
+        std::make_shared<ConstantTexture<Float>>(0),
+        std::make_shared<ConstantTexture<Float>>(1.5f), nullptr, true);
+    // The water is on the side the disk's normal points to
+    std::vector<std::shared_ptr<Primitive>> prims;
+    prims.push_back(std::make_shared<GeometricPrimitive>(
+        disk, glass, nullptr, MediumInterface(nullptr, &water)));
+    std::vector<std::shared_ptr<Light>> lights;
+    lights.push_back(std::make_shared<PointLight>(
+        Translate(Vector3f(pLight)), MediumInterface(), Spectrum(1.f)));
+    Scene scene(std::make_shared<BVHAccel>(prims), lights);
+
+    // Hit the disk from the water side
+    Ray ray(Point3f(.5f, .25f, 3), Vector3f(0, 0, -1), Infinity, 0, &water);
+    SurfaceInteraction isect;
+    EXPECT_TRUE(scene.Intersect(ray, &isect));
+    EXPECT_GT(isect.n.z, 0);
+    MemoryArena arena;
+    isect.ComputeScatteringFunctions(ray, arena, true);
+    RandomSampler sampler(1);
+    Float pathLength = 0;
+    EstimateDirect(isect, Point2f(.5f, .5f), *lights[0], Point2f(.5f, .5f),
+                   scene, sampler, arena, false, false, &pathLength);
+    return pathLength;
+}
+
+TEST(OpticalPath, LightSegmentAtInterface) {
+    // A light on the water side is reached through the water, even though
+    // the camera ray continues into the glass
+    EXPECT_FLOAT_EQ(1.33f * 2, LightPathLength(Point3f(.5f, .25f, 2)));
+    // A light behind the surface is reached through the glass
+    EXPECT_FLOAT_EQ(1.5f * 3, LightPathLength(Point3f(.5f, .25f, -3)));
+}
@@ -0,0 +1,99 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "parallel.h"
+
+TEST(Parallel, Basics) {
+    std::atomic<int> counter{0};
+    ParallelFor([&](int64_t) { ++counter; }, 1000);
+    EXPECT_EQ(1000, counter);
+
+    counter = 0;
+    ParallelFor([&](int64_t) { ++counter; }, 1000, 19);
+    EXPECT_EQ(1000, counter);
+
+    counter = 0;
+    ParallelFor2D([&](Point2i p) { ++counter; }, Point2i(15, 14));
+    EXPECT_EQ(15 * 14, counter);
+
+    TerminateWorkerThreads();
+}
+
+TEST(Parallel, DoNothing) {
+    std::atomic<int> counter{0};
+    ParallelFor([&](int64_t) { ++counter; }, 0);
+    EXPECT_EQ(0, counter);
+
+    counter = 0;
+    ParallelFor2D([&](Point2i p) { ++counter; }, Point2i(0, 0));
+    EXPECT_EQ(0, counter);
+
+    TerminateWorkerThreads();
+}
+
+TEST(Parallel, Nested) {
+    std::atomic<int> counter{0};
+    ParallelFor([&](int64_t) {
+        ParallelFor([&](int64_t) { ++counter; }, 100, 7);
+    }, 50);
+    EXPECT_EQ(50 * 100, counter);
+
+    TerminateWorkerThreads();
+}
+
+TEST(Parallel, Async) {
+    Future<int> value = Async([]() { return 42; });
+    EXPECT_EQ(42, value.Get());
+
+    // Tasks spawned from loop bodies complete independently of the loop
+    std::atomic<int> counter{0};
+    std::vector<Future<int>> futures(64);
+    ParallelFor([&](int64_t i) {
+        futures[i] = Async([&counter, i]() -> int {
+            ++counter;
+            return (int)i;
+        });
+    }, futures.size());
+    for (size_t i = 0; i < futures.size(); ++i)
+        EXPECT_EQ((int)i, futures[i].Get());
+    EXPECT_EQ((int)futures.size(), counter);
+
+    TerminateWorkerThreads();
+}
+
+TEST(Parallel, NestedAsync) {
+    // Recursive fork-join: every task waits on the tasks it spawns
+    std::function<int64_t(int)> sum = [&](int depth) -> int64_t {
+        if (depth == 0) return 1;
+        Future<int64_t> left = Async([&sum, depth]() { return sum(depth - 1); });
+        int64_t right = sum(depth - 1);
+        return left.Get() + right;
+    };
+    EXPECT_EQ(1 << 10, sum(10));
+
+    TerminateWorkerThreads();
+}
+
+TEST(Parallel, WaitsDoNotReenterLoopBodies) {
+    // Loop bodies that wait on nested loops and tasks must not have other
+    // loop bodies run on their thread in the meantime, since those would
+    // share the thread's per-thread scratch memory
+    std::vector<std::atomic<bool>> busy(MaxThreadIndex());
+    for (std::atomic<bool> &b : busy) b = false;
+    std::atomic<int> reentered{0}, counter{0};
+    auto body = [&](int64_t) {
+        if (busy[ThreadIndex].exchange(true)) ++reentered;
+        ParallelFor([&](int64_t) { ++counter; }, 64, 4);
+        Future<int> value = Async([]() { return 1; });
+        counter += value.Get();
+        busy[ThreadIndex] = false;
+    };
+    std::vector<Future<void>> loops;
+    for (int i = 0; i < 4; ++i)
+        loops.push_back(Async([&]() { ParallelFor(body, 200); }));
+    for (Future<void> &loop : loops) loop.Get();
+    EXPECT_EQ(0, reentered);
+    EXPECT_EQ(4 * 200 * 65, counter);
+
+    TerminateWorkerThreads();
+}
@@ -0,0 +1,80 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "paramset.h"
+
+static std::unique_ptr<Float[]> OneFloat(Float v) {
+    std::unique_ptr<Float[]> values(new Float[1]);
+    values[0] = v;
+    return values;
+}
+
+TEST(ParamSet, SmallLookup) {
+    ParamSet ps;
+    ps.AddFloat("radius", OneFloat(2));
+    std::unique_ptr<int[]> indices(new int[3]);
+    for (int i = 0; i < 3; ++i) indices[i] = i;
+    ps.AddInt("indices", std::move(indices), 3);
+    // The same name may be used by parameters of different types
+    ps.AddFloat("indices", OneFloat(5));
+
+    EXPECT_EQ(2, ps.FindOneFloat("radius", 0));
+    EXPECT_EQ(5, ps.FindOneFloat("indices", 0));
+    EXPECT_EQ(-1, ps.FindOneInt("radius", -1));
+    int n;
+    const int *found = ps.FindInt("indices", &n);
+    ASSERT_TRUE(found != nullptr);
+    EXPECT_EQ(3, n);
+    EXPECT_EQ(2, found[2]);
+    EXPECT_EQ(7, ps.FindOneFloat("zmax", 7));
+}
+
+TEST(ParamSet, LargeLookup) {
+    // Enough parameters that lookups go through the hashed index
+    ParamSet ps;
+    const int nParams = 100;
+    for (int i = 0; i < nParams; ++i)
+        ps.AddFloat("param" + std::to_string(i), OneFloat((Float)i));
+    ps.AddFloat("param7", OneFloat(-7));
+    for (int i = 0; i < nParams; ++i)
+        EXPECT_EQ(i == 7 ? -7 : i,
+                  ps.FindOneFloat("param" + std::to_string(i), -1));
+    EXPECT_EQ(-1, ps.FindOneFloat("param100", -1));
+    EXPECT_EQ(-1, ps.FindOneInt("param3", -1));
+
+    // Erasing moves the later items; they must still be found
+    EXPECT_TRUE(ps.EraseFloat("param10"));
+    EXPECT_FALSE(ps.EraseFloat("param10"));
+    EXPECT_EQ(-1, ps.FindOneFloat("param10", -1));
+    for (int i = 11; i < nParams; ++i)
+        EXPECT_EQ(i, ps.FindOneFloat("param" + std::to_string(i), -1));
+
+    // Copies have their own index
+    ParamSet copy = ps;
+    copy.AddFloat("extra", OneFloat(42));
+    EXPECT_EQ(42, copy.FindOneFloat("extra", 0));
+    EXPECT_EQ(0, ps.FindOneFloat("extra", 0));
+    EXPECT_EQ(50, copy.FindOneFloat("param50", 0));
+
+    ps.Clear();
+    EXPECT_EQ(-1, ps.FindOneFloat("param50", -1));
+    ps.AddFloat("param50", OneFloat(3));
+    EXPECT_EQ(3, ps.FindOneFloat("param50", -1));
+}
+
+TEST(ParamSet, AddAfterErase) {
+    // Erasing below the threshold keeps the index, which must still see
+    // parameters added afterwards
+    ParamSet ps;
+    for (int i = 0; i < 12; ++i)
+        ps.AddFloat("param" + std::to_string(i), OneFloat((Float)i));
+    for (int i = 0; i < 6; ++i)
+        EXPECT_TRUE(ps.EraseFloat("param" + std::to_string(i)));
+    ps.AddFloat("late", OneFloat(-1));
+    EXPECT_EQ(-1, ps.FindOneFloat("late", 0));
+    for (int i = 12; i < 24; ++i)
+        ps.AddFloat("param" + std::to_string(i), OneFloat((Float)i));
+    EXPECT_EQ(-1, ps.FindOneFloat("late", 0));
+    for (int i = 6; i < 24; ++i)
+        EXPECT_EQ(i, ps.FindOneFloat("param" + std::to_string(i), -1));
+}
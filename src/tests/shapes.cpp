@@ -8,8 +8,11 @@
 #include "shapes/cone.h"
 #include "shapes/cylinder.h"
 #include "shapes/paraboloid.h"
+#include "shapes/plymesh.h"
 #include "shapes/sphere.h"
 #include "shapes/triangle.h"
+#include "paramset.h"
+#include <fstream>
 
 static Float p(RNG &rng, Float exp = 8.) {
     Float logu = Lerp(rng.UniformFloat(), -exp, exp);
@@ -185,6 +188,179 @@ TEST(Triangle, Reintersect) {
     }
 }
 
+TEST(Triangle, OctahedralEncoding) {
+    RNG rng(7);
+    for (int i = 0; i < 10000; ++i) {
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Vector3f v = UniformSampleSphere(u);
+        Vector3f d = DecodeOctahedral(EncodeOctahedral(v));
+        EXPECT_NEAR(1, d.Length(), 1e-5);
+        EXPECT_GT(Dot(v, d), 0.99999f) << v << " " << d;
+    }
+    // The poles and the folded edges of the octahedron
+    Vector3f axes[6] = {Vector3f(1, 0, 0), Vector3f(-1, 0, 0),
+                        Vector3f(0, 1, 0), Vector3f(0, -1, 0),
+                        Vector3f(0, 0, 1), Vector3f(0, 0, -1)};
+    for (const Vector3f &v : axes)
+        EXPECT_GT(Dot(v, DecodeOctahedral(EncodeOctahedral(v))), 0.99999f)
+            << v;
+}
+
+TEST(Triangle, CompactMatchesFull) {
+    // A bumpy grid with normals, tangents and uvs
+    RNG rng(3);
+    int res = 32;
+    std::vector<Point3f> P;
+    std::vector<Normal3f> N;
+    std::vector<Vector3f> S;
+    std::vector<Point2f> uv;
+    for (int y = 0; y < res; ++y)
+        for (int x = 0; x < res; ++x) {
+            P.push_back(Point3f(x, y, rng.UniformFloat()));
+            Point2f u(rng.UniformFloat(), rng.UniformFloat());
+            N.push_back(Normal3f(UniformSampleHemisphere(u)));
+            S.push_back(
+                Normalize(Vector3f(1, 0, rng.UniformFloat() - 0.5f)));
+            uv.push_back(Point2f(-3 + x * 0.37f, 10 + y * 0.11f));
+        }
+    std::vector<int> indices;
+    for (int y = 0; y < res - 1; ++y)
+        for (int x = 0; x < res - 1; ++x) {
+            int v = y * res + x;
+            int quad[6] = {v, v + 1, v + res + 1, v, v + res + 1, v + res};
+            indices.insert(indices.end(), quad, quad + 6);
+        }
+
+    Transform identity;
+    std::vector<std::shared_ptr<Shape>> meshes[2];
+    for (int compact = 0; compact < 2; ++compact) {
+        meshes[compact] = CreateTriangleMesh(
+            &identity, &identity, false, indices.size() / 3, &indices[0],
+            P.size(), &P[0], &S[0], &N[0], &uv[0], nullptr, nullptr,
+            compact == 1);
+        ASSERT_EQ(indices.size() / 3, meshes[compact].size());
+    }
+    for (size_t i = 0; i < meshes[0].size(); ++i) {
+        const Shape &full = *meshes[0][i], &compact = *meshes[1][i];
+        Point2f u(rng.UniformFloat(), rng.UniformFloat());
+        Interaction it = full.Sample(u);
+        Ray r(it.p + Vector3f(0, 0, 5), Vector3f(0, 0, -1));
+        Float tFull, tCompact;
+        SurfaceInteraction isectFull, isectCompact;
+        bool hitFull = full.Intersect(r, &tFull, &isectFull, false);
+        ASSERT_EQ(hitFull, compact.Intersect(r, &tCompact, &isectCompact,
+                                             false));
+        if (!hitFull) continue;
+        // Positions are stored at full precision
+        EXPECT_EQ(tFull, tCompact);
+        EXPECT_EQ(isectFull.p, isectCompact.p);
+        EXPECT_EQ(isectFull.n, isectCompact.n);
+        EXPECT_NEAR(isectFull.uv.x, isectCompact.uv.x, 1e-3);
+        EXPECT_NEAR(isectFull.uv.y, isectCompact.uv.y, 1e-3);
+        EXPECT_GT(Dot(isectFull.shading.n, isectCompact.shading.n), 0.9999f);
+        EXPECT_GT(Dot(Normalize(isectFull.shading.dpdu),
+                      Normalize(isectCompact.shading.dpdu)),
+                  0.999f);
+    }
+}
+
+// Writes a small PLY file with a vertex layout that mixes types and, when
+// _quads_ is set, a quad and a per-face property
+static std::string WriteTestPly(const char *name, bool binary, bool quads) {
+    std::string filename = std::string("/tmp/") + name;
+    std::ofstream out(filename, std::ios::binary);
+    const int nVertices = 6;
+    out << "ply\nformat " << (binary ? "binary_little_endian" : "ascii")
+        << " 1.0\ncomment pbrt test\nelement vertex " << nVertices
+        << "\nproperty float x\nproperty float y\nproperty double z\n"
+           "property float nx\nproperty float ny\nproperty float nz\n"
+           "property uchar red\nproperty float u\nproperty float v\n"
+        << "element face " << (quads ? 2 : 4)
+        << "\nproperty list uchar int vertex_indices\n"
+        << (quads ? "property uchar flags\n" : "") << "end_header\n";
+    auto write = [&](double value, int size) {
+        if (!binary)
+            out << value << " ";
+        else if (size == 1) {
+            uint8_t v = (uint8_t)value;
+            out.write((const char *)&v, 1);
+        } else if (size == 4) {
+            float v = (float)value;
+            out.write((const char *)&v, 4);
+        } else
+            out.write((const char *)&value, 8);
+    };
+    for (int i = 0; i < nVertices; ++i) {
+        write(i * 0.5, 4);
+        write(i % 2, 4);
+        write(0.25 * i * i, 8);
+        write(0, 4);
+        write(0.6, 4);
+        write(0.8, 4);
+        write(7 * i, 1);
+        write(0.1 * i, 4);
+        write(1 - 0.1 * i, 4);
+        if (!binary) out << "\n";
+    }
+    auto writeFace = [&](std::vector<int> v) {
+        write(v.size(), 1);
+        for (int i : v) {
+            if (binary)
+                out.write((const char *)&i, 4);
+            else
+                out << i << " ";
+        }
+        if (quads) write(1, 1);
+        if (!binary) out << "\n";
+    };
+    if (quads) {
+        writeFace({0, 1, 2});
+        writeFace({2, 3, 4, 5});
+    } else {
+        writeFace({0, 1, 2});
+        writeFace({1, 3, 2});
+        writeFace({2, 3, 4});
+        writeFace({3, 5, 4});
+    }
+    return filename;
+}
+
+TEST(PLYMesh, MappedMatchesRply) {
+    // Binary little-endian files are read from a mapping and ASCII ones
+    // with rply
+    Transform identity;
+    for (bool quads : {false, true}) {
+        const TriangleMesh *meshes[2];
+        std::vector<std::shared_ptr<Shape>> shapes[2];
+        for (int binary = 0; binary < 2; ++binary) {
+            ParamSet params;
+            std::unique_ptr<std::string[]> filename(new std::string[1]);
+            filename[0] = WriteTestPly(binary ? "test_binary.ply"
+                                              : "test_ascii.ply",
+                                       binary, quads);
+            params.AddString("filename", std::move(filename), 1);
+            shapes[binary] = CreatePLYMesh(&identity, &identity, false, params);
+            ASSERT_EQ(quads ? 3 : 4, shapes[binary].size());
+            meshes[binary] =
+                ((const Triangle *)shapes[binary][0].get())->GetMesh().get();
+        }
+        const TriangleMesh &ascii = *meshes[0], &binary = *meshes[1];
+        ASSERT_EQ(ascii.nVertices, binary.nVertices);
+        ASSERT_TRUE(binary.n && binary.uv);
+        for (int i = 0; i < ascii.nVertices; ++i) {
+            EXPECT_EQ(ascii.p[i], binary.p[i]);
+            EXPECT_EQ(ascii.n[i], binary.n[i]);
+            EXPECT_EQ(ascii.uv[i], binary.uv[i]);
+        }
+        for (int t = 0; t < ascii.nTriangles; ++t) {
+            int va[3], vb[3];
+            ascii.GetVertexIndices(t, va);
+            binary.GetVertexIndices(t, vb);
+            for (int i = 0; i < 3; ++i) EXPECT_EQ(va[i], vb[i]);
+        }
+    }
+}
+
 // Check for incorrect self-intersection: assumes that the shape is convex,
 // such that if the dot product of an outgoing ray and the surface normal
 // at a point is positive, then a ray leaving that point in that direction
@@ -0,0 +1,57 @@
+
+#include "tests/gtest/gtest.h"
+#include "pbrt.h"
+#include "tilescheduler.h"
+#include <mutex>
+
+// Checks that _order_ hands out each tile of _bounds_ exactly once, and that
+// together the tiles cover each pixel exactly once
+static void CheckTileCoverage(const Bounds2i &bounds, int tileSize,
+                              TileOrder order) {
+    Vector2i extent = bounds.Diagonal();
+    int nx = (extent.x + tileSize - 1) / tileSize;
+    int ny = (extent.y + tileSize - 1) / tileSize;
+    TileScheduler scheduler(bounds, tileSize, order);
+    EXPECT_EQ((size_t)(nx * ny), scheduler.TileCount());
+
+    std::vector<int> tileVisits(nx * ny, 0);
+    std::vector<int> pixelVisits(extent.x * extent.y, 0);
+    std::mutex mutex;
+    scheduler.ParallelForTiles([&](const Bounds2i &tileBounds) {
+        std::lock_guard<std::mutex> lock(mutex);
+        Vector2i offset = tileBounds.pMin - bounds.pMin;
+        ASSERT_EQ(0, offset.x % tileSize);
+        ASSERT_EQ(0, offset.y % tileSize);
+        ++tileVisits[offset.y / tileSize * nx + offset.x / tileSize];
+        for (Point2i p : tileBounds) {
+            ASSERT_TRUE(InsideExclusive(p, bounds));
+            ++pixelVisits[(p.y - bounds.pMin.y) * extent.x +
+                          (p.x - bounds.pMin.x)];
+        }
+    });
+    for (int i = 0; i < nx * ny; ++i)
+        EXPECT_EQ(1, tileVisits[i]) << "tile " << i % nx << ", " << i / nx;
+    for (int i = 0; i < extent.x * extent.y; ++i)
+        EXPECT_EQ(1, pixelVisits[i]) << "pixel " << i % extent.x << ", "
+                                     << i / extent.x;
+}
+
+TEST(TileScheduler, EachTileOnce) {
+    // Grids of tiles that are not square or not a power of two on a side,
+    // with partial tiles at the edges and an offset origin
+    const Bounds2i regions[] = {
+        Bounds2i(Point2i(0, 0), Point2i(80, 48)),
+        Bounds2i(Point2i(0, 0), Point2i(100, 37)),
+        Bounds2i(Point2i(-7, 3), Point2i(41, 200)),
+        Bounds2i(Point2i(5, 5), Point2i(6, 90)),
+        Bounds2i(Point2i(0, 0), Point2i(16, 16))};
+    for (TileOrder order :
+         {TileOrder::Hilbert, TileOrder::Spiral, TileOrder::Raster})
+        for (const Bounds2i &bounds : regions) {
+            SCOPED_TRACE(testing::Message()
+                         << "order " << (int)order << ", bounds "
+                         << bounds.pMin << " - " << bounds.pMax);
+            CheckTileCoverage(bounds, 16, order);
+            CheckTileCoverage(bounds, 7, order);
+        }
+}